@@ -0,0 +1,131 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Allocation_Counter.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+namespace udit
+{
+
+    namespace
+    {
+
+        // Se inicializan a 0 antes que cualquier constructor global, que ya puede reservar memoria:
+
+        atomic< size_t > allocation_count(0);
+        atomic< size_t > allocated_bytes (0);
+
+        void * allocate (size_t size)
+        {
+            allocation_count.fetch_add (1,    memory_order_relaxed);
+            allocated_bytes .fetch_add (size, memory_order_relaxed);
+
+            return malloc (size ? size : 1);
+        }
+
+        void * allocate_or_throw (size_t size)
+        {
+            void * memory = allocate (size);
+
+            if (!memory) throw bad_alloc();
+
+            return memory;
+        }
+
+    #ifdef __cpp_aligned_new
+
+        void * allocate_aligned (size_t size, size_t alignment)
+        {
+            allocation_count.fetch_add (1,    memory_order_relaxed);
+            allocated_bytes .fetch_add (size, memory_order_relaxed);
+
+            // aligned_alloc() necesita un tamaño múltiplo de la alineación:
+
+            size = (size + alignment - 1) / alignment * alignment;
+
+            #ifdef _MSC_VER
+                return _aligned_malloc (size ? size : alignment, alignment);
+            #else
+                return aligned_alloc   (alignment, size ? size : alignment);
+            #endif
+        }
+
+        void free_aligned (void * memory)
+        {
+            #ifdef _MSC_VER
+                _aligned_free (memory);
+            #else
+                free (memory);
+            #endif
+        }
+
+    #endif
+
+    }
+
+    size_t Allocation_Counter::get_allocation_count ()
+    {
+        return allocation_count.load ();
+    }
+
+    size_t Allocation_Counter::get_allocated_bytes ()
+    {
+        return allocated_bytes.load ();
+    }
+
+}
+
+// Los operadores globales no pueden estar dentro de un namespace:
+
+void * operator new   (size_t size)                                   { return udit::allocate_or_throw (size); }
+void * operator new[] (size_t size)                                   { return udit::allocate_or_throw (size); }
+void * operator new   (size_t size, const std::nothrow_t & ) noexcept { return udit::allocate (size); }
+void * operator new[] (size_t size, const std::nothrow_t & ) noexcept { return udit::allocate (size); }
+
+void operator delete   (void * memory) noexcept                          { free (memory); }
+void operator delete[] (void * memory) noexcept                          { free (memory); }
+void operator delete   (void * memory, size_t ) noexcept                 { free (memory); }
+void operator delete[] (void * memory, size_t ) noexcept                 { free (memory); }
+void operator delete   (void * memory, const std::nothrow_t & ) noexcept { free (memory); }
+void operator delete[] (void * memory, const std::nothrow_t & ) noexcept { free (memory); }
+
+#ifdef __cpp_aligned_new
+
+void * operator new   (size_t size, std::align_val_t alignment)
+{
+    void * memory = udit::allocate_aligned (size, size_t(alignment));
+
+    if (!memory) throw std::bad_alloc();
+
+    return memory;
+}
+
+void * operator new[] (size_t size, std::align_val_t alignment)
+{
+    return operator new (size, alignment);
+}
+
+void * operator new   (size_t size, std::align_val_t alignment, const std::nothrow_t & ) noexcept
+{
+    return udit::allocate_aligned (size, size_t(alignment));
+}
+
+void * operator new[] (size_t size, std::align_val_t alignment, const std::nothrow_t & ) noexcept
+{
+    return udit::allocate_aligned (size, size_t(alignment));
+}
+
+void operator delete   (void * memory, std::align_val_t ) noexcept                         { udit::free_aligned (memory); }
+void operator delete[] (void * memory, std::align_val_t ) noexcept                         { udit::free_aligned (memory); }
+void operator delete   (void * memory, size_t, std::align_val_t ) noexcept                 { udit::free_aligned (memory); }
+void operator delete[] (void * memory, size_t, std::align_val_t ) noexcept                 { udit::free_aligned (memory); }
+void operator delete   (void * memory, std::align_val_t, const std::nothrow_t & ) noexcept { udit::free_aligned (memory); }
+void operator delete[] (void * memory, std::align_val_t, const std::nothrow_t & ) noexcept { udit::free_aligned (memory); }
+
+#endif
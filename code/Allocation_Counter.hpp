@@ -0,0 +1,33 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstddef>
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Cuenta las reservas de memoria dinámica de todo el programa. Allocation_Counter.cpp sustituye
+    ///     los operator new y delete globales por unos que llaman a malloc() y free() y suman cada
+    ///     reserva a un contador atómico, de modo que se cuenta todo lo que se reserva con new (también
+    ///     dentro de la biblioteca estándar) desde cualquier hilo.
+    ///
+    ///     Para saber cuánto reserva una parte del programa se toman dos lecturas y se restan. Como el
+    ///     contador es global, lo que reservan a la vez otros hilos también se cuenta.
+    /// </summary>
+    class Allocation_Counter
+    {
+    public:
+
+        /// Reservas hechas desde que empezó el programa:
+        static size_t get_allocation_count ();
+
+        /// Bytes pedidos en esas reservas:
+        static size_t get_allocated_bytes ();
+
+    };
+
+}
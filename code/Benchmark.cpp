@@ -0,0 +1,2023 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Allocation_Counter.hpp"
+#include "Benchmark.hpp"
+#include "Buddy_Allocator.hpp"
+#include "Command_List.hpp"
+#include "Dynamic_AABB_Tree.hpp"
+#include "Frame_Arena.hpp"
+#include "Frame_Clock.hpp"
+#include "Frustum_Culler.hpp"
+#include "Height_Archive.hpp"
+#include "Height_Field.hpp"
+#include "Height_Map.hpp"
+#include "Height_Noise.hpp"
+#include "Height_Pyramid.hpp"
+#include "Horizon_Culler.hpp"
+#include "Horizon_Map.hpp"
+#include "Job_System.hpp"
+#include "Light_Clusters.hpp"
+#include "Occlusion_Culler.hpp"
+#include "Scene_Graph.hpp"
+#include "Terrain.hpp"
+#include "Terrain_Lod.hpp"
+#include "Terrain_Streamer.hpp"
+#include "Triple_Buffer.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <iomanip>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <gtc/matrix_transform.hpp>
+
+using namespace std;
+
+namespace udit
+{
+
+    namespace
+    {
+
+        typedef chrono::high_resolution_clock Clock;
+
+        float milliseconds_since (Clock::time_point start)
+        {
+            return chrono::duration< float, milli >(Clock::now () - start).count ();
+        }
+
+        /// Reparto de luces entre clusters con un número creciente de luces visibles:
+        void benchmark_light_clusters ()
+        {
+            const float      z_near = 1.f;
+            const float      z_far  = 5000.f;
+            const glm::mat4  projection_matrix = glm::perspective (20.f, 16.f / 9.f, z_near, z_far);
+            const unsigned   iterations = 50;
+
+            Light_Clusters light_clusters;
+
+            light_clusters.set_projection (projection_matrix, z_near, z_far);
+
+            mt19937 random(1234);
+
+            uniform_real_distribution< float > unit (-1.f, 1.f);
+            uniform_real_distribution< float > depth(z_near, 300.f);
+            uniform_real_distribution< float > radius(2.f, 10.f);
+
+            float tan_x = 1.f / projection_matrix[0][0];
+            float tan_y = 1.f / projection_matrix[1][1];
+
+            cout << "light_clusters (" << Light_Clusters::GRID_X << "x" << Light_Clusters::GRID_Y << "x" << Light_Clusters::GRID_Z << " clusters)" << endl;
+
+            for (unsigned light_count : { 1000u, 2000u, 5000u, 10000u })
+            {
+                Light_Clusters::Light_Set lights;
+
+                // Luces repartidas dentro del frustum en espacio de vista:
+
+                for (unsigned i = 0; i < light_count; ++i)
+                {
+                    float z = depth (random);
+
+                    lights.add (glm::vec3(unit (random) * tan_x * z, unit (random) * tan_y * z, -z), radius (random), glm::vec3(1.f));
+                }
+
+                light_clusters.assign (lights);                     // Calentamiento
+
+                auto start = Clock::now ();
+
+                for (unsigned i = 0; i < iterations; ++i)
+                {
+                    light_clusters.assign (lights);
+                }
+
+                float average = milliseconds_since (start) / iterations;
+
+                cout << "    " << setw (6) << light_count << " lights: "
+                     << fixed << setprecision (3) << setw (8) << average << " ms/frame, "
+                     << setw (8) << light_clusters.get_statistics ().index_count << " light-cluster pairs" << endl;
+            }
+        }
+
+        /// Frustum culling de un número creciente de cajas repartidas alrededor de la cámara:
+        void benchmark_frustum_culling ()
+        {
+            const glm::mat4 projection_matrix = glm::perspective (20.f, 16.f / 9.f, 1.f, 5000.f);
+            const glm::mat4       view_matrix = glm::lookAt (glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f), glm::vec3(0.f, 1.f, 0.f));
+            const unsigned        iterations  = 100;
+
+            mt19937 random(1234);
+
+            uniform_real_distribution< float > position(-500.f, 500.f);
+            uniform_real_distribution< float > size    (   1.f,  20.f);
+
+            cout << "frustum_culling (" << Frustum_Culler::LANES << " objects per iteration)" << endl;
+
+            for (unsigned object_count : { 1000u, 10000u, 100000u, 1000000u })
+            {
+                Frustum_Culler culler;
+
+                for (unsigned i = 0; i < object_count; ++i)
+                {
+                    glm::vec3 center(position (random), position (random), position (random));
+                    glm::vec3 extent(size (random));
+
+                    culler.add (center - extent, center + extent);
+                }
+
+                culler.cull (projection_matrix * view_matrix);          // Calentamiento
+
+                auto start = Clock::now ();
+
+                for (unsigned i = 0; i < iterations; ++i)
+                {
+                    culler.cull (projection_matrix * view_matrix);
+                }
+
+                float average = milliseconds_since (start) / iterations;
+
+                cout << "    " << setw (7) << object_count << " objects: "
+                     << fixed << setprecision (3) << setw (8) << average << " ms/frame, "
+                     << setw (7) << culler.get_statistics ().visible_count << " visible, "
+                     << setw (7) << culler.get_statistics ().culled_count  << " culled" << endl;
+            }
+        }
+
+        /// Añade a los arrays una caja cerrada (12 triángulos) para usarla como oclusor:
+        void add_box_occluder (vector< float > & positions, vector< uint32_t > & indices, const glm::vec3 & min, const glm::vec3 & max)
+        {
+            static const uint32_t box_indices[] =
+            {
+                0, 1, 3,  0, 3, 2,  4, 6, 7,  4, 7, 5,  0, 4, 5,  0, 5, 1,
+                2, 3, 7,  2, 7, 6,  0, 2, 6,  0, 6, 4,  1, 5, 7,  1, 7, 3,
+            };
+
+            uint32_t first = uint32_t(positions.size () / 3);
+
+            for (int corner = 0; corner < 8; ++corner)
+            {
+                positions.push_back (corner & 1 ? max.x : min.x);
+                positions.push_back (corner & 2 ? max.y : min.y);
+                positions.push_back (corner & 4 ? max.z : min.z);
+            }
+
+            for (uint32_t index : box_indices) indices.push_back (first + index);
+        }
+
+        /// Occlusion culling por software: un terreno ondulado y varios edificios delante de la cámara
+        /// ocultan parte de los objetos repartidos detrás de ellos:
+        void benchmark_occlusion_culling ()
+        {
+            const glm::mat4 projection_matrix = glm::perspective (20.f, 16.f / 9.f, 1.f, 5000.f);
+            const glm::mat4       view_matrix = glm::lookAt (glm::vec3(0.f, 4.f, 0.f), glm::vec3(0.f, 3.f, -100.f), glm::vec3(0.f, 1.f, 0.f));
+            const unsigned        iterations  = 50;
+
+            vector< float    > positions;
+            vector< uint32_t > indices;
+
+            // Terreno de 128x128 cuadrados con colinas:
+
+            const int   grid_size   = 128;
+            const float cell_size   = 8.f;
+
+            for (int z = 0; z <= grid_size; ++z)
+            {
+                for (int x = 0; x <= grid_size; ++x)
+                {
+                    float world_x = (x - grid_size / 2) * cell_size;
+                    float world_z = -z * cell_size;
+
+                    positions.push_back (world_x);
+                    positions.push_back (6.f * sin (world_x * 0.02f) * cos (world_z * 0.03f) + 3.f);
+                    positions.push_back (world_z);
+                }
+            }
+
+            for (int z = 0; z < grid_size; ++z)
+            {
+                for (int x = 0; x < grid_size; ++x)
+                {
+                    uint32_t i = uint32_t(z * (grid_size + 1) + x);
+
+                    indices.insert (indices.end (), { i, i + 1, i + grid_size + 1, i + 1, i + grid_size + 2, i + grid_size + 1 });
+                }
+            }
+
+            // Edificios:
+
+            for (int building = 0; building < 16; ++building)
+            {
+                float x = -120.f + building * 16.f;
+                float z = -60.f - (building % 4) * 25.f;
+
+                add_box_occluder (positions, indices, glm::vec3(x, 0.f, z - 10.f), glm::vec3(x + 12.f, 30.f + (building % 3) * 10.f, z));
+            }
+
+            mt19937 random(1234);
+
+            uniform_real_distribution< float > object_x(-400.f,  400.f);
+            uniform_real_distribution< float > object_z(-800.f,  -20.f);
+            uniform_real_distribution< float > object_y(   0.f,    8.f);
+
+            vector< glm::vec3 > centers(10000);
+
+            for (auto & center : centers) center = glm::vec3(object_x (random), object_y (random), object_z (random));
+
+            Occlusion_Culler culler;
+
+            cout << "occlusion_culling (" << Occlusion_Culler::WIDTH << "x" << Occlusion_Culler::HEIGHT << " depth buffer, "
+                 << indices.size () / 3 << " occluder triangles, " << centers.size () << " objects)" << endl;
+
+            float raster_total = 0.f;
+            float   test_total = 0.f;
+
+            for (unsigned i = 0; i <= iterations; ++i)
+            {
+                culler.begin_frame (projection_matrix * view_matrix);
+                culler.add_occluder (positions.data (), positions.size () / 3, indices.data (), indices.size (), glm::mat4(1));
+                culler.rasterize ();
+                culler.reset_test_statistics ();
+
+                for (auto & center : centers) culler.is_occluded (center, glm::vec3(1.f));
+
+                if (i == 0) continue;                               // Calentamiento
+
+                raster_total += culler.get_statistics ().raster_milliseconds;
+                  test_total += culler.get_statistics ().  test_milliseconds;
+            }
+
+            auto & statistics = culler.get_statistics ();
+
+            cout << "    rasterized " << statistics.occluder_triangles << " triangles in "
+                 << fixed << setprecision (3) << raster_total / iterations << " ms/frame" << endl;
+            cout << "    tested     " << statistics.tested_count << " boxes in "
+                 << test_total / iterations << " ms/frame, "
+                 << setprecision (1) << 100.f * statistics.occluded_count / statistics.tested_count << "% occluded" << endl;
+        }
+
+        /// Árbol AABB dinámico: inserción, actualización de objetos que se mueven y consultas:
+        void benchmark_aabb_tree ()
+        {
+            const glm::mat4 projection_matrix = glm::perspective (20.f, 16.f / 9.f, 1.f, 5000.f);
+            const glm::mat4       view_matrix = glm::lookAt (glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f), glm::vec3(0.f, 1.f, 0.f));
+            const unsigned    query_count = 1000;
+
+            mt19937 random(1234);
+
+            uniform_real_distribution< float > position(-1000.f, 1000.f);
+            uniform_real_distribution< float > size    (    0.5f,    4.f);
+            uniform_real_distribution< float > step    (   -2.f,     2.f);
+            uniform_real_distribution< float > unit    (   -1.f,     1.f);
+
+            cout << "aabb_tree" << endl;
+
+            for (unsigned object_count : { 10000u, 100000u, 1000000u })
+            {
+                vector< glm::vec3 > centers(object_count);
+                vector< glm::vec3 > extents(object_count);
+                vector< int32_t   > proxies(object_count);
+
+                for (unsigned i = 0; i < object_count; ++i)
+                {
+                    centers[i] = glm::vec3(position (random), position (random), position (random));
+                    extents[i] = glm::vec3(size (random));
+                }
+
+                Dynamic_AABB_Tree tree(0.5f);
+
+                auto start = Clock::now ();
+
+                for (unsigned i = 0; i < object_count; ++i)
+                {
+                    proxies[i] = tree.create_proxy (centers[i] - extents[i], centers[i] + extents[i], i);
+                }
+
+                float insert_time = milliseconds_since (start);
+
+                // Se mueve el 10% de los objetos reinsertando los que salen de su caja engordada:
+
+                unsigned moved_count = object_count / 10;
+                unsigned reinserted  = 0;
+
+                start = Clock::now ();
+
+                for (unsigned i = 0; i < moved_count; ++i)
+                {
+                    centers[i] += glm::vec3(step (random), step (random), step (random));
+
+                    if (tree.move_proxy (proxies[i], centers[i] - extents[i], centers[i] + extents[i])) ++reinserted;
+                }
+
+                float move_time = milliseconds_since (start);
+
+                // Se mueven todos los objetos un poco y se reajusta el árbol completo:
+
+                for (unsigned i = 0; i < object_count; ++i)
+                {
+                    centers[i] += glm::vec3(step (random), step (random), step (random)) * 0.1f;
+
+                    tree.set_proxy_bounds (proxies[i], centers[i] - extents[i], centers[i] + extents[i]);
+                }
+
+                start = Clock::now ();
+
+                tree.refit ();
+
+                float refit_time = milliseconds_since (start);
+
+                vector< uint32_t > results;
+
+                start = Clock::now ();
+
+                for (unsigned i = 0; i < query_count; ++i)
+                {
+                    glm::vec3 center(position (random), position (random), position (random));
+
+                    results.clear ();
+                    tree.query_box (center - glm::vec3(20.f), center + glm::vec3(20.f), results);
+                }
+
+                float box_time = milliseconds_since (start) * 1000.f / query_count;
+
+                start = Clock::now ();
+
+                unsigned hits = 0;
+
+                for (unsigned i = 0; i < query_count; ++i)
+                {
+                    glm::vec3 origin(position (random), position (random), position (random));
+                    glm::vec3 direction = glm::normalize (glm::vec3(unit (random), unit (random), unit (random)) + glm::vec3(0.f, 0.f, 1e-3f));
+                    float     distance;
+
+                    if (tree.ray_cast (origin, direction, 4000.f, distance) != Dynamic_AABB_Tree::NULL_NODE) ++hits;
+                }
+
+                float ray_time = milliseconds_since (start) * 1000.f / query_count;
+
+                results.clear ();
+
+                start = Clock::now ();
+
+                tree.query_frustum (projection_matrix * view_matrix, results);
+
+                float frustum_time = milliseconds_since (start);
+
+                auto statistics = tree.get_statistics ();
+
+                cout << "    " << setw (7) << object_count << " objects (height " << statistics.height
+                     << ", area ratio " << fixed << setprecision (1) << statistics.area_ratio << ")" << endl
+                     << setprecision (3)
+                     << "        insert  " << setw (9) << insert_time  << " ms" << endl
+                     << "        move    " << setw (9) << move_time    << " ms (" << moved_count << " moved, " << reinserted << " reinserted)" << endl
+                     << "        refit   " << setw (9) << refit_time   << " ms" << endl
+                     << "        box     " << setw (9) << box_time     << " us/query" << endl
+                     << "        ray     " << setw (9) << ray_time     << " us/query (" << hits << "/" << query_count << " hits)" << endl
+                     << "        frustum " << setw (9) << frustum_time << " ms (" << results.size () << " visible)" << endl;
+            }
+        }
+
+        /// Nodo de una jerarquía enlazada con punteros que se recorre recursivamente multiplicando las
+        /// matrices en cada visita (el diseño que sustituye Scene_Graph):
+        struct Recursive_Node
+        {
+            glm::mat4 local_transform = glm::mat4(1.f);
+            glm::mat4 global_transform;
+
+            vector< unique_ptr< Recursive_Node > > children;
+
+            void update (const glm::mat4 & parent_transform)
+            {
+                global_transform = parent_transform * local_transform;
+
+                for (auto & child : children) child->update (global_transform);
+            }
+        };
+
+        /// Jerarquía plana frente a recursiva con 100.000 nodos, animando todos o solo el 1%:
+        void benchmark_scene_graph ()
+        {
+            const unsigned node_count = 100000;
+            const unsigned iterations = 50;
+
+            mt19937 random(1234);
+
+            // Cada nodo cuelga de uno anterior elegido al azar:
+
+            vector< uint32_t > parents(node_count, Scene_Graph::NO_PARENT);
+
+            for (unsigned i = 1; i < node_count; ++i)
+            {
+                parents[i] = uniform_int_distribution< uint32_t >(0, i - 1)(random);
+            }
+
+            Scene_Graph                graph;
+            Recursive_Node             root;
+            vector< Recursive_Node * > recursive_nodes(node_count);
+
+            recursive_nodes[0] = &root;
+
+            for (unsigned i = 0; i < node_count; ++i)
+            {
+                graph.add_node (parents[i], glm::vec3(0.f, 1.f, 0.f));
+
+                if (i > 0)
+                {
+                    auto & children = recursive_nodes[parents[i]]->children;
+
+                    children.push_back (make_unique< Recursive_Node >());
+
+                    recursive_nodes[i] = children.back ().get ();
+                }
+            }
+
+            graph.update ();
+
+            cout << "scene_graph (" << node_count << " nodes)" << endl;
+
+            for (unsigned percentage : { 100u, 1u })
+            {
+                unsigned animated_count = node_count * percentage / 100;
+                unsigned stride         = node_count / animated_count;
+
+                // Se empieza por el final porque los nodos más recientes suelen ser hojas o estar cerca de ellas:
+
+                auto animate = [&] (unsigned frame, auto && set_rotation)
+                {
+                    for (unsigned i = 0; i < animated_count; ++i)
+                    {
+                        set_rotation (node_count - 1 - i * stride, glm::angleAxis (0.01f * frame, glm::vec3(0.f, 1.f, 0.f)));
+                    }
+                };
+
+                auto start = Clock::now ();
+
+                for (unsigned frame = 0; frame < iterations; ++frame)
+                {
+                    animate (frame, [&] (unsigned node, const glm::quat & rotation) { graph.set_rotation (node, rotation); });
+
+                    graph.update ();
+                }
+
+                float flat_time = milliseconds_since (start) / iterations;
+
+                start = Clock::now ();
+
+                for (unsigned frame = 0; frame < iterations; ++frame)
+                {
+                    animate (frame, [&] (unsigned node, const glm::quat & rotation)
+                    {
+                        recursive_nodes[node]->local_transform = glm::translate (glm::mat4(1.f), glm::vec3(0.f, 1.f, 0.f)) * glm::mat4_cast (rotation);
+                    });
+
+                    root.update (glm::mat4(1.f));
+                }
+
+                float recursive_time = milliseconds_since (start) / iterations;
+
+                // Las dos jerarquías tienen que llegar a las mismas matrices:
+
+                float max_error = 0.f;
+
+                for (unsigned i = 0; i < node_count; i += 97)
+                {
+                    glm::mat4 difference = graph.get_world_matrix (i) - recursive_nodes[i]->global_transform;
+
+                    for (int c = 0; c < 4; ++c) max_error = std::max (max_error, glm::length (difference[c]));
+                }
+
+                cout << "    " << setw (3) << percentage << "% animated: flat "
+                     << fixed << setprecision (3) << setw (7) << flat_time << " ms/frame ("
+                     << setw (6) << graph.get_changed_nodes ().size () << " updated), recursive "
+                     << setw (7) << recursive_time << " ms/frame, max error " << scientific << setprecision (1) << max_error << endl;
+            }
+        }
+
+        /// Escalado del sistema de trabajos de 1 a N hilos con un parallel_for de carga irregular, y
+        /// tiempo que pasa cada hilo trabajando y dormido. Al final se mide lo que tarda un parallel_for
+        /// pequeño lanzado desde otro hilo (como los de un paso de la simulación) con trabajos largos
+        /// encolados desde el principal (como la generación de chunks) en la cola normal y en la de fondo:
+        void benchmark_job_system ()
+        {
+            const size_t   item_count = 1 << 20;
+            const unsigned iterations = 10;
+
+            vector< float > values(item_count);
+
+            // El coste de cada elemento crece con su índice para que el reparto estático fuese malo:
+
+            auto body = [&values] (size_t first, size_t last)
+            {
+                for (size_t i = first; i < last; ++i)
+                {
+                    float value = float(i);
+
+                    for (size_t step = 0, steps = 8 + (i >> 15); step < steps; ++step) value = sqrt (value + 1.f) * 1.0001f;
+
+                    values[i] = value;
+                }
+            };
+
+            unsigned max_threads = max (thread::hardware_concurrency (), 1u);
+            float    single_time = 0.f;
+
+            cout << "job_system (" << item_count << " items, " << max_threads << " hardware threads)" << endl;
+
+            for (unsigned thread_count = 1; thread_count <= max_threads; thread_count = thread_count < max_threads ? min (thread_count * 2, max_threads) : thread_count + 1)
+            {
+                Job_System jobs(thread_count - 1);
+
+                jobs.parallel_for (item_count, body);                   // Calentamiento
+                jobs.reset_statistics ();
+
+                auto start = Clock::now ();
+
+                for (unsigned i = 0; i < iterations; ++i) jobs.parallel_for (item_count, body);
+
+                float average = milliseconds_since (start) / iterations;
+
+                if (thread_count == 1) single_time = average;
+
+                cout << "    " << setw (3) << thread_count << " threads: " << fixed << setprecision (3) << setw (8) << average
+                     << " ms/iteration, speedup " << setprecision (2) << single_time / average << endl;
+
+                auto statistics = jobs.get_worker_statistics ();
+
+                for (size_t worker = 0; worker < statistics.size (); ++worker)
+                {
+                    cout << "        " << (worker == 0 ? "main    " : "worker ") << (worker == 0 ? string() : to_string (worker))
+                         << setprecision (1) << " busy " << setw (8) << statistics[worker].busy_milliseconds
+                         << " ms, idle " << setw (8) << statistics[worker].idle_milliseconds << " ms, "
+                         << statistics[worker].jobs_executed << " jobs (" << statistics[worker].jobs_stolen << " stolen)" << endl;
+                }
+            }
+
+            const unsigned long_job_count = 12;
+            const unsigned step_count     = 40;
+            const size_t   step_items     = item_count / 16;
+
+            auto long_job = [] ()
+            {
+                auto end = Clock::now () + chrono::milliseconds(20);
+
+                while (Clock::now () < end) { }
+            };
+
+            cout << "    4 threads, " << long_job_count << " jobs of 20 ms queued, parallel_for of " << step_items << " items:" << endl;
+
+            for (int background = 0; background < 2; ++background)
+            {
+                Job_System          jobs(3);
+                Job_System::Counter long_jobs;
+
+                for (unsigned i = 0; i < long_job_count; ++i)
+                {
+                    if (background) jobs.submit_background (long_job, &long_jobs);
+                    else            jobs.submit            (long_job, &long_jobs);
+                }
+
+                float total = 0.f, worst = 0.f;
+
+                thread simulation_thread([&] ()
+                {
+                    for (unsigned step = 0; step < step_count; ++step)
+                    {
+                        auto start = Clock::now ();
+
+                        jobs.parallel_for (step_items, body);
+
+                        float milliseconds = milliseconds_since (start);
+
+                        total += milliseconds;
+                        worst  = max (worst, milliseconds);
+                    }
+                });
+
+                simulation_thread.join ();
+
+                jobs.wait (long_jobs);
+
+                cout << "        " << (background ? "submit_background: " : "submit:            ") << fixed << setprecision (3)
+                     << setw (7) << total / step_count << " ms/step, max " << setw (7) << worst << " ms" << endl;
+            }
+        }
+
+        /// Simulación y render en serie frente a dos hilos comunicados con un triple buffer. La
+        /// simulación anima una jerarquía y descarta los objetos fuera del frustum; el render prepara
+        /// las matrices de los objetos visibles. Se mide cuántos frames se dibujan por segundo y cuánto
+        /// tarda de media un paso de la simulación en terminar de dibujarse:
+        void benchmark_frame_pipeline ()
+        {
+            const unsigned object_count = 20000;
+            const unsigned frame_count  = 200;
+
+            struct Snapshot
+            {
+                uint64_t              sequence = 0;
+                Clock::time_point     simulated_at;
+                glm::mat4             view_matrix;
+                vector< glm::mat4 >   model_matrices;   // Solo los objetos visibles
+            };
+
+            Scene_Graph    graph;
+            Frustum_Culler culler;
+
+            mt19937 random(1234);
+
+            uniform_real_distribution< float > position(-200.f, 200.f);
+
+            for (unsigned i = 0; i < object_count; ++i)
+            {
+                uint32_t parent = i < 100 ? Scene_Graph::NO_PARENT : i % 100;
+
+                graph .add_node (parent, glm::vec3(position (random), position (random) * 0.1f, position (random)));
+                culler.add      (glm::vec3(-1.f), glm::vec3(+1.f));
+            }
+
+            const glm::mat4 projection_matrix = glm::perspective (20.f, 16.f / 9.f, 1.f, 5000.f);
+
+            uint64_t step = 0;
+
+            auto simulate = [&] (Snapshot & snapshot)
+            {
+                ++step;
+
+                for (uint32_t node = 0; node < 100; ++node)
+                {
+                    graph.set_rotation (node, glm::angleAxis (0.01f * step + node, glm::vec3(0.f, 1.f, 0.f)));
+                }
+
+                graph.update ();
+
+                for (uint32_t object = 0; object < object_count; ++object) culler.set_transform (object, graph.get_world_matrix (object));
+
+                glm::mat4 view_matrix = glm::lookAt (glm::vec3(0.f, 20.f, 300.f), glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f));
+
+                culler.cull (projection_matrix * view_matrix);
+
+                snapshot.sequence    = step;
+                snapshot.view_matrix = view_matrix;
+                snapshot.model_matrices.clear ();
+
+                for (auto object : culler.get_visible_objects ()) snapshot.model_matrices.push_back (graph.get_world_matrix (object));
+
+                snapshot.simulated_at = Clock::now ();
+            };
+
+            float checksum = 0.f;
+
+            auto render = [&] (const Snapshot & snapshot)
+            {
+                for (auto & model_matrix : snapshot.model_matrices)
+                {
+                    glm::mat4 model_view_matrix = snapshot.view_matrix * model_matrix;
+                    glm::mat4 normal_matrix     = glm::transpose (glm::inverse (model_view_matrix));
+
+                    checksum += normal_matrix[0][0] + model_view_matrix[3][2];
+                }
+            };
+
+            cout << "frame_pipeline (" << object_count << " objects, " << frame_count << " frames)" << endl;
+
+            // En serie: cada frame simula y después dibuja:
+
+            {
+                Snapshot snapshot;
+                float    latency_total = 0.f;
+
+                auto start = Clock::now ();
+
+                for (unsigned frame = 0; frame < frame_count; ++frame)
+                {
+                    simulate (snapshot);
+                    render   (snapshot);
+
+                    latency_total += milliseconds_since (snapshot.simulated_at);
+                }
+
+                float elapsed = milliseconds_since (start);
+
+                cout << "    serial:    " << fixed << setprecision (1) << setw (7) << frame_count * 1000.f / elapsed << " frames/s, "
+                     << setprecision (3) << setw (7) << latency_total / frame_count << " ms latency" << endl;
+            }
+
+            // En paralelo: la simulación publica pasos sin esperar y el render dibuja el último:
+
+            {
+                Triple_Buffer< Snapshot > snapshots;
+                atomic< bool >            done(false);
+                atomic< unsigned >        simulated(0);
+
+                auto start = Clock::now ();
+
+                thread simulation_thread([&] ()
+                {
+                    while (!done)
+                    {
+                        simulate (snapshots.get_write_slot ());
+                        snapshots.publish ();
+                        simulated++;
+                    }
+                });
+
+                unsigned rendered      = 0;
+                unsigned repeated      = 0;
+                float    latency_total = 0.f;
+
+                while (rendered < frame_count)
+                {
+                    if (!snapshots.acquire ())
+                    {
+                        // Todavía no hay un paso nuevo. Un render real volvería a dibujar el anterior:
+                        if (snapshots.get_read_slot ().sequence == 0) { this_thread::yield (); continue; }
+
+                        ++repeated;
+                    }
+
+                    render (snapshots.get_read_slot ());
+
+                    latency_total += milliseconds_since (snapshots.get_read_slot ().simulated_at);
+                    rendered++;
+                }
+
+                float elapsed = milliseconds_since (start);
+
+                done = true;
+                simulation_thread.join ();
+
+                cout << "    pipelined: " << fixed << setprecision (1) << setw (7) << rendered * 1000.f / elapsed << " frames/s, "
+                     << setprecision (3) << setw (7) << latency_total / rendered << " ms latency, "
+                     << setprecision (1) << simulated * 1000.f / elapsed << " simulation steps/s, "
+                     << repeated << " frames without a new step" << endl;
+            }
+
+            if (checksum == 12345.f) cout << endl;          // Evita que se descarte el trabajo del render
+        }
+
+        /// Grabación de listas de comandos para muchos objetos: en una sola lista desde un hilo frente
+        /// a listas de 256 objetos grabadas en paralelo con el sistema de trabajos:
+        void benchmark_command_lists ()
+        {
+            const unsigned iterations = 20;
+
+            mt19937 random(1234);
+
+            uniform_real_distribution< float > position(-500.f, 500.f);
+            uniform_real_distribution< float > angle   (   0.f,   6.f);
+
+            const glm::mat4 view_matrix = glm::lookAt (glm::vec3(0.f, 50.f, 600.f), glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f));
+
+            cout << "command_lists (" << Job_System::get_instance ().get_thread_count () << " threads)" << endl;
+
+            for (unsigned object_count : { 10000u, 100000u })
+            {
+                vector< glm::mat4 > model_matrices(object_count);
+                vector< uint32_t  > materials     (object_count);
+
+                for (unsigned i = 0; i < object_count; ++i)
+                {
+                    model_matrices[i] = glm::rotate (glm::translate (glm::mat4(1.f), glm::vec3(position (random), position (random), position (random))), angle (random), glm::vec3(0.f, 1.f, 0.f));
+                    materials     [i] = i * 8 / object_count;           // Los objetos vienen ordenados por material
+                }
+
+                auto record = [&] (Command_List & list, size_t first, size_t last)
+                {
+                    for (size_t i = first; i < last; ++i)
+                    {
+                        list.bind_material       (materials[i]);
+                        list.set_object_uniforms (view_matrix * model_matrices[i]);
+                        list.bind_vertex_array   (1 + GLuint(i % 4));
+                        list.draw_elements       (GL_TRIANGLES, 36, GL_UNSIGNED_SHORT);
+                    }
+                };
+
+                Command_List           single_list;
+                vector< Command_List > lists;
+
+                auto start = Clock::now ();
+
+                for (unsigned i = 0; i < iterations; ++i)
+                {
+                    single_list.clear ();
+                    record (single_list, 0, object_count);
+                }
+
+                float serial_time = milliseconds_since (start) / iterations;
+
+                start = Clock::now ();
+
+                for (unsigned i = 0; i < iterations; ++i)
+                {
+                    Command_List::record_parallel (lists, object_count, 256, record);
+                }
+
+                float parallel_time = milliseconds_since (start) / iterations;
+
+                size_t command_count = 0;
+
+                for (auto & list : lists) command_count += list.size ();
+
+                cout << "    " << setw (6) << object_count << " objects: single list " << fixed << setprecision (3) << setw (7) << serial_time
+                     << " ms (" << single_list.size () << " commands), " << lists.size () << " lists " << setw (7) << parallel_time
+                     << " ms (" << command_count << " commands), speedup " << setprecision (2) << serial_time / parallel_time << endl;
+            }
+        }
+
+        /// Reparto de un búfer de geometría entre mallas que se crean y se destruyen continuamente,
+        /// y fragmentación antes y después de volver a colocarlas juntas (lo que hace
+        /// Geometry_Pool::defragment()):
+        void benchmark_buddy_allocator ()
+        {
+            const unsigned operations = 1000000;
+
+            cout << "buddy_allocator (" << operations << " allocations/frees)" << endl;
+
+            for (unsigned live_meshes : { 100u, 1000u, 10000u })
+            {
+                // Con mallas de hasta capacity / live_meshes vértices los bloques reservados (redondeados a
+                // potencias de dos) llenan buena parte del búfer, de modo que algunas reservas pueden
+                // fallar cuando el espacio libre está repartido en huecos pequeños:
+
+                const uint32_t capacity = 4 * 1024 * 1024;
+
+                mt19937 random(1234);
+
+                uniform_int_distribution< uint32_t > size(24, capacity / live_meshes);
+
+                Buddy_Allocator allocator(capacity, 64);
+
+                vector< pair< uint32_t, uint32_t > > meshes;                // Posición y tamaño
+
+                unsigned failed_count = 0;
+
+                auto start = Clock::now ();
+
+                for (unsigned i = 0; i < operations; ++i)
+                {
+                    uint32_t offset = Buddy_Allocator::INVALID;
+
+                    if (meshes.size () < live_meshes)
+                    {
+                        uint32_t mesh_size = size (random);
+
+                        offset = allocator.allocate (mesh_size);
+
+                        if (offset != Buddy_Allocator::INVALID) meshes.push_back ({ offset, mesh_size });
+                        else                                    failed_count++;
+                    }
+
+                    if (offset == Buddy_Allocator::INVALID && !meshes.empty ())
+                    {
+                        size_t victim = random () % meshes.size ();
+
+                        allocator.free (meshes[victim].first);
+
+                        meshes[victim] = meshes.back ();
+                        meshes.pop_back ();
+                    }
+                }
+
+                float nanoseconds = milliseconds_since (start) * 1e6f / operations;
+
+                Buddy_Allocator::Statistics before = allocator.get_statistics ();
+
+                // Se colocan de mayor a menor bloque en un reparto nuevo de la misma capacidad:
+
+                sort
+                (
+                    meshes.begin (), meshes.end (),
+                    [&] (const pair< uint32_t, uint32_t > & a, const pair< uint32_t, uint32_t > & b)
+                    {
+                        return allocator.get_block_size (a.first) > allocator.get_block_size (b.first);
+                    }
+                );
+
+                Buddy_Allocator packed(before.capacity, 64);
+
+                for (auto & mesh : meshes) packed.allocate (mesh.second);
+
+                Buddy_Allocator::Statistics after = packed.get_statistics ();
+
+                cout << "    " << setw (6) << live_meshes << " meshes: " << fixed << setprecision (1) << setw (6) << nanoseconds << " ns/operation, "
+                     << failed_count << " failed, used " << setprecision (1) << before.utilisation () * 100.f << "% -> " << after.utilisation () * 100.f
+                     << "%, fragmented " << before.fragmentation () * 100.f << "% -> " << after.fragmentation () * 100.f << "%" << endl;
+            }
+        }
+
+        /// Datos temporales de un frame (objetos visibles con sus matrices y el orden de dibujado)
+        /// construidos con vectores del heap frente a vectores en una Frame_Arena que se vacía cada
+        /// frame. Las reservas se cuentan con Allocation_Counter (todo lo que pasa por operator new),
+        /// por lo que también se notaría lo que reservase la propia ordenación. Comprueba que, pasado el
+        /// primer frame, la versión con la arena no vuelve a reservar memoria:
+        void benchmark_frame_arena ()
+        {
+            struct Draw_Item
+            {
+                glm::mat4 model_view_matrix;
+                uint32_t  material;
+            };
+
+            const unsigned warm_up_frames = 3;
+            const unsigned frames         = 2000;
+
+            cout << "frame_arena (" << frames << " frames)" << endl;
+
+            for (unsigned max_objects : { 100u, 1000u, 10000u })
+            {
+                // Cada frame ve un número distinto de objetos, el primero el máximo:
+                mt19937 random(1234);
+
+                uniform_int_distribution< unsigned > visible(max_objects / 2, max_objects);
+
+                vector< unsigned > object_counts(frames + warm_up_frames);
+
+                for (auto & count : object_counts) count = visible (random);
+
+                object_counts[0] = max_objects;
+
+                auto build_frame = [] (auto & items, auto & order, unsigned count)
+                {
+                    for (unsigned i = 0; i < count; ++i)
+                    {
+                        items.push_back ({ glm::translate (glm::mat4(1.f), glm::vec3(float(i))), i % 7 });
+                        order.push_back (i);
+                    }
+
+                    sort (order.begin (), order.end (), [&items] (uint32_t a, uint32_t b) { return items[a].material < items[b].material; });
+                };
+
+                // Vectores nuevos cada frame en el heap:
+
+                for (unsigned frame = 0; frame < warm_up_frames; ++frame)
+                {
+                    vector< Draw_Item > items;
+                    vector< uint32_t  > order;
+                    build_frame (items, order, object_counts[frame]);
+                }
+
+                size_t heap_allocations = Allocation_Counter::get_allocation_count ();
+
+                auto start = Clock::now ();
+
+                for (unsigned frame = warm_up_frames; frame < object_counts.size (); ++frame)
+                {
+                    vector< Draw_Item > items;
+                    vector< uint32_t  > order;
+                    build_frame (items, order, object_counts[frame]);
+                }
+
+                float heap_time = milliseconds_since (start) / frames;
+
+                heap_allocations = Allocation_Counter::get_allocation_count () - heap_allocations;
+
+                // Los mismos vectores en una arena (sin relleno de la memoria liberada para medir lo mismo que en release):
+
+                Frame_Arena arena(4 * 1024);
+
+                arena.set_poisoning (false);
+
+                for (unsigned frame = 0; frame < warm_up_frames; ++frame)
+                {
+                    {
+                        Frame_Vector< Draw_Item > items(arena);
+                        Frame_Vector< uint32_t  > order(arena);
+                        build_frame (items, order, object_counts[frame]);
+                    }
+
+                    arena.reset ();
+                }
+
+                size_t arena_allocations = Allocation_Counter::get_allocation_count ();
+
+                start = Clock::now ();
+
+                for (unsigned frame = warm_up_frames; frame < object_counts.size (); ++frame)
+                {
+                    {
+                        Frame_Vector< Draw_Item > items(arena);
+                        Frame_Vector< uint32_t  > order(arena);
+                        build_frame (items, order, object_counts[frame]);
+                    }
+
+                    arena.reset ();
+                }
+
+                float arena_time = milliseconds_since (start) / frames;
+
+                arena_allocations = Allocation_Counter::get_allocation_count () - arena_allocations;
+
+                cout << "    " << setw (6) << max_objects << " objects: heap " << fixed << setprecision (3) << setw (7) << heap_time
+                     << " ms (" << setw (6) << heap_allocations << " allocations), arena " << setw (7) << arena_time
+                     << " ms (" << arena_allocations << " allocations, high-water mark " << arena.get_statistics ().high_water_mark / 1024
+                     << " KB) " << (arena_allocations == 0 ? "OK" : "ERROR: the arena allocated in steady state") << endl;
+            }
+        }
+
+        /// Reservas de memoria dinámica en la parte de CPU de un frame de la escena una vez que se
+        /// repite: el paso de la simulación (grafo de escena, frustum culling, árbol de cajas, culling
+        /// con el horizonte del terreno y por software, selección de nodos del terreno y snapshot en
+        /// su arena) y lo que el render hace antes de llamar a OpenGL (reparto de las luces entre
+        /// clusters y grabación de las listas de comandos con el sistema de trabajos). Se cuentan con
+        /// Allocation_Counter todas las reservas de todos los hilos, etapa por etapa. La cámara recorre
+        /// un ciclo para calentar y en el siguiente, que repite los mismos frames, no se debería
+        /// reservar nada:
+        void benchmark_frame_allocations ()
+        {
+            const unsigned object_count = 2000;
+            const unsigned light_count  = 200;
+            const unsigned cycle_frames = 240;
+
+            struct Draw_Item
+            {
+                glm::mat4 model_matrix;
+                uint32_t  material;
+            };
+
+            struct Snapshot
+            {
+                uint64_t                          sequence = 0;
+                glm::mat4                         view_matrix;
+                Frame_Arena                       arena;
+                Frame_Vector< Draw_Item         > objects;
+                Frame_Vector< Terrain_Lod::Node > terrain_nodes;
+
+                Snapshot() : objects(arena), terrain_nodes(arena)
+                {
+                }
+            };
+
+            // Terreno con colinas y objetos repartidos por encima:
+
+            Height_Noise::Settings hills;
+
+            hills.frequency = 1.f / 250.f;
+
+            auto           height_map = Height_Noise(hills).generate (1025, 1025);
+            glm::vec3      size(2000.f, 120.f, 2000.f);
+            Terrain_Lod    terrain(*height_map, size, 40.f);
+            Height_Field   field(*height_map, terrain.get_pyramid (), size);
+            Horizon_Culler horizon(terrain.get_pyramid (), size);
+
+            Scene_Graph       graph;
+            Frustum_Culler    culler;
+            Dynamic_AABB_Tree tree;
+
+            vector< int32_t > proxies;
+
+            mt19937 random(1234);
+
+            uniform_real_distribution< float > coordinate(-size.x * .45f, size.x * .45f);
+
+            for (unsigned i = 0; i < object_count; ++i)
+            {
+                uint32_t parent = i < 100 ? Scene_Graph::NO_PARENT : i % 100;
+                float    x      = coordinate (random);
+                float    z      = coordinate (random);
+
+                graph .add_node (parent, glm::vec3(x, field.height_at (x, z) + 2.f, z));
+                culler.add      (glm::vec3(-1.f), glm::vec3(+1.f));
+
+                proxies.push_back (tree.create_proxy (glm::vec3(-1.f), glm::vec3(+1.f), i));
+            }
+
+            // Un edificio hace de oclusor por software:
+
+            vector< float    > occluder_positions;
+            vector< uint32_t > occluder_indices;
+
+            add_box_occluder (occluder_positions, occluder_indices, glm::vec3(-40.f, 0.f, -40.f), glm::vec3(40.f, 60.f, 40.f));
+
+            Occlusion_Culler occluder;
+            Light_Clusters   light_clusters;
+
+            Light_Clusters::Light_Set lights;
+            vector< glm::vec3 >       light_positions(light_count);
+
+            for (auto & position : light_positions) position = glm::vec3(coordinate (random), 20.f, coordinate (random));
+
+            const glm::mat4 projection_matrix = glm::perspective (20.f, 16.f / 9.f, 1.f, 5000.f);
+
+            light_clusters.set_projection (projection_matrix, 1.f, 5000.f);
+
+            Triple_Buffer< Snapshot > snapshots;
+            vector< Command_List >    command_lists;
+
+            // Etapas del frame:
+
+            enum Stage
+            {
+                SCENE_GRAPH, FRUSTUM_CULLING, AABB_TREE, HORIZON_CULLING, OCCLUSION_CULLING, SNAPSHOT, LIGHT_CLUSTERS, COMMAND_LISTS, STAGE_COUNT
+            };
+
+            static const char * const stage_names[STAGE_COUNT] =
+            {
+                "scene graph", "frustum culling", "aabb tree", "horizon culling", "occlusion culling", "snapshot + terrain", "light clusters", "command lists"
+            };
+
+            size_t allocations[STAGE_COUNT];
+
+            auto measure = [&allocations] (Stage stage, auto && run)
+            {
+                size_t before = Allocation_Counter::get_allocation_count ();
+
+                run ();
+
+                allocations[stage] += Allocation_Counter::get_allocation_count () - before;
+            };
+
+            auto run_frame = [&] (unsigned frame)
+            {
+                // La cámara da una vuelta alrededor del centro en cycle_frames frames:
+
+                float     angle  = 6.2831853f * float(frame % cycle_frames) / float(cycle_frames);
+                glm::vec3 camera = glm::vec3(700.f * cos (angle), 0.f, 700.f * sin (angle));
+
+                camera.y = field.height_at (camera.x, camera.z) + 10.f;
+
+                glm::mat4 view_matrix     = glm::lookAt (camera, glm::vec3(0.f, 30.f, 0.f), glm::vec3(0.f, 1.f, 0.f));
+                glm::mat4 view_projection = projection_matrix * view_matrix;
+
+                measure (SCENE_GRAPH, [&] ()
+                {
+                    for (uint32_t node = 0; node < 100; ++node)
+                    {
+                        graph.set_rotation (node, glm::angleAxis (angle + float(node), glm::vec3(0.f, 1.f, 0.f)));
+                    }
+
+                    graph.update ();
+                });
+
+                measure (FRUSTUM_CULLING, [&] ()
+                {
+                    for (uint32_t object = 0; object < object_count; ++object) culler.set_transform (object, graph.get_world_matrix (object));
+
+                    culler.cull (view_projection);
+                });
+
+                measure (AABB_TREE, [&] ()
+                {
+                    for (uint32_t object = 0; object < object_count; ++object)
+                    {
+                        tree.move_proxy (proxies[object], culler.get_center (object) - culler.get_extent (object), culler.get_center (object) + culler.get_extent (object));
+                    }
+                });
+
+                measure (HORIZON_CULLING, [&] ()
+                {
+                    horizon.reset_test_statistics ();
+                    horizon.build (camera);
+
+                    for (auto object : culler.get_visible_objects ()) horizon.is_occluded (culler.get_center (object), culler.get_extent (object));
+                });
+
+                measure (OCCLUSION_CULLING, [&] ()
+                {
+                    occluder.reset_test_statistics ();
+                    occluder.begin_frame (view_projection);
+                    occluder.add_occluder (occluder_positions.data (), occluder_positions.size () / 3, occluder_indices.data (), occluder_indices.size (), glm::mat4(1));
+                    occluder.rasterize ();
+
+                    for (auto object : culler.get_visible_objects ()) occluder.is_occluded (culler.get_center (object), culler.get_extent (object));
+                });
+
+                // Como Scene::update(): se vacía el slot del paso de hace tres frames y se llena en su arena:
+
+                measure (SNAPSHOT, [&] ()
+                {
+                    Snapshot & snapshot = snapshots.get_write_slot ();
+
+                    snapshot.objects       = Frame_Vector< Draw_Item         >(snapshot.arena);
+                    snapshot.terrain_nodes = Frame_Vector< Terrain_Lod::Node >(snapshot.arena);
+                    snapshot.arena.reset ();
+
+                    for (auto object : culler.get_visible_objects ())
+                    {
+                        snapshot.objects.push_back ({ graph.get_world_matrix (object), object % 4 });
+                    }
+
+                    terrain.select (camera, view_projection, snapshot.terrain_nodes);
+
+                    snapshot.sequence    = frame + 1;
+                    snapshot.view_matrix = view_matrix;
+
+                    snapshots.publish ();
+                    snapshots.acquire ();
+                });
+
+                const Snapshot & snapshot = snapshots.get_read_slot ();
+
+                measure (LIGHT_CLUSTERS, [&] ()
+                {
+                    lights.clear ();
+
+                    for (auto & position : light_positions)
+                    {
+                        lights.add (glm::vec3(snapshot.view_matrix * glm::vec4(position, 1.f)), 40.f, glm::vec3(1.f));
+                    }
+
+                    light_clusters.assign (lights);
+                });
+
+                measure (COMMAND_LISTS, [&] ()
+                {
+                    Command_List::record_parallel
+                    (
+                        command_lists, snapshot.objects.size (), 64,
+                        [&] (Command_List & list, size_t first, size_t last)
+                        {
+                            for (size_t i = first; i < last; ++i)
+                            {
+                                list.bind_material       (snapshot.objects[i].material);
+                                list.set_object_uniforms (snapshot.view_matrix * snapshot.objects[i].model_matrix);
+                                list.bind_vertex_array   (1);
+                                list.draw_elements       (GL_TRIANGLES, 36, GL_UNSIGNED_SHORT);
+                            }
+                        }
+                    );
+                });
+            };
+
+            cout << "frame_allocations (" << object_count << " objects, " << light_count << " lights, "
+                 << Job_System::get_instance ().get_thread_count () << " threads, " << cycle_frames << " frames after a warm-up cycle)" << endl;
+
+            for (unsigned frame = 0; frame < cycle_frames; ++frame) run_frame (frame);
+
+            fill_n (allocations, STAGE_COUNT, size_t(0));
+
+            for (unsigned frame = cycle_frames; frame < 2 * cycle_frames; ++frame) run_frame (frame);
+
+            size_t total = 0;
+
+            for (unsigned stage = 0; stage < STAGE_COUNT; ++stage)
+            {
+                cout << "    " << left << setw (20) << stage_names[stage] << right << setw (6) << allocations[stage] << " allocations" << endl;
+
+                total += allocations[stage];
+            }
+
+            cout << "    total " << fixed << setprecision (2) << float(total) / cycle_frames << " allocations/frame "
+                 << (total == 0 ? "OK" : "ERROR: the frame allocates in steady state") << endl;
+        }
+
+        /// Generación de la malla del terreno (alturas, normales y vértices) con rejillas de 512 x 512
+        /// a 8192 x 8192 cuadrados, y memoria que ocupa en la GPU repartida en tiles. Comprueba que las
+        /// normales calculadas con SIMD coinciden con las exactas:
+        void benchmark_terrain_generation ()
+        {
+            // Mapa de alturas de 1024 x 1024 con colinas suaves:
+            Height_Map height_map(1024, 1024);
+
+            for (unsigned z = 0; z < height_map.get_depth (); ++z)
+            {
+                for (unsigned x = 0; x < height_map.get_width (); ++x)
+                {
+                    float u = float(x) / 1023.f * 6.2831853f;
+                    float v = float(z) / 1023.f * 6.2831853f;
+
+                    height_map.set (x, z, .5f + .25f * sin (u * 3.f) * cos (v * 2.f) + .125f * sin (u * 11.f + v * 7.f));
+                }
+            }
+
+            const glm::vec3 size(1000.f, 100.f, 1000.f);
+
+            size_t tile_indices = Terrain::build_strip_indices (Terrain::TILE_QUADS, Terrain::TILE_QUADS).size ();
+            size_t tile_vertices = size_t(Terrain::TILE_QUADS + 1) * (Terrain::TILE_QUADS + 1);
+
+            cout << "terrain_generation (" << Job_System::get_instance ().get_thread_count () << " threads, "
+                 << sizeof(Terrain::Vertex) << " bytes per vertex, tiles of " << Terrain::TILE_QUADS << " quads)" << endl;
+
+            for (unsigned slices : { 512u, 1024u, 2048u, 4096u, 8192u })
+            {
+                Terrain::Grid grid;
+
+                unsigned iterations = slices <= 1024 ? 5 : 1;
+
+                Terrain::generate (height_map, size, slices, slices, grid);      // Calentamiento
+
+                auto start = Clock::now ();
+
+                for (unsigned i = 0; i < iterations; ++i)
+                {
+                    Terrain::generate (height_map, size, slices, slices, grid);
+                }
+
+                float milliseconds = milliseconds_since (start) / iterations;
+
+                // Normales de una muestra de vértices interiores frente a las calculadas en doble precisión:
+
+                mt19937 random(1234);
+
+                uniform_int_distribution< unsigned > coordinate(1, slices - 1);
+
+                int max_error = 0;
+
+                for (unsigned i = 0; i < 10000; ++i)
+                {
+                    unsigned x = coordinate (random);
+                    unsigned z = coordinate (random);
+
+                    auto height = [&] (unsigned x, unsigned z) { return double(grid.vertices[size_t(z) * grid.columns + x].position[1]); };
+
+                    double step    = double(size.x) / slices;
+                    double slope_x = (height (x + 1, z) - height (x - 1, z)) / (2. * step);
+                    double slope_z = (height (x, z + 1) - height (x, z - 1)) / (2. * step);
+                    double length  = sqrt (slope_x * slope_x + slope_z * slope_z + 1.);
+                    double exact[] = { -slope_x / length * 127., 1. / length * 127., -slope_z / length * 127. };
+
+                    const int8_t * normal = grid.vertices[size_t(z) * grid.columns + x].normal;
+
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        max_error = max (max_error, int(abs (double(normal[c]) - exact[c]) + .5));
+                    }
+                }
+
+                size_t tile_count   = size_t(slices / Terrain::TILE_QUADS) * (slices / Terrain::TILE_QUADS);
+                float  grid_mb      = float(grid.vertices.size () * sizeof(Terrain::Vertex)) / (1024.f * 1024.f);
+                float  vertices_mb  = float(tile_count * tile_vertices * sizeof(Terrain::Vertex)) / (1024.f * 1024.f);
+                float  indices_mb   = float(tile_count * tile_indices  * sizeof(uint16_t)) / (1024.f * 1024.f);
+
+                cout << "    " << setw (4) << slices << "^2: " << fixed << setprecision (1) << setw (8) << milliseconds << " ms, "
+                     << setw (6) << float(grid.vertices.size ()) / (milliseconds * 1000.f) << " Mvertices/s, grid " << setw (7) << grid_mb
+                     << " MB, GPU " << setw (7) << vertices_mb << " MB vertices + " << setw (6) << indices_mb << " MB indices in "
+                     << tile_count << " tiles, normal error " << max_error << (max_error <= 1 ? " OK" : " ERROR") << endl;
+            }
+        }
+
+        /// Elección de nodos del terreno con LOD continuo sobre terrenos de 512 a 8192 unidades de lado
+        /// (una celda del mapa por unidad) con la misma cámara y los mismos rangos. El número de
+        /// triángulos tiene que mantenerse casi constante aunque el terreno crezca. También se mide
+        /// lo que cuesta en la CPU una edición (alturas y cotas) y la memoria de vídeo de la textura
+        /// R16 frente a la de guardar un vértice del terreno en tiles por altura:
+        void benchmark_terrain_lod ()
+        {
+            const unsigned  iterations  = 100;
+            const glm::vec3 camera(0.f, 120.f, 0.f);
+
+            const glm::mat4 view_projection = glm::perspective (glm::radians (60.f), 16.f / 9.f, 1.f, 100000.f)
+                                            * glm::lookAt (camera, camera + glm::vec3(.3f, -.2f, -1.f), glm::vec3(0.f, 1.f, 0.f));
+
+            cout << "terrain_lod (same camera and ranges, 1 unit per height sample)" << endl;
+
+            for (unsigned samples : { 513u, 1025u, 2049u, 4097u, 8193u })
+            {
+                Height_Map height_map(samples, samples);
+
+                for (unsigned z = 0; z < samples; ++z)
+                {
+                    float * row = height_map.get_row (z);
+
+                    for (unsigned x = 0; x < samples; ++x)
+                    {
+                        row[x] = .5f + .25f * sin (float(x) * .013f) * cos (float(z) * .011f) + .2f * sin (float(x + z) * .002f);
+                    }
+                }
+
+                glm::vec3   size(float(samples - 1), 100.f, float(samples - 1));
+                Terrain_Lod terrain(height_map, size, 50.f);
+
+                Frame_Arena                       arena(64 * 1024);
+                Frame_Vector< Terrain_Lod::Node > nodes(arena);
+
+                terrain.select (camera, view_projection, nodes);                // Calentamiento
+
+                Terrain_Lod::Statistics statistics{};
+
+                auto start = Clock::now ();
+
+                for (unsigned i = 0; i < iterations; ++i)
+                {
+                    statistics = terrain.select (camera, view_projection, nodes);
+                }
+
+                float milliseconds = milliseconds_since (start) / iterations;
+
+                cout << "    " << setw (5) << samples - 1 << "^2: " << setw (2) << terrain.get_level_count () << " levels, "
+                     << setw (4) << statistics.node_count << " nodes, " << setw (7) << statistics.triangle_count << " triangles, "
+                     << setw (5) << statistics.culled_count << " culled, " << fixed << setprecision (3) << milliseconds << " ms/select, pyramid "
+                     << setprecision (1) << float(terrain.get_pyramid ().get_memory ()) / (1024.f * 1024.f) << " MB" << endl;
+
+                start = Clock::now ();
+
+                for (unsigned i = 0; i < iterations; ++i)
+                {
+                    float x = float(samples) * (.1f + .8f * float(i) / iterations);
+
+                    terrain.update_pyramid (height_map, height_map.raise (x, x, 8.f, .01f));
+                }
+
+                float texture_megabytes  = float(size_t(samples) * samples * sizeof(uint16_t       )) / (1024.f * 1024.f);
+                float vertices_megabytes = float(size_t(samples) * samples * sizeof(Terrain::Vertex)) / (1024.f * 1024.f);
+
+                cout << "           edit " << setprecision (3) << milliseconds_since (start) / iterations * 1000.f << " us, R16 texture "
+                     << setprecision (1) << texture_megabytes << " MB vs " << vertices_megabytes << " MB of vertices" << endl;
+            }
+        }
+
+        /// Consultas de altura y cortes de rayos con el terreno sobre mapas de 1024 a 8192 celdas de
+        /// lado (una por unidad): alturas de una en una y en lotes con SIMD, y rayos recorriendo las
+        /// cotas del Height_Pyramid. Comprueba que los lotes coinciden con las consultas sueltas y que
+        /// los cortes coinciden con los de avanzar por el rayo en pasos pequeños:
+        void benchmark_height_queries ()
+        {
+            const unsigned point_count = 1 << 20;
+            const unsigned ray_count   = 100000;
+            const unsigned march_count = 200;
+
+            cout << "height_queries (" << point_count << " points, " << ray_count << " rays)" << endl;
+
+            for (unsigned samples : { 1025u, 2049u, 4097u, 8193u })
+            {
+                Height_Map height_map(samples, samples);
+
+                for (unsigned z = 0; z < samples; ++z)
+                {
+                    float * row = height_map.get_row (z);
+
+                    for (unsigned x = 0; x < samples; ++x)
+                    {
+                        row[x] = .5f + .25f * sin (float(x) * .013f) * cos (float(z) * .011f) + .2f * sin (float(x + z) * .002f);
+                    }
+                }
+
+                Height_Pyramid pyramid(height_map);
+                glm::vec3      size(float(samples - 1), 100.f, float(samples - 1));
+                Height_Field   field(height_map, pyramid, size);
+
+                mt19937 random(1234);
+
+                uniform_real_distribution< float > coordinate(-size.x * .5f, size.x * .5f);
+
+                vector< float > x(point_count), z(point_count), single(point_count), batch(point_count);
+
+                for (unsigned i = 0; i < point_count; ++i)
+                {
+                    x[i] = coordinate (random);
+                    z[i] = coordinate (random);
+                }
+
+                auto start = Clock::now ();
+
+                for (unsigned i = 0; i < point_count; ++i) single[i] = field.height_at (x[i], z[i]);
+
+                float single_time = milliseconds_since (start);
+
+                start = Clock::now ();
+
+                field.height_at (x.data (), z.data (), batch.data (), point_count);
+
+                float batch_time = milliseconds_since (start);
+                float max_error  = 0.f;
+
+                for (unsigned i = 0; i < point_count; ++i) max_error = max (max_error, abs (single[i] - batch[i]));
+
+                // Rayos desde encima del terreno hacia abajo con inclinaciones de rasante a vertical:
+
+                uniform_real_distribution< float > angle(0.f, 6.2831853f);
+                uniform_real_distribution< float > slope(.05f, 1.f);
+
+                vector< glm::vec3 > origins(ray_count), directions(ray_count);
+
+                for (unsigned i = 0; i < ray_count; ++i)
+                {
+                    float a = angle (random), s = slope (random);
+
+                    origins   [i] = glm::vec3(coordinate (random), size.y * 1.5f, coordinate (random));
+                    directions[i] = glm::normalize (glm::vec3(cos (a), -s, sin (a)));
+                }
+
+                vector< float > distances(ray_count);
+                unsigned        hit_count = 0;
+
+                start = Clock::now ();
+
+                for (unsigned i = 0; i < ray_count; ++i)
+                {
+                    if (field.intersect_ray (origins[i], directions[i], 1e6f, distances[i])) hit_count++;
+                    else distances[i] = -1.f;
+                }
+
+                float ray_time = milliseconds_since (start);
+
+                // Los primeros rayos se repiten avanzando de 0.05 en 0.05 unidades hasta quedar por
+                // debajo de la superficie:
+
+                unsigned agree_count = 0;
+
+                for (unsigned i = 0; i < march_count; ++i)
+                {
+                    float marched = -1.f;
+
+                    for (float t = 0.f; t < 4.f * size.x; t += .05f)
+                    {
+                        glm::vec3 point = origins[i] + directions[i] * t;
+
+                        if (!field.contains (point.x, point.z)) break;
+
+                        if (point.y <= field.height_at (point.x, point.z))
+                        {
+                            marched = t;
+                            break;
+                        }
+                    }
+
+                    if ((marched < 0.f && distances[i] < 0.f) || abs (marched - distances[i]) <= .05f) agree_count++;
+                }
+
+                cout << "    " << setw (4) << samples - 1 << "^2: height_at " << fixed << setprecision (1) << setw (6)
+                     << point_count / (single_time * 1000.f) << " Mqueries/s, batch " << setw (6) << point_count / (batch_time * 1000.f)
+                     << " Mqueries/s (error " << setprecision (6) << max_error << "), rays " << setprecision (2) << setw (5)
+                     << ray_count / (ray_time * 1000.f) << " Mrays/s (" << hit_count * 100 / ray_count << "% hit), "
+                     << agree_count << "/" << march_count << " match ray marching" << (agree_count == march_count ? " OK" : " ERROR") << endl;
+            }
+        }
+
+        /// Generación procedural de un mapa de 2049 x 2049 alturas con fBm y con ridged deformado: la
+        /// versión escalar punto a punto, la SIMD en un hilo y la SIMD repartida en tiles entre todos los
+        /// hilos. Comprueba que la SIMD da las mismas alturas que la escalar:
+        void benchmark_height_noise ()
+        {
+            const unsigned samples      = 2049;
+            const unsigned thread_count = Job_System::get_instance ().get_thread_count ();
+
+            cout << "height_noise (" << samples << "^2 samples, " << thread_count << " threads)" << endl;
+
+            Height_Noise::Settings hills;
+
+            Height_Noise::Settings ridges;
+
+            ridges.type          = Height_Noise::RIDGED;
+            ridges.octaves       = 8;
+            ridges.warp_strength = 80.f;
+
+            for (auto & settings : { hills, ridges })
+            {
+                Height_Noise noise(settings);
+                Height_Map   scalar(samples, samples), single(samples, samples), parallel(samples, samples);
+
+                auto start = Clock::now ();
+
+                for (unsigned z = 0; z < samples; ++z)
+                {
+                    float * row = scalar.get_row (z);
+
+                    for (unsigned x = 0; x < samples; ++x) row[x] = noise.sample (float(x), float(z));
+                }
+
+                float scalar_time = milliseconds_since (start);
+
+                start = Clock::now ();
+
+                noise.fill (0.f, 0.f, 1.f, single, false);
+
+                float single_time = milliseconds_since (start);
+
+                start = Clock::now ();
+
+                noise.fill (0.f, 0.f, 1.f, parallel);
+
+                float parallel_time = milliseconds_since (start);
+                float max_error     = 0.f;
+
+                for (unsigned z = 0; z < samples; ++z)
+                {
+                    for (unsigned x = 0; x < samples; ++x)
+                    {
+                        max_error = max (max_error, abs (scalar.get_row (z)[x] - single  .get_row (z)[x]));
+                        max_error = max (max_error, abs (scalar.get_row (z)[x] - parallel.get_row (z)[x]));
+                    }
+                }
+
+                float million = float(samples) * float(samples) / 1e6f;
+
+                cout << "    " << (settings.type == Height_Noise::RIDGED ? "ridged+warp" : "fbm        ") << ": scalar "
+                     << fixed << setprecision (1) << setw (6) << million / (scalar_time * .001f) << " Msamples/s, simd "
+                     << setw (6) << million / (single_time * .001f) << " Msamples/s (x" << setprecision (2) << scalar_time / single_time
+                     << "), simd " << thread_count << " threads " << setprecision (1) << setw (6) << million / (parallel_time * .001f)
+                     << " Msamples/s (" << setw (5) << million / (parallel_time * .001f) / float(thread_count) << " per thread), error "
+                     << setprecision (6) << max_error << (max_error < 1e-4f ? " OK" : " ERROR") << endl;
+            }
+        }
+
+        /// Horizontes de mapas de ruido de 1025 y 2049 muestras de lado: cálculo en un hilo y repartido
+        /// entre todos, lectura y escritura de la caché en disco, y comparación de los texels guardados
+        /// con los calculados sin SIMD en muestras al azar (la diferencia tiene que ser la de cuantizar):
+        void benchmark_horizon_bake ()
+        {
+            const unsigned thread_count = Job_System::get_instance ().get_thread_count ();
+            const unsigned check_count  = 20000;
+            const char   * cache_path   = "benchmark.horizons";
+
+            cout << "horizon_bake (" << Horizon_Map::DIRECTIONS << " directions, " << thread_count << " threads)" << endl;
+
+            Height_Noise::Settings ridges;
+
+            ridges.type      = Height_Noise::RIDGED;
+            ridges.frequency = 1.f / 300.f;
+
+            for (unsigned samples : { 1025u, 2049u })
+            {
+                auto        height_map = Height_Noise(ridges).generate (samples, samples);
+                glm::vec3   size(200.f, 20.f, 200.f);
+                Horizon_Map horizons(*height_map, size);
+
+                auto start = Clock::now ();
+
+                horizons.bake (*height_map, false);
+
+                float single_time = milliseconds_since (start);
+
+                start = Clock::now ();
+
+                horizons.bake (*height_map);
+
+                float parallel_time = milliseconds_since (start);
+
+                start = Clock::now ();
+
+                bool saved = horizons.save (cache_path, *height_map);
+
+                float save_time = milliseconds_since (start);
+
+                start = Clock::now ();
+
+                Horizon_Map cached(*height_map, size);
+
+                bool loaded = cached.load (cache_path, *height_map);
+
+                float load_time = milliseconds_since (start);
+
+                // Con un mapa distinto la caché no tiene que servir:
+
+                height_map->set (samples / 2, samples / 2, height_map->get (samples / 2, samples / 2) + .01f);
+
+                bool rejected = !cached.load (cache_path, *height_map);
+
+                height_map->set (samples / 2, samples / 2, height_map->get (samples / 2, samples / 2) - .01f);
+
+                remove (cache_path);
+
+                mt19937 random(99);
+
+                uniform_int_distribution< unsigned > coordinate(0, samples - 1);
+                uniform_int_distribution< unsigned > direction (0, Horizon_Map::DIRECTIONS - 1);
+
+                float max_error = 0.f, occluded = 0.f;
+
+                for (unsigned i = 0; i < check_count; ++i)
+                {
+                    unsigned x = coordinate (random), z = coordinate (random), d = direction (random);
+
+                    max_error = max (max_error, abs (cached.get (x, z, d) - horizons.trace (*height_map, x, z, d)));
+                    occluded += cached.get (x, z, d);
+                }
+
+                bool ok = saved && loaded && rejected && max_error <= .5f / 255.f + 1e-4f;
+
+                cout << "    " << setw (4) << samples - 1 << "^2: bake " << fixed << setprecision (1) << setw (7) << single_time
+                     << " ms in 1 thread, " << setw (7) << parallel_time << " ms in " << thread_count << " (x" << setprecision (2)
+                     << single_time / parallel_time << "), " << setprecision (1) << float(samples) * samples * Horizon_Map::DIRECTIONS / (1024.f * 1024.f)
+                     << " MB, cache save " << save_time << " ms load " << load_time << " ms, mean horizon " << setprecision (3)
+                     << occluded / float(check_count) << ", error " << setprecision (5) << max_error << (ok ? " OK" : " ERROR") << endl;
+            }
+        }
+
+        /// Mapas de alturas de 16 bits (ruido) guardados por tiles comprimidos: tamaño frente a las
+        /// alturas sin comprimir, tiempo de escritura y de apertura, descompresión del mapa entero y de
+        /// los chunks que pide el streaming, y comprobación de que no se pierde nada:
+        void benchmark_height_archive ()
+        {
+            const char   * archive_path = "benchmark.heights";
+            const unsigned chunk_count  = 1000;
+            const unsigned chunk_side   = 67;                   // Muestras de un chunk con su borde
+
+            cout << "height_archive (" << Height_Archive::TILE_SIZE << "^2 tiles, " << Job_System::get_instance ().get_thread_count () << " threads)" << endl;
+
+            Height_Noise::Settings hills;
+
+            hills.frequency = 1.f / 500.f;
+            hills.octaves   = 8;
+
+            for (unsigned samples : { 2049u, 4097u })
+            {
+                auto height_map = Height_Noise(hills).generate (samples, samples);
+
+                // Se cuantiza a 16 bits para comparar con lo que se descomprime:
+
+                for (unsigned z = 0; z < samples; ++z)
+                {
+                    float * row = height_map->get_row (z);
+
+                    for (unsigned x = 0; x < samples; ++x) row[x] = float(unsigned(row[x] * 65535.f + .5f)) / 65535.f;
+                }
+
+                auto start = Clock::now ();
+
+                bool written = Height_Archive::write (archive_path, *height_map, 16);
+
+                float write_time = milliseconds_since (start);
+
+                start = Clock::now ();
+
+                auto archive = Height_Archive::open (archive_path);
+
+                float open_time = milliseconds_since (start);
+
+                if (!written || !archive)
+                {
+                    cout << "    " << samples - 1 << "^2: ERROR (no se ha podido escribir o abrir " << archive_path << ")" << endl;
+                    remove (archive_path);
+                    continue;
+                }
+
+                start = Clock::now ();
+
+                auto decoded = archive->decode ();
+
+                float decode_time = milliseconds_since (start);
+
+                float max_error = 0.f;
+
+                for (unsigned z = 0; z < samples; ++z)
+                {
+                    for (unsigned x = 0; x < samples; ++x)
+                    {
+                        max_error = max (max_error, abs (decoded->get (x, z) - height_map->get (x, z)));
+                    }
+                }
+
+                // Chunks al azar pedidos como los pide el streaming (una muestra por unidad):
+
+                shared_ptr< const Height_Archive > shared_archive = move (archive);
+
+                Terrain_Streamer::Height_Source source = Terrain_Streamer::archived (shared_archive, 1.f);
+
+                mt19937 random(5);
+
+                uniform_int_distribution< unsigned > corner(0, samples - chunk_side);
+
+                Height_Map chunk(chunk_side, chunk_side);
+
+                start = Clock::now ();
+
+                for (unsigned i = 0; i < chunk_count; ++i)
+                {
+                    unsigned x = corner (random), z = corner (random);
+
+                    source (float(x), float(z), 1.f, chunk);
+
+                    for (unsigned j = 0; j < chunk_side; ++j) max_error = max (max_error, abs (chunk.get (j, j) - height_map->get (x + j, z + j)));
+                }
+
+                float chunk_time = milliseconds_since (start);
+
+                float raw_megabytes = float(samples) * samples * 2.f / (1024.f * 1024.f);
+
+                cout << "    " << setw (4) << samples - 1 << "^2: " << fixed << setprecision (2) << float(shared_archive->get_size ()) / (1024.f * 1024.f)
+                     << " MB vs " << raw_megabytes << " MB raw (" << setprecision (2) << float(shared_archive->get_size ()) * 8.f / (float(samples) * samples)
+                     << " bits/sample), write " << setprecision (1) << write_time << " ms, open " << setprecision (3) << open_time
+                     << " ms, decode " << setprecision (1) << decode_time << " ms (" << raw_megabytes / (decode_time * .001f)
+                     << " MB/s), chunk " << setprecision (1) << chunk_time * 1000.f / float(chunk_count) << " us, error "
+                     << max_error << (max_error < .5f / 65535.f ? " OK" : " ERROR") << endl;
+
+                shared_archive.reset ();
+                source = nullptr;
+
+                remove (archive_path);
+            }
+        }
+
+        /// Horizonte de un terreno de ruido con colinas visto desde cámaras al azar a la altura de una
+        /// persona: tiempo de construcción y de prueba, cajas descartadas, y comprobación de que todas las
+        /// descartadas están de verdad tapadas (los rayos a sus esquinas y a su centro chocan antes con
+        /// el terreno):
+        void benchmark_horizon_culling ()
+        {
+            const unsigned camera_count = 100;
+            const unsigned box_count    = 2000;
+
+            cout << "horizon_culling (" << Horizon_Culler::COLUMNS << " columns, " << camera_count << " cameras, " << box_count << " boxes)" << endl;
+
+            Height_Noise::Settings hills;
+
+            hills.frequency = 1.f / 250.f;
+
+            for (unsigned samples : { 1025u, 4097u })
+            {
+                auto           height_map = Height_Noise(hills).generate (samples, samples);
+                Height_Pyramid pyramid(*height_map);
+                glm::vec3      size(2000.f, 120.f, 2000.f);
+                Height_Field   field(*height_map, pyramid, size);
+                Horizon_Culler culler(pyramid, size);
+
+                mt19937 random(2024);
+
+                uniform_real_distribution< float > coordinate(-size.x * .45f, size.x * .45f);
+                uniform_real_distribution< float > extent    (.5f, 4.f);
+
+                float  build_time = 0.f, test_time = 0.f;
+                size_t visited    = 0,   occluders = 0, tested = 0, occluded = 0, wrong = 0;
+
+                for (unsigned i = 0; i < camera_count; ++i)
+                {
+                    float     camera_x = coordinate (random), camera_z = coordinate (random);
+                    glm::vec3 camera(camera_x, field.height_at (camera_x, camera_z) + 1.7f, camera_z);
+
+                    culler.build (camera);
+                    culler.reset_test_statistics ();
+
+                    build_time += culler.get_statistics ().build_milliseconds;
+                    visited    += culler.get_statistics ().visited_count;
+                    occluders  += culler.get_statistics ().occluder_count;
+
+                    for (unsigned j = 0; j < box_count; ++j)
+                    {
+                        float     x = coordinate (random), z = coordinate (random);
+                        glm::vec3 half(extent (random), extent (random), extent (random));
+                        glm::vec3 center(x, field.height_at (x, z) + half.y, z);
+
+                        if (!culler.is_occluded (center, half)) continue;
+
+                        // Ningún rayo de la cámara a un punto de la caja puede llegar sin chocar antes:
+
+                        for (unsigned corner = 0; corner < 9; ++corner)
+                        {
+                            glm::vec3 point = corner == 8 ? center : center + half * glm::vec3
+                            (
+                                corner & 1 ? 1.f : -1.f, corner & 2 ? 1.f : -1.f, corner & 4 ? 1.f : -1.f
+                            );
+
+                            glm::vec3 ray      = point - camera;
+                            float     length   = glm::length (ray);
+                            float     distance;
+
+                            if (!field.intersect_ray (camera, ray / length, length * .999f, distance))
+                            {
+                                wrong++;
+                                break;
+                            }
+                        }
+                    }
+
+                    test_time += culler.get_statistics ().test_milliseconds;
+                    tested    += culler.get_statistics ().tested_count;
+                    occluded  += culler.get_statistics ().occluded_count;
+                }
+
+                cout << "    " << setw (4) << samples - 1 << "^2: build " << fixed << setprecision (3) << build_time / float(camera_count)
+                     << " ms (" << visited / camera_count << " nodes, " << occluders / camera_count << " occluders), test "
+                     << setprecision (1) << test_time * 1e6f / float(tested) << " ns/box, " << float(occluded) * 100.f / float(tested)
+                     << "% culled, " << wrong << " visible boxes culled" << (wrong == 0 ? " OK" : " ERROR") << endl;
+            }
+        }
+
+        /// Reloj de pasos fijos con secuencias de frames sintéticas de 10 segundos (con vsync a 60, 144
+        /// y 30 Hz, sin vsync con tiempos irregulares y con un frame de 2 segundos): pasos simulados,
+        /// que tienen que ser los mismos en todos los casos salvo por el tiempo descartado, máximo de
+        /// pasos en un frame, fracción de paso para interpolar y coste de tick() + step():
+        void benchmark_frame_clock ()
+        {
+            const double step_seconds = 1. / 60.;
+            const double duration     = 10.;
+            const double frequency    = 1. / Frame_Clock::to_seconds (1);
+
+            cout << "frame_clock (" << setprecision (2) << fixed << step_seconds * 1000. << " ms steps, " << duration << " s)" << endl;
+
+            struct Sequence
+            {
+                const char * name;
+                double       min_milliseconds;
+                double       max_milliseconds;
+                double       hitch_milliseconds;        // Un frame de esta duración a mitad de la secuencia
+            };
+
+            const Sequence sequences[] =
+            {
+                { "vsync 60 Hz ",  1000. /  60., 1000. /  60.,    0. },
+                { "vsync 144 Hz",  1000. / 144., 1000. / 144.,    0. },
+                { "vsync 30 Hz ",  1000. /  30., 1000. /  30.,    0. },
+                { "no vsync    ",  1.,           30.,             0. },
+                { "hitch 2 s   ",  1000. /  60., 1000. /  60., 2000. },
+            };
+
+            for (auto & sequence : sequences)
+            {
+                Frame_Clock clock(step_seconds);
+
+                mt19937 random(77);
+
+                uniform_real_distribution< double > frame_time(sequence.min_milliseconds, sequence.max_milliseconds);
+
+                uint64_t counter   = 1000;
+                double   elapsed   = 0.;
+                unsigned max_steps = 0;
+                float    min_alpha = 1.f, max_alpha = 0.f;
+                bool     hitched   = sequence.hitch_milliseconds == 0.;
+                size_t   frames    = 0;
+
+                clock.tick (counter);
+
+                auto start = Clock::now ();
+
+                while (elapsed < duration)
+                {
+                    double milliseconds = frame_time (random);
+
+                    if (!hitched && elapsed >= duration * .5)
+                    {
+                        milliseconds = sequence.hitch_milliseconds;
+                        hitched      = true;
+                    }
+
+                    elapsed += milliseconds * .001;
+                    counter  = 1000 + uint64_t(elapsed * frequency);
+
+                    clock.tick (counter);
+
+                    unsigned steps = 0;
+
+                    while (clock.step ()) ++steps;
+
+                    max_steps = max (max_steps, steps);
+                    min_alpha = min (min_alpha, clock.get_alpha ());
+                    max_alpha = max (max_alpha, clock.get_alpha ());
+                    frames++;
+                }
+
+                float tick_time = milliseconds_since (start) * 1e6f / float(frames);
+
+                // Los pasos tienen que cubrir el tiempo real menos el descartado, con menos de un paso de
+                // diferencia, y el último paso tiene que representar ese mismo tiempo:
+                double step      = Frame_Clock::to_seconds (uint64_t(step_seconds * frequency + .5));  // Redondeado a ticks
+                double simulated = double(clock.get_step_count ()) * step + clock.get_dropped_seconds ();
+                double lag       = Frame_Clock::to_seconds (counter - clock.get_simulated_counter ());
+                bool   ok        = elapsed - simulated > -1e-6 && elapsed - simulated < step + 1e-6
+                                && abs (lag - clock.get_alpha () * step) < 1e-6 && max_alpha < 1.f;
+
+                cout << "    " << sequence.name << ": " << setw (5) << frames << " frames, " << setw (4) << clock.get_step_count ()
+                     << " steps, " << setprecision (3) << clock.get_dropped_seconds () << " s dropped, max " << max_steps
+                     << " steps/frame, alpha [" << setprecision (2) << min_alpha << ", " << max_alpha << "], p50 "
+                     << clock.get_frame_percentile (.5f) << " ms, p99 " << clock.get_frame_percentile (.99f) << " ms, "
+                     << setprecision (1) << tick_time << " ns/frame" << (ok ? " OK" : " ERROR") << endl;
+            }
+        }
+
+        struct Benchmark
+        {
+            const char * name;
+            void      (* run)();
+        };
+
+        const Benchmark benchmarks[] =
+        {
+            { "light_clusters",     benchmark_light_clusters     },
+            { "frustum_culling",    benchmark_frustum_culling    },
+            { "occlusion_culling",  benchmark_occlusion_culling  },
+            { "aabb_tree",          benchmark_aabb_tree          },
+            { "scene_graph",        benchmark_scene_graph        },
+            { "job_system",         benchmark_job_system         },
+            { "frame_pipeline",     benchmark_frame_pipeline     },
+            { "command_lists",      benchmark_command_lists      },
+            { "frame_arena",        benchmark_frame_arena        },
+            { "frame_allocations",  benchmark_frame_allocations  },
+            { "buddy_allocator",    benchmark_buddy_allocator    },
+            { "terrain_generation", benchmark_terrain_generation },
+            { "terrain_lod",        benchmark_terrain_lod        },
+            { "height_queries",     benchmark_height_queries     },
+            { "height_noise",       benchmark_height_noise       },
+            { "horizon_bake",       benchmark_horizon_bake       },
+            { "height_archive",     benchmark_height_archive     },
+            { "horizon_culling",    benchmark_horizon_culling    },
+            { "frame_clock",        benchmark_frame_clock        },
+        };
+
+    }
+
+    int run_benchmarks (const string & filter)
+    {
+        bool found = false;
+
+        for (auto & benchmark : benchmarks)
+        {
+            if (filter.empty () || string(benchmark.name).find (filter) != string::npos)
+            {
+                benchmark.run ();
+                found = true;
+            }
+        }
+
+        if (!found)
+        {
+            cerr << "No benchmark matches \"" << filter << "\"" << endl;
+            return 1;
+        }
+
+        return 0;
+    }
+
+}
@@ -0,0 +1,19 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <string>
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Ejecuta las pruebas de rendimiento de la CPU sin abrir ninguna ventana (se lanzan con
+    ///     --benchmark [nombre]). Si se indica un nombre solo se ejecutan las que lo contienen.
+    ///     Retorna el código de salida del programa.
+    /// </summary>
+    int run_benchmarks (const std::string & filter);
+
+}
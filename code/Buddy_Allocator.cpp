@@ -0,0 +1,189 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Buddy_Allocator.hpp"
+
+#include <cassert>
+
+using namespace std;
+
+namespace udit
+{
+
+    namespace
+    {
+
+        unsigned ceil_log2 (uint32_t value)
+        {
+            unsigned order = 0;
+
+            while ((1u << order) < value) ++order;
+
+            return order;
+        }
+
+    }
+
+    Buddy_Allocator::Buddy_Allocator(uint32_t capacity, uint32_t min_block_size)
+    :
+        min_order (ceil_log2 (min_block_size)),
+        max_order (ceil_log2 (capacity)),
+        statistics{}
+    {
+        assert(capacity > 0 && max_order < 31);
+
+        if (max_order < min_order) max_order = min_order;
+
+        blocks    .assign (size_t(1) << (max_order - min_order), { NONE, NONE, 0, NOT_BLOCK, false });
+        free_lists.assign (max_order + 1, int32_t(NONE));
+
+        push (0, max_order);
+
+        statistics.capacity = 1u << max_order;
+    }
+
+    void Buddy_Allocator::push (uint32_t offset, unsigned order)
+    {
+        Block & block = blocks[index (offset)];
+
+        block.order    = uint8_t(order);
+        block.free     = true;
+        block.previous = NONE;
+        block.next     = free_lists[order];
+
+        if (block.next != NONE) blocks[block.next].previous = index (offset);
+
+        free_lists[order] = index (offset);
+    }
+
+    void Buddy_Allocator::remove (uint32_t offset, unsigned order)
+    {
+        Block & block = blocks[index (offset)];
+
+        if (block.previous != NONE) blocks[block.previous].next = block.next;
+        else                        free_lists[order]           = block.next;
+
+        if (block.next != NONE) blocks[block.next].previous = block.previous;
+
+        block.free = false;
+    }
+
+    uint32_t Buddy_Allocator::allocate (uint32_t size)
+    {
+        if (size == 0) size = 1;
+
+        unsigned order = ceil_log2 (size);
+
+        if (order < min_order) order = min_order;
+        if (order > max_order) return INVALID;
+
+        // Se busca el bloque libre más pequeño que baste:
+
+        unsigned found = order;
+
+        while (found <= max_order && free_lists[found] == NONE) ++found;
+
+        if (found > max_order) return INVALID;
+
+        uint32_t offset = uint32_t(free_lists[found]) << min_order;
+
+        remove (offset, found);
+
+        // Se parte hasta ajustarlo, dejando libre la mitad superior de cada división:
+
+        while (found > order)
+        {
+            --found;
+
+            push (offset + (1u << found), found);
+        }
+
+        Block & block = blocks[index (offset)];
+
+        block.order     = uint8_t(order);
+        block.free      = false;
+        block.requested = size;
+
+        statistics.allocated += 1u << order;
+        statistics.requested += size;
+        statistics.allocation_count++;
+
+        return offset;
+    }
+
+    void Buddy_Allocator::free (uint32_t offset)
+    {
+        Block & block = blocks[index (offset)];
+
+        assert(block.order != NOT_BLOCK && !block.free);
+
+        statistics.allocated -= 1u << block.order;
+        statistics.requested -= block.requested;
+        statistics.allocation_count--;
+
+        merge (offset, block.order);
+    }
+
+    void Buddy_Allocator::merge (uint32_t offset, unsigned order)
+    {
+        // Se une con su compañero mientras esté libre y tenga el mismo tamaño:
+
+        blocks[index (offset)].order = NOT_BLOCK;
+
+        while (order < max_order)
+        {
+            uint32_t buddy = offset ^ (1u << order);
+            Block  & other = blocks[index (buddy)];
+
+            if (!other.free || other.order != order) break;
+
+            remove (buddy, order);
+
+            other.order = NOT_BLOCK;
+
+            offset &= ~(1u << order);
+            order++;
+        }
+
+        push (offset, order);
+    }
+
+    void Buddy_Allocator::grow ()
+    {
+        assert(max_order < 30);
+
+        uint32_t old_capacity = 1u << max_order;
+
+        blocks.resize (blocks.size () * 2, { NONE, NONE, 0, NOT_BLOCK, false });
+
+        free_lists.push_back (int32_t(NONE));
+
+        ++max_order;
+
+        // La mitad nueva es un bloque libre que se une con la antigua si esta estaba vacía:
+
+        merge (old_capacity, max_order - 1);
+
+        statistics.capacity = 1u << max_order;
+    }
+
+    Buddy_Allocator::Statistics Buddy_Allocator::get_statistics () const
+    {
+        Statistics result = statistics;
+
+        result.largest_free = 0;
+
+        for (unsigned order = max_order + 1; order-- > min_order; )
+        {
+            if (free_lists[order] != NONE)
+            {
+                result.largest_free = 1u << order;
+                break;
+            }
+        }
+
+        return result;
+    }
+
+}
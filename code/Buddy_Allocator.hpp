@@ -0,0 +1,124 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Reparto de un rango [0, capacidad) en bloques de tamaño potencia de dos (buddy allocator).
+    ///     No gestiona memoria: solo lleva la cuenta de qué posiciones están ocupadas, por lo que sirve
+    ///     igual para bytes que para vértices o índices dentro de un búfer de la GPU.
+    ///
+    ///     Cada bloque libre está en la lista de su orden (log2 de su tamaño). Reservar toma un bloque
+    ///     del menor orden que basta y lo parte por la mitad hasta ajustarlo; liberar lo vuelve a unir
+    ///     con su compañero (el bloque cuya posición solo difiere en el bit de su tamaño) mientras este
+    ///     también esté libre. Las listas son doblemente enlazadas sobre arrays indexados por bloque
+    ///     mínimo para que sacar al compañero de su lista sea O(1).
+    /// </summary>
+    class Buddy_Allocator
+    {
+    public:
+
+        static const uint32_t INVALID = ~0u;
+
+        struct Statistics
+        {
+            uint32_t capacity;
+            uint32_t allocated;                     // Suma de los bloques reservados (tamaños redondeados)
+            uint32_t requested;                     // Suma de lo que se pidió
+            uint32_t largest_free;                  // Bloque libre más grande
+            uint32_t allocation_count;
+
+            /// Parte de la capacidad ocupada por lo que se pidió:
+            float utilisation () const
+            {
+                return capacity ? float(requested) / float(capacity) : 0.f;
+            }
+
+            /// Cuánto más pequeño es el mayor bloque libre que el mayor que podría haber con el espacio
+            /// libre que queda (la mayor potencia de dos que cabe en él). 0 si está todo junto:
+            float fragmentation () const
+            {
+                uint32_t free = capacity - allocated;
+
+                if (free == 0) return 0.f;
+
+                uint32_t best = 1;
+
+                while (best <= free / 2) best *= 2;
+
+                return 1.f - float(largest_free) / float(best);
+            }
+        };
+
+    private:
+
+        static const int32_t  NONE      = -1;
+        static const uint8_t  NOT_BLOCK = 0xFF;     // La posición es parte de un bloque que empieza antes
+
+        struct Block
+        {
+            int32_t  next;                          // Siguiente y anterior en la lista libre de su orden
+            int32_t  previous;
+            uint32_t requested;                     // Lo que se pidió (solo en bloques reservados)
+            uint8_t  order;                         // Orden del bloque que empieza aquí o NOT_BLOCK
+            bool     free;
+        };
+
+        unsigned              min_order;            // Tamaño mínimo de bloque: 1 << min_order
+        unsigned              max_order;            // Tamaño total: 1 << max_order
+
+        std::vector< Block   > blocks;              // Uno por bloque mínimo
+        std::vector< int32_t > free_lists;          // Primer bloque libre de cada orden
+
+        Statistics statistics;
+
+    public:
+
+        /// La capacidad y el bloque mínimo se redondean a potencias de dos:
+        Buddy_Allocator(uint32_t capacity, uint32_t min_block_size = 1);
+
+    public:
+
+        /// Retorna la posición del bloque o INVALID si no hay ninguno libre que baste:
+        uint32_t allocate (uint32_t size);
+
+        void     free     (uint32_t offset);
+
+        /// Dobla la capacidad. Las reservas existentes conservan su posición:
+        void     grow     ();
+
+        /// Tamaño del bloque reservado en offset:
+        uint32_t get_block_size (uint32_t offset) const
+        {
+            return 1u << blocks[offset >> min_order].order;
+        }
+
+        uint32_t get_capacity () const
+        {
+            return 1u << max_order;
+        }
+
+        /// Las estadísticas se actualizan al reservar y liberar (salvo largest_free, que se calcula aquí):
+        Statistics get_statistics () const;
+
+    private:
+
+        void push   (uint32_t offset, unsigned order);
+        void remove (uint32_t offset, unsigned order);
+        void merge  (uint32_t offset, unsigned order);
+
+        int32_t index (uint32_t offset) const
+        {
+            return int32_t(offset >> min_order);
+        }
+
+    };
+
+}
@@ -52,4 +52,14 @@ glm::mat4 Camera::get_view_matrix() const
 glm::vec3 Camera::get_position() const
 {
     return position;
+}
+
+glm::vec3 Camera::get_front() const
+{
+    return front;
+}
+
+void Camera::set_position(const glm::vec3 & new_position)
+{
+    position = new_position;
 }
\ No newline at end of file
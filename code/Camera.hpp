@@ -13,6 +13,9 @@ public:
 
     glm::mat4 get_view_matrix () const;
     glm::vec3 get_position    () const;
+    glm::vec3 get_front       () const;
+
+    void      set_position    (const glm::vec3 & new_position);
 
 private:
     glm::vec3 position;
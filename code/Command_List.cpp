@@ -0,0 +1,201 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Command_List.hpp"
+#include "Job_System.hpp"
+
+#include <cassert>
+#include <gtc/type_ptr.hpp>
+
+using namespace std;
+
+namespace udit
+{
+
+    Command_List::Command_List()
+    :
+        current_material    (NO_STATE),
+        current_vertex_array(NO_STATE)
+    {
+    }
+
+    void Command_List::clear ()
+    {
+        // Se conserva la memoria reservada para que grabar la lista en el siguiente frame no reserve:
+
+        commands.clear ();
+        uniforms.clear ();
+
+        current_material     = NO_STATE;
+        current_vertex_array = NO_STATE;
+    }
+
+    void Command_List::bind_material (uint32_t material)
+    {
+        if (material == current_material) return;
+
+        commands.push_back ({ BIND_MATERIAL, { material, 0, 0, 0 } });
+
+        current_material = material;
+    }
+
+    void Command_List::bind_vertex_array (GLuint vertex_array_id)
+    {
+        if (vertex_array_id == current_vertex_array) return;
+
+        commands.push_back ({ BIND_VERTEX_ARRAY, { vertex_array_id, 0, 0, 0 } });
+
+        current_vertex_array = vertex_array_id;
+    }
+
+    void Command_List::set_object_uniforms (const glm::mat4 & model_view_matrix)
+    {
+        commands.push_back ({ SET_OBJECT_UNIFORMS, { uint32_t(uniforms.size ()), 0, 0, 0 } });
+
+        uniforms.push_back ({ model_view_matrix, glm::transpose (glm::inverse (model_view_matrix)) });
+    }
+
+    void Command_List::draw_elements (GLenum primitive, GLsizei index_count, GLenum index_type, GLsizei first_index, GLint base_vertex)
+    {
+        // Los valores de las primitivas y de los tipos de índices caben en 16 bits:
+
+        assert(primitive < 0x10000 && index_type < 0x10000);
+
+        commands.push_back
+        ({
+            DRAW_ELEMENTS,
+            { uint32_t(primitive) | uint32_t(index_type) << 16, uint32_t(index_count), uint32_t(first_index), uint32_t(base_vertex) }
+        });
+    }
+
+    void Command_List::draw_arrays (GLenum primitive, GLint first_vertex, GLsizei vertex_count)
+    {
+        commands.push_back ({ DRAW_ARRAYS, { uint32_t(primitive), uint32_t(first_vertex), uint32_t(vertex_count), 0 } });
+    }
+
+    void Command_List::begin_conditional_render (GLuint query_id, GLenum mode)
+    {
+        commands.push_back ({ BEGIN_CONDITIONAL_RENDER, { query_id, uint32_t(mode), 0, 0 } });
+    }
+
+    void Command_List::end_conditional_render ()
+    {
+        commands.push_back ({ END_CONDITIONAL_RENDER, { 0, 0, 0, 0 } });
+    }
+
+    void Command_List::replay (const Material_Binder & bind_material) const
+    {
+        // Las posiciones de los uniforms dependen del programa, que lo elige el último material:
+
+        const Shader_Variants::Variant * variant = nullptr;
+
+        for (const Command & command : commands)
+        {
+            const uint32_t * arguments = command.arguments;
+
+            switch (command.opcode)
+            {
+                case BIND_MATERIAL:
+                {
+                    variant = &bind_material (arguments[0]);
+                    break;
+                }
+
+                case BIND_VERTEX_ARRAY:
+                {
+                    glBindVertexArray (arguments[0]);
+                    break;
+                }
+
+                case SET_OBJECT_UNIFORMS:
+                {
+                    assert(variant);
+
+                    const Object_Uniforms & object = uniforms[arguments[0]];
+
+                    glUniformMatrix4fv (variant->model_view_matrix_id, 1, GL_FALSE, glm::value_ptr (object.model_view_matrix));
+                    glUniformMatrix4fv (variant->normal_matrix_id,     1, GL_FALSE, glm::value_ptr (object.normal_matrix    ));
+                    break;
+                }
+
+                case DRAW_ELEMENTS:
+                {
+                    GLenum primitive  = GLenum(arguments[0] & 0xFFFF);
+                    GLenum index_type = GLenum(arguments[0] >> 16);
+                    size_t index_size = index_type == GL_UNSIGNED_BYTE ? 1 : index_type == GL_UNSIGNED_SHORT ? 2 : 4;
+
+                    glDrawElementsBaseVertex
+                    (
+                        primitive,
+                        GLsizei(arguments[1]),
+                        index_type,
+                        reinterpret_cast< const void * >(arguments[2] * index_size),
+                        GLint(arguments[3])
+                    );
+                    break;
+                }
+
+                case DRAW_ARRAYS:
+                {
+                    glDrawArrays (GLenum(arguments[0]), GLint(arguments[1]), GLsizei(arguments[2]));
+                    break;
+                }
+
+                case BEGIN_CONDITIONAL_RENDER:
+                {
+                    glBeginConditionalRender (arguments[0], GLenum(arguments[1]));
+                    break;
+                }
+
+                case END_CONDITIONAL_RENDER:
+                {
+                    glEndConditionalRender ();
+                    break;
+                }
+            }
+        }
+    }
+
+    void Command_List::record_parallel
+    (
+        vector< Command_List > & lists,
+        size_t                   count,
+        size_t                   objects_per_list,
+        Recorder                 record
+    )
+    {
+        assert(objects_per_list > 0);
+
+        size_t list_count = (count + objects_per_list - 1) / objects_per_list;
+
+        if (lists.size () < list_count) lists.resize (list_count);
+
+        // Las listas que sobran de frames con más objetos se vacían para que no se reproduzcan:
+
+        for (size_t i = list_count; i < lists.size (); ++i) lists[i].clear ();
+
+        Job_System::get_instance ().parallel_for
+        (
+            list_count,
+            [&] (size_t first_list, size_t last_list)
+            {
+                for (size_t i = first_list; i < last_list; ++i)
+                {
+                    size_t first = i * objects_per_list;
+                    size_t last  = min (first + objects_per_list, count);
+
+                    lists[i].clear ();
+
+                    record (lists[i], first, last);
+                }
+            }
+        );
+    }
+
+    void Command_List::replay (const vector< Command_List > & lists, const Material_Binder & bind_material)
+    {
+        for (auto & list : lists) list.replay (bind_material);
+    }
+
+}
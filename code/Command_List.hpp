@@ -0,0 +1,125 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glad/glad.h>
+#include <glm.hpp>
+#include <vector>
+#include "Function_Reference.hpp"
+#include "Shader_Variants.hpp"
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Lista de comandos de dibujado grabada en la CPU. Las llamadas a OpenGL solo se pueden hacer
+    ///     desde el hilo del contexto, pero preparar lo que hay que dibujar (elegir el material, calcular
+    ///     las matrices de cada objeto, descartar cambios de estado redundantes) no. Varios hilos graban
+    ///     listas independientes para rangos disjuntos de objetos y el hilo del contexto las reproduce
+    ///     después en orden con un bucle que solo decodifica comandos y llama a OpenGL.
+    ///
+    ///     Cada comando ocupa 20 bytes. Los uniforms de cada objeto van en un array aparte y el comando
+    ///     que los activa guarda su posición en él.
+    /// </summary>
+    class Command_List
+    {
+    public:
+
+        enum Opcode : uint32_t
+        {
+            BIND_MATERIAL,                          // material (índice en la tabla de quien reproduce la lista)
+            BIND_VERTEX_ARRAY,                      // id del VAO
+            SET_OBJECT_UNIFORMS,                    // posición del bloque de uniforms del objeto
+            DRAW_ELEMENTS,                          // primitiva | tipo de los índices << 16, número de índices, primer índice, vértice base
+            DRAW_ARRAYS,                            // primitiva, primer vértice, número de vértices
+            BEGIN_CONDITIONAL_RENDER,               // id de la consulta, modo de espera
+            END_CONDITIONAL_RENDER,
+        };
+
+        struct Command
+        {
+            Opcode   opcode;
+            uint32_t arguments[4];
+        };
+
+        /// Uniforms propios de cada objeto:
+        struct Object_Uniforms
+        {
+            glm::mat4 model_view_matrix;
+            glm::mat4 normal_matrix;
+        };
+
+        /// Retorna la variante activada para un material (la llama el hilo del contexto al reproducir):
+        typedef Function_Reference< const Shader_Variants::Variant & (uint32_t material) > Material_Binder;
+
+        /// Graba en list los objetos [first, last) (la llaman los hilos del sistema de trabajos):
+        typedef Function_Reference< void (Command_List & list, size_t first, size_t last) > Recorder;
+
+    private:
+
+        static const uint32_t NO_STATE = ~0u;
+
+        std::vector< Command         > commands;
+        std::vector< Object_Uniforms > uniforms;
+
+        // Estado que dejan los comandos grabados, para no repetir los cambios que no hacen nada:
+
+        uint32_t current_material;
+        uint32_t current_vertex_array;
+
+    public:
+
+        Command_List();
+
+    public:
+
+        void clear ();
+
+        void bind_material       (uint32_t material);
+        void bind_vertex_array   (GLuint   vertex_array_id);
+
+        /// Calcula la matriz de las normales del objeto y guarda sus uniforms:
+        void set_object_uniforms (const glm::mat4 & model_view_matrix);
+
+        void draw_elements       (GLenum primitive, GLsizei index_count, GLenum index_type, GLsizei first_index = 0, GLint base_vertex = 0);
+        void draw_arrays         (GLenum primitive, GLint first_vertex, GLsizei vertex_count);
+
+        /// Los dibujados entre estos dos comandos solo se hacen si la consulta query_id ha pasado:
+        void begin_conditional_render (GLuint query_id, GLenum mode);
+        void   end_conditional_render ();
+
+        size_t size () const
+        {
+            return commands.size ();
+        }
+
+        const std::vector< Command > & get_commands () const
+        {
+            return commands;
+        }
+
+        /// Ejecuta los comandos (solo desde el hilo del contexto de OpenGL):
+        void replay (const Material_Binder & bind_material) const;
+
+    public:
+
+        /// Reparte [0, count) en rangos de objects_per_list objetos y graba cada rango en su propia
+        /// lista con el sistema de trabajos. Las listas quedan en el orden de los rangos:
+        static void record_parallel
+        (
+            std::vector< Command_List > & lists,
+            size_t                        count,
+            size_t                        objects_per_list,
+            Recorder                      record
+        );
+
+        /// Reproduce las listas en orden:
+        static void replay (const std::vector< Command_List > & lists, const Material_Binder & bind_material);
+
+    };
+
+}
@@ -3,6 +3,7 @@
 // angel.rodriguez@udit.es
 
 #include "Cube.hpp"
+#include <vector>
 
 namespace udit
 {
@@ -63,7 +64,7 @@ namespace udit
          0.f, +1.f,  0.f,
     };
 
-    const GLubyte Cube::indices[] =
+    const uint16_t Cube::indices[] =
     {
         1,  0,  3,              // front
         1,  3,  2,
@@ -79,55 +80,51 @@ namespace udit
         20, 22, 21,
     };
 
-    Cube::Cube()
+    Cube::Cube(Geometry_Pool & geometry_pool)
+    :
+        geometry_pool(geometry_pool)
     {
-        // Se generan ndices para los VBOs del cubo:
-
-        glGenBuffers (VBO_COUNT, vbo_ids);
-        glGenVertexArrays (1, &vao_id);
-
-        // Se activa el VAO del cubo para configurarlo:
-
-        glBindVertexArray (vao_id);
-
-        // Se suben a un VBO los datos de coordenadas y se vinculan al VAO:
-
-        glBindBuffer (GL_ARRAY_BUFFER, vbo_ids[COORDINATES_VBO]);
-        glBufferData (GL_ARRAY_BUFFER, sizeof(coordinates), coordinates, GL_STATIC_DRAW);
-
-        glEnableVertexAttribArray (0);
-        glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-        // Se suben a un VBO los datos de normales y se vinculan al VAO:
-
-        glBindBuffer (GL_ARRAY_BUFFER, vbo_ids[NORMALS_VBO]);
-        glBufferData (GL_ARRAY_BUFFER, sizeof(normals), normals, GL_STATIC_DRAW);
-
-        glEnableVertexAttribArray (1);
-        glVertexAttribPointer (1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-        // Se suben a un IBO los datos de ndices:
-
-        glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, vbo_ids[INDICES_IBO]);
-        glBufferData (GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
-        glBindVertexArray (0);
+        // Las coordenadas y las normales se intercalan en el formato de vrtice del almacn:
+
+        static const Geometry_Pool::Vertex_Format format
+        {
+            {
+                { 0, 3, GL_FLOAT, GL_FALSE, 0 },
+                { 1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat) },
+            },
+            6 * sizeof(GLfloat)
+        };
+
+        const size_t vertex_count = sizeof(coordinates) / sizeof(GLfloat) / 3;
+
+        std::vector< GLfloat > vertices;
+
+        for (size_t i = 0; i < vertex_count; ++i)
+        {
+            vertices.insert (vertices.end (), coordinates + i * 3, coordinates + i * 3 + 3);
+            vertices.insert (vertices.end (), normals     + i * 3, normals     + i * 3 + 3);
+        }
+
+        mesh = geometry_pool.create_mesh
+        (
+            format,
+            vertices.data (), GLsizei(vertex_count),
+            indices, GLsizei(sizeof(indices) / sizeof(indices[0]))
+        );
     }
 
     Cube::~Cube()
     {
-        // Se liberan los VBOs y el VAO usados:
+        // Se libera el espacio que ocupaba el cubo en el almacn:
 
-        glDeleteVertexArrays (1, &vao_id);
-        glDeleteBuffers      (VBO_COUNT, vbo_ids);
+        geometry_pool.destroy_mesh (mesh);
     }
 
     void Cube::render ()
     {
         // Se selecciona el VAO que contiene los datos del objeto y se dibujan sus elementos:
 
-        glBindVertexArray (vao_id);
-        glDrawElements    (GL_TRIANGLES, sizeof(indices), GL_UNSIGNED_BYTE, 0);
+        geometry_pool.draw (mesh, GL_TRIANGLES);
     }
 
 }
@@ -6,6 +6,7 @@
 #define CUBE_HEADER
 
     #include <glad/glad.h>
+    #include "Geometry_Pool.hpp"
 
     namespace udit
     {
@@ -14,32 +15,26 @@
         {
         private:
 
-            // ndices para indexar el array vbo_ids:
-
-            enum
-            {
-                COORDINATES_VBO,
-                NORMALS_VBO,
-                INDICES_IBO,
-                VBO_COUNT
-            };
-
             // Arrays de datos del cubo base:
 
-            static const GLfloat coordinates[];
-            static const GLfloat normals    [];
-            static const GLubyte indices    [];
+            static const GLfloat  coordinates[];
+            static const GLfloat  normals    [];
+            static const uint16_t indices    [];
 
         private:
 
-            GLuint vbo_ids[VBO_COUNT];      // Ids de los VBOs que se usan
-            GLuint vao_id;                  // Id del VAO del cubo
+            Geometry_Pool     & geometry_pool;      // Guarda los vrtices y los ndices del cubo
+            Geometry_Pool::Mesh mesh;
 
         public:
 
-            Cube();
+            Cube(Geometry_Pool & geometry_pool);
            ~Cube();
 
+            Cube(const Cube & ) = delete;
+
+            Cube & operator = (const Cube & ) = delete;
+
             void render ();
 
         };
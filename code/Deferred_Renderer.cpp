@@ -0,0 +1,428 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Deferred_Renderer.hpp"
+
+#include <cassert>
+#include <gtc/type_ptr.hpp>
+
+using namespace std;
+
+namespace udit
+{
+
+    /// Lectura del G-buffer, común a las dos etapas de iluminación
+    static const string gbuffer_shader_code =
+        "uniform sampler2D gbuffer_normal;\n"
+        "uniform sampler2D gbuffer_albedo;\n"
+        "uniform sampler2D gbuffer_depth;\n"
+        "uniform mat4 inverse_projection_matrix;\n"     // Para reconstruir la posición en eye-space
+        "uniform vec2 gbuffer_pixel_size;\n"            // 1 / tamaño del G-buffer
+        ""
+        "struct Surface\n"
+        "{\n"
+        "    vec3  position;\n"
+        "    vec3  normal;\n"
+        "    vec3  albedo;\n"
+        "    float shininess;\n"
+        "};\n"
+        ""
+        /// Inversa de la codificación octaédrica: el octaedro desplegado en [0,1]² se vuelve a plegar
+        "vec3 octahedral_decode (vec2 e)\n"
+        "{\n"
+        "    e = e * 2.0 - 1.0;\n"
+        "    vec3  n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+        "    float t = max(-n.z, 0.0);\n"
+        "    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);\n"
+        "    return normalize(n);\n"
+        "}\n"
+        ""
+        /// Retorna false si en el píxel no se dibujó ningún objeto opaco
+        "bool read_surface (out Surface surface)\n"
+        "{\n"
+        "    ivec2 texel = ivec2(gl_FragCoord.xy);\n"
+        "    float depth = texelFetch(gbuffer_depth, texel, 0).r;\n"
+        "    if (depth == 1.0) return false;\n"
+        "    vec4 position = inverse_projection_matrix * vec4(vec3(gl_FragCoord.xy * gbuffer_pixel_size, depth) * 2.0 - 1.0, 1.0);\n"
+        "    vec4 albedo   = texelFetch(gbuffer_albedo, texel, 0);\n"
+        "    surface.position  = position.xyz / position.w;\n"
+        "    surface.normal    = octahedral_decode(texelFetch(gbuffer_normal, texel, 0).rg);\n"
+        "    surface.albedo    = albedo.rgb;\n"
+        "    surface.shininess = roughness_to_shininess(albedo.a);\n"
+        "    return true;\n"
+        "}\n";
+
+    /// Etapa de resolución: luz ambiental y luces globales de la escena sobre todos los píxeles
+    const string Deferred_Renderer::resolve_vertex_shader_code =
+        "#version 330\n"
+        ""
+        "layout (location = 0) in vec2 corner;\n"      // Esquina del quad en clip-space (-1 a +1)
+        ""
+        "void main()\n"
+        "{\n"
+        "    gl_Position = vec4(corner, 0.0, 1.0);\n"
+        "}";
+
+    const string Deferred_Renderer::resolve_fragment_shader_code =
+        "#version 330\n"
+        + gbuffer_shader_code +
+        ""
+        "uniform vec3 background_color;\n"
+        ""
+        "out vec4 fragment_color;\n"
+        ""
+        "void main()\n"
+        "{\n"
+        "    Surface surface;\n"
+        "    if (!read_surface(surface))\n"
+        "    {\n"
+        "        fragment_color = vec4(background_color, 1.0);\n"
+        "        return;\n"
+        "    }\n"
+        "    fragment_color = vec4(compute_lighting(surface.position, surface.normal, surface.albedo, surface.shininess), 1.0);\n"
+        "}";
+
+    /// Etapa de luces puntuales: un quad instanciado por luz que cubre la proyección de su esfera
+    const string Deferred_Renderer::volume_vertex_shader_code =
+        "#version 330\n"
+        ""
+        "uniform mat4  projection_matrix;\n"
+        "uniform float z_near;\n"
+        ""
+        "layout (location = 0) in vec2 corner;\n"
+        "layout (location = 1) in vec4 light_position;\n"  // Posición en eye-space y radio (por instancia)
+        "layout (location = 2) in vec3 light_color;\n"
+        ""
+        "flat out vec4 position_radius;\n"
+        "flat out vec3 color;\n"
+        ""
+        "void main()\n"
+        "{\n"
+        "    position_radius = light_position;\n"
+        "    color           = light_color;\n"
+        ""
+        "    vec3  center = light_position.xyz;\n"
+        "    float radius = light_position.w;\n"
+        "    float near_z = -center.z - radius;\n"
+        "    float far_z  = -center.z + radius;\n"
+        ""
+        // Si la esfera corta el plano cercano se cubre toda la pantalla
+        "    if (near_z <= z_near)\n"
+        "    {\n"
+        "        gl_Position = vec4(corner, 0.0, 1.0);\n"
+        "        return;\n"
+        "    }\n"
+        ""
+        // Proyección conservadora de la caja de la esfera: cada extremo se divide por la
+        // profundidad que lo aleja más del centro de la pantalla
+        "    vec2 scale = vec2(projection_matrix[0][0], projection_matrix[1][1]);\n"
+        "    vec2 low   = center.xy - radius;\n"
+        "    vec2 high  = center.xy + radius;\n"
+        "    vec2 ndc_low  = scale * low  / vec2(low.x  < 0.0 ? near_z : far_z, low.y  < 0.0 ? near_z : far_z);\n"
+        "    vec2 ndc_high = scale * high / vec2(high.x > 0.0 ? near_z : far_z, high.y > 0.0 ? near_z : far_z);\n"
+        ""
+        "    gl_Position = vec4(mix(ndc_low, ndc_high, corner * 0.5 + 0.5), 0.0, 1.0);\n"
+        "}";
+
+    const string Deferred_Renderer::volume_fragment_shader_code =
+        "#version 330\n"
+        + gbuffer_shader_code +
+        ""
+        "flat in vec4 position_radius;\n"
+        "flat in vec3 color;\n"
+        ""
+        "out vec4 fragment_color;\n"
+        ""
+        "void main()\n"
+        "{\n"
+        "    Surface surface;\n"
+        "    if (!read_surface(surface)) discard;\n"
+        ""
+        "    vec3  L        = position_radius.xyz - surface.position;\n"
+        "    float distance = length(L);\n"
+        "    if (distance >= position_radius.w) discard;\n"
+        ""
+        // Misma atenuación y sombreado que compute_clustered_lighting() en el camino forward
+        "    float attenuation = 1.0 - distance / position_radius.w;\n"
+        "    L /= max(distance, 0.0001);\n"
+        "    vec3  V    = normalize(-surface.position);\n"
+        "    float diff = diffuse_intensity * max(dot(surface.normal, L), 0.0);\n"
+        "    vec3  H    = normalize(L + V);\n"
+        "    float spec = specular_intensity * pow(max(dot(surface.normal, H), 0.0), surface.shininess);\n"
+        "    fragment_color = vec4(attenuation * attenuation * (diff * color * surface.albedo + spec * specular_color), 1.0);\n"
+        "}";
+
+    Deferred_Renderer::Deferred_Renderer(Shader_Compiler & compiler, const string & common_shader_code, GLsizei width, GLsizei height)
+    :
+        width          (width ),
+        height         (height),
+        gbuffer_id     (0),
+        lighting_id    (0),
+        texture_ids    {},
+        vao_id         (0),
+        vbo_ids        {},
+        light_count    (0),
+        resolve_shaders(compiler, common_shader_code, resolve_vertex_shader_code, resolve_fragment_shader_code),
+         volume_shaders(compiler, common_shader_code,  volume_vertex_shader_code,  volume_fragment_shader_code)
+    {
+    }
+
+    Deferred_Renderer::~Deferred_Renderer()
+    {
+        if (gbuffer_id)
+        {
+            glDeleteFramebuffers (1, &gbuffer_id );
+            glDeleteFramebuffers (1, &lighting_id);
+            glDeleteTextures     (TEXTURE_COUNT, texture_ids);
+            glDeleteVertexArrays (1, &vao_id);
+            glDeleteBuffers      (VBO_COUNT, vbo_ids);
+        }
+    }
+
+    void Deferred_Renderer::build (GLuint output_texture_id, unsigned light_count)
+    {
+        this->light_count = light_count;
+
+        // Se crean las texturas del G-buffer. Se leen con texelFetch(), por lo que no necesitan filtrado:
+
+        static const struct { GLint internal_format; GLenum format; GLenum type; } formats[TEXTURE_COUNT] =
+        {
+            { GL_RG16,              GL_RG,              GL_UNSIGNED_SHORT },
+            { GL_RGBA8,             GL_RGBA,            GL_UNSIGNED_BYTE  },
+            { GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT   },
+        };
+
+        glGenTextures (TEXTURE_COUNT, texture_ids);
+
+        for (unsigned i = 0; i < TEXTURE_COUNT; ++i)
+        {
+            glBindTexture   (GL_TEXTURE_2D, texture_ids[i]);
+            glTexImage2D    (GL_TEXTURE_2D, 0, formats[i].internal_format, width, height, 0, formats[i].format, formats[i].type, nullptr);
+            glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+
+        // Framebuffer de la etapa de geometría:
+        {
+            glGenFramebuffers (1, &gbuffer_id);
+            glBindFramebuffer (GL_FRAMEBUFFER, gbuffer_id);
+
+            glFramebufferTexture (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture_ids[NORMAL_TEXTURE], 0);
+            glFramebufferTexture (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, texture_ids[ALBEDO_TEXTURE], 0);
+            glFramebufferTexture (GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,  texture_ids[ DEPTH_TEXTURE], 0);
+
+            const GLenum draw_buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+
+            glDrawBuffers (2, draw_buffers);
+
+            assert(glCheckFramebufferStatus (GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+        }
+
+        // Framebuffer de la etapa de iluminación. Comparte la profundidad con el G-buffer para que
+        // los objetos transparentes se puedan dibujar después con la prueba de profundidad:
+        {
+            glGenFramebuffers (1, &lighting_id);
+            glBindFramebuffer (GL_FRAMEBUFFER, lighting_id);
+
+            glFramebufferTexture (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, output_texture_id, 0);
+            glFramebufferTexture (GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,  texture_ids[DEPTH_TEXTURE], 0);
+
+            const GLenum draw_buffer = GL_COLOR_ATTACHMENT0;
+
+            glDrawBuffers (1, &draw_buffer);
+
+            assert(glCheckFramebufferStatus (GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+        }
+
+        glBindFramebuffer (GL_FRAMEBUFFER, 0);
+
+        // Quad de las dos etapas de iluminación. Los datos de las luces puntuales se leen por instancia:
+
+        static const GLfloat corners[] =
+        {
+            -1.f, -1.f,
+            +1.f, -1.f,
+            -1.f, +1.f,
+            +1.f, +1.f,
+        };
+
+        glGenVertexArrays (1, &vao_id);
+        glGenBuffers      (VBO_COUNT, vbo_ids);
+
+        glBindVertexArray (vao_id);
+
+        glBindBuffer (GL_ARRAY_BUFFER, vbo_ids[CORNERS_VBO]);
+        glBufferData (GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+
+        glEnableVertexAttribArray (0);
+        glVertexAttribPointer     (0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+        // Los atributos por instancia apuntan a una posición distinta del búfer de streaming en cada
+        // frame, por lo que se configuran en render_lighting():
+
+        glEnableVertexAttribArray (1);
+        glVertexAttribDivisor     (1, 1);
+
+        glEnableVertexAttribArray (2);
+        glVertexAttribDivisor     (2, 1);
+
+        glBindVertexArray (0);
+
+        // Los programas se envían a compilar sin esperar por ellos:
+
+        resolve_shaders.acquire (Shader_Variants::make_key (0, light_count));
+         volume_shaders.acquire (Shader_Variants::make_key (0, 0));
+    }
+
+    bool Deferred_Renderer::is_ready ()
+    {
+        // Se consultan los dos para que ambos avancen aunque el primero no esté listo:
+
+        bool resolve_ready = resolve_shaders.get_ready (Shader_Variants::make_key (0, light_count)) != nullptr;
+        bool  volume_ready =  volume_shaders.get_ready (Shader_Variants::make_key (0, 0          )) != nullptr;
+
+        return resolve_ready && volume_ready;
+    }
+
+    Shader_Variants::Variant & Deferred_Renderer::resolve_variant ()
+    {
+        return resolve_shaders.acquire (Shader_Variants::make_key (0, light_count));
+    }
+
+    Shader_Variants::Variant & Deferred_Renderer::volume_variant ()
+    {
+        return volume_shaders.acquire (Shader_Variants::make_key (0, 0));
+    }
+
+    void Deferred_Renderer::begin_geometry_pass ()
+    {
+        glViewport        (0, 0, width, height);
+        glBindFramebuffer (GL_FRAMEBUFFER, gbuffer_id);
+
+        // La normal (0.5, 0.5) y el albedo negro no importan: los píxeles sin geometría se
+        // detectan por su profundidad:
+
+        glClearColor (.5f, .5f, 0.f, 0.f);
+        glClear      (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        glEnable    (GL_DEPTH_TEST);
+        glDepthMask (GL_TRUE);
+        glDisable   (GL_BLEND);
+    }
+
+    void Deferred_Renderer::render_lighting
+    (
+        const glm::mat4                 & projection_matrix,
+        float                             z_near,
+        const Light_Clusters::Light_Set & point_lights,
+        const glm::vec3                 & background_color,
+        Streaming_Buffer                & stream
+    )
+    {
+        glBindFramebuffer (GL_FRAMEBUFFER, lighting_id);
+
+        // Los quads no escriben profundidad y deben sobrevivir a la prueba aunque haya geometría:
+
+        glDisable   (GL_DEPTH_TEST);
+        glDepthMask (GL_FALSE);
+
+        for (unsigned i = 0; i < TEXTURE_COUNT; ++i)
+        {
+            glActiveTexture (GL_TEXTURE0 + first_texture_unit + i);
+            glBindTexture   (GL_TEXTURE_2D, texture_ids[i]);
+        }
+
+        glActiveTexture (GL_TEXTURE0);
+
+        glm::mat4 inverse_projection_matrix = glm::inverse (projection_matrix);
+
+        auto configure_gbuffer = [&] (GLuint program_id)
+        {
+            glUniform1i        (glGetUniformLocation (program_id, "gbuffer_normal"), first_texture_unit + NORMAL_TEXTURE);
+            glUniform1i        (glGetUniformLocation (program_id, "gbuffer_albedo"), first_texture_unit + ALBEDO_TEXTURE);
+            glUniform1i        (glGetUniformLocation (program_id, "gbuffer_depth" ), first_texture_unit +  DEPTH_TEXTURE);
+            glUniform2f        (glGetUniformLocation (program_id, "gbuffer_pixel_size"), 1.f / width, 1.f / height);
+            glUniformMatrix4fv (glGetUniformLocation (program_id, "inverse_projection_matrix"), 1, GL_FALSE, glm::value_ptr (inverse_projection_matrix));
+        };
+
+        glBindVertexArray (vao_id);
+
+        // Primero se escribe cada píxel con la luz ambiental y las luces globales (o con el fondo):
+        {
+            GLuint program_id = resolve_variant ().program_id;
+
+            glUseProgram (program_id);
+
+            configure_gbuffer (program_id);
+
+            glUniform3fv (glGetUniformLocation (program_id, "background_color"), 1, glm::value_ptr (background_color));
+
+            glDisable    (GL_BLEND);
+            glDrawArrays (GL_TRIANGLE_STRIP, 0, 4);
+        }
+
+        // Después cada luz puntual suma su aportación en los píxeles que cubre su quad:
+
+        size_t count = point_lights.size ();
+
+        const GLsizei light_stride = 8 * sizeof(float);             // Posición, radio, color y relleno
+
+        Streaming_Buffer::Allocation allocation{};
+
+        if (count > 0) allocation = stream.allocate (GLsizeiptr(count) * light_stride);
+
+        if (allocation.memory)
+        {
+            // Se escribe directamente en la región del frame del búfer de streaming, que la GPU ya no
+            // está leyendo, sin pasar por una copia intermedia ni pedir un búfer nuevo al driver:
+
+            float * light = static_cast< float * >(allocation.memory);
+
+            for (size_t i = 0; i < count; ++i, light += 8)
+            {
+                light[0] = point_lights.x     [i];
+                light[1] = point_lights.y     [i];
+                light[2] = point_lights.z     [i];
+                light[3] = point_lights.radius[i];
+                light[4] = point_lights.red   [i];
+                light[5] = point_lights.green [i];
+                light[6] = point_lights.blue  [i];
+                light[7] = 0.f;
+            }
+
+            stream.commit (allocation);
+
+            const char * base = reinterpret_cast< const char * >(allocation.offset);
+
+            glBindBuffer          (GL_ARRAY_BUFFER, stream.get_id ());
+            glVertexAttribPointer (1, 4, GL_FLOAT, GL_FALSE, light_stride, base);
+            glVertexAttribPointer (2, 3, GL_FLOAT, GL_FALSE, light_stride, base + 4 * sizeof(float));
+
+            GLuint program_id = volume_variant ().program_id;
+
+            glUseProgram (program_id);
+
+            configure_gbuffer (program_id);
+
+            glUniformMatrix4fv (glGetUniformLocation (program_id, "projection_matrix"), 1, GL_FALSE, glm::value_ptr (projection_matrix));
+            glUniform1f        (glGetUniformLocation (program_id, "z_near"), z_near);
+
+            glEnable    (GL_BLEND);
+            glBlendFunc (GL_ONE, GL_ONE);
+
+            glDrawArraysInstanced (GL_TRIANGLE_STRIP, 0, 4, GLsizei(count));
+
+            glDisable (GL_BLEND);
+        }
+
+        glBindVertexArray (0);
+
+        // Se deja la prueba de profundidad lista para los objetos transparentes:
+
+        glEnable (GL_DEPTH_TEST);
+    }
+
+}
@@ -0,0 +1,125 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <glad/glad.h>
+#include <glm.hpp>
+#include <string>
+#include <vector>
+#include "Light_Clusters.hpp"
+#include "Shader_Compiler.hpp"
+#include "Shader_Variants.hpp"
+#include "Streaming_Buffer.hpp"
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Deferred shading: los objetos opacos solo escriben sus propiedades de superficie en un
+    ///     G-buffer compacto y la iluminación se calcula después una sola vez por píxel visible.
+    ///     Cada luz puntual se dibuja como un quad que cubre en pantalla la proyección de su esfera de
+    ///     influencia y suma su aportación al búfer de color de salida (el del framebuffer de
+    ///     postprocesado de la escena).
+    ///
+    ///     Formato del G-buffer (12 bytes por píxel):
+    ///         - RG16:    normal en eye-space con codificación octaédrica.
+    ///         - RGBA8:   albedo en RGB y rugosidad en A.
+    ///         - DEPTH24: profundidad, a partir de la cual se reconstruye la posición.
+    /// </summary>
+    class Deferred_Renderer
+    {
+    public:
+
+        /// Las texturas del G-buffer se vinculan a unidades consecutivas a partir de esta:
+        static const GLuint first_texture_unit = 1;
+
+    private:
+
+        enum
+        {
+            NORMAL_TEXTURE,
+            ALBEDO_TEXTURE,
+            DEPTH_TEXTURE,
+            TEXTURE_COUNT
+        };
+
+        enum
+        {
+            CORNERS_VBO,
+            VBO_COUNT
+        };
+
+        static const std::string   resolve_vertex_shader_code;
+        static const std::string resolve_fragment_shader_code;
+        static const std::string    volume_vertex_shader_code;
+        static const std::string  volume_fragment_shader_code;
+
+        GLsizei width;
+        GLsizei height;
+
+        GLuint  gbuffer_id;                         // Framebuffer de la etapa de geometría
+        GLuint  lighting_id;                        // Búfer de color de salida + profundidad del G-buffer
+        GLuint  texture_ids[TEXTURE_COUNT];
+
+        GLuint  vao_id;
+        GLuint  vbo_ids[VBO_COUNT];
+
+        unsigned light_count;                       // Número de luces de la etapa de resolución
+
+        Shader_Variants resolve_shaders;            // Luz ambiental y luces globales (quad de pantalla completa)
+        Shader_Variants  volume_shaders;            // Luces puntuales (un quad por luz)
+
+    public:
+
+        Deferred_Renderer(Shader_Compiler & compiler, const std::string & common_shader_code, GLsizei width, GLsizei height);
+       ~Deferred_Renderer();
+
+        Deferred_Renderer(const Deferred_Renderer & ) = delete;
+
+        Deferred_Renderer & operator = (const Deferred_Renderer & ) = delete;
+
+    public:
+
+        /// Crea el G-buffer y envía a compilar los programas. La luz se acumula en output_texture_id:
+        void build (GLuint output_texture_id, unsigned light_count);
+
+        /// Retorna true cuando los programas de las dos etapas de iluminación están listos:
+        bool is_ready ();
+
+        /// Variantes de las etapas de iluminación. Quien las usa debe configurar sus uniforms de
+        /// iluminación (intensidades, color especular y luces) cuando is_configured sea false:
+        Shader_Variants::Variant & resolve_variant ();
+        Shader_Variants::Variant &  volume_variant ();
+
+        void reset_configuration ()
+        {
+            resolve_shaders.reset_configuration ();
+             volume_shaders.reset_configuration ();
+        }
+
+        /// Activa el G-buffer y lo limpia. Los objetos opacos se deben dibujar a continuación con
+        /// variantes que tengan activada la característica DEFERRED_GEOMETRY:
+        void begin_geometry_pass ();
+
+        /// Calcula la iluminación de los píxeles del G-buffer. Al terminar queda activo el búfer de
+        /// salida junto con la profundidad del G-buffer para poder dibujar los objetos transparentes.
+        /// Los datos por instancia de las luces puntuales se escriben en la región del frame de stream:
+        void render_lighting
+        (
+            const glm::mat4                 & projection_matrix,
+            float                             z_near,
+            const Light_Clusters::Light_Set & point_lights,
+            const glm::vec3                 & background_color,
+            Streaming_Buffer                & stream
+        );
+
+        size_t gbuffer_bytes () const
+        {
+            return size_t(width) * size_t(height) * (4 + 4 + 4);
+        }
+
+    };
+
+}
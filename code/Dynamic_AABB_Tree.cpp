@@ -0,0 +1,678 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Dynamic_AABB_Tree.hpp"
+#include "Frustum_Culler.hpp"
+#include "Job_System.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+using namespace std;
+
+namespace udit
+{
+
+    namespace
+    {
+
+        /// Semiárea de la superficie de una caja (proporcional a la probabilidad de que un rayo la corte):
+        inline float area (const glm::vec3 & min, const glm::vec3 & max)
+        {
+            glm::vec3 size = max - min;
+
+            return size.x * size.y + size.y * size.z + size.z * size.x;
+        }
+
+        inline float union_area (const glm::vec3 & min_a, const glm::vec3 & max_a, const glm::vec3 & min_b, const glm::vec3 & max_b)
+        {
+            return area (glm::min (min_a, min_b), glm::max (max_a, max_b));
+        }
+
+        inline bool overlaps (const glm::vec3 & min_a, const glm::vec3 & max_a, const glm::vec3 & min_b, const glm::vec3 & max_b)
+        {
+            return min_a.x <= max_b.x && min_b.x <= max_a.x
+                && min_a.y <= max_b.y && min_b.y <= max_a.y
+                && min_a.z <= max_b.z && min_b.z <= max_a.z;
+        }
+
+        inline bool contains (const glm::vec3 & outer_min, const glm::vec3 & outer_max, const glm::vec3 & min, const glm::vec3 & max)
+        {
+            return outer_min.x <= min.x && outer_min.y <= min.y && outer_min.z <= min.z
+                && max.x <= outer_max.x && max.y <= outer_max.y && max.z <= outer_max.z;
+        }
+
+        /// Intersección de un rayo con una caja (método de las franjas). Retorna la distancia de
+        /// entrada o un valor negativo si no la corta dentro de [0, max_distance]:
+        inline float ray_box
+        (
+            const glm::vec3 & origin, const glm::vec3 & inverse_direction, float max_distance,
+            const glm::vec3 & min,    const glm::vec3 & max
+        )
+        {
+            glm::vec3 t0 = (min - origin) * inverse_direction;
+            glm::vec3 t1 = (max - origin) * inverse_direction;
+
+            glm::vec3 near_t = glm::min (t0, t1);
+            glm::vec3  far_t = glm::max (t0, t1);
+
+            float enter = std::max (std::max (near_t.x, near_t.y), std::max (near_t.z, 0.f));
+            float exit  = std::min (std::min ( far_t.x,  far_t.y), std::min ( far_t.z, max_distance));
+
+            return enter <= exit ? enter : -1.f;
+        }
+
+    }
+
+    Dynamic_AABB_Tree::Dynamic_AABB_Tree(float margin)
+    :
+        root      (NULL_NODE),
+        free_list (NULL_NODE),
+        leaf_count(0),
+        margin    (margin)
+    {
+    }
+
+    int32_t Dynamic_AABB_Tree::allocate_node ()
+    {
+        // Si no quedan nodos libres se duplica la capacidad y se enlazan los nuevos en la lista de libres:
+
+        if (free_list == NULL_NODE)
+        {
+            size_t old_size = nodes.size ();
+            size_t new_size = std::max (old_size * 2, size_t(16));
+
+            nodes  .resize (new_size);
+            parents.resize (new_size);
+            heights.resize (new_size, -1);
+
+            for (size_t i = old_size; i < new_size; ++i)
+            {
+                parents[i] = i + 1 < new_size ? int32_t(i + 1) : NULL_NODE;
+            }
+
+            free_list = int32_t(old_size);
+        }
+
+        int32_t node = free_list;
+
+        free_list       = parents[node];
+        parents[node]   = NULL_NODE;
+        heights[node]   = 0;
+        nodes[node].child1 = NULL_NODE;
+        nodes[node].child2 = NULL_NODE;
+
+        return node;
+    }
+
+    void Dynamic_AABB_Tree::free_node (int32_t node)
+    {
+        parents[node] = free_list;
+        heights[node] = -1;
+        free_list     = node;
+    }
+
+    int32_t Dynamic_AABB_Tree::create_proxy (const glm::vec3 & min, const glm::vec3 & max, uint32_t user_data)
+    {
+        int32_t leaf = allocate_node ();
+
+        nodes[leaf].min    = min - glm::vec3(margin);
+        nodes[leaf].max    = max + glm::vec3(margin);
+        nodes[leaf].child2 = int32_t(user_data);
+
+        insert_leaf (leaf);
+
+        ++leaf_count;
+
+        return leaf;
+    }
+
+    void Dynamic_AABB_Tree::destroy_proxy (int32_t proxy)
+    {
+        assert(is_leaf (proxy));
+
+        remove_leaf (proxy);
+        free_node   (proxy);
+
+        --leaf_count;
+    }
+
+    bool Dynamic_AABB_Tree::move_proxy (int32_t proxy, const glm::vec3 & min, const glm::vec3 & max)
+    {
+        if (contains (nodes[proxy].min, nodes[proxy].max, min, max)) return false;
+
+        remove_leaf (proxy);
+
+        nodes[proxy].min = min - glm::vec3(margin);
+        nodes[proxy].max = max + glm::vec3(margin);
+
+        insert_leaf (proxy);
+
+        return true;
+    }
+
+    void Dynamic_AABB_Tree::set_proxy_bounds (int32_t proxy, const glm::vec3 & min, const glm::vec3 & max)
+    {
+        if (contains (nodes[proxy].min, nodes[proxy].max, min, max)) return;
+
+        nodes[proxy].min = min - glm::vec3(margin);
+        nodes[proxy].max = max + glm::vec3(margin);
+    }
+
+    void Dynamic_AABB_Tree::insert_leaf (int32_t leaf)
+    {
+        if (root == NULL_NODE)
+        {
+            root = leaf;
+            parents[leaf] = NULL_NODE;
+            return;
+        }
+
+        // Búsqueda branch-and-bound del mejor hermano. El coste de colgar la hoja de un nodo es el área
+        // de la unión de ambos más lo que crecen sus antecesores (coste heredado). Se exploran primero
+        // los nodos con menor coste heredado y se podan los subárboles que no pueden mejorar el mejor:
+
+        const glm::vec3 leaf_min  = nodes[leaf].min;
+        const glm::vec3 leaf_max  = nodes[leaf].max;
+        const float     leaf_area = area (leaf_min, leaf_max);
+
+        int32_t best_sibling = root;
+        float   best_cost    = union_area (nodes[root].min, nodes[root].max, leaf_min, leaf_max);
+
+        auto lower_cost_first = [] (const pair< float, int32_t > & a, const pair< float, int32_t > & b) { return a.first > b.first; };
+
+        search_queue.clear ();
+        search_queue.emplace_back (0.f, root);
+
+        while (!search_queue.empty ())
+        {
+            pop_heap (search_queue.begin (), search_queue.end (), lower_cost_first);
+
+            float   inherited_cost = search_queue.back ().first;
+            int32_t node           = search_queue.back ().second;
+
+            search_queue.pop_back ();
+
+            const Node & current = nodes[node];
+
+            float direct_cost = union_area (current.min, current.max, leaf_min, leaf_max);
+            float cost        = direct_cost + inherited_cost;
+
+            if (cost < best_cost)
+            {
+                best_cost    = cost;
+                best_sibling = node;
+            }
+
+            if (current.child1 != NULL_NODE)
+            {
+                float child_inherited_cost = inherited_cost + direct_cost - area (current.min, current.max);
+
+                // Ningún descendiente puede costar menos que el área de la hoja más el coste heredado:
+
+                if (leaf_area + child_inherited_cost < best_cost)
+                {
+                    search_queue.emplace_back (child_inherited_cost, current.child1);
+                    push_heap (search_queue.begin (), search_queue.end (), lower_cost_first);
+                    search_queue.emplace_back (child_inherited_cost, current.child2);
+                    push_heap (search_queue.begin (), search_queue.end (), lower_cost_first);
+                }
+            }
+        }
+
+        // Se crea un padre nuevo para la hoja y su hermano:
+
+        int32_t sibling    = best_sibling;
+        int32_t old_parent = parents[sibling];
+        int32_t new_parent = allocate_node ();
+
+        parents[new_parent]     = old_parent;
+        nodes  [new_parent].min = glm::min (leaf_min, nodes[sibling].min);
+        nodes  [new_parent].max = glm::max (leaf_max, nodes[sibling].max);
+        nodes  [new_parent].child1 = sibling;
+        nodes  [new_parent].child2 = leaf;
+        heights[new_parent]     = heights[sibling] + 1;
+
+        if (old_parent == NULL_NODE)
+        {
+            root = new_parent;
+        }
+        else if (nodes[old_parent].child1 == sibling)
+        {
+            nodes[old_parent].child1 = new_parent;
+        }
+        else
+        {
+            nodes[old_parent].child2 = new_parent;
+        }
+
+        parents[sibling] = new_parent;
+        parents[leaf   ] = new_parent;
+
+        // Se reajustan las cajas de los antecesores y se rotan los que mejoran con ello:
+
+        for (int32_t node = old_parent; node != NULL_NODE; node = parents[node])
+        {
+            refit_node (node);
+            rotate     (node);
+        }
+    }
+
+    void Dynamic_AABB_Tree::remove_leaf (int32_t leaf)
+    {
+        if (leaf == root)
+        {
+            root = NULL_NODE;
+            return;
+        }
+
+        int32_t parent      = parents[leaf];
+        int32_t grandparent = parents[parent];
+        int32_t sibling     = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+
+        // El hermano ocupa el lugar del padre, que se libera:
+
+        if (grandparent == NULL_NODE)
+        {
+            root = sibling;
+            parents[sibling] = NULL_NODE;
+        }
+        else
+        {
+            if (nodes[grandparent].child1 == parent) nodes[grandparent].child1 = sibling;
+            else                                     nodes[grandparent].child2 = sibling;
+
+            parents[sibling] = grandparent;
+        }
+
+        free_node (parent);
+
+        for (int32_t node = grandparent; node != NULL_NODE; node = parents[node])
+        {
+            refit_node (node);
+        }
+    }
+
+    void Dynamic_AABB_Tree::refit_node (int32_t node)
+    {
+        Node & current = nodes[node];
+
+        current.min   = glm::min (nodes[current.child1].min, nodes[current.child2].min);
+        current.max   = glm::max (nodes[current.child1].max, nodes[current.child2].max);
+        heights[node] = 1 + std::max (heights[current.child1], heights[current.child2]);
+    }
+
+    void Dynamic_AABB_Tree::rotate (int32_t a)
+    {
+        // Se prueba a intercambiar cada hijo de A con cada nieto del otro lado y se aplica el cambio
+        // que más reduce el área del hijo que cambia (el área de A no cambia, contiene las mismas hojas):
+        //
+        //      A                   A
+        //      +-- B               +-- F
+        //      +-- C       =>      +-- C
+        //          +-- F               +-- B
+        //          +-- G               +-- G
+
+        if (heights[a] < 2) return;
+
+        int32_t b = nodes[a].child1;
+        int32_t c = nodes[a].child2;
+
+        float   best_gain   = 0.f;
+        int32_t best_child  = NULL_NODE;             // Hijo de A que baja
+        int32_t best_grand  = NULL_NODE;             // Nieto de A que sube
+
+        auto consider = [&] (int32_t down, int32_t other)
+        {
+            // other es el hermano de down y tiene que ser interno para tener nietos:
+
+            if (is_leaf (other)) return;
+
+            float current_area = area (nodes[other].min, nodes[other].max);
+
+            int32_t grand[2] = { nodes[other].child1, nodes[other].child2 };
+
+            for (int i = 0; i < 2; ++i)
+            {
+                // Si sube grand[i], other pasa a contener down y el otro nieto:
+
+                int32_t stays = grand[1 - i];
+                float   gain  = current_area - union_area (nodes[down].min, nodes[down].max, nodes[stays].min, nodes[stays].max);
+
+                if (gain > best_gain)
+                {
+                    best_gain  = gain;
+                    best_child = down;
+                    best_grand = grand[i];
+                }
+            }
+        };
+
+        consider (b, c);
+        consider (c, b);
+
+        if (best_child == NULL_NODE) return;
+
+        int32_t other = best_child == b ? c : b;
+
+        // El nieto ocupa el lugar del hijo en A y el hijo el del nieto en other:
+
+        if (nodes[a].child1 == best_child) nodes[a].child1 = best_grand; else nodes[a].child2 = best_grand;
+
+        if (nodes[other].child1 == best_grand) nodes[other].child1 = best_child; else nodes[other].child2 = best_child;
+
+        parents[best_grand] = a;
+        parents[best_child] = other;
+
+        refit_node (other);
+        refit_node (a);
+    }
+
+    void Dynamic_AABB_Tree::refit ()
+    {
+        if (root == NULL_NODE || is_leaf (root)) return;
+
+        // Se baja por el árbol en anchura hasta tener bastantes subárboles para repartirlos entre los
+        // hilos. Los nodos expandidos se reajustan después, en orden inverso, en el hilo actual:
+
+        Job_System & jobs = Job_System::get_instance ();
+
+        unsigned thread_count = jobs.get_thread_count ();
+
+        vector< int32_t > top_nodes;
+        vector< int32_t > subtrees  = { root };
+
+        while (subtrees.size () < thread_count * 8)
+        {
+            vector< int32_t > next;
+            bool              expanded = false;
+
+            for (int32_t node : subtrees)
+            {
+                if (is_leaf (node))
+                {
+                    next.push_back (node);
+                }
+                else
+                {
+                    top_nodes.push_back (node);
+                    next.push_back (nodes[node].child1);
+                    next.push_back (nodes[node].child2);
+                    expanded = true;
+                }
+            }
+
+            subtrees.swap (next);
+
+            if (!expanded) break;
+        }
+
+        jobs.parallel_for
+        (
+            subtrees.size (),
+            [&] (size_t first, size_t last)
+            {
+                vector< int32_t > scratch;
+
+                for (size_t i = first; i < last; ++i) refit_subtree (subtrees[i], scratch);
+            }
+        );
+
+        for (auto node = top_nodes.rbegin (); node != top_nodes.rend (); ++node)
+        {
+            refit_node (*node);
+        }
+    }
+
+    void Dynamic_AABB_Tree::refit_subtree (int32_t subtree, vector< int32_t > & scratch)
+    {
+        // Recorrido en preorden de los nodos internos; en orden inverso cada nodo va después de sus hijos:
+
+        scratch.clear ();
+
+        if (is_leaf (subtree)) return;
+
+        scratch.push_back (subtree);
+
+        for (size_t i = 0; i < scratch.size (); ++i)
+        {
+            const Node & node = nodes[scratch[i]];
+
+            if (!is_leaf (node.child1)) scratch.push_back (node.child1);
+            if (!is_leaf (node.child2)) scratch.push_back (node.child2);
+        }
+
+        for (auto node = scratch.rbegin (); node != scratch.rend (); ++node)
+        {
+            Node & current = nodes[*node];
+
+            current.min = glm::min (nodes[current.child1].min, nodes[current.child2].min);
+            current.max = glm::max (nodes[current.child1].max, nodes[current.child2].max);
+        }
+    }
+
+    Dynamic_AABB_Tree::Statistics Dynamic_AABB_Tree::get_statistics () const
+    {
+        Statistics statistics{};
+
+        statistics.leaf_count = leaf_count;
+
+        if (root == NULL_NODE) return statistics;
+
+        float internal_area = 0.f;
+
+        for (size_t node = 0; node < nodes.size (); ++node)
+        {
+            if (heights[node] < 0) continue;
+
+            statistics.node_count++;
+
+            if (heights[node] > 0) internal_area += area (nodes[node].min, nodes[node].max);
+        }
+
+        statistics.height     = heights[root];
+        statistics.area_ratio = internal_area / std::max (area (nodes[root].min, nodes[root].max), 1e-6f);
+
+        return statistics;
+    }
+
+    void Dynamic_AABB_Tree::collect_leaves (int32_t subtree, vector< uint32_t > & results) const
+    {
+        Stack stack;
+
+        stack.push (subtree);
+
+        while (!stack.empty ())
+        {
+            const Node & node = nodes[stack.pop ()];
+
+            if (node.child1 == NULL_NODE)
+            {
+                results.push_back (uint32_t(node.child2));
+            }
+            else
+            {
+                stack.push (node.child1);
+                stack.push (node.child2);
+            }
+        }
+    }
+
+    void Dynamic_AABB_Tree::query_box (const glm::vec3 & min, const glm::vec3 & max, vector< uint32_t > & results) const
+    {
+        if (root == NULL_NODE) return;
+
+        Stack stack;
+
+        stack.push (root);
+
+        while (!stack.empty ())
+        {
+            const Node & node = nodes[stack.pop ()];
+
+            if (!overlaps (node.min, node.max, min, max)) continue;
+
+            if (node.child1 == NULL_NODE)
+            {
+                results.push_back (uint32_t(node.child2));
+            }
+            else
+            {
+                stack.push (node.child1);
+                stack.push (node.child2);
+            }
+        }
+    }
+
+    void Dynamic_AABB_Tree::query_sphere (const glm::vec3 & center, float radius, vector< uint32_t > & results) const
+    {
+        if (root == NULL_NODE) return;
+
+        Stack stack;
+
+        stack.push (root);
+
+        const float radius2 = radius * radius;
+
+        while (!stack.empty ())
+        {
+            const Node & node = nodes[stack.pop ()];
+
+            // Distancia del centro al punto más cercano de la caja:
+
+            glm::vec3 offset = glm::max (glm::max (node.min - center, center - node.max), glm::vec3(0.f));
+
+            if (glm::dot (offset, offset) > radius2) continue;
+
+            if (node.child1 == NULL_NODE)
+            {
+                results.push_back (uint32_t(node.child2));
+            }
+            else
+            {
+                stack.push (node.child1);
+                stack.push (node.child2);
+            }
+        }
+    }
+
+    void Dynamic_AABB_Tree::query_frustum (const glm::mat4 & view_projection_matrix, vector< uint32_t > & results) const
+    {
+        if (root == NULL_NODE) return;
+
+        glm::vec4 planes[6];
+
+        Frustum_Culler::extract_planes (view_projection_matrix, planes);
+
+        Stack stack;
+
+        stack.push (root);
+
+        while (!stack.empty ())
+        {
+            int32_t      index = stack.pop ();
+            const Node & node  = nodes[index];
+
+            glm::vec3 center = (node.max + node.min) * 0.5f;
+            glm::vec3 extent = (node.max - node.min) * 0.5f;
+
+            bool outside = false;
+            bool inside  = true;
+
+            for (int p = 0; p < 6 && !outside; ++p)
+            {
+                glm::vec3 normal   = glm::vec3(planes[p]);
+                float     distance = glm::dot (normal, center) + planes[p].w;
+                float     radius   = glm::dot (glm::abs (normal), extent);
+
+                if (distance + radius < 0.f) outside = true;
+                if (distance - radius < 0.f) inside  = false;
+            }
+
+            if (outside) continue;
+
+            // Si la caja queda por completo dentro no hace falta probar su subárbol:
+
+            if (inside || node.child1 == NULL_NODE)
+            {
+                collect_leaves (index, results);
+            }
+            else
+            {
+                stack.push (node.child1);
+                stack.push (node.child2);
+            }
+        }
+    }
+
+    void Dynamic_AABB_Tree::query_ray (const glm::vec3 & origin, const glm::vec3 & direction, float max_distance, vector< uint32_t > & results) const
+    {
+        if (root == NULL_NODE) return;
+
+        const glm::vec3 inverse_direction = 1.f / direction;
+
+        Stack stack;
+
+        stack.push (root);
+
+        while (!stack.empty ())
+        {
+            const Node & node = nodes[stack.pop ()];
+
+            if (ray_box (origin, inverse_direction, max_distance, node.min, node.max) < 0.f) continue;
+
+            if (node.child1 == NULL_NODE)
+            {
+                results.push_back (uint32_t(node.child2));
+            }
+            else
+            {
+                stack.push (node.child1);
+                stack.push (node.child2);
+            }
+        }
+    }
+
+    int32_t Dynamic_AABB_Tree::ray_cast (const glm::vec3 & origin, const glm::vec3 & direction, float max_distance, float & distance) const
+    {
+        int32_t best = NULL_NODE;
+
+        if (root == NULL_NODE) return best;
+
+        const glm::vec3 inverse_direction = 1.f / direction;
+
+        // Cada impacto acorta el rayo, lo que poda los nodos que quedan más lejos:
+
+        Stack stack;
+
+        stack.push (root);
+
+        while (!stack.empty ())
+        {
+            int32_t      index = stack.pop ();
+            const Node & node  = nodes[index];
+
+            float enter = ray_box (origin, inverse_direction, max_distance, node.min, node.max);
+
+            if (enter < 0.f) continue;
+
+            if (node.child1 == NULL_NODE)
+            {
+                best         = index;
+                max_distance = enter;
+            }
+            else
+            {
+                stack.push (node.child1);
+                stack.push (node.child2);
+            }
+        }
+
+        distance = max_distance;
+
+        return best;
+    }
+
+}
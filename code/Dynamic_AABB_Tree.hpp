@@ -0,0 +1,156 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstdint>
+#include <glm.hpp>
+#include <utility>
+#include <vector>
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Jerarquía de volúmenes envolventes (BVH) dinámica sobre cajas alineadas con los ejes.
+    ///     Cada objeto es una hoja cuya caja se engorda con un margen, de modo que los objetos que se
+    ///     mueven poco no cambian el árbol. Al insertar se busca el hermano que menos aumenta el área
+    ///     total (SAH, con poda branch-and-bound) y al subir se aplican rotaciones que reducen el área
+    ///     de los nodos. Cuando se mueven muchos objetos a la vez es más barato actualizar las hojas y
+    ///     reajustar todas las cajas en paralelo (refit()).
+    ///
+    ///     Los nodos guardan solo lo que leen las consultas (caja e hijos, 32 bytes, dos por línea de
+    ///     caché). El padre y la altura, que solo se usan al modificar el árbol, van en arrays aparte.
+    /// </summary>
+    class Dynamic_AABB_Tree
+    {
+    public:
+
+        static const int32_t NULL_NODE = -1;
+
+        struct Statistics
+        {
+            size_t leaf_count;
+            size_t node_count;
+            int    height;
+            float  area_ratio;                      // Suma de las áreas de los nodos internos / área de la raíz
+        };
+
+    private:
+
+        struct alignas(32) Node
+        {
+            glm::vec3 min;
+            int32_t   child1;                       // NULL_NODE en las hojas
+            glm::vec3 max;
+            int32_t   child2;                       // En las hojas guarda el dato del usuario
+        };
+
+        /// Pila de recorrido sin reservas de memoria mientras no se supere su tamaño local:
+        struct Stack
+        {
+            int32_t                local[128];
+            std::vector< int32_t > overflow;
+            size_t                 size = 0;
+
+            void push (int32_t node)
+            {
+                if (size < 128) local[size] = node; else overflow.push_back (node);
+                ++size;
+            }
+
+            int32_t pop ()
+            {
+                --size;
+                if (size < 128) return local[size];
+                int32_t node = overflow.back (); overflow.pop_back (); return node;
+            }
+
+            bool empty () const
+            {
+                return size == 0;
+            }
+        };
+
+        std::vector< Node    > nodes;
+        std::vector< int32_t > parents;             // En los nodos libres enlaza la lista de libres
+        std::vector< int32_t > heights;             // 0 en las hojas, -1 en los nodos libres
+
+        int32_t root;
+        int32_t free_list;
+        size_t  leaf_count;
+        float   margin;                             // Cuánto se engordan las cajas de las hojas
+
+        std::vector< std::pair< float, int32_t > > search_queue;   // Memoria temporal de insert_leaf()
+
+    public:
+
+        explicit Dynamic_AABB_Tree(float margin = 0.1f);
+
+    public:
+
+        /// Añade un objeto y retorna el índice de su hoja:
+        int32_t create_proxy  (const glm::vec3 & min, const glm::vec3 & max, uint32_t user_data);
+        void    destroy_proxy (int32_t proxy);
+
+        /// Actualiza la caja de un objeto. Solo se reinserta si se sale de su caja engordada, en cuyo
+        /// caso retorna true:
+        bool    move_proxy    (int32_t proxy, const glm::vec3 & min, const glm::vec3 & max);
+
+        /// Actualiza la caja de una hoja sin reestructurar el árbol. Las cajas de los nodos internos no
+        /// son válidas hasta llamar a refit():
+        void    set_proxy_bounds (int32_t proxy, const glm::vec3 & min, const glm::vec3 & max);
+
+        /// Recalcula de abajo arriba las cajas de todos los nodos internos repartiendo subárboles entre hilos:
+        void    refit ();
+
+        uint32_t get_user_data (int32_t proxy) const
+        {
+            return uint32_t(nodes[proxy].child2);
+        }
+
+        const glm::vec3 & get_fat_min (int32_t proxy) const { return nodes[proxy].min; }
+        const glm::vec3 & get_fat_max (int32_t proxy) const { return nodes[proxy].max; }
+
+        size_t size () const
+        {
+            return leaf_count;
+        }
+
+        Statistics get_statistics () const;
+
+    public:
+
+        // Consultas. Añaden a results el dato de usuario de cada hoja cuya caja engordada cumple la condición:
+
+        void query_box     (const glm::vec3 & min, const glm::vec3 & max, std::vector< uint32_t > & results) const;
+        void query_sphere  (const glm::vec3 & center, float radius,        std::vector< uint32_t > & results) const;
+        void query_frustum (const glm::mat4 & view_projection_matrix,     std::vector< uint32_t > & results) const;
+        void query_ray     (const glm::vec3 & origin, const glm::vec3 & direction, float max_distance, std::vector< uint32_t > & results) const;
+
+        /// Retorna la hoja cuya caja corta antes el rayo (o NULL_NODE) y la distancia a la que lo hace:
+        int32_t ray_cast   (const glm::vec3 & origin, const glm::vec3 & direction, float max_distance, float & distance) const;
+
+    private:
+
+        int32_t allocate_node ();
+        void    free_node     (int32_t node);
+
+        void    insert_leaf   (int32_t leaf);
+        void    remove_leaf   (int32_t leaf);
+
+        void    refit_node    (int32_t node);
+        void    rotate        (int32_t node);
+        void    refit_subtree (int32_t node, std::vector< int32_t > & scratch);
+
+        void    collect_leaves (int32_t node, std::vector< uint32_t > & results) const;
+
+        bool    is_leaf (int32_t node) const
+        {
+            return nodes[node].child1 == NULL_NODE;
+        }
+
+    };
+
+}
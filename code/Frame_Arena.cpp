@@ -0,0 +1,120 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Frame_Arena.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+using namespace std;
+
+namespace udit
+{
+
+    Frame_Arena::Frame_Arena(size_t capacity)
+    :
+        offset          (0),
+        used_in_previous(0),
+        last_allocation (nullptr),
+        statistics      {}
+    {
+        #ifdef NDEBUG
+            poisoning = false;
+        #else
+            poisoning = true;
+        #endif
+
+        add_block (capacity);
+    }
+
+    void Frame_Arena::add_block (size_t size)
+    {
+        blocks.push_back ({ unique_ptr< uint8_t[] >(new uint8_t[size]), size });
+
+        statistics.capacity += size;
+        statistics.heap_allocations++;
+    }
+
+    void * Frame_Arena::allocate (size_t size, size_t alignment)
+    {
+        assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+        Block * block = &blocks.back ();
+
+        // Se alinea la dirección, no el desplazamiento, porque el bloque solo está alineado a max_align_t:
+
+        uintptr_t base    = reinterpret_cast< uintptr_t >(block->memory.get ());
+        size_t    aligned = size_t(((base + offset + alignment - 1) & ~uintptr_t(alignment - 1)) - base);
+
+        if (aligned + size > block->size)
+        {
+            // No cabe: se pide otro bloque al menos el doble de grande que el anterior. En el
+            // siguiente reset() todos se sustituyen por uno solo:
+
+            used_in_previous += offset;
+
+            add_block (max (block->size * 2, size + alignment));
+
+            block   = &blocks.back ();
+            offset  = 0;
+            base    = reinterpret_cast< uintptr_t >(block->memory.get ());
+            aligned = size_t(((base + alignment - 1) & ~uintptr_t(alignment - 1)) - base);
+        }
+
+        void * memory = block->memory.get () + aligned;
+
+        offset          = aligned + size;
+        last_allocation = memory;
+
+        statistics.used            = used_in_previous + offset;
+        statistics.high_water_mark = max (statistics.high_water_mark, statistics.used);
+
+        return memory;
+    }
+
+    void Frame_Arena::deallocate (void * memory, size_t size)
+    {
+        if (!memory) return;
+
+        if (poisoning) memset (memory, POISON, size);
+
+        if (memory == last_allocation)
+        {
+            offset          = size_t(static_cast< uint8_t * >(memory) - blocks.back ().memory.get ());
+            last_allocation = nullptr;
+
+            statistics.used = used_in_previous + offset;
+        }
+    }
+
+    void Frame_Arena::reset ()
+    {
+        if (poisoning)
+        {
+            for (size_t i = 0; i + 1 < blocks.size (); ++i) memset (blocks[i].memory.get (), POISON, blocks[i].size);
+
+            memset (blocks.back ().memory.get (), POISON, offset);
+        }
+
+        // Si el frame no cupo en un bloque, se sustituyen todos por uno que tenga la capacidad total:
+
+        if (blocks.size () > 1)
+        {
+            size_t capacity = statistics.capacity;
+
+            blocks.clear ();
+
+            statistics.capacity = 0;
+
+            add_block (capacity);
+        }
+
+        offset           = 0;
+        used_in_previous = 0;
+        last_allocation  = nullptr;
+        statistics.used  = 0;
+    }
+
+}
@@ -0,0 +1,158 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Memoria para los datos temporales de un frame. Reservar es solo avanzar un desplazamiento
+    ///     dentro de un bloque, y al terminar el frame se libera todo de golpe con reset(). Si un frame
+    ///     no cabe se pide otro bloque al sistema y en el reset() siguiente se sustituyen todos por uno
+    ///     solo del tamaño total, de modo que los frames que se repiten dejan de reservar memoria del
+    ///     sistema.
+    ///
+    ///     En depuración la memoria liberada se rellena con POISON para que los accesos a datos de un
+    ///     frame anterior se noten enseguida. La arena no es thread-safe: cada hilo (o cada snapshot de
+    ///     la simulación, ver Scene::Frame_Snapshot) usa la suya.
+    /// </summary>
+    class Frame_Arena
+    {
+    public:
+
+        static const uint8_t POISON = 0xCD;
+
+        struct Statistics
+        {
+            size_t capacity;                        // Bytes que se pueden reservar sin pedir más al sistema
+            size_t used;                            // Bytes reservados en el frame actual
+            size_t high_water_mark;                 // Máximo de used desde que se creó la arena
+            size_t heap_allocations;                // Bloques pedidos al sistema desde que se creó la arena
+        };
+
+    private:
+
+        struct Block
+        {
+            std::unique_ptr< uint8_t[] > memory;
+            size_t                       size;
+        };
+
+        std::vector< Block > blocks;
+        size_t               offset;                // Dentro del último bloque
+        size_t               used_in_previous;      // Bytes usados en los bloques anteriores al último
+        void               * last_allocation;       // Se puede devolver al liberarla si es la última
+        bool                 poisoning;
+
+        Statistics statistics;
+
+    public:
+
+        explicit Frame_Arena(size_t capacity = 64 * 1024);
+
+        Frame_Arena(const Frame_Arena & ) = delete;
+
+        Frame_Arena & operator = (const Frame_Arena & ) = delete;
+
+    public:
+
+        void * allocate (size_t size, size_t alignment = alignof(std::max_align_t));
+
+        /// Solo devuelve la memoria si es lo último que se ha reservado (lo habitual al crecer un
+        /// vector). En otro caso se recupera en el siguiente reset():
+        void deallocate (void * memory, size_t size);
+
+        /// Reserva un array sin inicializar (solo para tipos que no necesitan destructor):
+        template< class T >
+        T * allocate_array (size_t count)
+        {
+            static_assert(std::is_trivially_destructible< T >::value, "Frame_Arena no llama a los destructores");
+
+            return static_cast< T * >(allocate (sizeof(T) * count, alignof(T)));
+        }
+
+        /// Libera todo lo reservado en el frame:
+        void reset ();
+
+        /// Activa o desactiva el relleno de la memoria liberada (por defecto solo en depuración):
+        void set_poisoning (bool enabled)
+        {
+            poisoning = enabled;
+        }
+
+        const Statistics & get_statistics () const
+        {
+            return statistics;
+        }
+
+    private:
+
+        void add_block (size_t size);
+
+    };
+
+    /// <summary>
+    ///     Adaptador para que los contenedores de la biblioteca estándar reserven en una Frame_Arena.
+    ///     Los contenedores tienen que destruirse o vaciarse (con shrink_to_fit() o asignándoles uno
+    ///     nuevo) antes del reset() de su arena.
+    /// </summary>
+    template< class T >
+    class Arena_Allocator
+    {
+        template< class U > friend class Arena_Allocator;
+
+        Frame_Arena * arena;
+
+    public:
+
+        typedef T value_type;
+
+        typedef std::true_type propagate_on_container_copy_assignment;
+        typedef std::true_type propagate_on_container_move_assignment;
+        typedef std::true_type propagate_on_container_swap;
+
+        Arena_Allocator(Frame_Arena & arena) : arena(&arena)
+        {
+        }
+
+        template< class U >
+        Arena_Allocator(const Arena_Allocator< U > & other) : arena(other.arena)
+        {
+        }
+
+        T * allocate (size_t count)
+        {
+            return static_cast< T * >(arena->allocate (sizeof(T) * count, alignof(T)));
+        }
+
+        void deallocate (T * memory, size_t count)
+        {
+            arena->deallocate (memory, sizeof(T) * count);
+        }
+
+        template< class U >
+        bool operator == (const Arena_Allocator< U > & other) const
+        {
+            return arena == other.arena;
+        }
+
+        template< class U >
+        bool operator != (const Arena_Allocator< U > & other) const
+        {
+            return arena != other.arena;
+        }
+
+    };
+
+    template< class T >
+    using Frame_Vector = std::vector< T, Arena_Allocator< T > >;
+
+}
@@ -0,0 +1,102 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Frame_Clock.hpp"
+
+#include <algorithm>
+#include <SDL.h>
+
+using namespace std;
+
+namespace udit
+{
+
+    Frame_Clock::Frame_Clock(double step_seconds, unsigned max_steps)
+    :
+        running          (false),
+        step_ticks       (max (uint64_t(step_seconds * double(SDL_GetPerformanceFrequency ()) + .5), uint64_t(1))),
+        max_frame_ticks  (step_ticks * max (max_steps, 1u)),
+        last_counter     (0),
+        accumulator      (0),
+        simulated_counter(0),
+        step_count       (0),
+        dropped_ticks    (0),
+        history          {},
+        history_index    (0),
+        history_count    (0)
+    {
+    }
+
+    uint64_t Frame_Clock::now ()
+    {
+        return SDL_GetPerformanceCounter ();
+    }
+
+    double Frame_Clock::to_seconds (uint64_t ticks)
+    {
+        return double(ticks) / double(SDL_GetPerformanceFrequency ());
+    }
+
+    float Frame_Clock::tick (uint64_t counter)
+    {
+        if (!running)
+        {
+            running           = true;
+            last_counter      = counter;
+            simulated_counter = counter;
+
+            return 0.f;
+        }
+
+        uint64_t elapsed = counter - last_counter;
+
+        last_counter = counter;
+
+        history[history_index] = float(to_seconds (elapsed) * 1000.);
+        history_index          = (history_index + 1) % HISTORY;
+        history_count          = min (history_count + 1, HISTORY);
+
+        // Lo que no cabe en max_steps pasos se da por simulado sin simularlo, de modo que el instante
+        // del último paso sigue a menos de un paso del tiempo real:
+
+        uint64_t accumulated = elapsed;
+
+        if (accumulated > max_frame_ticks)
+        {
+            dropped_ticks     += accumulated - max_frame_ticks;
+            simulated_counter += accumulated - max_frame_ticks;
+            accumulated        = max_frame_ticks;
+        }
+
+        accumulator += accumulated;
+
+        return float(to_seconds (elapsed));
+    }
+
+    bool Frame_Clock::step ()
+    {
+        if (accumulator < step_ticks) return false;
+
+        accumulator       -= step_ticks;
+        simulated_counter += step_ticks;
+        step_count++;
+
+        return true;
+    }
+
+    float Frame_Clock::get_frame_percentile (float p) const
+    {
+        if (history_count == 0) return 0.f;
+
+        float    sorted[HISTORY];
+        unsigned index = min (unsigned(p * float(history_count)), history_count - 1);
+
+        copy_n (history, history_count, sorted);                 // Si no está lleno, los primeros son los válidos
+
+        nth_element (sorted, sorted + index, sorted + history_count);
+
+        return sorted[index];
+    }
+
+}
@@ -0,0 +1,128 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstdint>
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Reloj de alta resolución (SDL_GetPerformanceCounter) para avanzar la simulación a pasos de
+    ///     duración fija independientemente de la frecuencia de los frames.
+    ///
+    ///     Cada tick() mide el tiempo real desde el anterior y lo suma a un acumulador, y step() retorna
+    ///     true mientras quede al menos un paso por simular, de modo que en un segundo se simulan
+    ///     siempre los mismos pasos aunque haya vsync o no. Si un frame tarda demasiado (una pausa en el
+    ///     depurador, una carga), el tiempo que pasa de max_steps pasos se descarta en lugar de
+    ///     intentar recuperarlo, ya que cada paso de más haría el siguiente frame aún más largo.
+    ///
+    ///     Todo se cuenta en ticks del contador, sin redondeos que se acumulen. El instante que
+    ///     representa el último paso simulado sirve al render para interpolar entre ese paso y el
+    ///     anterior, y se guardan los últimos HISTORY tiempos de frame para los perfiles.
+    /// </summary>
+    class Frame_Clock
+    {
+    public:
+
+        static const unsigned HISTORY = 256;
+
+    private:
+
+        bool     running;                           // Ha habido al menos un tick()
+        uint64_t step_ticks;
+        uint64_t max_frame_ticks;                   // Lo que más puede sumar un frame al acumulador
+        uint64_t last_counter;                      // Contador en el último tick()
+        uint64_t accumulator;                       // Tiempo real que falta por simular
+        uint64_t simulated_counter;                 // Instante (en el contador) del último paso simulado
+        uint64_t step_count;
+        uint64_t dropped_ticks;                     // Tiempo descartado por los frames demasiado largos
+
+        float    history[HISTORY];                  // Milisegundos de cada frame
+        unsigned history_index;                     // Donde se va a escribir el siguiente
+        unsigned history_count;
+
+    public:
+
+        /// Reloj con pasos de step_seconds. Un frame no puede dar lugar a más de max_steps pasos:
+        explicit Frame_Clock(double step_seconds = 1. / 60., unsigned max_steps = 8);
+
+        Frame_Clock(const Frame_Clock & ) = delete;
+
+        Frame_Clock & operator = (const Frame_Clock & ) = delete;
+
+    public:
+
+        /// Valor actual del contador de alta resolución:
+        static uint64_t now ();
+
+        /// Convierte ticks del contador en segundos:
+        static double   to_seconds (uint64_t ticks);
+
+        /// Mide el frame que acaba de terminar y suma su duración (recortada) al acumulador. Retorna
+        /// los segundos reales del frame. La primera llamada solo pone el reloj en marcha:
+        float tick ()
+        {
+            return tick (now ());
+        }
+
+        /// Lo mismo a partir de un valor del contador dado (para reproducir secuencias de frames):
+        float tick (uint64_t counter);
+
+        /// Consume un paso del acumulador si lo hay. Se llama en bucle después de cada tick():
+        bool  step ();
+
+        /// Fracción de paso que queda en el acumulador ([0, 1)):
+        float get_alpha () const
+        {
+            return float(double(accumulator) / double(step_ticks));
+        }
+
+        float get_step_seconds () const
+        {
+            return float(to_seconds (step_ticks));
+        }
+
+        /// Segundos que faltan hasta que se acumule el siguiente paso desde el último tick():
+        double get_seconds_to_next_step () const
+        {
+            return to_seconds (step_ticks - accumulator);
+        }
+
+        /// Instante del contador que representa el último paso simulado. El render interpola entre el
+        /// paso anterior y ese con el tiempo que ha pasado desde este instante dividido entre un paso:
+        uint64_t get_simulated_counter () const
+        {
+            return simulated_counter;
+        }
+
+        uint64_t get_step_count () const
+        {
+            return step_count;
+        }
+
+        /// Segundos que se han descartado por los frames demasiado largos:
+        double get_dropped_seconds () const
+        {
+            return to_seconds (dropped_ticks);
+        }
+
+        /// Milisegundos del frame index-ésimo más reciente (0 es el último):
+        float get_frame_milliseconds (unsigned index = 0) const
+        {
+            return history[(history_index + HISTORY - 1 - index) % HISTORY];
+        }
+
+        unsigned get_history_count () const
+        {
+            return history_count;
+        }
+
+        /// Percentil p ([0, 1]) de los tiempos de frame guardados. Retorna 0 si no hay ninguno:
+        float get_frame_percentile (float p) const;
+
+    };
+
+}
@@ -0,0 +1,205 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Frustum_Culler.hpp"
+#include "simd-recipes.hpp"
+
+#include <chrono>
+#include <cmath>
+
+#ifdef __AVX2__
+    #include <immintrin.h>                  // AVX2
+#else
+    #include <xmmintrin.h>                  // SSE
+#endif
+
+using namespace std;
+
+namespace udit
+{
+
+    namespace
+    {
+
+        #ifdef __AVX2__
+
+            typedef __m256 Lanes;
+
+            inline Lanes lanes_set1  (float value)        { return _mm256_set1_ps (value); }
+            inline Lanes lanes_load  (const float * data) { return _mm256_loadu_ps (data ); }
+            inline Lanes lanes_mul   (Lanes a, Lanes b)   { return _mm256_mul_ps   (a, b ); }
+            inline Lanes lanes_add   (Lanes a, Lanes b)   { return _mm256_add_ps   (a, b ); }
+            inline Lanes lanes_and   (Lanes a, Lanes b)   { return _mm256_and_ps   (a, b ); }
+            inline Lanes lanes_ge    (Lanes a, Lanes b)   { return _mm256_cmp_ps   (a, b, _CMP_GE_OQ); }
+            inline int   lanes_mask  (Lanes a)            { return _mm256_movemask_ps (a); }
+            inline Lanes lanes_true  ()                   { return _mm256_castsi256_ps (_mm256_set1_epi32 (-1)); }
+
+        #else
+
+            typedef __m128 Lanes;
+
+            inline Lanes lanes_set1  (float value)        { return _mm_set1_ps (value); }
+            inline Lanes lanes_load  (const float * data) { return _mm_loadu_ps (data ); }
+            inline Lanes lanes_mul   (Lanes a, Lanes b)   { return _mm_mul_ps   (a, b ); }
+            inline Lanes lanes_add   (Lanes a, Lanes b)   { return _mm_add_ps   (a, b ); }
+            inline Lanes lanes_and   (Lanes a, Lanes b)   { return _mm_and_ps   (a, b ); }
+            inline Lanes lanes_ge    (Lanes a, Lanes b)   { return _mm_cmpge_ps (a, b ); }
+            inline int   lanes_mask  (Lanes a)            { return _mm_movemask_ps (a); }
+            inline Lanes lanes_true  ()                   { return _mm_cmpeq_ps (_mm_setzero_ps (), _mm_setzero_ps ()); }
+
+        #endif
+
+        typedef chrono::high_resolution_clock Clock;
+
+    }
+
+    Frustum_Culler::Frustum_Culler()
+    :
+        statistics{}
+    {
+    }
+
+    uint32_t Frustum_Culler::add (const glm::vec3 & local_min, const glm::vec3 & local_max, const glm::mat4 & model_matrix)
+    {
+        uint32_t object = uint32_t(local_center.size ());
+
+        local_center.push_back ((local_max + local_min) * 0.5f);
+        local_extent.push_back ((local_max - local_min) * 0.5f);
+
+        visible_flags.push_back (1);
+
+        // Los arrays SoA crecen de LANES en LANES. Los huecos de relleno nunca se leen como visibles:
+
+        if (center_x.size () < local_center.size ())
+        {
+            for (auto * lane : { &center_x, &center_y, &center_z, &extent_x, &extent_y, &extent_z })
+            {
+                lane->resize (lane->size () + LANES, 0.f);
+            }
+        }
+
+        set_transform (object, model_matrix);
+
+        return object;
+    }
+
+    void Frustum_Culler::set_transform (uint32_t object, const glm::mat4 & model_matrix)
+    {
+        // Caja que envuelve la caja local transformada (Arvo): el centro se transforma como un punto
+        // y la semiextensión con el valor absoluto de la parte lineal de la matriz:
+
+        glm::vec3 center = glm::vec3(model_matrix * glm::vec4(local_center[object], 1.f));
+        glm::vec3 extent = glm::vec3(0.f);
+
+        for (int column = 0; column < 3; ++column)
+        {
+            extent += glm::abs (glm::vec3(model_matrix[column])) * local_extent[object][column];
+        }
+
+        center_x[object] = center.x;
+        center_y[object] = center.y;
+        center_z[object] = center.z;
+        extent_x[object] = extent.x;
+        extent_y[object] = extent.y;
+        extent_z[object] = extent.z;
+    }
+
+    void Frustum_Culler::cull (const glm::mat4 & view_projection_matrix)
+    {
+        auto start = Clock::now ();
+
+        glm::vec4 planes[6];
+
+        extract_planes (view_projection_matrix, planes);
+
+        // Se preparan los componentes de los planos y sus valores absolutos en registros SIMD:
+
+        Lanes plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+        Lanes   abs_x[6],   abs_y[6],   abs_z[6];
+
+        for (int p = 0; p < 6; ++p)
+        {
+            plane_x[p] = lanes_set1 (planes[p].x);
+            plane_y[p] = lanes_set1 (planes[p].y);
+            plane_z[p] = lanes_set1 (planes[p].z);
+            plane_w[p] = lanes_set1 (planes[p].w);
+              abs_x[p] = lanes_set1 (fabs (planes[p].x));
+              abs_y[p] = lanes_set1 (fabs (planes[p].y));
+              abs_z[p] = lanes_set1 (fabs (planes[p].z));
+        }
+
+        const Lanes zero = lanes_set1 (0.f);
+
+        size_t object_count = local_center.size ();
+
+        visible_objects.clear ();
+
+        for (size_t i = 0; i < object_count; i += LANES)
+        {
+            Lanes cx = lanes_load (&center_x[i]);
+            Lanes cy = lanes_load (&center_y[i]);
+            Lanes cz = lanes_load (&center_z[i]);
+            Lanes ex = lanes_load (&extent_x[i]);
+            Lanes ey = lanes_load (&extent_y[i]);
+            Lanes ez = lanes_load (&extent_z[i]);
+
+            // Una caja está fuera si queda por completo detrás de algún plano: la distancia con signo
+            // del centro más la proyección de la semiextensión sobre la normal es negativa:
+
+            Lanes inside = lanes_true ();
+
+            for (int p = 0; p < 6; ++p)
+            {
+                Lanes distance = lanes_add
+                (
+                    lanes_add (lanes_add (lanes_mul (plane_x[p], cx), lanes_mul (plane_y[p], cy)), lanes_add (lanes_mul (plane_z[p], cz), plane_w[p])),
+                    lanes_add (lanes_add (lanes_mul (  abs_x[p], ex), lanes_mul (  abs_y[p], ey)),            lanes_mul (  abs_z[p], ez)             )
+                );
+
+                inside = lanes_and (inside, lanes_ge (distance, zero));
+            }
+
+            unsigned mask  = unsigned(lanes_mask (inside));
+            size_t   lanes = min (size_t(LANES), object_count - i);
+
+            // Se descartan los huecos de relleno del último grupo:
+
+            mask &= (1u << lanes) - 1u;
+
+            for (size_t lane = 0; lane < lanes; ++lane)
+            {
+                visible_flags[i + lane] = uint8_t((mask >> lane) & 1u);
+            }
+
+            for (; mask; mask &= mask - 1)
+            {
+                visible_objects.push_back (uint32_t(i + lowest_set_bit (mask)));
+            }
+        }
+
+        statistics.object_count      = object_count;
+        statistics.visible_count     = visible_objects.size ();
+        statistics.culled_count      = object_count - visible_objects.size ();
+        statistics.cull_milliseconds = chrono::duration< float, milli >(Clock::now () - start).count ();
+    }
+
+    void Frustum_Culler::extract_planes (const glm::mat4 & m, glm::vec4 planes[6])
+    {
+        // Método de Gribb y Hartmann. GLM guarda las matrices por columnas, por lo que cada fila de la
+        // matriz se forma con el mismo componente de las 4 columnas:
+
+        glm::vec4 row_x(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row_y(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row_z(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 row_w(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+        planes[0] = row_w + row_x;          // Izquierdo
+        planes[1] = row_w - row_x;          // Derecho
+        planes[2] = row_w + row_y;          // Inferior
+        planes[3] = row_w - row_y;          // Superior
+        planes[4] = row_w + row_z;          // Cercano
+        planes[5] = row_w - row_z;          // Lejano
+    }
+
+}
@@ -0,0 +1,106 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstdint>
+#include <glm.hpp>
+#include <vector>
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Descarta los objetos cuya caja envolvente (AABB en espacio de mundo) queda fuera del
+    ///     frustum de la cámara. Las cajas se guardan como structure-of-arrays (centro y semiextensión)
+    ///     para probar 8 objetos a la vez con AVX2 (o 4 con SSE si no se compila con AVX2). El
+    ///     resultado es una lista compacta con los índices de los objetos visibles.
+    /// </summary>
+    class Frustum_Culler
+    {
+    public:
+
+        #ifdef __AVX2__
+            static const unsigned LANES = 8;
+        #else
+            static const unsigned LANES = 4;
+        #endif
+
+        struct Statistics
+        {
+            size_t object_count;
+            size_t visible_count;
+            size_t culled_count;
+            float  cull_milliseconds;
+        };
+
+    private:
+
+        // Cajas en espacio local de cada objeto (solo se usan al cambiar su transformación):
+
+        std::vector< glm::vec3 > local_center;
+        std::vector< glm::vec3 > local_extent;
+
+        // Cajas en espacio de mundo, rellenadas a múltiplo de LANES:
+
+        std::vector< float > center_x, center_y, center_z;
+        std::vector< float > extent_x, extent_y, extent_z;
+
+        std::vector< uint32_t > visible_objects;
+        std::vector< uint8_t  > visible_flags;
+
+        Statistics statistics;
+
+    public:
+
+        Frustum_Culler();
+
+    public:
+
+        /// Añade un objeto a partir de su caja en espacio local y retorna su índice:
+        uint32_t add (const glm::vec3 & local_min, const glm::vec3 & local_max, const glm::mat4 & model_matrix = glm::mat4(1));
+
+        /// Recalcula la caja en espacio de mundo de un objeto que se ha movido:
+        void set_transform (uint32_t object, const glm::mat4 & model_matrix);
+
+        /// Prueba todos los objetos contra el frustum de projection_matrix * view_matrix:
+        void cull (const glm::mat4 & view_projection_matrix);
+
+        size_t size () const
+        {
+            return local_center.size ();
+        }
+
+        bool is_visible (uint32_t object) const
+        {
+            return visible_flags[object] != 0;
+        }
+
+        /// Caja en espacio de mundo de un objeto (centro y semiextensión):
+        glm::vec3 get_center (uint32_t object) const
+        {
+            return glm::vec3(center_x[object], center_y[object], center_z[object]);
+        }
+
+        glm::vec3 get_extent (uint32_t object) const
+        {
+            return glm::vec3(extent_x[object], extent_y[object], extent_z[object]);
+        }
+
+        const std::vector< uint32_t > & get_visible_objects () const
+        {
+            return visible_objects;
+        }
+
+        const Statistics & get_statistics () const
+        {
+            return statistics;
+        }
+
+        /// Extrae los 6 planos del frustum (sin normalizar, con las normales hacia dentro):
+        static void extract_planes (const glm::mat4 & view_projection_matrix, glm::vec4 planes[6]);
+
+    };
+
+}
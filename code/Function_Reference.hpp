@@ -0,0 +1,53 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <type_traits>
+#include <utility>
+
+namespace udit
+{
+
+    template< class Signature >
+    class Function_Reference;
+
+    /// <summary>
+    ///     Referencia a una función (normalmente un lambda) para los parámetros que solo se llaman
+    ///     mientras dura la llamada que los recibe. A diferencia de std::function no copia la función
+    ///     ni reserva memoria, por lo que se puede usar cada frame. La función tiene que seguir viva
+    ///     mientras se use la referencia (un lambda temporal en la llamada basta).
+    /// </summary>
+    template< class Result, class ... Arguments >
+    class Function_Reference< Result (Arguments ...) >
+    {
+
+        const void * function;
+        Result    (* call) (const void * function, Arguments ... arguments);
+
+    public:
+
+        template
+        <
+            class Function,
+            class = typename std::enable_if< !std::is_same< typename std::decay< Function >::type, Function_Reference >::value >::type
+        >
+        Function_Reference(const Function & function)
+        :
+            function(&function),
+            call    ([] (const void * function, Arguments ... arguments) -> Result
+                    {
+                        return (*static_cast< const Function * >(function)) (std::forward< Arguments >(arguments)...);
+                    })
+        {
+        }
+
+        Result operator () (Arguments ... arguments) const
+        {
+            return call (function, std::forward< Arguments >(arguments)...);
+        }
+
+    };
+
+}
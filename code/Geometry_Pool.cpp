@@ -0,0 +1,384 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Geometry_Pool.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+
+namespace udit
+{
+
+    bool Geometry_Pool::Vertex_Format::operator == (const Vertex_Format & other) const
+    {
+        if (stride != other.stride || attributes.size () != other.attributes.size ()) return false;
+
+        for (size_t i = 0; i < attributes.size (); ++i)
+        {
+            const Attribute & a = attributes[i];
+            const Attribute & b = other.attributes[i];
+
+            if (a.location   != b.location   || a.components != b.components || a.type != b.type ||
+                a.normalized != b.normalized || a.offset     != b.offset) return false;
+        }
+
+        return true;
+    }
+
+    Geometry_Pool::Geometry_Pool()
+    :
+        index_allocator(initial_index_capacity, minimum_block)
+    {
+        glGenBuffers (1, &index_buffer_id);
+
+        glBindBuffer (GL_COPY_WRITE_BUFFER, index_buffer_id);
+        glBufferData (GL_COPY_WRITE_BUFFER, GLsizeiptr(index_allocator.get_capacity ()) * sizeof(uint16_t), nullptr, GL_STATIC_DRAW);
+        glBindBuffer (GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    Geometry_Pool::~Geometry_Pool()
+    {
+        for (auto & buffer : formats)
+        {
+            glDeleteVertexArrays (1, &buffer->vertex_array_id);
+            glDeleteBuffers      (1, &buffer->buffer_id);
+        }
+
+        glDeleteBuffers (1, &index_buffer_id);
+    }
+
+    uint32_t Geometry_Pool::find_format (const Vertex_Format & format)
+    {
+        for (size_t i = 0; i < formats.size (); ++i)
+        {
+            if (formats[i]->format == format) return uint32_t(i);
+        }
+
+        // Primera malla con este formato: se crean su búfer de vértices y su VAO:
+
+        unique_ptr< Format_Buffer > buffer(new Format_Buffer{ format, 0, 0, Buddy_Allocator(initial_vertex_capacity, minimum_block) });
+
+        glGenBuffers      (1, &buffer->buffer_id);
+        glGenVertexArrays (1, &buffer->vertex_array_id);
+
+        glBindBuffer (GL_COPY_WRITE_BUFFER, buffer->buffer_id);
+        glBufferData (GL_COPY_WRITE_BUFFER, GLsizeiptr(buffer->allocator.get_capacity ()) * format.stride, nullptr, GL_STATIC_DRAW);
+        glBindBuffer (GL_COPY_WRITE_BUFFER, 0);
+
+        configure_vertex_array (*buffer);
+
+        formats.push_back (std::move (buffer));
+
+        return uint32_t(formats.size () - 1);
+    }
+
+    void Geometry_Pool::configure_vertex_array (const Format_Buffer & buffer) const
+    {
+        glBindVertexArray (buffer.vertex_array_id);
+
+        glBindBuffer (GL_ARRAY_BUFFER, buffer.buffer_id);
+
+        for (auto & attribute : buffer.format.attributes)
+        {
+            glEnableVertexAttribArray (attribute.location);
+            glVertexAttribPointer
+            (
+                attribute.location,
+                attribute.components,
+                attribute.type,
+                attribute.normalized,
+                buffer.format.stride,
+                reinterpret_cast< const void * >(size_t(attribute.offset))
+            );
+        }
+
+        // El búfer de índices es el mismo para todos los formatos:
+
+        glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, index_buffer_id);
+
+        glBindVertexArray (0);
+    }
+
+    Geometry_Pool::Mesh Geometry_Pool::create_mesh
+    (
+        const Vertex_Format & format,
+        const void          * vertices,
+        GLsizei               vertex_count,
+        const uint16_t      * indices,
+        GLsizei               index_count
+    )
+    {
+        assert(vertex_count > 0 && (indices || index_count == 0));
+
+        uint32_t        format_index = find_format (format);
+        Format_Buffer & buffer       = *formats[format_index];
+
+        // Vértices:
+
+        uint32_t base_vertex;
+
+        while ((base_vertex = buffer.allocator.allocate (uint32_t(vertex_count))) == Buddy_Allocator::INVALID)
+        {
+            grow_vertex_buffer (buffer);
+        }
+
+        glBindBuffer    (GL_COPY_WRITE_BUFFER, buffer.buffer_id);
+        glBufferSubData (GL_COPY_WRITE_BUFFER, GLintptr(base_vertex) * format.stride, GLsizeiptr(vertex_count) * format.stride, vertices);
+
+        // Índices:
+
+        uint32_t first_index = 0;
+
+        if (index_count > 0)
+        {
+            while ((first_index = index_allocator.allocate (uint32_t(index_count))) == Buddy_Allocator::INVALID)
+            {
+                grow_index_buffer ();
+            }
+
+            glBindBuffer    (GL_COPY_WRITE_BUFFER, index_buffer_id);
+            glBufferSubData (GL_COPY_WRITE_BUFFER, GLintptr(first_index) * sizeof(uint16_t), GLsizeiptr(index_count) * sizeof(uint16_t), indices);
+        }
+
+        glBindBuffer (GL_COPY_WRITE_BUFFER, 0);
+
+        // Se reutiliza la entrada de una malla destruida si la hay:
+
+        Mesh_Entry entry{ format_index, { buffer.vertex_array_id, GLint(base_vertex), vertex_count, GLsizei(first_index), index_count } };
+
+        if (!free_meshes.empty ())
+        {
+            Mesh mesh = free_meshes.back ();
+
+            free_meshes.pop_back ();
+
+            meshes[mesh] = entry;
+
+            return mesh;
+        }
+
+        meshes.push_back (entry);
+
+        return Mesh(meshes.size () - 1);
+    }
+
+    void Geometry_Pool::destroy_mesh (Mesh mesh)
+    {
+        Mesh_Entry & entry = meshes[mesh];
+
+        assert(entry.format != NO_MESH);
+
+        formats[entry.format]->allocator.free (uint32_t(entry.range.base_vertex));
+
+        if (entry.range.index_count > 0)
+        {
+            index_allocator.free (uint32_t(entry.range.first_index));
+        }
+
+        entry.format = NO_MESH;
+
+        free_meshes.push_back (mesh);
+    }
+
+    void Geometry_Pool::draw (Mesh mesh, GLenum primitive) const
+    {
+        const Mesh_Range & range = meshes[mesh].range;
+
+        glBindVertexArray (range.vertex_array_id);
+
+        if (range.index_count > 0)
+        {
+            glDrawElementsBaseVertex
+            (
+                primitive,
+                range.index_count,
+                GL_UNSIGNED_SHORT,
+                reinterpret_cast< const void * >(size_t(range.first_index) * sizeof(uint16_t)),
+                range.base_vertex
+            );
+        }
+        else
+        {
+            glDrawArrays (primitive, range.base_vertex, range.vertex_count);
+        }
+    }
+
+    GLuint Geometry_Pool::relocate
+    (
+        GLuint                    buffer_id,
+        GLsizeiptr                element_size,
+        uint32_t                  new_capacity,
+        const vector< uint32_t > & moves
+    ) const
+    {
+        GLuint new_buffer_id;
+
+        glGenBuffers (1, &new_buffer_id);
+
+        glBindBuffer (GL_COPY_WRITE_BUFFER, new_buffer_id);
+        glBufferData (GL_COPY_WRITE_BUFFER, GLsizeiptr(new_capacity) * element_size, nullptr, GL_STATIC_DRAW);
+        glBindBuffer (GL_COPY_READ_BUFFER,  buffer_id);
+
+        // Las copias se hacen en la GPU sin pasar por la memoria del proceso:
+
+        for (size_t i = 0; i + 2 < moves.size (); i += 3)
+        {
+            glCopyBufferSubData
+            (
+                GL_COPY_READ_BUFFER,
+                GL_COPY_WRITE_BUFFER,
+                GLintptr  (moves[i + 0]) * element_size,
+                GLintptr  (moves[i + 1]) * element_size,
+                GLsizeiptr(moves[i + 2]) * element_size
+            );
+        }
+
+        glBindBuffer (GL_COPY_READ_BUFFER,  0);
+        glBindBuffer (GL_COPY_WRITE_BUFFER, 0);
+
+        glDeleteBuffers (1, &buffer_id);
+
+        return new_buffer_id;
+    }
+
+    void Geometry_Pool::grow_vertex_buffer (Format_Buffer & buffer)
+    {
+        uint32_t old_capacity = buffer.allocator.get_capacity ();
+
+        buffer.allocator.grow ();
+
+        buffer.buffer_id = relocate (buffer.buffer_id, buffer.format.stride, buffer.allocator.get_capacity (), { 0, 0, old_capacity });
+
+        configure_vertex_array (buffer);
+    }
+
+    void Geometry_Pool::grow_index_buffer ()
+    {
+        uint32_t old_capacity = index_allocator.get_capacity ();
+
+        index_allocator.grow ();
+
+        index_buffer_id = relocate (index_buffer_id, sizeof(uint16_t), index_allocator.get_capacity (), { 0, 0, old_capacity });
+
+        // Todos los VAOs apuntan al búfer de índices anterior:
+
+        for (auto & buffer : formats) configure_vertex_array (*buffer);
+    }
+
+    void Geometry_Pool::defragment ()
+    {
+        // Si se colocan los bloques de mayor a menor en un reparto vacío, cada uno cae justo detrás del
+        // anterior (todos son potencias de dos) y el espacio libre queda en un solo bloque al final:
+
+        auto repack = [] (Buddy_Allocator & allocator, uint32_t minimum_capacity, auto get_offset, auto get_size, vector< Mesh > & members) -> vector< uint32_t >
+        {
+            sort
+            (
+                members.begin (), members.end (),
+                [&] (Mesh a, Mesh b) { return allocator.get_block_size (get_offset (a)) > allocator.get_block_size (get_offset (b)); }
+            );
+
+            uint32_t capacity = max (minimum_capacity, allocator.get_statistics ().allocated);
+
+            Buddy_Allocator packed(capacity, minimum_block);
+
+            vector< uint32_t > moves;
+
+            for (Mesh mesh : members)
+            {
+                uint32_t offset = packed.allocate (get_size (mesh));
+
+                assert(offset != Buddy_Allocator::INVALID);
+
+                moves.insert (moves.end (), { get_offset (mesh), offset, get_size (mesh) });
+            }
+
+            allocator = packed;
+
+            return moves;
+        };
+
+        for (uint32_t format_index = 0; format_index < formats.size (); ++format_index)
+        {
+            Format_Buffer & buffer = *formats[format_index];
+
+            vector< Mesh > members;
+
+            for (Mesh mesh = 0; mesh < meshes.size (); ++mesh)
+            {
+                if (meshes[mesh].format == format_index) members.push_back (mesh);
+            }
+
+            vector< uint32_t > moves = repack
+            (
+                buffer.allocator, initial_vertex_capacity,
+                [this] (Mesh mesh) { return uint32_t(meshes[mesh].range.base_vertex ); },
+                [this] (Mesh mesh) { return uint32_t(meshes[mesh].range.vertex_count); },
+                members
+            );
+
+            buffer.buffer_id = relocate (buffer.buffer_id, buffer.format.stride, buffer.allocator.get_capacity (), moves);
+
+            for (size_t i = 0; i < members.size (); ++i)
+            {
+                meshes[members[i]].range.base_vertex = GLint(moves[i * 3 + 1]);
+            }
+        }
+
+        // Índices (son relativos al vértice base, así que no cambian al mover los vértices):
+
+        vector< Mesh > indexed;
+
+        for (Mesh mesh = 0; mesh < meshes.size (); ++mesh)
+        {
+            if (meshes[mesh].format != NO_MESH && meshes[mesh].range.index_count > 0) indexed.push_back (mesh);
+        }
+
+        vector< uint32_t > moves = repack
+        (
+            index_allocator, initial_index_capacity,
+            [this] (Mesh mesh) { return uint32_t(meshes[mesh].range.first_index); },
+            [this] (Mesh mesh) { return uint32_t(meshes[mesh].range.index_count); },
+            indexed
+        );
+
+        index_buffer_id = relocate (index_buffer_id, sizeof(uint16_t), index_allocator.get_capacity (), moves);
+
+        for (size_t i = 0; i < indexed.size (); ++i)
+        {
+            meshes[indexed[i]].range.first_index = GLsizei(moves[i * 3 + 1]);
+        }
+
+        for (auto & buffer : formats) configure_vertex_array (*buffer);
+    }
+
+    Geometry_Pool::Statistics Geometry_Pool::get_statistics () const
+    {
+        Statistics statistics{};
+
+        statistics.buffer_count       = formats.size () + 1;
+        statistics.vertex_array_count = formats.size ();
+        statistics.mesh_count         = meshes.size () - free_meshes.size ();
+
+        auto add = [&statistics] (const Buddy_Allocator & allocator, size_t element_size)
+        {
+            Buddy_Allocator::Statistics buffer = allocator.get_statistics ();
+
+            statistics.capacity_bytes += size_t(buffer.capacity ) * element_size;
+            statistics.used_bytes     += size_t(buffer.requested) * element_size;
+            statistics.fragmentation   = max (statistics.fragmentation, buffer.fragmentation ());
+        };
+
+        for (auto & buffer : formats) add (buffer->allocator, size_t(buffer->format.stride));
+
+        add (index_allocator, sizeof(uint16_t));
+
+        statistics.utilisation = statistics.capacity_bytes ? float(statistics.used_bytes) / float(statistics.capacity_bytes) : 0.f;
+
+        return statistics;
+    }
+
+}
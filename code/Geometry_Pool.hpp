@@ -0,0 +1,163 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstdint>
+#include <glad/glad.h>
+#include <memory>
+#include <vector>
+#include "Buddy_Allocator.hpp"
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Almacén compartido de la geometría estática. En lugar de que cada malla tenga sus propios
+    ///     VBOs y su VAO, los vértices de todas las mallas con el mismo formato van intercalados en un
+    ///     mismo búfer grande y todos los índices (de 16 bits) en otro. Cada formato tiene un solo VAO,
+    ///     por lo que dibujar mallas distintas del mismo formato no cambia de VAO: solo cambian el
+    ///     primer índice y el vértice base de glDrawElementsBaseVertex.
+    ///
+    ///     El espacio de los búferes se reparte con un Buddy_Allocator por búfer (en vértices o en
+    ///     índices). Cuando no queda un hueco que baste, el búfer dobla su tamaño. defragment() vuelve a
+    ///     colocar todas las mallas juntas desde el principio, copiando los datos dentro de la GPU.
+    ///
+    ///     Las mallas se identifican con un Mesh que no cambia al desfragmentar; su posición actual se
+    ///     consulta con get_range().
+    /// </summary>
+    class Geometry_Pool
+    {
+    public:
+
+        typedef uint32_t Mesh;
+
+        static const Mesh NO_MESH = ~0u;
+
+        struct Attribute
+        {
+            GLuint    location;                     // layout (location = ...) del vertex shader
+            GLint     components;
+            GLenum    type;
+            GLboolean normalized;
+            GLuint    offset;                       // Dentro del vértice
+        };
+
+        struct Vertex_Format
+        {
+            std::vector< Attribute > attributes;
+            GLsizei                  stride;
+
+            bool operator == (const Vertex_Format & other) const;
+        };
+
+        /// Lo necesario para dibujar una malla:
+        struct Mesh_Range
+        {
+            GLuint  vertex_array_id;
+            GLint   base_vertex;
+            GLsizei vertex_count;
+            GLsizei first_index;
+            GLsizei index_count;                    // 0 si la malla no tiene índices
+        };
+
+        struct Statistics
+        {
+            size_t buffer_count;                    // Búferes de la GPU (uno por formato más el de índices)
+            size_t vertex_array_count;
+            size_t mesh_count;
+            size_t capacity_bytes;
+            size_t used_bytes;                      // Bytes de los vértices e índices de las mallas
+            float  utilisation;                     // used_bytes / capacity_bytes
+            float  fragmentation;                   // Peor fragmentación externa entre los búferes (ver Buddy_Allocator)
+        };
+
+    private:
+
+        static const GLsizei initial_vertex_capacity = 64 * 1024;
+        static const GLsizei initial_index_capacity  = 256 * 1024;
+        static const GLsizei minimum_block           = 64;         // Vértices o índices
+
+        struct Format_Buffer
+        {
+            Vertex_Format   format;
+            GLuint          buffer_id;
+            GLuint          vertex_array_id;
+            Buddy_Allocator allocator;
+        };
+
+        struct Mesh_Entry
+        {
+            uint32_t   format;                      // Posición en formats o NO_MESH si la entrada está libre
+            Mesh_Range range;
+        };
+
+        std::vector< std::unique_ptr< Format_Buffer > > formats;
+
+        GLuint          index_buffer_id;
+        Buddy_Allocator index_allocator;
+
+        std::vector< Mesh_Entry > meshes;
+        std::vector< Mesh       > free_meshes;      // Entradas de meshes que se pueden reutilizar
+
+    public:
+
+        Geometry_Pool();
+       ~Geometry_Pool();
+
+        Geometry_Pool(const Geometry_Pool & ) = delete;
+
+        Geometry_Pool & operator = (const Geometry_Pool & ) = delete;
+
+    public:
+
+        /// Copia los vértices (intercalados según format) y los índices, que son relativos al primer
+        /// vértice de la malla. indices puede ser nullptr para mallas que se dibujan sin índices:
+        Mesh create_mesh
+        (
+            const Vertex_Format  & format,
+            const void           * vertices,
+            GLsizei                vertex_count,
+            const uint16_t       * indices     = nullptr,
+            GLsizei                index_count = 0
+        );
+
+        void destroy_mesh (Mesh mesh);
+
+        const Mesh_Range & get_range (Mesh mesh) const
+        {
+            return meshes[mesh].range;
+        }
+
+        /// Activa el VAO del formato de la malla y la dibuja:
+        void draw (Mesh mesh, GLenum primitive) const;
+
+        /// Junta las mallas de cada búfer al principio y reduce los búferes a lo necesario (sin bajar
+        /// de su tamaño inicial):
+        void defragment ();
+
+        Statistics get_statistics () const;
+
+    private:
+
+        uint32_t find_format (const Vertex_Format & format);
+
+        void     configure_vertex_array (const Format_Buffer & buffer) const;
+
+        /// Copia a un búfer nuevo de new_capacity elementos los rangos indicados (posición anterior,
+        /// posición nueva, tamaño, en elementos) y retorna su id:
+        GLuint   relocate
+        (
+            GLuint            buffer_id,
+            GLsizeiptr        element_size,
+            uint32_t          new_capacity,
+            const std::vector< uint32_t > & moves
+        ) const;
+
+        void     grow_vertex_buffer (Format_Buffer & buffer);
+        void     grow_index_buffer  ();
+
+    };
+
+}
@@ -0,0 +1,578 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Height_Archive.hpp"
+#include "Job_System.hpp"
+#include "simd-recipes.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#ifdef _WIN32
+    #ifndef  WIN32_LEAN_AND_MEAN
+    #define  WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef  NOMINMAX
+    #define  NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace udit
+{
+
+    namespace
+    {
+
+        struct Header
+        {
+            char     magic[4];
+            uint32_t width;
+            uint32_t depth;
+            uint32_t tile_size;
+            uint32_t bits;
+            uint32_t tiles_x;
+            uint32_t tiles_z;
+            uint32_t reserved;
+        };
+
+        const char archive_magic[4] = { 'H', 'T', 'A', '1' };
+
+        const unsigned UNARY_LIMIT = 24;            // Con más unos se guarda el valor entero
+        const unsigned ESCAPE_BITS = 17;            // Bits de una diferencia de 16 bits en zigzag
+
+        /// Parámetro del código de Rice que se adapta a la media de las últimas diferencias (como en
+        /// LOCO-I): el menor k tal que count * 2^k >= total:
+        struct Rice_Model
+        {
+            uint32_t total = 4;
+            uint32_t count = 1;
+
+            unsigned parameter () const
+            {
+                unsigned k = 0;
+
+                while ((count << k) < total) ++k;
+
+                return k;
+            }
+
+            void update (uint32_t value)
+            {
+                total += value;
+
+                if (++count == 64)
+                {
+                    total >>= 1;
+                    count >>= 1;
+                }
+            }
+        };
+
+        class Bit_Writer
+        {
+            vector< uint8_t > & bytes;
+            uint64_t            buffer;
+            unsigned            count;
+
+        public:
+
+            Bit_Writer(vector< uint8_t > & bytes) : bytes(bytes), buffer(0), count(0)
+            {
+            }
+
+            /// Añade los bits bajos de value (bits <= 32, sin nada por encima):
+            void put (uint32_t value, unsigned bits)
+            {
+                buffer |= uint64_t(value) << count;
+                count  += bits;
+
+                while (count >= 8)
+                {
+                    bytes.push_back (uint8_t(buffer));
+
+                    buffer >>= 8;
+                    count   -= 8;
+                }
+            }
+
+            /// Código de Rice: value >> k unos seguidos de un cero y los k bits bajos de value:
+            void put_rice (uint32_t value, unsigned k)
+            {
+                uint32_t quotient = value >> k;
+
+                if (quotient < UNARY_LIMIT)
+                {
+                    put ((1u << quotient) - 1, quotient + 1);
+                    put (value & ((1u << k) - 1), k);
+                }
+                else
+                {
+                    put ((1u << UNARY_LIMIT) - 1, UNARY_LIMIT);
+                    put (value, ESCAPE_BITS);
+                }
+            }
+
+            void flush ()
+            {
+                if (count > 0) bytes.push_back (uint8_t(buffer));
+
+                buffer = 0;
+                count  = 0;
+            }
+        };
+
+        class Bit_Reader
+        {
+            const uint8_t * next;
+            const uint8_t * end;
+            uint64_t        buffer;
+            unsigned        count;
+
+        public:
+
+            Bit_Reader(const uint8_t * data, size_t size) : next(data), end(data + size), buffer(0), count(0)
+            {
+            }
+
+            /// Deja al menos 57 bits en el búfer (ceros al acabarse los datos). Lejos del final se leen
+            /// 8 bytes de una vez y se avanza solo lo que ha cabido:
+            void refill ()
+            {
+                if (end - next >= 8)
+                {
+                    uint64_t word;
+
+                    memcpy (&word, next, sizeof(word));
+
+                    buffer |= word << count;
+                    next   += (63 - count) >> 3;
+                    count  |= 56;
+                }
+                else while (count <= 56)
+                {
+                    uint64_t byte = next < end ? *next++ : 0;
+
+                    buffer |= byte << count;
+                    count  += 8;
+                }
+            }
+
+            /// Quita bits del búfer (tiene que haberlos):
+            uint32_t take (unsigned bits)
+            {
+                uint32_t value = uint32_t(buffer) & ((1u << bits) - 1);
+
+                buffer >>= bits;
+                count   -= bits;
+
+                return value;
+            }
+
+            /// Con un solo refill() caben los unos, el cero y los bits bajos de cualquier código:
+            uint32_t get_rice (unsigned k)
+            {
+                refill ();
+
+                // Los unos iniciales se cuentan de una vez buscando el primer cero:
+
+                unsigned quotient = lowest_set_bit (~uint32_t(buffer) | (1u << UNARY_LIMIT));
+
+                if (quotient < UNARY_LIMIT)
+                {
+                    take (quotient + 1);
+
+                    return (quotient << k) | take (k);
+                }
+
+                take (UNARY_LIMIT);
+
+                return take (ESCAPE_BITS);
+            }
+        };
+
+        /// Predicción de un valor a partir de los de su izquierda (a), arriba (b) y arriba a la
+        /// izquierda (c). La primera fila usa solo a y la primera columna solo b:
+        inline int32_t predict (const int32_t * row, const int32_t * above, unsigned x, unsigned z)
+        {
+            if (z == 0) return x > 0 ? row[x - 1] : 0;
+            if (x == 0) return above[0];
+
+            int32_t a = row  [x - 1];
+            int32_t b = above[x];
+            int32_t c = above[x - 1];
+
+            if (c >= max (a, b)) return min (a, b);
+            if (c <= min (a, b)) return max (a, b);
+
+            return a + b - c;
+        }
+
+        inline uint32_t zigzag   (int32_t  value) { return (uint32_t(value) << 1) ^ uint32_t(value >> 31); }
+        inline int32_t  unzigzag (uint32_t value) { return int32_t(value >> 1) ^ -int32_t(value & 1); }
+
+        /// Cuantiza y comprime el tile que empieza en (x0, z0). Retorna sus cotas en tile:
+        void encode_tile
+        (
+            const Height_Map      & height_map,
+            unsigned                x0,
+            unsigned                z0,
+            unsigned                bits,
+            vector< uint8_t >     & bytes,
+            Height_Archive::Tile  & tile
+        )
+        {
+            unsigned width  = min (unsigned(Height_Archive::TILE_SIZE), height_map.get_width () - x0);
+            unsigned depth  = min (unsigned(Height_Archive::TILE_SIZE), height_map.get_depth () - z0);
+            int32_t  top    = (1 << bits) - 1;
+            float    scale  = float(top);
+
+            vector< int32_t > values(size_t(width) * depth);
+
+            int32_t low = top, high = 0;
+
+            for (unsigned z = 0; z < depth; ++z)
+            {
+                const float * heights = height_map.get_row (z0 + z) + x0;
+
+                for (unsigned x = 0; x < width; ++x)
+                {
+                    int32_t value = min (max (int32_t(heights[x] * scale + .5f), 0), top);
+
+                    values[size_t(z) * width + x] = value;
+
+                    low  = min (low,  value);
+                    high = max (high, value);
+                }
+            }
+
+            tile.min  = uint16_t(low);
+            tile.max  = uint16_t(high);
+            tile.size = 0;
+
+            if (low == high) return;
+
+            Bit_Writer writer(bytes);
+            Rice_Model model;
+
+            for (unsigned z = 0; z < depth; ++z)
+            {
+                int32_t * row   = values.data () + size_t(z) * width;
+                int32_t * above = row - width;
+
+                for (unsigned x = 0; x < width; ++x) row[x] -= low;
+
+                for (unsigned x = 0; x < width; ++x)
+                {
+                    uint32_t residual = zigzag (row[x] - predict (row, above, x, z));
+
+                    writer.put_rice (residual, model.parameter ());
+                    model .update   (residual);
+                }
+            }
+
+            writer.flush ();
+
+            tile.size = uint32_t(bytes.size ());
+        }
+
+    }
+
+    Height_Archive::Height_Archive()
+    :
+        data     (nullptr),
+        data_size(0),
+        tiles    (nullptr),
+        width    (0),
+        depth    (0),
+        bits     (0),
+        tiles_x  (0),
+        tiles_z  (0),
+        step     (0.f)
+    {
+    }
+
+    Height_Archive::~Height_Archive()
+    {
+        if (data)
+        {
+            #ifdef _WIN32
+                UnmapViewOfFile (data);
+            #else
+                munmap (const_cast< uint8_t * >(data), data_size);
+            #endif
+        }
+    }
+
+    bool Height_Archive::write (const string & path, const Height_Map & height_map, unsigned bits)
+    {
+        assert(bits == 8 || bits == 16);
+
+        Header header;
+
+        memcpy (header.magic, archive_magic, sizeof(archive_magic));
+
+        header.width     = height_map.get_width ();
+        header.depth     = height_map.get_depth ();
+        header.tile_size = TILE_SIZE;
+        header.bits      = bits;
+        header.tiles_x   = (header.width + TILE_SIZE - 1) / TILE_SIZE;
+        header.tiles_z   = (header.depth + TILE_SIZE - 1) / TILE_SIZE;
+        header.reserved  = 0;
+
+        size_t tile_count = size_t(header.tiles_x) * header.tiles_z;
+
+        vector< Tile >              directory(tile_count);
+        vector< vector< uint8_t > > streams  (tile_count);
+
+        Job_System::get_instance ().parallel_for
+        (
+            tile_count,
+            [&] (size_t first, size_t last)
+            {
+                for (size_t i = first; i < last; ++i)
+                {
+                    unsigned x0 = unsigned(i % header.tiles_x) * TILE_SIZE;
+                    unsigned z0 = unsigned(i / header.tiles_x) * TILE_SIZE;
+
+                    encode_tile (height_map, x0, z0, bits, streams[i], directory[i]);
+                }
+            },
+            4
+        );
+
+        // Los datos de cada tile empiezan en un múltiplo de 8 para poder leerlos directamente del
+        // fichero proyectado:
+
+        uint64_t offset = sizeof(Header) + tile_count * sizeof(Tile);
+
+        for (size_t i = 0; i < tile_count; ++i)
+        {
+            directory[i].offset = offset;
+
+            offset = (offset + directory[i].size + 7) & ~uint64_t(7);
+        }
+
+        ofstream file(path, ios::binary | ios::trunc);
+
+        file.write (reinterpret_cast< const char * >(&header), sizeof(header));
+        file.write (reinterpret_cast< const char * >(directory.data ()), streamsize(tile_count * sizeof(Tile)));
+
+        const char padding[8] = { };
+
+        for (size_t i = 0; i < tile_count; ++i)
+        {
+            file.write (reinterpret_cast< const char * >(streams[i].data ()), streamsize(streams[i].size ()));
+            file.write (padding, streamsize((8 - streams[i].size () % 8) % 8));
+        }
+
+        return bool(file);
+    }
+
+    unique_ptr< Height_Archive > Height_Archive::open (const string & path)
+    {
+        unique_ptr< Height_Archive > archive(new Height_Archive);
+
+        // Se proyecta el fichero entero en memoria. El sistema solo lee las páginas que se tocan:
+
+        #ifdef _WIN32
+
+            HANDLE file = CreateFileA (path.c_str (), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+            if (file == INVALID_HANDLE_VALUE) return nullptr;
+
+            LARGE_INTEGER size;
+
+            if (GetFileSizeEx (file, &size) && size.QuadPart >= LONGLONG(sizeof(Header)))
+            {
+                HANDLE mapping = CreateFileMappingA (file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+                if (mapping)
+                {
+                    archive->data      = static_cast< const uint8_t * >(MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, 0));
+                    archive->data_size = size_t(size.QuadPart);
+
+                    CloseHandle (mapping);
+                }
+            }
+
+            CloseHandle (file);
+
+        #else
+
+            int file = ::open (path.c_str (), O_RDONLY);
+
+            if (file < 0) return nullptr;
+
+            struct stat status;
+
+            if (fstat (file, &status) == 0 && size_t(status.st_size) >= sizeof(Header))
+            {
+                void * mapped = mmap (nullptr, size_t(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+
+                if (mapped != MAP_FAILED)
+                {
+                    archive->data      = static_cast< const uint8_t * >(mapped);
+                    archive->data_size = size_t(status.st_size);
+                }
+            }
+
+            close (file);
+
+        #endif
+
+        if (!archive->data) return nullptr;
+
+        // Se comprueba la cabecera y que todos los tiles quedan dentro del fichero:
+
+        Header header;
+
+        memcpy (&header, archive->data, sizeof(header));
+
+        size_t tile_count = size_t(header.tiles_x) * header.tiles_z;
+
+        if
+        (
+            memcmp (header.magic, archive_magic, sizeof(archive_magic)) != 0  ||
+            header.tile_size != TILE_SIZE                                      ||
+            (header.bits != 8 && header.bits != 16)                            ||
+            header.width < 2 || header.depth < 2                               ||
+            header.tiles_x   != (header.width + TILE_SIZE - 1) / TILE_SIZE     ||
+            header.tiles_z   != (header.depth + TILE_SIZE - 1) / TILE_SIZE     ||
+            archive->data_size < sizeof(Header) + tile_count * sizeof(Tile)
+        )
+        {
+            return nullptr;
+        }
+
+        archive->tiles   = reinterpret_cast< const Tile * >(archive->data + sizeof(Header));
+        archive->width   = header.width;
+        archive->depth   = header.depth;
+        archive->bits    = header.bits;
+        archive->tiles_x = header.tiles_x;
+        archive->tiles_z = header.tiles_z;
+        archive->step    = 1.f / float((1u << header.bits) - 1);
+
+        for (size_t i = 0; i < tile_count; ++i)
+        {
+            const Tile & tile = archive->tiles[i];
+
+            if (tile.offset > archive->data_size || tile.size > archive->data_size - tile.offset || tile.min > tile.max) return nullptr;
+        }
+
+        return archive;
+    }
+
+    void Height_Archive::decode_tile (unsigned tile_x, unsigned tile_z, float * heights, size_t stride) const
+    {
+        assert(tile_x < tiles_x && tile_z < tiles_z);
+
+        const Tile & tile  = tiles[size_t(tile_z) * tiles_x + tile_x];
+        unsigned     x0    = tile_x * TILE_SIZE;
+        unsigned     z0    = tile_z * TILE_SIZE;
+        unsigned     tile_width = min (unsigned(TILE_SIZE), width - x0);
+        unsigned     tile_depth = min (unsigned(TILE_SIZE), depth - z0);
+
+        if (tile.size == 0)
+        {
+            for (unsigned z = 0; z < tile_depth; ++z)
+            {
+                fill_n (heights + z * stride, tile_width, float(tile.min) * step);
+            }
+
+            return;
+        }
+
+        // Se guardan los valores de la fila anterior, que hacen falta para predecir los de la actual:
+
+        int32_t rows[2][TILE_SIZE];
+
+        Bit_Reader reader(data + tile.offset, tile.size);
+        Rice_Model model;
+
+        for (unsigned z = 0; z < tile_depth; ++z)
+        {
+            int32_t * row    = rows[ z      & 1];
+            int32_t * above  = rows[(z + 1) & 1];
+            float   * target = heights + z * stride;
+
+            for (unsigned x = 0; x < tile_width; ++x)
+            {
+                uint32_t residual = reader.get_rice (model.parameter ());
+
+                model.update (residual);
+
+                row   [x] = predict (row, above, x, z) + unzigzag (residual);
+                target[x] = float(row[x] + tile.min) * step;
+            }
+        }
+    }
+
+    void Height_Archive::decode (const Height_Map::Region & region, float * heights) const
+    {
+        assert(region.x + region.width <= width && region.z + region.depth <= depth);
+
+        if (region.width == 0 || region.depth == 0) return;
+
+        float tile_heights[TILE_SIZE * TILE_SIZE];
+
+        for (unsigned tile_z = region.z / TILE_SIZE; tile_z <= (region.z + region.depth - 1) / TILE_SIZE; ++tile_z)
+        {
+            for (unsigned tile_x = region.x / TILE_SIZE; tile_x <= (region.x + region.width - 1) / TILE_SIZE; ++tile_x)
+            {
+                decode_tile (tile_x, tile_z, tile_heights, TILE_SIZE);
+
+                // Parte del tile que cae dentro de la región:
+
+                unsigned x0 = max (tile_x * TILE_SIZE, region.x);
+                unsigned z0 = max (tile_z * TILE_SIZE, region.z);
+                unsigned x1 = min ((tile_x + 1) * TILE_SIZE, region.x + region.width);
+                unsigned z1 = min ((tile_z + 1) * TILE_SIZE, region.z + region.depth);
+
+                for (unsigned z = z0; z < z1; ++z)
+                {
+                    const float * source = tile_heights + (z - tile_z * TILE_SIZE) * TILE_SIZE + (x0 - tile_x * TILE_SIZE);
+
+                    copy (source, source + (x1 - x0), heights + size_t(z - region.z) * region.width + (x0 - region.x));
+                }
+            }
+        }
+    }
+
+    unique_ptr< Height_Map > Height_Archive::decode () const
+    {
+        auto height_map = make_unique< Height_Map > (width, depth);
+
+        float * heights = height_map->get_row (0);
+
+        Job_System::get_instance ().parallel_for
+        (
+            size_t(tiles_x) * tiles_z,
+            [&] (size_t first, size_t last)
+            {
+                for (size_t i = first; i < last; ++i)
+                {
+                    unsigned tile_x = unsigned(i % tiles_x);
+                    unsigned tile_z = unsigned(i / tiles_x);
+
+                    decode_tile (tile_x, tile_z, heights + size_t(tile_z) * TILE_SIZE * width + tile_x * TILE_SIZE, width);
+                }
+            },
+            4
+        );
+
+        return height_map;
+    }
+
+}
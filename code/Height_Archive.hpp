@@ -0,0 +1,126 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "Height_Map.hpp"
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Mapa de alturas comprimido por tiles en un fichero que se proyecta en memoria, de modo que
+    ///     se puede leer cualquier tile sin leer ni descomprimir el resto del mapa.
+    ///
+    ///     Cada tile de TILE_SIZE x TILE_SIZE alturas se cuantiza con 8 o 16 bits entre su mínimo y su
+    ///     máximo (sin pérdidas si el mapa original tenía esos bits). Cada valor se predice a partir de
+    ///     sus vecinos de la izquierda, de arriba y de arriba a la izquierda (el predictor MED de
+    ///     LOCO-I) y se guarda la diferencia con un código de Rice cuyo parámetro se adapta a las
+    ///     últimas diferencias, igual en quien escribe y en quien lee, sin guardar nada más. Los tiles
+    ///     planos no ocupan nada.
+    ///
+    ///     El fichero tiene una cabecera, un directorio con el desplazamiento, el tamaño y las cotas
+    ///     de cada tile (que sirven para acotar consultas sin descomprimir) y los datos de los tiles,
+    ///     cada uno alineado a 8 bytes. Todo en little-endian y con tamaños fijos.
+    /// </summary>
+    class Height_Archive
+    {
+    public:
+
+        static const unsigned TILE_SIZE = 64;
+
+        /// Entrada del directorio (16 bytes por tile):
+        struct Tile
+        {
+            uint64_t offset;                        // Desde el principio del fichero
+            uint32_t size;                          // Bytes de datos (0 si el tile es plano)
+            uint16_t min;                           // Cotas de los valores cuantizados del tile
+            uint16_t max;
+        };
+
+    private:
+
+        const uint8_t * data;                       // Fichero proyectado en memoria
+        size_t          data_size;
+        const Tile    * tiles;
+        unsigned        width;
+        unsigned        depth;
+        unsigned        bits;
+        unsigned        tiles_x;
+        unsigned        tiles_z;
+        float           step;                       // Altura de cada valor cuantizado
+
+    private:
+
+        Height_Archive();
+
+    public:
+
+        /// Comprime height_map cuantizando las alturas con bits bits (8 o 16) y lo guarda en path.
+        /// Los tiles se comprimen en paralelo. Retorna false si no se ha podido escribir:
+        static bool write (const std::string & path, const Height_Map & height_map, unsigned bits = 16);
+
+        /// Proyecta en memoria el fichero de path. Retorna nullptr si no se puede abrir o no es válido:
+        static std::unique_ptr< Height_Archive > open (const std::string & path);
+
+       ~Height_Archive();
+
+        Height_Archive(const Height_Archive & ) = delete;
+
+        Height_Archive & operator = (const Height_Archive & ) = delete;
+
+    public:
+
+        unsigned get_width () const
+        {
+            return width;
+        }
+
+        unsigned get_depth () const
+        {
+            return depth;
+        }
+
+        unsigned get_tiles_x () const
+        {
+            return tiles_x;
+        }
+
+        unsigned get_tiles_z () const
+        {
+            return tiles_z;
+        }
+
+        /// Bytes del fichero:
+        size_t get_size () const
+        {
+            return data_size;
+        }
+
+        /// Altura mínima y máxima del tile sin descomprimirlo:
+        void get_tile_bounds (unsigned tile_x, unsigned tile_z, float & min, float & max) const
+        {
+            const Tile & tile = tiles[size_t(tile_z) * tiles_x + tile_x];
+
+            min = float(tile.min) * step;
+            max = float(tile.max) * step;
+        }
+
+        /// Descomprime el tile en heights, cuyas filas empiezan cada stride alturas:
+        void decode_tile (unsigned tile_x, unsigned tile_z, float * heights, size_t stride) const;
+
+        /// Descomprime solo los tiles que tocan region y copia sus alturas en heights por filas de
+        /// region.width (no usa hilos, para poder llamarlo desde los trabajos del streaming):
+        void decode (const Height_Map::Region & region, float * heights) const;
+
+        /// Descomprime el mapa entero repartiendo los tiles entre los hilos del sistema de trabajos:
+        std::unique_ptr< Height_Map > decode () const;
+
+    };
+
+}
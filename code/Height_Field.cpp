@@ -0,0 +1,310 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Height_Field.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#ifdef __AVX2__
+    #include <immintrin.h>                  // AVX2
+#else
+    #include <emmintrin.h>                  // SSE2
+#endif
+
+using namespace std;
+
+namespace udit
+{
+
+    Height_Field::Height_Field(const Height_Map & height_map, const Height_Pyramid & pyramid, const glm::vec3 & size)
+    :
+        height_map(height_map),
+        pyramid   (pyramid),
+        size      (size),
+        cell_x    (size.x / float(height_map.get_width () - 1)),
+        cell_z    (size.z / float(height_map.get_depth () - 1))
+    {
+        assert(pyramid.get_width (0) == height_map.get_width () - 1 && pyramid.get_depth (0) == height_map.get_depth () - 1);
+    }
+
+    float Height_Field::height_at (float x, float z) const
+    {
+        return height_map.sample (x / size.x + .5f, z / size.z + .5f) * size.y;
+    }
+
+    void Height_Field::height_at (const float * x, const float * z, float * heights, size_t count) const
+    {
+        const unsigned width = height_map.get_width ();
+        const float  * data  = height_map.get_row (0);
+
+        size_t i = 0;
+
+        #ifdef __AVX2__
+
+            // 8 puntos a la vez: las cuatro alturas de cada celda se leen con gather:
+
+            const __m256  scale_x   = _mm256_set1_ps (float(width - 1) / size.x);
+            const __m256  scale_z   = _mm256_set1_ps (float(height_map.get_depth () - 1) / size.z);
+            const __m256  offset_x  = _mm256_set1_ps (float(width - 1) * .5f);
+            const __m256  offset_z  = _mm256_set1_ps (float(height_map.get_depth () - 1) * .5f);
+            const __m256  last_x    = _mm256_set1_ps (float(width - 2));
+            const __m256  last_z    = _mm256_set1_ps (float(height_map.get_depth () - 2));
+            const __m256  end_x     = _mm256_set1_ps (float(width - 1));
+            const __m256  end_z     = _mm256_set1_ps (float(height_map.get_depth () - 1));
+            const __m256  zero      = _mm256_setzero_ps ();
+            const __m256  height    = _mm256_set1_ps (size.y);
+            const __m256i row       = _mm256_set1_epi32 (int(width));
+            const __m256i one       = _mm256_set1_epi32 (1);
+
+            for ( ; i + 8 <= count; i += 8)
+            {
+                // Posición en celdas, limitada al mapa, y la celda que la contiene (la última fila y
+                // columna de alturas usan la celda anterior):
+
+                __m256 u  = _mm256_min_ps (_mm256_max_ps (_mm256_fmadd_ps (_mm256_loadu_ps (x + i), scale_x, offset_x), zero), end_x);
+                __m256 v  = _mm256_min_ps (_mm256_max_ps (_mm256_fmadd_ps (_mm256_loadu_ps (z + i), scale_z, offset_z), zero), end_z);
+                __m256 x0 = _mm256_min_ps (_mm256_floor_ps (u), last_x);
+                __m256 z0 = _mm256_min_ps (_mm256_floor_ps (v), last_z);
+                __m256 fx = _mm256_sub_ps (u, x0);
+                __m256 fz = _mm256_sub_ps (v, z0);
+
+                __m256i index0 = _mm256_add_epi32 (_mm256_mullo_epi32 (_mm256_cvttps_epi32 (z0), row), _mm256_cvttps_epi32 (x0));
+                __m256i index1 = _mm256_add_epi32 (index0, row);
+
+                __m256 h00 = _mm256_i32gather_ps (data, index0, 4);
+                __m256 h10 = _mm256_i32gather_ps (data, _mm256_add_epi32 (index0, one), 4);
+                __m256 h01 = _mm256_i32gather_ps (data, index1, 4);
+                __m256 h11 = _mm256_i32gather_ps (data, _mm256_add_epi32 (index1, one), 4);
+
+                __m256 top    = _mm256_fmadd_ps (_mm256_sub_ps (h10, h00), fx, h00);
+                __m256 bottom = _mm256_fmadd_ps (_mm256_sub_ps (h11, h01), fx, h01);
+
+                _mm256_storeu_ps (heights + i, _mm256_mul_ps (_mm256_fmadd_ps (_mm256_sub_ps (bottom, top), fz, top), height));
+            }
+
+        #else
+
+            // 4 puntos a la vez. SSE2 no tiene gather ni producto de enteros de 32 bits, así que los
+            // índices se calculan fuera de los registros y solo la interpolación es vectorial:
+
+            const __m128 scale_x   = _mm_set1_ps (float(width - 1) / size.x);
+            const __m128 scale_z   = _mm_set1_ps (float(height_map.get_depth () - 1) / size.z);
+            const __m128 offset_x  = _mm_set1_ps (float(width - 1) * .5f);
+            const __m128 offset_z  = _mm_set1_ps (float(height_map.get_depth () - 1) * .5f);
+            const __m128 last_x    = _mm_set1_ps (float(width - 2));
+            const __m128 last_z    = _mm_set1_ps (float(height_map.get_depth () - 2));
+            const __m128 end_x     = _mm_set1_ps (float(width - 1));
+            const __m128 end_z     = _mm_set1_ps (float(height_map.get_depth () - 1));
+            const __m128 zero      = _mm_setzero_ps ();
+            const __m128 height    = _mm_set1_ps (size.y);
+
+            for ( ; i + 4 <= count; i += 4)
+            {
+                __m128 u  = _mm_min_ps (_mm_max_ps (_mm_add_ps (_mm_mul_ps (_mm_loadu_ps (x + i), scale_x), offset_x), zero), end_x);
+                __m128 v  = _mm_min_ps (_mm_max_ps (_mm_add_ps (_mm_mul_ps (_mm_loadu_ps (z + i), scale_z), offset_z), zero), end_z);
+                __m128 x0 = _mm_min_ps (_mm_cvtepi32_ps (_mm_cvttps_epi32 (u)), last_x);     // u >= 0: truncar es redondear hacia abajo
+                __m128 z0 = _mm_min_ps (_mm_cvtepi32_ps (_mm_cvttps_epi32 (v)), last_z);
+                __m128 fx = _mm_sub_ps (u, x0);
+                __m128 fz = _mm_sub_ps (v, z0);
+
+                alignas(16) int column[4], line[4];
+
+                _mm_store_si128 (reinterpret_cast< __m128i * >(column), _mm_cvttps_epi32 (x0));
+                _mm_store_si128 (reinterpret_cast< __m128i * >(line  ), _mm_cvttps_epi32 (z0));
+
+                alignas(16) float h00[4], h10[4], h01[4], h11[4];
+
+                for (int lane = 0; lane < 4; ++lane)
+                {
+                    const float * corner = data + size_t(line[lane]) * width + column[lane];
+
+                    h00[lane] = corner[0];
+                    h10[lane] = corner[1];
+                    h01[lane] = corner[width];
+                    h11[lane] = corner[width + 1];
+                }
+
+                __m128 top    = _mm_add_ps (_mm_load_ps (h00), _mm_mul_ps (_mm_sub_ps (_mm_load_ps (h10), _mm_load_ps (h00)), fx));
+                __m128 bottom = _mm_add_ps (_mm_load_ps (h01), _mm_mul_ps (_mm_sub_ps (_mm_load_ps (h11), _mm_load_ps (h01)), fx));
+
+                _mm_storeu_ps (heights + i, _mm_mul_ps (_mm_add_ps (top, _mm_mul_ps (_mm_sub_ps (bottom, top), fz)), height));
+            }
+
+        #endif
+
+        for ( ; i < count; ++i)
+        {
+            heights[i] = height_at (x[i], z[i]);
+        }
+    }
+
+    bool Height_Field::intersect_ray (const glm::vec3 & origin, const glm::vec3 & direction, float max_distance, float & distance) const
+    {
+        // Las componentes nulas de la dirección se sustituyen por una muy pequeña para que el corte con
+        // las cajas no divida entre 0:
+
+        glm::vec3 inverse_direction;
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float component = abs (direction[axis]) > 1e-12f ? direction[axis] : 1e-12f;
+
+            inverse_direction[axis] = 1.f / component;
+        }
+
+        bool hit = false;
+
+        distance = max_distance;
+
+        intersect_node (pyramid.get_level_count () - 1, 0, 0, origin, inverse_direction, direction, distance, hit);
+
+        return hit;
+    }
+
+    void Height_Field::intersect_node
+    (
+        unsigned            level,
+        unsigned            x,
+        unsigned            z,
+        const glm::vec3   & origin,
+        const glm::vec3   & inverse_direction,
+        const glm::vec3   & direction,
+        float             & distance,
+        bool              & hit
+    ) const
+    {
+        // Caja del nodo: las celdas del nivel 0 que cubre y sus alturas mínima y máxima:
+
+        unsigned first_x = x << level, last_x = min ((x + 1) << level, pyramid.get_width (0));
+        unsigned first_z = z << level, last_z = min ((z + 1) << level, pyramid.get_depth (0));
+
+        Height_Pyramid::Range range = pyramid.get (level, x, z);
+
+        glm::vec3 box_min(-size.x * .5f + float(first_x) * cell_x, range.min * size.y, -size.z * .5f + float(first_z) * cell_z);
+        glm::vec3 box_max(-size.x * .5f + float(last_x ) * cell_x, range.max * size.y, -size.z * .5f + float(last_z ) * cell_z);
+
+        glm::vec3 t0 = (box_min - origin) * inverse_direction;
+        glm::vec3 t1 = (box_max - origin) * inverse_direction;
+
+        glm::vec3 near = glm::min (t0, t1);
+        glm::vec3 far  = glm::max (t0, t1);
+
+        float enter = max (max (max (near.x, near.y), near.z), 0.f);
+        float exit  = min (min (min (far.x,  far.y ), far.z ), distance);
+
+        if (enter > exit) return;
+
+        if (level == 0)
+        {
+            float cell_distance;
+
+            if (intersect_cell (x, z, origin, direction, enter, exit, cell_distance))
+            {
+                distance = cell_distance;
+                hit      = true;
+            }
+
+            return;
+        }
+
+        // Se visitan primero los hijos más cercanos al origen del rayo, para que el corte que encuentren
+        // permita descartar los demás:
+
+        unsigned near_x = direction.x >= 0.f ? 0 : 1;
+        unsigned near_z = direction.z >= 0.f ? 0 : 1;
+
+        for (unsigned child = 0; child < 4; ++child)
+        {
+            unsigned child_x = x * 2 + (near_x ^ (child &  1));
+            unsigned child_z = z * 2 + (near_z ^ (child >> 1));
+
+            if (child_x < pyramid.get_width (level - 1) && child_z < pyramid.get_depth (level - 1))
+            {
+                intersect_node (level - 1, child_x, child_z, origin, inverse_direction, direction, distance, hit);
+            }
+        }
+    }
+
+    bool Height_Field::intersect_cell
+    (
+        unsigned            x,
+        unsigned            z,
+        const glm::vec3   & origin,
+        const glm::vec3   & direction,
+        float               t0,
+        float               t1,
+        float             & distance
+    ) const
+    {
+        // Dentro de la celda la superficie es h(u, v) = a + b u + c v + d u v, con u y v de 0 a 1. A lo
+        // largo del rayo, f(s) = h(u(s), v(s)) - y(s) es una parábola que pasa de negativa a positiva
+        // donde el rayo entra en el terreno. Se mide s desde t0 para no perder precisión lejos del origen:
+
+        float h00 = height_map.get (x,     z    ) * size.y;
+        float h10 = height_map.get (x + 1, z    ) * size.y;
+        float h01 = height_map.get (x,     z + 1) * size.y;
+        float h11 = height_map.get (x + 1, z + 1) * size.y;
+
+        float a = h00;
+        float b = h10 - h00;
+        float c = h01 - h00;
+        float d = h00 - h10 - h01 + h11;
+
+        glm::vec3 start = origin + direction * t0;
+
+        float u0 = (start.x + size.x * .5f) / cell_x - float(x);
+        float v0 = (start.z + size.z * .5f) / cell_z - float(z);
+        float du = direction.x / cell_x;
+        float dv = direction.z / cell_z;
+
+        float A = d * du * dv;
+        float B = b * du + c * dv + d * (u0 * dv + v0 * du) - direction.y;
+        float C = a + b * u0 + c * v0 + d * u0 * v0 - start.y;
+
+        float length = t1 - t0;
+
+        // El rayo ya empieza por debajo de la superficie al entrar en la celda:
+
+        if (C >= 0.f)
+        {
+            distance = t0;
+            return true;
+        }
+
+        float s;
+
+        if (abs (A) < 1e-9f)
+        {
+            if (B <= 0.f) return false;             // La recta no sube hacia la superficie
+
+            s = -C / B;
+        }
+        else
+        {
+            float discriminant = B * B - 4.f * A * C;
+
+            if (discriminant < 0.f) return false;
+
+            // Fórmula estable (sin restar cantidades parecidas). Como f(0) < 0, la primera raíz positiva
+            // es el punto de entrada:
+
+            float q  = -.5f * (B + copysign (sqrt (discriminant), B));
+            float r0 = q / A;
+            float r1 = q != 0.f ? C / q : r0;
+
+            if (r0 > r1) swap (r0, r1);
+
+            s = r0 >= 0.f ? r0 : r1;
+        }
+
+        if (s < 0.f || s > length) return false;
+
+        distance = t0 + s;
+
+        return true;
+    }
+
+}
@@ -0,0 +1,97 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstddef>
+#include <glm.hpp>
+#include "Height_Map.hpp"
+#include "Height_Pyramid.hpp"
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Consultas sobre la superficie del terreno en la CPU, en el espacio local del terreno (ocupa
+    ///     size.x x size.z centrado en el origen con alturas de [0, size.y], como Terrain y Terrain_Lod).
+    ///     La superficie es la interpolación bilineal de las alturas del mapa, la misma que muestrea la
+    ///     GPU, de modo que lo que se consulta coincide con lo que se ve.
+    ///
+    ///     Los rayos recorren el Height_Pyramid de arriba abajo descartando los nodos cuya caja no cortan
+    ///     o que quedan detrás del corte más cercano encontrado, y solo en las celdas que quedan se
+    ///     resuelve el corte exacto con la superficie (una ecuación de segundo grado por celda).
+    ///
+    ///     Guarda referencias al mapa y a sus cotas, por lo que ve sus cambios si se editan juntos.
+    /// </summary>
+    class Height_Field
+    {
+    private:
+
+        const Height_Map     & height_map;
+        const Height_Pyramid & pyramid;
+        glm::vec3              size;
+        float                  cell_x;                 // Tamaño de una celda del mapa
+        float                  cell_z;
+
+    public:
+
+        Height_Field(const Height_Map & height_map, const Height_Pyramid & pyramid, const glm::vec3 & size);
+
+        Height_Field(const Height_Field & ) = delete;
+
+        Height_Field & operator = (const Height_Field & ) = delete;
+
+    public:
+
+        const glm::vec3 & get_size () const
+        {
+            return size;
+        }
+
+        /// Indica si el punto (x, z) queda encima del terreno:
+        bool  contains (float x, float z) const
+        {
+            return x >= -size.x * .5f && x <= size.x * .5f && z >= -size.z * .5f && z <= size.z * .5f;
+        }
+
+        /// Altura de la superficie en (x, z). Fuera del terreno se toma la del borde más cercano:
+        float height_at (float x, float z) const;
+
+        /// Alturas de count puntos (x[i], z[i]) de una vez, de 4 u 8 en 4 u 8 con SIMD:
+        void  height_at (const float * x, const float * z, float * heights, size_t count) const;
+
+        /// Primer corte del rayo (direction normalizada) con la superficie a menos de max_distance.
+        /// Retorna false si no lo hay:
+        bool  intersect_ray (const glm::vec3 & origin, const glm::vec3 & direction, float max_distance, float & distance) const;
+
+    private:
+
+        /// Recorre el nodo (x, z) del nivel level si el rayo corta su caja antes de distance:
+        void  intersect_node
+        (
+            unsigned            level,
+            unsigned            x,
+            unsigned            z,
+            const glm::vec3   & origin,
+            const glm::vec3   & inverse_direction,
+            const glm::vec3   & direction,
+            float             & distance,
+            bool              & hit
+        ) const;
+
+        /// Corte del rayo con la superficie bilineal de la celda (x, z) entre t0 y t1:
+        bool  intersect_cell
+        (
+            unsigned            x,
+            unsigned            z,
+            const glm::vec3   & origin,
+            const glm::vec3   & direction,
+            float               t0,
+            float               t1,
+            float             & distance
+        ) const;
+
+    };
+
+}
@@ -0,0 +1,64 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Height_Map.hpp"
+#include "opengl-recipes.hpp"
+
+#include <cmath>
+
+using namespace std;
+
+namespace udit
+{
+
+    unique_ptr< Height_Map > Height_Map::load (const string & image_path)
+    {
+        auto image = load_image< Monochrome8 > (image_path);
+
+        if (!image || image->get_width () < 2 || image->get_height () < 2) return nullptr;
+
+        auto height_map = make_unique< Height_Map > (image->get_width (), image->get_height ());
+
+        const Monochrome8 * pixels = image->colors ();
+
+        for (size_t i = 0, count = height_map->heights.size (); i < count; ++i)
+        {
+            height_map->heights[i] = float(pixels[i]) * (1.f / 255.f);
+        }
+
+        return height_map;
+    }
+
+    Height_Map::Region Height_Map::raise (float center_x, float center_z, float radius, float amount)
+    {
+        int x0 = max (int(floor (center_x - radius)), 0);
+        int z0 = max (int(floor (center_z - radius)), 0);
+        int x1 = min (int( ceil (center_x + radius)), int(width) - 1);
+        int z1 = min (int( ceil (center_z + radius)), int(depth) - 1);
+
+        if (x0 > x1 || z0 > z1 || radius <= 0.f) return { 0, 0, 0, 0 };
+
+        for (int z = z0; z <= z1; ++z)
+        {
+            float * row = get_row (unsigned(z));
+
+            for (int x = x0; x <= x1; ++x)
+            {
+                float dx = (float(x) - center_x) / radius;
+                float dz = (float(z) - center_z) / radius;
+                float d2 = dx * dx + dz * dz;
+
+                if (d2 < 1.f)
+                {
+                    float falloff = (1.f - d2) * (1.f - d2);
+
+                    row[x] = min (max (row[x] + amount * falloff, 0.f), 1.f);
+                }
+            }
+        }
+
+        return { unsigned(x0), unsigned(z0), unsigned(x1 - x0 + 1), unsigned(z1 - z0 + 1) };
+    }
+
+}
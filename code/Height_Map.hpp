@@ -0,0 +1,116 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Mapa de alturas en memoria: una rejilla de width x depth alturas normalizadas a [0, 1] que
+    ///     se guardan por filas (la fila z empieza en z * width). Se carga desde una imagen en escala
+    ///     de grises o se rellena por código, y se puede muestrear con coordenadas normalizadas para
+    ///     generar mallas de cualquier resolución a partir de él.
+    /// </summary>
+    class Height_Map
+    {
+    public:
+
+        /// Rectángulo de alturas [x, x + width) x [z, z + depth):
+        struct Region
+        {
+            unsigned x;
+            unsigned z;
+            unsigned width;
+            unsigned depth;
+        };
+
+    private:
+
+        unsigned               width;
+        unsigned               depth;
+        std::vector< float >   heights;
+
+    public:
+
+        Height_Map(unsigned width, unsigned depth)
+        :
+            width  (width),
+            depth  (depth),
+            heights(size_t(width) * depth, 0.f)
+        {
+        }
+
+        /// Carga una imagen (cualquier formato que lea SOIL2) y la convierte a escala de grises.
+        /// Retorna nullptr si no se ha podido cargar:
+        static std::unique_ptr< Height_Map > load (const std::string & image_path);
+
+    public:
+
+        unsigned get_width () const
+        {
+            return width;
+        }
+
+        unsigned get_depth () const
+        {
+            return depth;
+        }
+
+        float * get_row (unsigned z)
+        {
+            return heights.data () + size_t(z) * width;
+        }
+
+        const float * get_row (unsigned z) const
+        {
+            return heights.data () + size_t(z) * width;
+        }
+
+        float get (unsigned x, unsigned z) const
+        {
+            return heights[size_t(z) * width + x];
+        }
+
+        void  set (unsigned x, unsigned z, float height)
+        {
+            heights[size_t(z) * width + x] = height;
+        }
+
+        /// Suma amount a las alturas que quedan a menos de radius muestras de (x, z), con una caída
+        /// suave hacia el borde, y las limita a [0, 1]. Retorna el rectángulo que ha cambiado (vacío
+        /// si el círculo queda fuera del mapa):
+        Region raise (float x, float z, float radius, float amount);
+
+        /// Interpolación bilineal entre las cuatro alturas que rodean el punto (u, v) de [0, 1] x [0, 1].
+        /// Fuera de ese rango se toma el borde:
+        float sample (float u, float v) const
+        {
+            float x = std::min (std::max (u, 0.f), 1.f) * float(width - 1);
+            float z = std::min (std::max (v, 0.f), 1.f) * float(depth - 1);
+
+            unsigned x0 = std::min (unsigned(x), width - 2);
+            unsigned z0 = std::min (unsigned(z), depth - 2);
+
+            float fx = x - float(x0);
+            float fz = z - float(z0);
+
+            const float * row0 = get_row (z0);
+            const float * row1 = row0 + width;
+
+            float top    = row0[x0] + (row0[x0 + 1] - row0[x0]) * fx;
+            float bottom = row1[x0] + (row1[x0 + 1] - row1[x0]) * fx;
+
+            return top + (bottom - top) * fz;
+        }
+
+    };
+
+}
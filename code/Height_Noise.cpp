@@ -0,0 +1,395 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Height_Noise.hpp"
+#include "Job_System.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#ifdef __AVX2__
+    #include <immintrin.h>                  // AVX2
+#else
+    #include <emmintrin.h>                  // SSE2
+#endif
+
+using namespace std;
+
+namespace udit
+{
+
+    namespace
+    {
+
+        // El ruido se escribe una sola vez como plantilla sobre estas operaciones, de modo que la versión
+        // escalar y la SIMD hacen exactamente los mismos cálculos:
+
+        struct Scalar_Ops
+        {
+            typedef float    F;
+            typedef uint32_t I;
+
+            static F set      (float value)             { return value; }
+            static I set_int  (uint32_t value)          { return value; }
+            static F add      (F a, F b)                { return a + b; }
+            static F sub      (F a, F b)                { return a - b; }
+            static F mul      (F a, F b)                { return a * b; }
+            static F max      (F a, F b)                { return a > b ? a : b; }
+            static F min      (F a, F b)                { return a < b ? a : b; }
+            static F abs      (F a)                     { return std::fabs (a); }
+            static F floor    (F a)                     { return std::floor (a); }
+            static F step     (F a, F b)                { return a > b ? 1.f : 0.f; }          // 1 si a > b
+            static I to_int   (F a)                     { return uint32_t(int32_t(a)); }
+            static I add_int  (I a, I b)                { return a + b; }
+            static I mul_int  (I a, I b)                { return a * b; }
+            static I xor_int  (I a, I b)                { return a ^ b; }
+            static I shift    (I a, int bits)           { return a >> bits; }
+
+            /// h & bit ? a : b
+            static F choose   (I h, uint32_t bit, F a, F b) { return h & bit ? a : b; }
+        };
+
+        #ifdef __AVX2__
+
+            struct Simd_Ops
+            {
+                typedef __m256  F;
+                typedef __m256i I;
+
+                static const unsigned LANES = 8;
+
+                static F load     (const float * data)      { return _mm256_loadu_ps (data); }
+                static void store (float * data, F value)   { _mm256_storeu_ps (data, value); }
+
+                static F set      (float value)             { return _mm256_set1_ps (value); }
+                static I set_int  (uint32_t value)          { return _mm256_set1_epi32 (int(value)); }
+                static F add      (F a, F b)                { return _mm256_add_ps (a, b); }
+                static F sub      (F a, F b)                { return _mm256_sub_ps (a, b); }
+                static F mul      (F a, F b)                { return _mm256_mul_ps (a, b); }
+                static F max      (F a, F b)                { return _mm256_max_ps (a, b); }
+                static F min      (F a, F b)                { return _mm256_min_ps (a, b); }
+                static F abs      (F a)                     { return _mm256_andnot_ps (_mm256_set1_ps (-0.f), a); }
+                static F floor    (F a)                     { return _mm256_floor_ps (a); }
+                static F step     (F a, F b)                { return _mm256_and_ps (_mm256_cmp_ps (a, b, _CMP_GT_OQ), _mm256_set1_ps (1.f)); }
+                static I to_int   (F a)                     { return _mm256_cvttps_epi32 (a); }
+                static I add_int  (I a, I b)                { return _mm256_add_epi32 (a, b); }
+                static I mul_int  (I a, I b)                { return _mm256_mullo_epi32 (a, b); }
+                static I xor_int  (I a, I b)                { return _mm256_xor_si256 (a, b); }
+                static I shift    (I a, int bits)           { return _mm256_srli_epi32 (a, bits); }
+
+                static F choose   (I h, uint32_t bit, F a, F b)
+                {
+                    __m256i set = _mm256_set1_epi32 (int(bit));
+
+                    return _mm256_blendv_ps (b, a, _mm256_castsi256_ps (_mm256_cmpeq_epi32 (_mm256_and_si256 (h, set), set)));
+                }
+            };
+
+        #else
+
+            struct Simd_Ops
+            {
+                typedef __m128  F;
+                typedef __m128i I;
+
+                static const unsigned LANES = 4;
+
+                static F load     (const float * data)      { return _mm_loadu_ps (data); }
+                static void store (float * data, F value)   { _mm_storeu_ps (data, value); }
+
+                static F set      (float value)             { return _mm_set1_ps (value); }
+                static I set_int  (uint32_t value)          { return _mm_set1_epi32 (int(value)); }
+                static F add      (F a, F b)                { return _mm_add_ps (a, b); }
+                static F sub      (F a, F b)                { return _mm_sub_ps (a, b); }
+                static F mul      (F a, F b)                { return _mm_mul_ps (a, b); }
+                static F max      (F a, F b)                { return _mm_max_ps (a, b); }
+                static F min      (F a, F b)                { return _mm_min_ps (a, b); }
+                static F abs      (F a)                     { return _mm_andnot_ps (_mm_set1_ps (-0.f), a); }
+                static F step     (F a, F b)                { return _mm_and_ps (_mm_cmpgt_ps (a, b), _mm_set1_ps (1.f)); }
+                static I to_int   (F a)                     { return _mm_cvttps_epi32 (a); }
+                static I add_int  (I a, I b)                { return _mm_add_epi32 (a, b); }
+                static I xor_int  (I a, I b)                { return _mm_xor_si128 (a, b); }
+                static I shift    (I a, int bits)           { return _mm_srli_epi32 (a, bits); }
+
+                /// SSE2 no tiene floor: se trunca y se resta 1 donde el resultado ha quedado por encima:
+                static F floor    (F a)
+                {
+                    F truncated = _mm_cvtepi32_ps (_mm_cvttps_epi32 (a));
+
+                    return _mm_sub_ps (truncated, step (truncated, a));
+                }
+
+                /// Ni producto de enteros de 32 bits: se multiplican los carriles pares y los impares por
+                /// separado y se juntan las mitades bajas:
+                static I mul_int  (I a, I b)
+                {
+                    __m128i even = _mm_mul_epu32 (a, b);
+                    __m128i odd  = _mm_mul_epu32 (_mm_srli_epi64 (a, 32), _mm_srli_epi64 (b, 32));
+
+                    return _mm_unpacklo_epi32 (_mm_shuffle_epi32 (even, _MM_SHUFFLE (0, 0, 2, 0)), _mm_shuffle_epi32 (odd, _MM_SHUFFLE (0, 0, 2, 0)));
+                }
+
+                static F choose   (I h, uint32_t bit, F a, F b)
+                {
+                    __m128i set  = _mm_set1_epi32 (int(bit));
+                    __m128  mask = _mm_castsi128_ps (_mm_cmpeq_epi32 (_mm_and_si128 (h, set), set));
+
+                    return _mm_or_ps (_mm_and_ps (mask, a), _mm_andnot_ps (mask, b));
+                }
+            };
+
+        #endif
+
+        const float F2    = .366025403784f;         // (sqrt(3) - 1) / 2: de la rejilla cuadrada a la de triángulos
+        const float G2    = .211324865405f;         // (3 - sqrt(3)) / 6: y de vuelta
+        const float SCALE = 45.23f;                 // Deja el ruido aproximadamente en [-1, 1]
+
+        template< class OPS >
+        typename OPS::I hash (typename OPS::I i, typename OPS::I j, typename OPS::I seed)
+        {
+            typedef typename OPS::I I;
+
+            I h = OPS::xor_int (OPS::xor_int (OPS::mul_int (i, OPS::set_int (0x27d4eb2du)), OPS::mul_int (j, OPS::set_int (0x165667b1u))), seed);
+
+            h = OPS::xor_int (h, OPS::shift (h, 15));
+            h = OPS::mul_int (h, OPS::set_int (0x2c1b3c6du));
+            h = OPS::xor_int (h, OPS::shift (h, 12));
+            h = OPS::mul_int (h, OPS::set_int (0x297a2d39u));
+
+            return OPS::xor_int (h, OPS::shift (h, 15));
+        }
+
+        /// Aportación de una esquina del triángulo: (0.5 - d²)⁴ por el producto con su gradiente, que es
+        /// uno de los 8 vectores (±1, ±2) o (±2, ±1) según los bits bajos del hash:
+        template< class OPS >
+        typename OPS::F corner (typename OPS::I h, typename OPS::F x, typename OPS::F z)
+        {
+            typedef typename OPS::F F;
+
+            F t = OPS::max (OPS::sub (OPS::set (.5f), OPS::add (OPS::mul (x, x), OPS::mul (z, z))), OPS::set (0.f));
+
+            t = OPS::mul (t, t);
+            t = OPS::mul (t, t);
+
+            F u = OPS::choose (h, 4, z, x);
+            F v = OPS::choose (h, 4, x, z);
+
+            u = OPS::choose (h, 1, OPS::sub (OPS::set (0.f), u), u);
+            v = OPS::choose (h, 2, OPS::sub (OPS::set (0.f), v), v);
+
+            return OPS::mul (t, OPS::add (u, OPS::add (v, v)));
+        }
+
+        template< class OPS >
+        typename OPS::F simplex (typename OPS::F x, typename OPS::F z, typename OPS::I seed)
+        {
+            typedef typename OPS::F F;
+            typedef typename OPS::I I;
+
+            // Triángulo que contiene el punto y posición del punto respecto a sus tres esquinas:
+
+            F s  = OPS::mul (OPS::add (x, z), OPS::set (F2));
+            F fi = OPS::floor (OPS::add (x, s));
+            F fj = OPS::floor (OPS::add (z, s));
+            F t  = OPS::mul (OPS::add (fi, fj), OPS::set (G2));
+
+            F x0 = OPS::sub (x, OPS::sub (fi, t));
+            F z0 = OPS::sub (z, OPS::sub (fj, t));
+
+            F i1 = OPS::step (x0, z0);              // Triángulo inferior (1, 0) o superior (0, 1)
+            F j1 = OPS::sub  (OPS::set (1.f), i1);
+
+            F x1 = OPS::add (OPS::sub (x0, i1), OPS::set (G2));
+            F z1 = OPS::add (OPS::sub (z0, j1), OPS::set (G2));
+            F x2 = OPS::add (x0, OPS::set (2.f * G2 - 1.f));
+            F z2 = OPS::add (z0, OPS::set (2.f * G2 - 1.f));
+
+            I i   = OPS::to_int (fi);
+            I j   = OPS::to_int (fj);
+            I one = OPS::set_int (1);
+
+            F n0 = corner< OPS > (hash< OPS > (i, j, seed), x0, z0);
+            F n1 = corner< OPS > (hash< OPS > (OPS::add_int (i, OPS::to_int (i1)), OPS::add_int (j, OPS::to_int (j1)), seed), x1, z1);
+            F n2 = corner< OPS > (hash< OPS > (OPS::add_int (i, one), OPS::add_int (j, one), seed), x2, z2);
+
+            return OPS::mul (OPS::add (n0, OPS::add (n1, n2)), OPS::set (SCALE));
+        }
+
+        /// Suma de octavas sin normalizar. Cada octava usa su propia semilla para que no se alineen:
+        template< class OPS >
+        typename OPS::F octaves
+        (
+            typename OPS::F     x,
+            typename OPS::F     z,
+            uint32_t            seed,
+            float               frequency,
+            unsigned            count,
+            float               lacunarity,
+            float               gain,
+            bool                ridged
+        )
+        {
+            typedef typename OPS::F F;
+
+            F     sum       = OPS::set (0.f);
+            float amplitude = 1.f;
+
+            for (unsigned octave = 0; octave < count; ++octave)
+            {
+                F f = OPS::set (frequency);
+                F n = simplex< OPS > (OPS::mul (x, f), OPS::mul (z, f), OPS::set_int (seed + octave * 0x9e3779b9u));
+
+                if (ridged)
+                {
+                    n = OPS::sub (OPS::set (1.f), OPS::abs (n));
+                    n = OPS::mul (n, n);
+                }
+
+                sum        = OPS::add (sum, OPS::mul (n, OPS::set (amplitude)));
+                frequency *= lacunarity;
+                amplitude *= gain;
+            }
+
+            return sum;
+        }
+
+        template< class OPS >
+        typename OPS::F height
+        (
+            typename OPS::F                 x,
+            typename OPS::F                 z,
+            const Height_Noise::Settings  & settings,
+            float                           normalization,
+            float                           warp_normalization
+        )
+        {
+            typedef typename OPS::F F;
+
+            // Deformación del dominio: cada coordenada se desplaza con un fBm distinto y más suave:
+
+            if (settings.warp_strength > 0.f)
+            {
+                F strength = OPS::set (settings.warp_strength * warp_normalization);
+
+                F warp_x = octaves< OPS > (x, z, settings.seed ^ 0x68bc21ebu, settings.warp_frequency, settings.warp_octaves, 2.f, .5f, false);
+                F warp_z = octaves< OPS > (x, z, settings.seed ^ 0x02e5be93u, settings.warp_frequency, settings.warp_octaves, 2.f, .5f, false);
+
+                x = OPS::add (x, OPS::mul (warp_x, strength));
+                z = OPS::add (z, OPS::mul (warp_z, strength));
+            }
+
+            bool ridged = settings.type == Height_Noise::RIDGED;
+
+            F sum = octaves< OPS > (x, z, settings.seed, settings.frequency, settings.octaves, settings.lacunarity, settings.gain, ridged);
+
+            // fBm está en [-1, 1] y ridged en [0, 1] (multiplicados por la suma de las amplitudes):
+
+            F h = ridged ? OPS::mul (sum, OPS::set (normalization))
+                         : OPS::add (OPS::set (.5f), OPS::mul (sum, OPS::set (.5f * normalization)));
+
+            return OPS::min (OPS::max (h, OPS::set (0.f)), OPS::set (1.f));
+        }
+
+        float amplitude_sum (unsigned count, float gain)
+        {
+            float sum = 0.f, amplitude = 1.f;
+
+            for (unsigned i = 0; i < count; ++i, amplitude *= gain) sum += amplitude;
+
+            return sum;
+        }
+
+    }
+
+    Height_Noise::Height_Noise(const Settings & settings)
+    :
+        settings          (settings),
+        normalization     (1.f / amplitude_sum (max (settings.octaves,      1u), settings.gain)),
+        warp_normalization(1.f / amplitude_sum (max (settings.warp_octaves, 1u), .5f))
+    {
+        assert(settings.octaves > 0);
+    }
+
+    float Height_Noise::simplex (float x, float z, uint32_t seed)
+    {
+        return udit::simplex< Scalar_Ops > (x, z, seed);
+    }
+
+    float Height_Noise::sample (float x, float z) const
+    {
+        return height< Scalar_Ops > (x, z, settings, normalization, warp_normalization);
+    }
+
+    void Height_Noise::fill_row (float x0, float z, float step, float * heights, unsigned count) const
+    {
+        typedef Simd_Ops::F F;
+
+        // Posiciones de los carriles dentro de un grupo (0, 1, 2...) que se desplazan en cada grupo:
+
+        alignas(32) float lane_offsets[Simd_Ops::LANES];
+
+        for (unsigned lane = 0; lane < Simd_Ops::LANES; ++lane) lane_offsets[lane] = float(lane);
+
+        const F offsets = Simd_Ops::load (lane_offsets);
+        const F steps   = Simd_Ops::set  (step);
+        const F zs      = Simd_Ops::set  (z);
+
+        unsigned x = 0;
+
+        for ( ; x + Simd_Ops::LANES <= count; x += Simd_Ops::LANES)
+        {
+            F xs = Simd_Ops::add (Simd_Ops::set (x0), Simd_Ops::mul (Simd_Ops::add (Simd_Ops::set (float(x)), offsets), steps));
+
+            Simd_Ops::store (heights + x, height< Simd_Ops > (xs, zs, settings, normalization, warp_normalization));
+        }
+
+        for ( ; x < count; ++x)
+        {
+            heights[x] = sample (x0 + float(x) * step, z);
+        }
+    }
+
+    void Height_Noise::fill (float x0, float z0, float step, Height_Map & heights, bool parallel) const
+    {
+        unsigned width   = heights.get_width ();
+        unsigned depth   = heights.get_depth ();
+        unsigned tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+        unsigned tiles_z = (depth + TILE_SIZE - 1) / TILE_SIZE;
+
+        auto fill_tiles = [&] (size_t first, size_t last)
+        {
+            for (size_t tile = first; tile < last; ++tile)
+            {
+                unsigned first_x = unsigned(tile % tiles_x) * TILE_SIZE;
+                unsigned first_z = unsigned(tile / tiles_x) * TILE_SIZE;
+                unsigned count   = min (unsigned(TILE_SIZE), width - first_x);
+
+                for (unsigned z = first_z; z < min (first_z + unsigned(TILE_SIZE), depth); ++z)
+                {
+                    fill_row (x0 + float(first_x) * step, z0 + float(z) * step, step, heights.get_row (z) + first_x, count);
+                }
+            }
+        };
+
+        if (parallel)
+        {
+            Job_System::get_instance ().parallel_for (size_t(tiles_x) * tiles_z, fill_tiles, 1);
+        }
+        else
+        {
+            fill_tiles (0, size_t(tiles_x) * tiles_z);
+        }
+    }
+
+    unique_ptr< Height_Map > Height_Noise::generate (unsigned width, unsigned depth, float step) const
+    {
+        auto height_map = make_unique< Height_Map > (width, depth);
+
+        fill (0.f, 0.f, step, *height_map);
+
+        return height_map;
+    }
+
+}
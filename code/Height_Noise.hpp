@@ -0,0 +1,86 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include "Height_Map.hpp"
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Alturas procedurales para generar mundos de prueba sin dibujar mapas enormes. La base es ruido
+    ///     simplex 2D con gradientes que salen de un hash de la celda (sin tablas de permutaciones, por lo
+    ///     que no se repite y se calcula igual en todos los carriles SIMD). Las octavas se suman como fBm
+    ///     (colinas) o como ruido ridged (crestas), y opcionalmente se deforma antes el dominio con otro fBm
+    ///     para que las formas no queden alineadas con la rejilla.
+    ///
+    ///     fill() reparte el mapa en tiles entre los hilos del sistema de trabajos y calcula cada fila de
+    ///     8 en 8 puntos con AVX2 o de 4 en 4 con SSE2. sample() es la versión escalar de referencia.
+    /// </summary>
+    class Height_Noise
+    {
+    public:
+
+        enum Type
+        {
+            FBM,                                    // Suma de octavas: colinas suaves
+            RIDGED                                  // Suma de 1 - |ruido| al cuadrado: crestas afiladas
+        };
+
+        struct Settings
+        {
+            uint32_t seed           = 1;
+            Type     type           = FBM;
+            float    frequency      = 1.f / 256.f;  // Por unidad del mundo, de la primera octava
+            unsigned octaves        = 6;
+            float    lacunarity     = 2.f;          // Multiplicador de la frecuencia de cada octava
+            float    gain           = .5f;          // Multiplicador de la amplitud de cada octava
+            float    warp_strength  = 0.f;          // Desplazamiento máximo del dominio en unidades del mundo (0 = sin deformar)
+            float    warp_frequency = 1.f / 512.f;
+            unsigned warp_octaves   = 3;
+        };
+
+        static const unsigned TILE_SIZE = 64;       // Muestras por lado de cada trabajo de fill()
+
+    private:
+
+        Settings settings;
+        float    normalization;                     // 1 / suma de las amplitudes de las octavas
+        float    warp_normalization;
+
+    public:
+
+        explicit Height_Noise(const Settings & settings);
+
+    public:
+
+        const Settings & get_settings () const
+        {
+            return settings;
+        }
+
+        /// Altura normalizada a [0, 1] en el punto (x, z) del mundo:
+        float sample (float x, float z) const;
+
+        /// Rellena heights con las alturas de los puntos (x0 + x * step, z0 + z * step). Si parallel es
+        /// false se calcula todo en el hilo que llama:
+        void  fill (float x0, float z0, float step, Height_Map & heights, bool parallel = true) const;
+
+        /// Mapa de width x depth alturas, una cada step unidades empezando en el origen:
+        std::unique_ptr< Height_Map > generate (unsigned width, unsigned depth, float step = 1.f) const;
+
+        /// Ruido simplex 2D sin escalar, aproximadamente en [-1, 1]:
+        static float simplex (float x, float z, uint32_t seed);
+
+    private:
+
+        /// Alturas de una fila de count puntos empezando en (x0, z), separados step unidades:
+        void  fill_row (float x0, float z, float step, float * heights, unsigned count) const;
+
+    };
+
+}
@@ -0,0 +1,194 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Height_Pyramid.hpp"
+#include "Job_System.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+
+namespace udit
+{
+
+    Height_Pyramid::Height_Pyramid(const Height_Map & height_map)
+    :
+        height_map(height_map),
+        cells_x   (height_map.get_width () - 1),
+        cells_z   (height_map.get_depth () - 1)
+    {
+        assert(height_map.get_width () > 1 && height_map.get_depth () > 1);
+
+        if (cells_x == 1 && cells_z == 1) return;
+
+        // Nivel 1: una entrada por cada 2 x 2 celdas del mapa. Es el más grande, por lo que se reparte
+        // por filas:
+
+        levels.push_back ({ (cells_x + 1) / 2, (cells_z + 1) / 2, {} });
+
+        Level & base = levels.back ();
+
+        base.ranges.resize (size_t(base.width) * base.depth);
+
+        Job_System::get_instance ().parallel_for
+        (
+            base.depth,
+            [&] (size_t first, size_t last)
+            {
+                for (size_t z = first; z < last; ++z)
+                {
+                    Range * out = base.ranges.data () + z * base.width;
+
+                    for (unsigned x = 0; x < base.width; ++x) out[x] = get_block (x, unsigned(z));
+                }
+            },
+            32
+        );
+
+        // Cada nivel junta 2 x 2 entradas del anterior (la última fila o columna puede quedar sola):
+
+        while (levels.back ().width > 1 || levels.back ().depth > 1)
+        {
+            unsigned width = (levels.back ().width + 1) / 2;
+            unsigned depth = (levels.back ().depth + 1) / 2;
+            unsigned level = unsigned(levels.size ()) + 1;
+
+            levels.push_back ({ width, depth, vector< Range >(size_t(width) * depth) });
+
+            for (unsigned z = 0; z < depth; ++z)
+            {
+                for (unsigned x = 0; x < width; ++x) combine (level, x, z);
+            }
+        }
+    }
+
+    Height_Pyramid::Range Height_Pyramid::get_block (unsigned x, unsigned z) const
+    {
+        // Las 2 x 2 celdas comparten las alturas de en medio, por lo que son 3 x 3 alturas (o 2 en el
+        // borde si el número de celdas es impar):
+
+        unsigned x0 = x * 2, x1 = min (x0 + 2, cells_x);
+        unsigned z0 = z * 2, z1 = min (z0 + 2, cells_z);
+
+        Range result = { height_map.get_row (z0)[x0], height_map.get_row (z0)[x0] };
+
+        for (unsigned row = z0; row <= z1; ++row)
+        {
+            const float * heights = height_map.get_row (row);
+
+            for (unsigned column = x0; column <= x1; ++column)
+            {
+                result.min = min (result.min, heights[column]);
+                result.max = max (result.max, heights[column]);
+            }
+        }
+
+        return result;
+    }
+
+    void Height_Pyramid::combine (unsigned level, unsigned x, unsigned z)
+    {
+        const Level & below = levels[level - 2];
+
+        unsigned x0 = x * 2, x1 = min (x0 + 1, below.width - 1);
+        unsigned z0 = z * 2, z1 = min (z0 + 1, below.depth - 1);
+
+        const Range & a = below.ranges[size_t(z0) * below.width + x0];
+        const Range & b = below.ranges[size_t(z0) * below.width + x1];
+        const Range & c = below.ranges[size_t(z1) * below.width + x0];
+        const Range & d = below.ranges[size_t(z1) * below.width + x1];
+
+        levels[level - 1].ranges[size_t(z) * levels[level - 1].width + x] =
+        {
+            min (min (a.min, b.min), min (c.min, d.min)),
+            max (max (a.max, b.max), max (c.max, d.max))
+        };
+    }
+
+    void Height_Pyramid::update (const Height_Map & height_map, const Height_Map::Region & region)
+    {
+        assert(&height_map == &this->height_map);
+
+        if (region.width == 0 || region.depth == 0 || levels.empty ()) return;
+
+        // Celdas del nivel 0 que tocan alguna de las alturas cambiadas (las de la fila y la columna
+        // anteriores también las usan). El nivel 0 se lee directamente del mapa, así que se empieza
+        // por los bloques del nivel 1 que las contienen:
+
+        unsigned x0 = region.x > 0 ? region.x - 1 : 0;
+        unsigned z0 = region.z > 0 ? region.z - 1 : 0;
+        unsigned x1 = min (region.x + region.width, cells_x);
+        unsigned z1 = min (region.z + region.depth, cells_z);
+
+        x0 >>= 1;  x1 = ((x1 - 1) >> 1) + 1;
+        z0 >>= 1;  z1 = ((z1 - 1) >> 1) + 1;
+
+        Level & base = levels[0];
+
+        for (unsigned z = z0; z < z1; ++z)
+        {
+            for (unsigned x = x0; x < x1; ++x) base.ranges[size_t(z) * base.width + x] = get_block (x, z);
+        }
+
+        // Y sus antecesoras en cada nivel:
+
+        for (unsigned level = 2; level <= levels.size (); ++level)
+        {
+            x0 >>= 1;  x1 = ((x1 - 1) >> 1) + 1;
+            z0 >>= 1;  z1 = ((z1 - 1) >> 1) + 1;
+
+            for (unsigned z = z0; z < z1; ++z)
+            {
+                for (unsigned x = x0; x < x1; ++x) combine (level, x, z);
+            }
+        }
+    }
+
+    Height_Pyramid::Range Height_Pyramid::get_range (unsigned x0, unsigned z0, unsigned x1, unsigned z1) const
+    {
+        x1 = min (x1, cells_x);
+        z1 = min (z1, cells_z);
+
+        assert(x0 < x1 && z0 < z1);
+
+        // Se sube hasta que la primera y la última celda del rectángulo quedan en la misma entrada o en
+        // entradas vecinas en ambos ejes:
+
+        unsigned level = 0;
+
+        while ((((x1 - 1) >> level) - (x0 >> level) > 1 || ((z1 - 1) >> level) - (z0 >> level) > 1) && level + 1 < get_level_count ())
+        {
+            ++level;
+        }
+
+        unsigned first_x = x0 >> level, last_x = (x1 - 1) >> level;
+        unsigned first_z = z0 >> level, last_z = (z1 - 1) >> level;
+
+        Range result = get (level, first_x, first_z);
+
+        for (unsigned z = first_z; z <= last_z; ++z)
+        {
+            for (unsigned x = first_x; x <= last_x; ++x)
+            {
+                Range range = get (level, x, z);
+
+                result.min = min (result.min, range.min);
+                result.max = max (result.max, range.max);
+            }
+        }
+
+        return result;
+    }
+
+    size_t Height_Pyramid::get_memory () const
+    {
+        size_t memory = 0;
+
+        for (auto & level : levels) memory += level.ranges.size () * sizeof(Range);
+
+        return memory;
+    }
+
+}
@@ -0,0 +1,292 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Horizon_Culler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace udit
+{
+
+    namespace
+    {
+
+        typedef chrono::high_resolution_clock Clock;
+
+        float milliseconds_since (Clock::time_point start)
+        {
+            return chrono::duration< float, milli >(Clock::now () - start).count ();
+        }
+
+        const float pi = 3.14159265f;
+
+        // Las distancias se limitan a este mínimo para no dividir entre 0 en el borde de una caja:
+
+        const float minimum_distance = 1e-4f;
+
+        /// Pendiente vista desde la altura camera_y de un punto a altura y cuya distancia horizontal
+        /// está en [near_distance, far_distance]. Si lowest es true se retorna la menor posible (la que
+        /// sirve para un oclusor) y si no la mayor (la que sirve para algo que se quiere ocultar):
+        float slope (float y, float camera_y, float near_distance, float far_distance, bool lowest)
+        {
+            float height = y - camera_y;
+
+            return height / ((height < 0.f) == lowest ? near_distance : far_distance);
+        }
+
+    }
+
+    Horizon_Culler::Horizon_Culler(const Height_Pyramid & pyramid, const glm::vec3 & size, float detail)
+    :
+        pyramid   (pyramid),
+        size      (size),
+        cell_x    (size.x / float(pyramid.get_width (0))),
+        cell_z    (size.z / float(pyramid.get_depth (0))),
+        detail    (detail),
+        camera    (0.f),
+        statistics{}
+    {
+        fill_n (slopes,    COLUMNS, -numeric_limits< float >::infinity ());
+        fill_n (distances, COLUMNS,  numeric_limits< float >::infinity ());
+    }
+
+    void Horizon_Culler::build (const glm::vec3 & camera_position)
+    {
+        auto start = Clock::now ();
+
+        camera = camera_position;
+
+        fill_n (slopes,    COLUMNS, -numeric_limits< float >::infinity ());
+        fill_n (distances, COLUMNS,  numeric_limits< float >::infinity ());
+
+        statistics.visited_count  = 0;
+        statistics.occluder_count = 0;
+
+        visit (pyramid.get_level_count () - 1, 0, 0);
+
+        statistics.build_milliseconds = milliseconds_since (start);
+    }
+
+    bool Horizon_Culler::is_occluded (const glm::vec3 & center, const glm::vec3 & extent)
+    {
+        auto start = Clock::now ();
+
+        statistics.tested_count++;
+
+        int   first, last;
+        float near_distance, far_distance;
+        bool  occluded = false;
+
+        // Si la cámara está encima de la caja la caja no puede estar detrás del terreno:
+
+        if (project ({ center.x - extent.x, center.z - extent.z }, { center.x + extent.x, center.z + extent.z }, false, first, last, near_distance, far_distance))
+        {
+            // El punto más alto de la caja visto desde la cámara debe quedar por debajo del horizonte
+            // en todas sus columnas, y lo que forma el horizonte debe estar delante de la caja:
+
+            float top = slope (center.y + extent.y, camera.y, near_distance, far_distance, false);
+
+            occluded = true;
+
+            for (int c = first; c <= last && occluded; ++c)
+            {
+                unsigned column = unsigned(c) & (COLUMNS - 1);
+
+                occluded = slopes[column] > top && distances[column] <= near_distance;
+            }
+        }
+
+        if (occluded) statistics.occluded_count++;
+
+        statistics.test_milliseconds += milliseconds_since (start);
+
+        return occluded;
+    }
+
+    bool Horizon_Culler::project
+    (
+        const glm::vec2 & min,
+        const glm::vec2 & max,
+        bool              inner,
+        int             & first,
+        int             & last,
+        float           & near_distance,
+        float           & far_distance
+    ) const
+    {
+        if (camera.x >= min.x && camera.x <= max.x && camera.z >= min.y && camera.z <= max.y)
+        {
+            return false;
+        }
+
+        // Como la cámara está fuera del rectángulo, este ocupa menos de media vuelta y los ángulos de
+        // sus esquinas se pueden medir sin saltos respecto al de su centro:
+
+        float center_angle = atan2 ((min.y + max.y) * .5f - camera.z, (min.x + max.x) * .5f - camera.x);
+        float low          =  pi;
+        float high         = -pi;
+
+        far_distance = 0.f;
+
+        for (unsigned corner = 0; corner < 4; ++corner)
+        {
+            float x     = (corner & 1 ? max.x : min.x) - camera.x;
+            float z     = (corner & 2 ? max.y : min.y) - camera.z;
+            float angle = atan2 (z, x) - center_angle;
+
+            if (angle >  pi) angle -= 2.f * pi; else
+            if (angle < -pi) angle += 2.f * pi;
+
+            low          = std::min (low,  angle);
+            high         = std::max (high, angle);
+            far_distance = std::max (far_distance, x * x + z * z);
+        }
+
+        float scale = float(COLUMNS) / (2.f * pi);
+
+        low  = (center_angle + low  + pi) * scale;
+        high = (center_angle + high + pi) * scale;
+
+        if (inner)
+        {
+            first = int(ceil  (low )    );
+            last  = int(floor (high)) - 1;
+        }
+        else
+        {
+            first = int(floor (low ));
+            last  = int(floor (high));
+        }
+
+        float x = std::max (std::max (min.x - camera.x, camera.x - max.x), 0.f);
+        float z = std::max (std::max (min.y - camera.z, camera.z - max.y), 0.f);
+
+        near_distance = std::max (sqrt (x * x + z * z), minimum_distance);
+        far_distance  = std::max (sqrt (far_distance),  minimum_distance);
+
+        return true;
+    }
+
+    void Horizon_Culler::visit (unsigned level, unsigned x, unsigned z)
+    {
+        statistics.visited_count++;
+
+        // Rectángulo que cubre el nodo en el espacio local del terreno:
+
+        unsigned first_x = x << level, last_x = std::min ((x + 1) << level, pyramid.get_width (0));
+        unsigned first_z = z << level, last_z = std::min ((z + 1) << level, pyramid.get_depth (0));
+
+        glm::vec2 min(-size.x * .5f + float(first_x) * cell_x, -size.z * .5f + float(first_z) * cell_z);
+        glm::vec2 max(-size.x * .5f + float( last_x) * cell_x, -size.z * .5f + float( last_z) * cell_z);
+
+        Height_Pyramid::Range range = pyramid.get (level, x, z);
+
+        int   first, last;
+        float near_distance, far_distance;
+
+        bool outside = project (min, max, false, first, last, near_distance, far_distance);
+
+        if (outside)
+        {
+            // Si lo más alto del nodo ya queda por debajo del horizonte en todas sus columnas, ni el
+            // nodo ni sus hijos lo pueden levantar:
+
+            float top    = slope (range.max * size.y, camera.y, near_distance, far_distance, false);
+            bool  hidden = true;
+
+            for (int c = first; c <= last && hidden; ++c)
+            {
+                unsigned column = unsigned(c) & (COLUMNS - 1);
+
+                hidden = slopes[column] > top && distances[column] <= near_distance;
+            }
+
+            if (hidden) return;
+
+            // Si el nodo se ve suficientemente pequeño, lo que queda por debajo de su altura mínima se
+            // usa como oclusor en las columnas que tapa enteras:
+
+            float side = std::max (max.x - min.x, max.y - min.y);
+
+            if (level == 0 || side < detail * near_distance)
+            {
+                project (min, max, true, first, last, near_distance, far_distance);
+
+                float bottom = slope (range.min * size.y, camera.y, near_distance, far_distance, true);
+
+                for (int c = first; c <= last; ++c)
+                {
+                    unsigned column = unsigned(c) & (COLUMNS - 1);
+
+                    if (bottom > slopes[column])
+                    {
+                        slopes   [column] = bottom;
+                        distances[column] = far_distance;
+                    }
+                }
+
+                statistics.occluder_count++;
+
+                return;
+            }
+        }
+        else
+        if (level == 0)
+        {
+            return;                                 // La celda que queda debajo de la cámara no tapa nada
+        }
+
+        // Se recorren los hijos de delante hacia atrás para que los oclusores cercanos descarten cuanto
+        // antes a los lejanos:
+
+        struct Child
+        {
+            unsigned x, z;
+            float    distance;
+        };
+
+        Child    children[4];
+        unsigned count       = 0;
+        unsigned child_level = level - 1;
+
+        for (unsigned child_z = z * 2; child_z < std::min (z * 2 + 2, pyramid.get_depth (child_level)); ++child_z)
+        {
+            for (unsigned child_x = x * 2; child_x < std::min (x * 2 + 2, pyramid.get_width (child_level)); ++child_x)
+            {
+                float center_x = -size.x * .5f + (float(child_x) + .5f) * float(1u << child_level) * cell_x;
+                float center_z = -size.z * .5f + (float(child_z) + .5f) * float(1u << child_level) * cell_z;
+                float dx       = center_x - camera.x;
+                float dz       = center_z - camera.z;
+
+                children[count++] = { child_x, child_z, dx * dx + dz * dz };
+            }
+        }
+
+        // Ordenación por inserción (como mucho hay 4 hijos):
+
+        for (unsigned i = 1; i < count; ++i)
+        {
+            Child    child = children[i];
+            unsigned j     = i;
+
+            for ( ; j > 0 && children[j - 1].distance > child.distance; --j)
+            {
+                children[j] = children[j - 1];
+            }
+
+            children[j] = child;
+        }
+
+        for (unsigned i = 0; i < count; ++i)
+        {
+            visit (child_level, children[i].x, children[i].z);
+        }
+    }
+
+}
@@ -0,0 +1,117 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstddef>
+#include <glm.hpp>
+#include "Height_Pyramid.hpp"
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Occlusion culling con el propio terreno como oclusor, pensado para escenas al aire libre en
+    ///     las que lo que queda detrás de una colina no se ve. Cada frame se construye un horizonte de
+    ///     una dimensión alrededor de la cámara: para cada columna (un intervalo de acimut, de modo que
+    ///     las verticales del mundo caen siempre en la misma columna aunque la cámara mire hacia abajo)
+    ///     se guarda la pendiente más alta, vista desde la cámara, del terreno sólido que hay delante, y
+    ///     la distancia a partir de la cual la tapa. Un objeto está oculto si en todas sus columnas su
+    ///     caja queda por debajo del horizonte y más lejos que lo que lo forma.
+    ///
+    ///     El horizonte se construye recorriendo las cotas del Height_Pyramid de delante hacia atrás.
+    ///     Debajo de la altura mínima de un nodo todo es terreno, por lo que sirve de oclusor. Los nodos
+    ///     se subdividen hasta que se ven pequeños desde la cámara, y los que ya quedan por completo por
+    ///     debajo del horizonte se descartan con todos sus hijos, ya que no lo pueden levantar.
+    ///
+    ///     Trabaja en el espacio local del terreno (como Height_Field), en la CPU y sin OpenGL.
+    /// </summary>
+    class Horizon_Culler
+    {
+    public:
+
+        static const unsigned COLUMNS = 1024;       // Intervalos de acimut de toda la vuelta
+
+        struct Statistics
+        {
+            size_t visited_count;                   // Nodos del quadtree recorridos
+            size_t occluder_count;                  // Nodos que han levantado el horizonte
+            size_t tested_count;
+            size_t occluded_count;
+            float  build_milliseconds;
+            float  test_milliseconds;
+        };
+
+    private:
+
+        const Height_Pyramid & pyramid;
+        glm::vec3              size;
+        float                  cell_x;              // Tamaño de una celda del mapa
+        float                  cell_z;
+        float                  detail;              // Un nodo se usa como oclusor si su lado es menor que
+                                                    // esta fracción de su distancia a la cámara
+        glm::vec3              camera;
+        float                  slopes   [COLUMNS];  // Pendiente del horizonte (altura / distancia)
+        float                  distances[COLUMNS];  // Distancia a partir de la cual se cumple
+
+        Statistics             statistics;
+
+    public:
+
+        Horizon_Culler(const Height_Pyramid & pyramid, const glm::vec3 & size, float detail = .25f);
+
+        Horizon_Culler(const Horizon_Culler & ) = delete;
+
+        Horizon_Culler & operator = (const Horizon_Culler & ) = delete;
+
+    public:
+
+        /// Construye el horizonte visto desde camera_position (espacio local del terreno):
+        void build (const glm::vec3 & camera_position);
+
+        /// Retorna true si la caja (en el espacio local del terreno) queda oculta por el horizonte:
+        bool is_occluded (const glm::vec3 & center, const glm::vec3 & extent);
+
+        /// Pone a cero los contadores de objetos probados (se llama una vez por frame):
+        void reset_test_statistics ()
+        {
+            statistics.tested_count      = 0;
+            statistics.occluded_count    = 0;
+            statistics.test_milliseconds = 0.f;
+        }
+
+        const Statistics & get_statistics () const
+        {
+            return statistics;
+        }
+
+        /// Pendiente del horizonte en la columna column, para depurar y dibujarlo:
+        float get_slope (unsigned column) const
+        {
+            return slopes[column];
+        }
+
+    private:
+
+        /// Columnas [first, last] que ocupa el rectángulo [min, max] del plano xz (sin dar la vuelta:
+        /// la columna de c es c & (COLUMNS - 1)) y distancias a su punto más cercano y más lejano.
+        /// Retorna false si la cámara está encima del rectángulo. Si inner es true solo se cuentan las
+        /// columnas que el rectángulo cubre enteras (puede que ninguna):
+        bool project
+        (
+            const glm::vec2 & min,
+            const glm::vec2 & max,
+            bool              inner,
+            int             & first,
+            int             & last,
+            float           & near_distance,
+            float           & far_distance
+        ) const;
+
+        /// Recorre el nodo (x, z) del nivel level:
+        void visit (unsigned level, unsigned x, unsigned z);
+
+    };
+
+}
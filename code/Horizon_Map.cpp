@@ -0,0 +1,403 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Horizon_Map.hpp"
+#include "Job_System.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <gtc/type_ptr.hpp>
+
+#ifdef __AVX2__
+    #include <immintrin.h>                  // AVX2
+#else
+    #include <emmintrin.h>                  // SSE2
+#endif
+
+using namespace std;
+
+namespace udit
+{
+
+    namespace
+    {
+
+        const int direction_x[Horizon_Map::DIRECTIONS] = { 1, 1, 0, -1, -1, -1,  0,  1 };
+        const int direction_z[Horizon_Map::DIRECTIONS] = { 0, 1, 1,  1,  0, -1, -1, -1 };
+
+        // Operaciones sobre un grupo de muestras consecutivas de una fila:
+
+        #ifdef __AVX2__
+
+            typedef __m256 Lanes;
+
+            const unsigned LANES = 8;
+
+            inline Lanes read   (const float * data)  { return _mm256_loadu_ps (data); }
+            inline void  write  (float * data, Lanes a){ _mm256_storeu_ps (data, a); }
+            inline Lanes splat  (float value)         { return _mm256_set1_ps (value); }
+            inline Lanes add    (Lanes a, Lanes b)    { return _mm256_add_ps (a, b); }
+            inline Lanes sub    (Lanes a, Lanes b)    { return _mm256_sub_ps (a, b); }
+            inline Lanes mul    (Lanes a, Lanes b)    { return _mm256_mul_ps (a, b); }
+            inline Lanes divide (Lanes a, Lanes b)    { return _mm256_div_ps (a, b); }
+            inline Lanes maximum(Lanes a, Lanes b)    { return _mm256_max_ps (a, b); }
+            inline Lanes root   (Lanes a)             { return _mm256_sqrt_ps (a); }
+
+        #else
+
+            typedef __m128 Lanes;
+
+            const unsigned LANES = 4;
+
+            inline Lanes read   (const float * data)  { return _mm_loadu_ps (data); }
+            inline void  write  (float * data, Lanes a){ _mm_storeu_ps (data, a); }
+            inline Lanes splat  (float value)         { return _mm_set1_ps (value); }
+            inline Lanes add    (Lanes a, Lanes b)    { return _mm_add_ps (a, b); }
+            inline Lanes sub    (Lanes a, Lanes b)    { return _mm_sub_ps (a, b); }
+            inline Lanes mul    (Lanes a, Lanes b)    { return _mm_mul_ps (a, b); }
+            inline Lanes divide (Lanes a, Lanes b)    { return _mm_div_ps (a, b); }
+            inline Lanes maximum(Lanes a, Lanes b)    { return _mm_max_ps (a, b); }
+            inline Lanes root   (Lanes a)             { return _mm_sqrt_ps (a); }
+
+        #endif
+
+        /// Cabecera del fichero de caché, seguida de los texels:
+        struct Cache_Header
+        {
+            char     magic[4];
+            uint32_t width;
+            uint32_t depth;
+            uint32_t texel_bytes;
+            uint64_t fingerprint;
+        };
+
+        const char cache_magic[4] = { 'H', 'R', 'Z', '1' };
+
+        /// Seno del ángulo de una pendiente (tangente), que es lo que se guarda:
+        inline float tangent_to_sine (float tangent)
+        {
+            return tangent / sqrt (1.f + tangent * tangent);
+        }
+
+    }
+
+    Horizon_Map::Horizon_Map(const Height_Map & height_map, const glm::vec3 & size, unsigned max_distance)
+    :
+        width       (height_map.get_width ()),
+        depth       (height_map.get_depth ()),
+        size        (size),
+        max_distance(max_distance),
+        texels      (size_t(width) * depth * DIRECTIONS, 0),
+        texture_id  (0)
+    {
+        assert(width > 1 && depth > 1 && max_distance > 0);
+
+        // Cerca del punto se mira cada muestra y después cada vez más separado (x1.4), ya que un
+        // mismo desnivel levanta menos el horizonte cuanto más lejos está:
+
+        for (unsigned step = 1; step <= max_distance; step = max (step + 1, unsigned(float(step) * 1.4142f + .5f)))
+        {
+            steps.push_back (step);
+        }
+
+        if (steps.back () != max_distance) steps.push_back (max_distance);
+    }
+
+    Horizon_Map::~Horizon_Map()
+    {
+        if (texture_id) glDeleteTextures (1, &texture_id);
+    }
+
+    void Horizon_Map::bake (const Height_Map & height_map, bool parallel)
+    {
+        bake (height_map, { 0, 0, width, depth }, parallel);
+    }
+
+    Height_Map::Region Horizon_Map::update (const Height_Map & height_map, const Height_Map::Region & region)
+    {
+        if (region.width == 0 || region.depth == 0) return region;
+
+        unsigned x0 = region.x > max_distance ? region.x - max_distance : 0;
+        unsigned z0 = region.z > max_distance ? region.z - max_distance : 0;
+        unsigned x1 = min (region.x + region.width + max_distance, width);
+        unsigned z1 = min (region.z + region.depth + max_distance, depth);
+
+        Height_Map::Region affected{ x0, z0, x1 - x0, z1 - z0 };
+
+        // Se llama desde la simulación con regiones pequeñas, por lo que no compensa repartirlo:
+
+        bake (height_map, affected, false);
+
+        return affected;
+    }
+
+    void Horizon_Map::bake (const Height_Map & height_map, const Height_Map::Region & region, bool parallel)
+    {
+        assert(height_map.get_width () == width && height_map.get_depth () == depth);
+
+        // Copia de las alturas de la región con max_distance muestras más por cada lado, repitiendo
+        // las del borde del mapa, para que todos los accesos caigan dentro sin comprobar nada:
+
+        const unsigned border        = max_distance;
+        const unsigned window_width  = region.width + 2 * border;
+        const unsigned window_depth  = region.depth + 2 * border;
+
+        vector< float > window(size_t(window_width) * window_depth);
+
+        for (unsigned z = 0; z < window_depth; ++z)
+        {
+            int           map_z  = min (max (int(region.z + z) - int(border), 0), int(depth) - 1);
+            const float * source = height_map.get_row (unsigned(map_z));
+            float       * target = window.data () + size_t(z) * window_width;
+
+            for (unsigned x = 0; x < window_width; ++x)
+            {
+                target[x] = source[min (max (int(region.x + x) - int(border), 0), int(width) - 1)];
+            }
+        }
+
+        // Para cada dirección y cada paso: desplazamiento en la copia y factor que convierte un
+        // desnivel del mapa (en [0, 1]) en la tangente del ángulo con el que se ve:
+
+        const size_t step_count = steps.size ();
+        const float  cell_x     = size.x / float(width - 1);
+        const float  cell_z     = size.z / float(depth - 1);
+
+        vector< ptrdiff_t > offsets(DIRECTIONS * step_count);
+        vector< float     > factors(DIRECTIONS * step_count);
+
+        for (unsigned direction = 0; direction < DIRECTIONS; ++direction)
+        {
+            int   dx     = direction_x[direction];
+            int   dz     = direction_z[direction];
+            float length = sqrt (float(dx * dx) * cell_x * cell_x + float(dz * dz) * cell_z * cell_z);
+
+            for (size_t s = 0; s < step_count; ++s)
+            {
+                offsets[direction * step_count + s] = ptrdiff_t(int(steps[s]) * dz) * ptrdiff_t(window_width) + int(steps[s]) * dx;
+                factors[direction * step_count + s] = size.y / (float(steps[s]) * length);
+            }
+        }
+
+        auto bake_rows = [&] (size_t first, size_t last)
+        {
+            vector< float > sines(region.width);
+
+            for (size_t row = first; row < last; ++row)
+            {
+                const float * center = window.data () + (row + border) * window_width + border;
+
+                for (unsigned direction = 0; direction < DIRECTIONS; ++direction)
+                {
+                    const ptrdiff_t * direction_offsets = offsets.data () + direction * step_count;
+                    const float     * direction_factors = factors.data () + direction * step_count;
+
+                    // La tangente más alta de cada muestra empieza en 0 (horizonte plano): los que
+                    // quedan por debajo no tapan nada del cielo:
+
+                    unsigned x = 0;
+
+                    for ( ; x + LANES <= region.width; x += LANES)
+                    {
+                        Lanes height  = read (center + x);
+                        Lanes tangent = splat (0.f);
+
+                        for (size_t s = 0; s < step_count; ++s)
+                        {
+                            tangent = maximum (tangent, mul (sub (read (center + x + direction_offsets[s]), height), splat (direction_factors[s])));
+                        }
+
+                        write (sines.data () + x, divide (tangent, root (add (splat (1.f), mul (tangent, tangent)))));
+                    }
+
+                    for ( ; x < region.width; ++x)
+                    {
+                        float tangent = 0.f;
+
+                        for (size_t s = 0; s < step_count; ++s)
+                        {
+                            tangent = max (tangent, (center[ptrdiff_t(x) + direction_offsets[s]] - center[x]) * direction_factors[s]);
+                        }
+
+                        sines[x] = tangent_to_sine (tangent);
+                    }
+
+                    uint8_t * target = texels.data () + texel_index (direction / 4, region.x, region.z + unsigned(row)) + direction % 4;
+
+                    for (x = 0; x < region.width; ++x)
+                    {
+                        target[x * 4] = uint8_t(sines[x] * 255.f + .5f);
+                    }
+                }
+            }
+        };
+
+        if (parallel)
+        {
+            Job_System::get_instance ().parallel_for (region.depth, bake_rows, 8);
+        }
+        else
+        {
+            bake_rows (0, region.depth);
+        }
+    }
+
+    float Horizon_Map::trace (const Height_Map & height_map, unsigned x, unsigned z, unsigned direction) const
+    {
+        int   dx      = direction_x[direction];
+        int   dz      = direction_z[direction];
+        float cell_x  = size.x / float(width - 1);
+        float cell_z  = size.z / float(depth - 1);
+        float length  = sqrt (float(dx * dx) * cell_x * cell_x + float(dz * dz) * cell_z * cell_z);
+        float height  = height_map.get (x, z);
+        float tangent = 0.f;
+
+        for (unsigned step : steps)
+        {
+            int sample_x = min (max (int(x) + int(step) * dx, 0), int(width) - 1);
+            int sample_z = min (max (int(z) + int(step) * dz, 0), int(depth) - 1);
+
+            tangent = max (tangent, (height_map.get (unsigned(sample_x), unsigned(sample_z)) - height) * size.y / (float(step) * length));
+        }
+
+        return tangent_to_sine (tangent);
+    }
+
+    uint64_t Horizon_Map::fingerprint (const Height_Map & height_map) const
+    {
+        // FNV-1a de 64 bits sobre palabras de 32 bits (en lugar de bytes, para que comprobar la caché
+        // cueste mucho menos que calcular los horizontes) de los parámetros y de todas las alturas:
+
+        uint64_t hash = 14695981039346656037ull;
+
+        auto combine = [&hash] (const void * data, size_t count)
+        {
+            const uint8_t * bytes = static_cast< const uint8_t * >(data);
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                uint32_t word;
+
+                memcpy (&word, bytes + i * sizeof(word), sizeof(word));
+
+                hash = (hash ^ word) * 1099511628211ull;
+            }
+        };
+
+        uint32_t parameters[] = { width, depth, max_distance, DIRECTIONS };
+
+        combine (parameters, 4);
+        combine (glm::value_ptr (size), 3);
+        combine (height_map.get_row (0), size_t(width) * depth);
+
+        return hash;
+    }
+
+    bool Horizon_Map::load (const string & path, const Height_Map & height_map)
+    {
+        ifstream file(path, ios::binary);
+
+        Cache_Header header;
+
+        if (!file.read (reinterpret_cast< char * >(&header), sizeof(header))) return false;
+
+        if
+        (
+            memcmp (header.magic, cache_magic, sizeof(cache_magic)) != 0 ||
+            header.width       != width                                  ||
+            header.depth       != depth                                  ||
+            header.texel_bytes != texels.size ()                         ||
+            header.fingerprint != fingerprint (height_map)
+        )
+        {
+            return false;
+        }
+
+        // Si el fichero está cortado los horizontes quedan a medias, pero quien llama los va a calcular:
+
+        return bool(file.read (reinterpret_cast< char * >(texels.data ()), streamsize(texels.size ())));
+    }
+
+    bool Horizon_Map::save (const string & path, const Height_Map & height_map) const
+    {
+        ofstream file(path, ios::binary | ios::trunc);
+
+        Cache_Header header;
+
+        memcpy (header.magic, cache_magic, sizeof(cache_magic));
+
+        header.width       = width;
+        header.depth       = depth;
+        header.texel_bytes = uint32_t(texels.size ());
+        header.fingerprint = fingerprint (height_map);
+
+        file.write (reinterpret_cast< const char * >(&header), sizeof(header));
+        file.write (reinterpret_cast< const char * >(texels.data ()), streamsize(texels.size ()));
+
+        return bool(file);
+    }
+
+    void Horizon_Map::copy (const Height_Map::Region & region, vector< uint8_t > & region_texels) const
+    {
+        region_texels.resize (size_t(region.width) * region.depth * DIRECTIONS);
+
+        uint8_t * target = region_texels.data ();
+
+        for (unsigned layer = 0; layer < DIRECTIONS / 4; ++layer)
+        {
+            for (unsigned z = region.z; z < region.z + region.depth; ++z)
+            {
+                const uint8_t * source = texels.data () + texel_index (layer, region.x, z);
+
+                target = std::copy (source, source + size_t(region.width) * 4, target);
+            }
+        }
+    }
+
+    void Horizon_Map::build ()
+    {
+        // Interpolación bilineal entre muestras como la de las alturas (el shader muestrea también en
+        // los centros de los texels):
+
+        glGenTextures   (1, &texture_id);
+        glBindTexture   (GL_TEXTURE_2D_ARRAY, texture_id);
+        glTexImage3D    (GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, GLsizei(width), GLsizei(depth), DIRECTIONS / 4, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels.data ());
+        glTexParameteri (GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri (GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri (GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S,     GL_CLAMP_TO_EDGE);
+        glTexParameteri (GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T,     GL_CLAMP_TO_EDGE);
+        glBindTexture   (GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    void Horizon_Map::upload (const Height_Map::Region & region, const uint8_t * region_texels)
+    {
+        if (!texture_id || region.width == 0 || region.depth == 0) return;
+
+        assert(region.x + region.width <= width && region.z + region.depth <= depth);
+
+        glBindTexture   (GL_TEXTURE_2D_ARRAY, texture_id);
+        glTexSubImage3D
+        (
+            GL_TEXTURE_2D_ARRAY, 0,
+            GLint(region.x), GLint(region.z), 0,
+            GLsizei(region.width), GLsizei(region.depth), DIRECTIONS / 4,
+            GL_RGBA, GL_UNSIGNED_BYTE, region_texels
+        );
+        glBindTexture   (GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    void Horizon_Map::bind (GLuint program_id, const glm::vec3 & sun_direction) const
+    {
+        glUniform1i  (glGetUniformLocation (program_id, "horizon_texture"), GLint(horizon_texture_unit));
+        glUniform3fv (glGetUniformLocation (program_id, "sun_direction"  ), 1, glm::value_ptr (sun_direction));
+
+        glActiveTexture (GL_TEXTURE0 + horizon_texture_unit);
+        glBindTexture   (GL_TEXTURE_2D_ARRAY, texture_id);
+        glActiveTexture (GL_TEXTURE0);
+    }
+
+}
@@ -0,0 +1,122 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include <glm.hpp>
+#include "Height_Map.hpp"
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Horizontes precalculados del terreno para sombrearlo sin calcular nada en tiempo real. Para
+    ///     cada muestra del mapa y cada una de 8 direcciones (cada 45 grados) se guarda el seno del
+    ///     ángulo de elevación del horizonte: lo más alto que se ve del terreno en esa dirección hasta
+    ///     max_distance muestras. Con eso el shader sabe si el sol queda por debajo del horizonte
+    ///     (sombra) y qué parte del cielo tapa el terreno (oclusión ambiental).
+    ///
+    ///     Se guarda un byte por dirección en una textura array RGBA8 de dos capas (direcciones 0-3 y
+    ///     4-7), por lo que el shader lo lee todo con dos accesos. Las direcciones son las de la
+    ///     rejilla: (1, 0), (1, 1), (0, 1), (-1, 1), (-1, 0), (-1, -1), (0, -1) y (1, -1) en (x, z).
+    ///
+    ///     bake() reparte las filas entre los hilos del sistema de trabajos y avanza cada fila de 8 en
+    ///     8 muestras con AVX2 (o de 4 en 4 con SSE2): en una dirección fija, las muestras que se
+    ///     comparan con muestras consecutivas de una fila están también en muestras consecutivas. El
+    ///     resultado se puede guardar en disco junto con una huella del mapa para no repetirlo.
+    /// </summary>
+    class Horizon_Map
+    {
+    public:
+
+        static const unsigned DIRECTIONS            = 8;
+        static const GLuint   horizon_texture_unit  = 5;    // La 4 es la de las alturas de Terrain_Lod
+
+    private:
+
+        unsigned                width;
+        unsigned                depth;
+        glm::vec3               size;                       // Mismo espacio que Terrain_Lod
+        unsigned                max_distance;               // En muestras del mapa
+        std::vector< unsigned > steps;                      // Distancias a las que se busca el horizonte
+        std::vector< uint8_t  > texels;                     // [capa][z][x][dirección % 4]
+
+        GLuint                  texture_id;
+
+    public:
+
+        /// Reserva los horizontes de un terreno como el de Terrain_Lod (size.x x size.z centrado en el
+        /// origen con alturas de [0, size.y]) hecho con height_map. No calcula nada hasta bake() o load():
+        Horizon_Map(const Height_Map & height_map, const glm::vec3 & size, unsigned max_distance = 128);
+
+       ~Horizon_Map();
+
+        Horizon_Map(const Horizon_Map & ) = delete;
+
+        Horizon_Map & operator = (const Horizon_Map & ) = delete;
+
+    public:
+
+        /// Calcula todos los horizontes. Si parallel es false se calcula todo en el hilo que llama:
+        void bake (const Height_Map & height_map, bool parallel = true);
+
+        /// Recalcula los horizontes que pueden haber cambiado al editar region (los que están a menos
+        /// de max_distance muestras). Retorna el rectángulo recalculado:
+        Height_Map::Region update (const Height_Map & height_map, const Height_Map::Region & region);
+
+        /// Lee los horizontes de la caché de path si se calcularon con el mismo mapa y los mismos
+        /// parámetros. Retorna false si no existe, no se puede leer o no coincide (entonces hay que
+        /// llamar a bake()):
+        bool load (const std::string & path, const Height_Map & height_map);
+
+        /// Guarda los horizontes y la huella de height_map en path. Retorna false si falla:
+        bool save (const std::string & path, const Height_Map & height_map) const;
+
+        /// Seno de la elevación del horizonte guardado en la muestra (x, z) y la dirección direction:
+        float get (unsigned x, unsigned z, unsigned direction) const
+        {
+            return float(texels[texel_index (direction / 4, x, z) + direction % 4]) * (1.f / 255.f);
+        }
+
+        /// Lo mismo calculado sin SIMD ni cuantizar, como referencia:
+        float trace (const Height_Map & height_map, unsigned x, unsigned z, unsigned direction) const;
+
+        /// Copia los texels de region en region_texels con el orden que espera upload() (no usa OpenGL):
+        void copy (const Height_Map::Region & region, std::vector< uint8_t > & region_texels) const;
+
+        /// Crea la textura con los horizontes actuales (hilo del contexto de OpenGL):
+        void build ();
+
+        /// Sube a la textura los texels de region copiados con copy() (hilo del contexto de OpenGL):
+        void upload (const Height_Map::Region & region, const uint8_t * region_texels);
+
+        /// Enlaza la textura con la variante TERRAIN_LOD activa y le pasa la dirección del sol (hacia el
+        /// sol, normalizada y en el espacio del terreno):
+        void bind (GLuint program_id, const glm::vec3 & sun_direction) const;
+
+        size_t get_video_memory () const
+        {
+            return texture_id ? texels.size () : 0;
+        }
+
+    private:
+
+        size_t texel_index (unsigned layer, unsigned x, unsigned z) const
+        {
+            return ((size_t(layer) * depth + z) * width + x) * 4;
+        }
+
+        /// Huella del mapa y de los parámetros con los que se calculan los horizontes:
+        uint64_t fingerprint (const Height_Map & height_map) const;
+
+        /// Calcula los horizontes de region:
+        void bake (const Height_Map & height_map, const Height_Map::Region & region, bool parallel);
+
+    };
+
+}
@@ -0,0 +1,468 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Job_System.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+using namespace std;
+
+namespace udit
+{
+
+    namespace
+    {
+
+        typedef chrono::steady_clock Clock;
+
+        uint64_t nanoseconds_since (Clock::time_point start)
+        {
+            return uint64_t(chrono::duration_cast< chrono::nanoseconds >(Clock::now () - start).count ());
+        }
+
+        // Sistema y hueco que ocupa el hilo actual (los hilos ajenos no tienen hueco propio):
+
+        thread_local const Job_System * current_system = nullptr;
+        thread_local unsigned           current_worker = 0;
+
+    }
+
+    Job_System::Job_System(unsigned worker_count)
+    :
+        main_thread_id   (this_thread::get_id ()),
+        queued_tasks     (0),
+        queued_background(0),
+        stop             (false),
+        next_queue       (0)
+    {
+        // Se crean todas las colas antes de arrancar ningún hilo porque cualquiera puede robar de cualquiera:
+
+        for (unsigned i = 0; i <= worker_count; ++i)
+        {
+            workers.emplace_back (new Worker);
+
+            Worker & worker = *workers.back ();
+
+            worker.jobs_executed    = 0;
+            worker.jobs_stolen      = 0;
+            worker.busy_nanoseconds = 0;
+            worker.idle_nanoseconds = 0;
+        }
+
+        for (unsigned i = 1; i <= worker_count; ++i)
+        {
+            workers[i]->thread = thread([this, i] () { worker_loop (i); });
+        }
+    }
+
+    Job_System::~Job_System()
+    {
+        {
+            lock_guard< mutex > lock(sleep_mutex);
+
+            stop = true;
+        }
+
+        wake_up.notify_all ();
+
+        for (auto & worker : workers)
+        {
+            if (worker->thread.joinable ()) worker->thread.join ();
+        }
+    }
+
+    Job_System & Job_System::get_instance ()
+    {
+        static Job_System instance;
+
+        return instance;
+    }
+
+    unsigned Job_System::current_index () const
+    {
+        if (current_system == this) return current_worker;
+
+        // Los hilos ajenos reparten sus trabajos entre todas las colas; el principal usa la suya:
+
+        if (this_thread::get_id () == main_thread_id) return 0;
+
+        return next_queue.load () % unsigned(workers.size ());
+    }
+
+    void Job_System::submit (Job job, Counter * counter)
+    {
+        if (counter) counter->pending++;
+
+        push (Task{ move (job), counter });
+    }
+
+    void Job_System::submit_after (Counter & dependency, Job job, Counter * counter)
+    {
+        if (counter) counter->pending++;
+
+        {
+            // Se comprueba con el cerrojo tomado para no perder la liberación que hace finish():
+
+            lock_guard< mutex > lock(dependency.mutex);
+
+            if (dependency.pending.load () > 0)
+            {
+                dependency.continuations.push_back (Task{ move (job), counter });
+                return;
+            }
+        }
+
+        push (Task{ move (job), counter });
+    }
+
+    void Job_System::submit_background (Job job, Counter * counter)
+    {
+        if (counter) counter->pending++;
+
+        Task task{ move (job), counter };
+
+        // Sin hilos de trabajo nadie lo sacaría de la cola:
+
+        if (workers.size () == 1)
+        {
+            execute (current_index (), task);
+            return;
+        }
+
+        {
+            lock_guard< mutex > lock(background_mutex);
+
+            background_tasks.push_back (move (task));
+        }
+
+        queued_background++;
+
+        {
+            lock_guard< mutex > lock(sleep_mutex);
+        }
+
+        wake_up.notify_one ();
+    }
+
+    void Job_System::submit_main (Job job, Counter * counter)
+    {
+        if (counter) counter->pending++;
+
+        lock_guard< mutex > lock(main_mutex);
+
+        main_tasks.push_back (Task{ move (job), counter });
+    }
+
+    void Job_System::run_main_thread_jobs ()
+    {
+        assert(this_thread::get_id () == main_thread_id);
+
+        // Los trabajos que se encolen mientras tanto se ejecutarán en la siguiente llamada. Los dos
+        // vectores se intercambian cada vez, por lo que ambos conservan su capacidad:
+
+        {
+            lock_guard< mutex > lock(main_mutex);
+
+            running_main_tasks.swap (main_tasks);
+        }
+
+        for (auto & task : running_main_tasks) execute (0, task);
+
+        running_main_tasks.clear ();
+    }
+
+    bool Job_System::run_one_main_task ()
+    {
+        Task task;
+
+        {
+            lock_guard< mutex > lock(main_mutex);
+
+            if (main_tasks.empty ()) return false;
+
+            task = move (main_tasks.front ());
+
+            main_tasks.erase (main_tasks.begin ());
+        }
+
+        execute (0, task);
+
+        return true;
+    }
+
+    void Job_System::wait (Counter & counter)
+    {
+        const unsigned self    = current_index ();
+        const bool     is_main = this_thread::get_id () == main_thread_id;
+
+        while (counter.pending.load () > 0)
+        {
+            if (is_main && run_one_main_task ()) continue;
+
+            Task task;
+
+            if (take (self, task))
+            {
+                execute (self, task);
+            }
+            else
+            {
+                // Lo que falta se está ejecutando en otros hilos:
+
+                this_thread::yield ();
+            }
+        }
+
+        // Se espera a que finish() suelte el cerrojo del contador antes de que se pueda destruir:
+
+        lock_guard< mutex > lock(counter.mutex);
+    }
+
+    void Job_System::parallel_for (size_t count, Range_Function body, size_t min_chunk)
+    {
+        if (count == 0) return;
+
+        // El grano deja unos 8 trozos por hilo para que los que terminan antes puedan robar a los demás:
+
+        const size_t grain = max (max (min_chunk, size_t(1)), count / (size_t(8) * workers.size ()));
+
+        if (count <= grain)
+        {
+            body (0, count);
+            return;
+        }
+
+        // Los trabajos solo capturan un puntero a este estado (que vive en la pila hasta que terminan
+        // todos) y su rango, de modo que caben en un Job:
+
+        struct Splitter
+        {
+            Job_System   & jobs;
+            Counter      & counter;
+            Range_Function body;
+            size_t         grain;
+
+            void run (size_t first, size_t last) const
+            {
+                // Se encola la mitad derecha y se sigue partiendo la izquierda hasta llegar al grano:
+
+                while (last - first > grain)
+                {
+                    size_t middle = first + (last - first) / 2;
+
+                    jobs.submit ([this, middle, last] () { run (middle, last); }, &counter);
+
+                    last = middle;
+                }
+
+                body (first, last);
+            }
+        };
+
+        Counter  counter;
+        Splitter splitter{ *this, counter, body, grain };
+
+        splitter.run (0, count);
+
+        wait (counter);
+    }
+
+    void Job_System::push (Task && task)
+    {
+        Worker & worker = *workers[current_index ()];
+
+        if (current_system != this && this_thread::get_id () != main_thread_id) next_queue++;
+
+        {
+            lock_guard< mutex > lock(worker.mutex);
+
+            worker.tasks.push_back (move (task));
+        }
+
+        queued_tasks++;
+
+        // Se toma el cerrojo de los hilos dormidos para que ninguno se duerma sin ver el trabajo nuevo:
+
+        {
+            lock_guard< mutex > lock(sleep_mutex);
+        }
+
+        wake_up.notify_one ();
+    }
+
+    void Job_System::Task_Queue::push_back (Task && task)
+    {
+        // Al llenarse se duplica la capacidad y las tareas se colocan en orden al principio:
+
+        if (count == slots.size ())
+        {
+            vector< Task > grown(max (slots.size () * 2, size_t(16)));
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                grown[i] = move (slots[(first + i) % slots.size ()]);
+            }
+
+            slots.swap (grown);
+            first = 0;
+        }
+
+        slots[(first + count++) % slots.size ()] = move (task);
+    }
+
+    bool Job_System::take (unsigned self, Task & task)
+    {
+        if (queued_tasks.load () <= 0) return false;
+
+        const unsigned count = unsigned(workers.size ());
+
+        // Primero la cola propia, por el final:
+
+        {
+            Worker & worker = *workers[self];
+
+            lock_guard< mutex > lock(worker.mutex);
+
+            if (!worker.tasks.empty ())
+            {
+                worker.tasks.pop_back (task);
+                queued_tasks--;
+
+                return true;
+            }
+        }
+
+        // Después se roba por el principio de las colas de los demás:
+
+        for (unsigned i = 1; i < count; ++i)
+        {
+            Worker & victim = *workers[(self + i) % count];
+
+            unique_lock< mutex > lock(victim.mutex, try_to_lock);
+
+            if (lock.owns_lock () && !victim.tasks.empty ())
+            {
+                victim.tasks.pop_front (task);
+                queued_tasks--;
+
+                workers[self]->jobs_stolen++;
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool Job_System::take_background (Task & task)
+    {
+        if (queued_background.load () <= 0) return false;
+
+        lock_guard< mutex > lock(background_mutex);
+
+        if (background_tasks.empty ()) return false;
+
+        background_tasks.pop_front (task);
+        queued_background--;
+
+        return true;
+    }
+
+    void Job_System::execute (unsigned self, Task & task)
+    {
+        Worker & worker = *workers[self];
+
+        auto start = Clock::now ();
+
+        task.job ();
+
+        worker.busy_nanoseconds += nanoseconds_since (start);
+        worker.jobs_executed++;
+
+        finish (task.counter);
+    }
+
+    void Job_System::finish (Counter * counter)
+    {
+        if (!counter) return;
+
+        // El último trabajo del grupo lanza los que dependían de él. El contador se decrementa con
+        // el cerrojo tomado para que quien espera no lo destruya mientras se usa (ver wait()):
+
+        vector< Task > continuations;
+
+        {
+            lock_guard< mutex > lock(counter->mutex);
+
+            if (--counter->pending > 0) return;
+
+            continuations.swap (counter->continuations);
+        }
+
+        for (auto & task : continuations) push (move (task));
+    }
+
+    void Job_System::worker_loop (unsigned index)
+    {
+        current_system = this;
+        current_worker = index;
+
+        Worker & worker = *workers[index];
+
+        while (!stop)
+        {
+            Task task;
+
+            // Los trabajos de fondo solo se empiezan cuando no queda ninguno de los demás:
+
+            if (take (index, task) || take_background (task))
+            {
+                execute (index, task);
+                continue;
+            }
+
+            auto idle_start = Clock::now ();
+
+            {
+                unique_lock< mutex > lock(sleep_mutex);
+
+                wake_up.wait (lock, [this] () { return stop.load () || queued_tasks.load () > 0 || queued_background.load () > 0; });
+            }
+
+            worker.idle_nanoseconds += nanoseconds_since (idle_start);
+        }
+    }
+
+    vector< Job_System::Worker_Statistics > Job_System::get_worker_statistics () const
+    {
+        vector< Worker_Statistics > statistics;
+
+        for (auto & worker : workers)
+        {
+            statistics.push_back
+            ({
+                worker->jobs_executed.load (),
+                worker->jobs_stolen  .load (),
+                float(worker->busy_nanoseconds.load ()) / 1000000.f,
+                float(worker->idle_nanoseconds.load ()) / 1000000.f
+            });
+        }
+
+        return statistics;
+    }
+
+    void Job_System::reset_statistics ()
+    {
+        for (auto & worker : workers)
+        {
+            worker->jobs_executed    = 0;
+            worker->jobs_stolen      = 0;
+            worker->busy_nanoseconds = 0;
+            worker->idle_nanoseconds = 0;
+        }
+    }
+
+}
@@ -0,0 +1,329 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "Function_Reference.hpp"
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Sistema de trabajos con robo de trabajo (work stealing). Cada hilo tiene su propia cola: mete
+    ///     y saca trabajos por el final (lo último que ha creado es lo que tiene en caché) y, cuando se
+    ///     queda sin trabajo, roba por el principio de las colas de los demás (los trabajos más grandes
+    ///     de un parallel_for). El hilo que crea el sistema (el principal) ocupa el hueco 0: no tiene
+    ///     hilo propio, pero ejecuta trabajos mientras espera en wait() y es el único que ejecuta los
+    ///     trabajos marcados como "del hilo principal" (los que llaman a OpenGL).
+    ///
+    ///     Los contadores permiten esperar a un grupo de trabajos o lanzar un trabajo cuando termina
+    ///     un grupo (dependencias) sin bloquear ningún hilo.
+    ///
+    ///     Los trabajos largos que no tienen que terminar en este frame (la generación de chunks) van a
+    ///     una cola aparte que solo miran los hilos que se quedan sin otro trabajo: wait() nunca los
+    ///     ejecuta, así que un parallel_for no se queda esperando a que termine uno de ellos.
+    ///
+    ///     Como se lanzan trabajos en cada frame, ni los trabajos ni las colas reservan memoria una vez
+    ///     que las colas han alcanzado su tamaño máximo.
+    /// </summary>
+    class Job_System
+    {
+    public:
+
+        class Job;
+        class Counter;
+
+        typedef Function_Reference< void (size_t first, size_t last) > Range_Function;
+
+        struct Worker_Statistics
+        {
+            size_t jobs_executed;
+            size_t jobs_stolen;                     // Trabajos sacados de la cola de otro hilo
+            float  busy_milliseconds;               // Tiempo ejecutando trabajos
+            float  idle_milliseconds;               // Tiempo dormido esperando trabajo (0 en el hilo principal)
+        };
+
+        /// <summary>
+        ///     Función sin parámetros guardada dentro del propio trabajo. A diferencia de std::function
+        ///     nunca reserva memoria: lo que captura no puede ocupar más de CAPACITY bytes (si hace falta
+        ///     más, se captura un puntero a los datos).
+        /// </summary>
+        class Job
+        {
+        public:
+
+            static const size_t CAPACITY = 48;
+
+        private:
+
+            typedef void (* Invoke  ) (void * function);
+            typedef void (* Relocate) (void * from, void * to);    // Mueve la función a to y destruye la de from
+
+            alignas(std::max_align_t) unsigned char storage[CAPACITY];
+
+            Invoke   invoke;
+            Relocate relocate;
+
+        public:
+
+            Job() : invoke(nullptr), relocate(nullptr)
+            {
+            }
+
+            template
+            <
+                class Function,
+                class = typename std::enable_if< !std::is_same< typename std::decay< Function >::type, Job >::value >::type
+            >
+            Job(Function && function)
+            {
+                typedef typename std::decay< Function >::type Stored;
+
+                static_assert(sizeof (Stored) <= CAPACITY,                  "La captura del trabajo no cabe en Job::CAPACITY");
+                static_assert(alignof(Stored) <= alignof(std::max_align_t), "La captura del trabajo necesita más alineación");
+
+                new (storage) Stored(std::forward< Function >(function));
+
+                invoke   = [] (void * function) { (*static_cast< Stored * >(function)) (); };
+                relocate = [] (void * from, void * to)
+                {
+                    Stored * stored = static_cast< Stored * >(from);
+
+                    if (to) new (to) Stored(std::move (*stored));
+
+                    stored->~Stored ();
+                };
+            }
+
+            Job(Job && other) : invoke(other.invoke), relocate(other.relocate)
+            {
+                if (relocate) relocate (other.storage, storage);
+
+                other.invoke   = nullptr;
+                other.relocate = nullptr;
+            }
+
+           ~Job()
+            {
+                if (relocate) relocate (storage, nullptr);
+            }
+
+            Job(const Job & ) = delete;
+
+            Job & operator = (const Job & ) = delete;
+
+            Job & operator = (Job && other)
+            {
+                if (this != &other)
+                {
+                    if (relocate) relocate (storage, nullptr);
+
+                    invoke   = other.invoke;
+                    relocate = other.relocate;
+
+                    if (relocate) relocate (other.storage, storage);
+
+                    other.invoke   = nullptr;
+                    other.relocate = nullptr;
+                }
+
+                return *this;
+            }
+
+            void operator () ()
+            {
+                invoke (storage);
+            }
+
+        };
+
+    private:
+
+        struct Task
+        {
+            Job       job;
+            Counter * counter;                      // Se decrementa al terminar el trabajo (puede ser nulo)
+        };
+
+        /// Cola doble en un array circular que solo crece (std::deque reserva y libera sus bloques
+        /// al llenarse y vaciarse):
+        class Task_Queue
+        {
+            std::vector< Task > slots;
+            size_t              first;
+            size_t              count;
+
+        public:
+
+            Task_Queue() : first(0), count(0)
+            {
+            }
+
+            bool empty () const
+            {
+                return count == 0;
+            }
+
+            void push_back (Task && task);
+
+            void pop_back  (Task & task)
+            {
+                task = std::move (slots[(first + --count) % slots.size ()]);
+            }
+
+            void pop_front (Task & task)
+            {
+                task = std::move (slots[first]);
+
+                first = (first + 1) % slots.size ();
+                count--;
+            }
+        };
+
+    public:
+
+        /// Número de trabajos pendientes de un grupo. Tiene que seguir vivo hasta que llegue a 0:
+        class Counter
+        {
+            friend class Job_System;
+
+            std::atomic< int >  pending;
+            mutable std::mutex  mutex;
+            std::vector< Task > continuations;      // Trabajos que se lanzan cuando pending llega a 0
+
+        public:
+
+            Counter() : pending(0)
+            {
+            }
+
+            Counter(const Counter & ) = delete;
+
+            Counter & operator = (const Counter & ) = delete;
+
+            bool is_done () const
+            {
+                std::lock_guard< std::mutex > lock(mutex);
+
+                return pending.load () == 0;
+            }
+        };
+
+    private:
+
+        struct Worker
+        {
+            Task_Queue              tasks;
+            std::mutex              mutex;
+            std::thread             thread;
+
+            std::atomic< size_t   > jobs_executed;
+            std::atomic< size_t   > jobs_stolen;
+            std::atomic< uint64_t > busy_nanoseconds;
+            std::atomic< uint64_t > idle_nanoseconds;
+        };
+
+        std::vector< std::unique_ptr< Worker > > workers;
+
+        std::thread::id          main_thread_id;
+        std::mutex               main_mutex;
+        std::vector< Task >      main_tasks;
+        std::vector< Task >      running_main_tasks;  // Se intercambia con main_tasks para no reservar memoria
+
+        std::mutex               background_mutex;
+        Task_Queue               background_tasks;
+
+        std::atomic< int >       queued_tasks;      // Trabajos en las colas de los hilos (sin contar los del hilo principal)
+        std::atomic< int >       queued_background; // Trabajos en background_tasks
+        std::atomic< bool >      stop;
+        std::mutex               sleep_mutex;
+        std::condition_variable  wake_up;
+
+        std::atomic< unsigned >  next_queue;        // Reparto de los trabajos que llegan de hilos ajenos
+
+    public:
+
+        /// Crea worker_count hilos además del principal:
+        explicit Job_System(unsigned worker_count = default_worker_count ());
+       ~Job_System();
+
+        Job_System(const Job_System & ) = delete;
+
+        Job_System & operator = (const Job_System & ) = delete;
+
+        /// Sistema compartido por todo el motor (se crea en el primer uso, que debe ser desde el hilo principal):
+        static Job_System & get_instance ();
+
+        static unsigned default_worker_count ()
+        {
+            unsigned hardware_threads = std::thread::hardware_concurrency ();
+
+            return hardware_threads > 1 ? hardware_threads - 1 : 0;
+        }
+
+    public:
+
+        /// Número de hilos que ejecutan trabajos (incluido el principal):
+        unsigned get_thread_count () const
+        {
+            return unsigned(workers.size ());
+        }
+
+        void submit      (Job job, Counter * counter = nullptr);
+
+        /// Lanza el trabajo cuando dependency llegue a 0:
+        void submit_after (Counter & dependency, Job job, Counter * counter = nullptr);
+
+        /// Encola un trabajo largo que solo ejecutan los hilos de trabajo cuando no tienen otra cosa que
+        /// hacer, en el orden en que llegan. Sin hilos de trabajo se ejecuta antes de retornar:
+        void submit_background (Job job, Counter * counter = nullptr);
+
+        /// Encola un trabajo que solo puede ejecutar el hilo principal (por ejemplo, llamadas a OpenGL):
+        void submit_main (Job job, Counter * counter = nullptr);
+
+        /// Ejecuta los trabajos pendientes del hilo principal. Se llama una vez por frame:
+        void run_main_thread_jobs ();
+
+        /// Espera a que el contador llegue a 0 ejecutando otros trabajos mientras tanto (nunca los de
+        /// submit_background(), que se dejan a los hilos de trabajo):
+        void wait (Counter & counter);
+
+        /// Reparte [0, count) en trozos y llama a body(first, last) con cada uno. Los rangos se parten
+        /// por la mitad mientras son mayores que el grano, y las mitades se encolan para que las roben
+        /// los hilos libres, de modo que el tamaño de los trozos se adapta a la carga. Retorna cuando
+        /// se han procesado todos:
+        void parallel_for (size_t count, Range_Function body, size_t min_chunk = 1);
+
+        std::vector< Worker_Statistics > get_worker_statistics () const;
+
+        void reset_statistics ();
+
+    private:
+
+        void push    (Task && task);
+        bool take    (unsigned self, Task & task);
+        bool take_background (Task & task);
+        void execute (unsigned self, Task & task);
+        void finish  (Counter * counter);
+
+        bool run_one_main_task ();
+
+        void worker_loop (unsigned index);
+
+        unsigned current_index () const;
+
+    };
+
+}
@@ -0,0 +1,371 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Light_Clusters.hpp"
+#include "Job_System.hpp"
+#include "simd-recipes.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <xmmintrin.h>                      // SSE
+
+using namespace std;
+
+namespace udit
+{
+
+    namespace
+    {
+
+        // Las luces de relleno quedan tan lejos que nunca intersecan con ningún cluster:
+
+        const float padding_position = 1e18f;
+
+        /// Prueba 4 esferas contra una caja y retorna una máscara con las que la intersecan:
+        inline int intersect_4_spheres
+        (
+            const float * x, const float * y, const float * z, const float * radius,
+            __m128 box_min_x, __m128 box_min_y, __m128 box_min_z,
+            __m128 box_max_x, __m128 box_max_y, __m128 box_max_z
+        )
+        {
+            const __m128 zero = _mm_setzero_ps ();
+
+            __m128 center_x = _mm_loadu_ps (x);
+            __m128 center_y = _mm_loadu_ps (y);
+            __m128 center_z = _mm_loadu_ps (z);
+            __m128 r        = _mm_loadu_ps (radius);
+
+            // Distancia de cada centro a la caja en cada eje (0 si está dentro en ese eje):
+
+            __m128 dx = _mm_add_ps (_mm_max_ps (_mm_sub_ps (box_min_x, center_x), zero), _mm_max_ps (_mm_sub_ps (center_x, box_max_x), zero));
+            __m128 dy = _mm_add_ps (_mm_max_ps (_mm_sub_ps (box_min_y, center_y), zero), _mm_max_ps (_mm_sub_ps (center_y, box_max_y), zero));
+            __m128 dz = _mm_add_ps (_mm_max_ps (_mm_sub_ps (box_min_z, center_z), zero), _mm_max_ps (_mm_sub_ps (center_z, box_max_z), zero));
+
+            __m128 distance2 = _mm_add_ps (_mm_add_ps (_mm_mul_ps (dx, dx), _mm_mul_ps (dy, dy)), _mm_mul_ps (dz, dz));
+
+            return _mm_movemask_ps (_mm_cmple_ps (distance2, _mm_mul_ps (r, r)));
+        }
+
+        /// Copia las esferas que intersecan con la caja a otro array compacto (rellenado a múltiplo de 4):
+        void filter_spheres
+        (
+            const vector< float > & x, const vector< float > & y, const vector< float > & z,
+            const vector< float > & radius, const vector< uint32_t > & index,
+            size_t count,
+            const float box_min[3], const float box_max[3],
+            vector< float > & out_x, vector< float > & out_y, vector< float > & out_z,
+            vector< float > & out_radius, vector< uint32_t > & out_index
+        )
+        {
+            out_x.clear (); out_y.clear (); out_z.clear (); out_radius.clear (); out_index.clear ();
+
+            __m128 min_x = _mm_set1_ps (box_min[0]), max_x = _mm_set1_ps (box_max[0]);
+            __m128 min_y = _mm_set1_ps (box_min[1]), max_y = _mm_set1_ps (box_max[1]);
+            __m128 min_z = _mm_set1_ps (box_min[2]), max_z = _mm_set1_ps (box_max[2]);
+
+            for (size_t i = 0; i < count; i += 4)
+            {
+                int mask = intersect_4_spheres (&x[i], &y[i], &z[i], &radius[i], min_x, min_y, min_z, max_x, max_y, max_z);
+
+                for (; mask; mask &= mask - 1)
+                {
+                    size_t j = i + lowest_set_bit (unsigned(mask));
+
+                    out_x     .push_back (x     [j]);
+                    out_y     .push_back (y     [j]);
+                    out_z     .push_back (z     [j]);
+                    out_radius.push_back (radius[j]);
+                    out_index .push_back (index [j]);
+                }
+            }
+
+            while (out_x.size () % 4)
+            {
+                out_x.push_back (padding_position); out_y.push_back (padding_position); out_z.push_back (padding_position);
+                out_radius.push_back (0.f);
+                out_index .push_back (0  );
+            }
+        }
+
+    }
+
+    Light_Clusters::Light_Clusters()
+    :
+        near_z     (1.f),
+        far_z      (1.f),
+        buffer_ids (),
+        texture_ids(),
+        max_texels (0)
+    {
+        statistics = Statistics();
+
+        slices.resize (GRID_Z);
+        grid  .resize (CLUSTER_COUNT);
+    }
+
+    Light_Clusters::~Light_Clusters()
+    {
+        if (buffer_ids[0])
+        {
+            glDeleteTextures (BUFFER_COUNT, texture_ids);
+            glDeleteBuffers  (BUFFER_COUNT,  buffer_ids);
+        }
+    }
+
+    void Light_Clusters::set_projection (const glm::mat4 & projection_matrix, float near_z, float far_z)
+    {
+        this->near_z = near_z;
+        this->far_z  = far_z;
+
+        // Tangentes de los semiángulos del frustum a partir de la matriz de proyección:
+
+        float tan_x = 1.f / projection_matrix[0][0];
+        float tan_y = 1.f / projection_matrix[1][1];
+
+        min_x.resize (CLUSTER_COUNT); min_y.resize (CLUSTER_COUNT); min_z.resize (CLUSTER_COUNT);
+        max_x.resize (CLUSTER_COUNT); max_y.resize (CLUSTER_COUNT); max_z.resize (CLUSTER_COUNT);
+
+        for (unsigned k = 0; k < GRID_Z; ++k)
+        {
+            // Cortes exponenciales: cada uno cubre la misma proporción de profundidad:
+
+            float depth_0 = near_z * pow (far_z / near_z, float(k    ) / GRID_Z);
+            float depth_1 = near_z * pow (far_z / near_z, float(k + 1) / GRID_Z);
+
+            for (unsigned j = 0; j < GRID_Y; ++j)
+            {
+                float ndc_y0 = -1.f + 2.f * float(j    ) / GRID_Y;
+                float ndc_y1 = -1.f + 2.f * float(j + 1) / GRID_Y;
+
+                for (unsigned i = 0; i < GRID_X; ++i)
+                {
+                    float ndc_x0 = -1.f + 2.f * float(i    ) / GRID_X;
+                    float ndc_x1 = -1.f + 2.f * float(i + 1) / GRID_X;
+
+                    unsigned c = (k * GRID_Y + j) * GRID_X + i;
+
+                    // La caja debe englobar la tesela tanto en su cara cercana como en la lejana:
+
+                    min_x[c] = min (ndc_x0 * tan_x * depth_0, ndc_x0 * tan_x * depth_1);
+                    max_x[c] = max (ndc_x1 * tan_x * depth_0, ndc_x1 * tan_x * depth_1);
+                    min_y[c] = min (ndc_y0 * tan_y * depth_0, ndc_y0 * tan_y * depth_1);
+                    max_y[c] = max (ndc_y1 * tan_y * depth_0, ndc_y1 * tan_y * depth_1);
+                    min_z[c] = -depth_1;                // En espacio de vista la cámara mira hacia -Z
+                    max_z[c] = -depth_0;
+                }
+            }
+        }
+    }
+
+    void Light_Clusters::assign (const Light_Set & lights)
+    {
+        auto start = chrono::high_resolution_clock::now ();
+
+        // Se copian las luces a arrays rellenados a múltiplo de 4 para poder probarlas con SSE:
+
+        padded.x = lights.x; padded.y = lights.y; padded.z = lights.z; padded.radius = lights.radius;
+        padded.light_index.resize (lights.size ());
+
+        for (uint32_t i = 0; i < padded.light_index.size (); ++i) padded.light_index[i] = i;
+
+        while (padded.x.size () % 4)
+        {
+            padded.x.push_back (padding_position); padded.y.push_back (padding_position); padded.z.push_back (padding_position);
+            padded.radius     .push_back (0.f);
+            padded.light_index.push_back (0  );
+        }
+
+        // Los cortes de profundidad se reparten entre los hilos del sistema de trabajos. Son
+        // independientes entre sí, por lo que no hace falta sincronizar nada más:
+
+        Job_System::get_instance ().parallel_for
+        (
+            GRID_Z,
+            [this] (size_t first, size_t last)
+            {
+                for (size_t k = first; k < last; ++k) assign_slice (unsigned(k));
+            }
+        );
+
+        // Se unen las listas de todos los cortes y se calcula el desplazamiento de cada cluster:
+
+        light_indices.clear ();
+
+        for (unsigned k = 0; k < GRID_Z; ++k)
+        {
+            const Slice & slice = slices[k];
+
+            uint32_t offset = uint32_t(light_indices.size ());
+
+            for (unsigned c = 0; c < GRID_X * GRID_Y; ++c)
+            {
+                grid[k * GRID_X * GRID_Y + c] = glm::uvec2(offset, slice.cluster_count[c]);
+
+                offset += slice.cluster_count[c];
+            }
+
+            light_indices.insert (light_indices.end (), slice.cluster_lights.begin (), slice.cluster_lights.end ());
+        }
+
+        auto end = chrono::high_resolution_clock::now ();
+
+        statistics.light_count         = lights.size ();
+        statistics.index_count         = light_indices.size ();
+        statistics.dropped_count       = 0;
+        statistics.assign_milliseconds = chrono::duration< float, milli >(end - start).count ();
+    }
+
+    void Light_Clusters::assign_slice (unsigned k)
+    {
+        Slice & slice = slices[k];
+
+        slice.cluster_lights.clear ();
+
+        // 1) Luces que alcanzan el corte completo:
+
+        unsigned first = k * GRID_X * GRID_Y;
+        unsigned last  = first + GRID_X * GRID_Y - 1;
+
+        float slice_min[3] = { min_x[first], min_y[first], min_z[first] };
+        float slice_max[3] = { max_x[last ], max_y[last ], max_z[first] };
+
+        filter_spheres (padded.x, padded.y, padded.z, padded.radius, padded.light_index, padded.x.size (), slice_min, slice_max, slice.x, slice.y, slice.z, slice.radius, slice.light_index);
+
+        vector< float    > & row_x      = slice.row_x;
+        vector< float    > & row_y      = slice.row_y;
+        vector< float    > & row_z      = slice.row_z;
+        vector< float    > & row_radius = slice.row_radius;
+        vector< uint32_t > & row_index  = slice.row_index;
+
+        for (unsigned j = 0; j < GRID_Y; ++j)
+        {
+            // 2) Luces que alcanzan la fila de clusters:
+
+            unsigned row_first = first + j * GRID_X;
+            unsigned row_last  = row_first + GRID_X - 1;
+
+            float row_min[3] = { min_x[row_first], min_y[row_first], min_z[row_first] };
+            float row_max[3] = { max_x[row_last ], max_y[row_last ], max_z[row_first] };
+
+            filter_spheres (slice.x, slice.y, slice.z, slice.radius, slice.light_index, slice.x.size (), row_min, row_max, row_x, row_y, row_z, row_radius, row_index);
+
+            // 3) Luces que alcanzan cada cluster de la fila:
+
+            for (unsigned i = 0; i < GRID_X; ++i)
+            {
+                unsigned c     = row_first + i;
+                size_t   count = slice.cluster_lights.size ();
+
+                __m128 box_min_x = _mm_set1_ps (min_x[c]), box_max_x = _mm_set1_ps (max_x[c]);
+                __m128 box_min_y = _mm_set1_ps (min_y[c]), box_max_y = _mm_set1_ps (max_y[c]);
+                __m128 box_min_z = _mm_set1_ps (min_z[c]), box_max_z = _mm_set1_ps (max_z[c]);
+
+                for (size_t l = 0; l < row_x.size (); l += 4)
+                {
+                    int mask = intersect_4_spheres
+                    (
+                        &row_x[l], &row_y[l], &row_z[l], &row_radius[l],
+                        box_min_x, box_min_y, box_min_z, box_max_x, box_max_y, box_max_z
+                    );
+
+                    for (; mask; mask &= mask - 1)
+                    {
+                        slice.cluster_lights.push_back (row_index[l + lowest_set_bit (unsigned(mask))]);
+                    }
+                }
+
+                slice.cluster_count[j * GRID_X + i] = uint32_t(slice.cluster_lights.size () - count);
+            }
+        }
+    }
+
+    void Light_Clusters::upload (const Light_Set & lights)
+    {
+        if (!buffer_ids[0])
+        {
+            glGenBuffers  (BUFFER_COUNT,  buffer_ids);
+            glGenTextures (BUFFER_COUNT, texture_ids);
+
+            glGetIntegerv (GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+
+            static const GLenum formats[BUFFER_COUNT] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+
+            for (unsigned b = 0; b < BUFFER_COUNT; ++b)
+            {
+                glBindBuffer  (GL_TEXTURE_BUFFER, buffer_ids[b]);
+                glBufferData  (GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+                glBindTexture (GL_TEXTURE_BUFFER, texture_ids[b]);
+                glTexBuffer   (GL_TEXTURE_BUFFER, formats[b], buffer_ids[b]);
+            }
+        }
+
+        // Se empaquetan las luces en 2 texels cada una: (posición, radio) y (color, 0):
+
+        size_t light_count = min (lights.size (), size_t(max_texels / 2));
+
+        light_data.resize (max (light_count, size_t(1)) * 8);
+
+        for (size_t i = 0; i < light_count; ++i)
+        {
+            float * texels = &light_data[i * 8];
+
+            texels[0] = lights.x  [i]; texels[1] = lights.y    [i]; texels[2] = lights.z   [i]; texels[3] = lights.radius[i];
+            texels[4] = lights.red[i]; texels[5] = lights.green[i]; texels[6] = lights.blue[i]; texels[7] = 0.f;
+        }
+
+        // Si la lista de índices no cabe en el texture buffer se recortan los clusters que se salen:
+
+        if (light_indices.size () > size_t(max_texels))
+        {
+            statistics.dropped_count = light_indices.size () - size_t(max_texels);
+
+            for (auto & cluster : grid)
+            {
+                cluster.x = min (cluster.x, uint32_t(max_texels));
+                cluster.y = min (cluster.y, uint32_t(max_texels) - cluster.x);
+            }
+
+            light_indices.resize (size_t(max_texels));
+        }
+
+        if (light_indices.empty ()) light_indices.push_back (0);
+
+        // Se reemplaza el contenido de los búferes (el driver puede descartar el anterior sin esperar):
+
+        glBindBuffer (GL_TEXTURE_BUFFER, buffer_ids[LIGHT_DATA]);
+        glBufferData (GL_TEXTURE_BUFFER, light_data.size () * sizeof(float), light_data.data (), GL_STREAM_DRAW);
+
+        glBindBuffer (GL_TEXTURE_BUFFER, buffer_ids[CLUSTER_GRID]);
+        glBufferData (GL_TEXTURE_BUFFER, grid.size () * sizeof(glm::uvec2), grid.data (), GL_STREAM_DRAW);
+
+        glBindBuffer (GL_TEXTURE_BUFFER, buffer_ids[LIGHT_INDICES]);
+        glBufferData (GL_TEXTURE_BUFFER, light_indices.size () * sizeof(uint32_t), light_indices.data (), GL_STREAM_DRAW);
+
+        glBindBuffer (GL_TEXTURE_BUFFER, 0);
+    }
+
+    void Light_Clusters::bind (GLuint first_texture_unit) const
+    {
+        for (unsigned b = 0; b < BUFFER_COUNT; ++b)
+        {
+            glActiveTexture (GL_TEXTURE0 + first_texture_unit + b);
+            glBindTexture   (GL_TEXTURE_BUFFER, texture_ids[b]);
+        }
+
+        glActiveTexture (GL_TEXTURE0);
+    }
+
+    float Light_Clusters::slice_scale () const
+    {
+        return float(GRID_Z) / log (far_z / near_z);
+    }
+
+    float Light_Clusters::slice_bias () const
+    {
+        return -float(GRID_Z) * log (near_z) / log (far_z / near_z);
+    }
+
+}
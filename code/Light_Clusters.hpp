@@ -0,0 +1,160 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstdint>
+#include <glad/glad.h>
+#include <glm.hpp>
+#include <vector>
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Clustered forward shading: divide el frustum de la cámara en una rejilla 3D de clusters
+    ///     (teselas en pantalla y cortes exponenciales en profundidad) y reparte las luces puntuales
+    ///     entre los clusters a los que alcanzan. El reparto se hace en la CPU, en paralelo por cortes
+    ///     de profundidad y probando 4 luces a la vez (SSE). El resultado se sube a texture buffers
+    ///     para que el fragment shader recorra solo las luces de su cluster.
+    /// </summary>
+    class Light_Clusters
+    {
+    public:
+
+        static const unsigned GRID_X        = 16;
+        static const unsigned GRID_Y        =  9;
+        static const unsigned GRID_Z        = 24;
+        static const unsigned CLUSTER_COUNT = GRID_X * GRID_Y * GRID_Z;
+
+        /// Luces en espacio de vista guardadas como structure-of-arrays:
+        struct Light_Set
+        {
+            std::vector< float > x, y, z, radius;
+            std::vector< float > red, green, blue;
+
+            size_t size () const
+            {
+                return x.size ();
+            }
+
+            void clear ()
+            {
+                x.clear (); y.clear (); z.clear (); radius.clear ();
+                red.clear (); green.clear (); blue.clear ();
+            }
+
+            void add (const glm::vec3 & view_position, float light_radius, const glm::vec3 & color)
+            {
+                x     .push_back (view_position.x);
+                y     .push_back (view_position.y);
+                z     .push_back (view_position.z);
+                radius.push_back (light_radius   );
+                red   .push_back (color.r);
+                green .push_back (color.g);
+                blue  .push_back (color.b);
+            }
+        };
+
+        struct Statistics
+        {
+            size_t light_count;
+            size_t index_count;                     // Total de referencias luz-cluster
+            size_t dropped_count;                   // Referencias que no cupieron en el texture buffer
+            float  assign_milliseconds;
+        };
+
+    private:
+
+        /// Luces candidatas de un corte de profundidad (copia compacta para poder usar SIMD):
+        struct Slice
+        {
+            std::vector< float    > x, y, z, radius;
+            std::vector< uint32_t > light_index;
+            std::vector< uint32_t > cluster_lights; // Índices de luz de todos los clusters del corte
+            uint32_t                cluster_count [GRID_X * GRID_Y];
+
+            // Luces de la fila que se está repartiendo. Se guardan aquí para conservar su capacidad
+            // entre frames:
+            std::vector< float    > row_x, row_y, row_z, row_radius;
+            std::vector< uint32_t > row_index;
+        };
+
+        // Cajas de los clusters en espacio de vista (structure-of-arrays):
+
+        std::vector< float > min_x, min_y, min_z;
+        std::vector< float > max_x, max_y, max_z;
+
+        float near_z;
+        float  far_z;
+
+        Slice                      padded;          // Todas las luces, rellenadas a múltiplo de 4
+        std::vector< Slice     > slices;
+        std::vector< glm::uvec2 > grid;             // (offset, count) de cada cluster en light_indices
+        std::vector< uint32_t  > light_indices;
+        std::vector< float     > light_data;        // 2 texels RGBA32F por luz
+
+        Statistics statistics;
+
+        // Recursos de OpenGL (se crean la primera vez que se sube el resultado):
+
+        enum
+        {
+            LIGHT_DATA,
+            CLUSTER_GRID,
+            LIGHT_INDICES,
+            BUFFER_COUNT
+        };
+
+        GLuint buffer_ids [BUFFER_COUNT];
+        GLuint texture_ids[BUFFER_COUNT];
+        GLint  max_texels;
+
+    public:
+
+        Light_Clusters();
+       ~Light_Clusters();
+
+        Light_Clusters(const Light_Clusters & ) = delete;
+
+        Light_Clusters & operator = (const Light_Clusters & ) = delete;
+
+    public:
+
+        /// Recalcula las cajas de los clusters. Solo es necesario si cambia la proyección:
+        void set_projection (const glm::mat4 & projection_matrix, float near_z, float far_z);
+
+        /// Reparte las luces entre los clusters (solo CPU, no necesita contexto de OpenGL):
+        void assign (const Light_Set & lights);
+
+        /// Sube el resultado a los texture buffers y los vincula a tres unidades de textura consecutivas:
+        void upload (const Light_Set & lights);
+        void bind   (GLuint first_texture_unit) const;
+
+        /// Parámetros que necesita el shader para calcular el cluster de un fragmento:
+        float slice_scale () const;
+        float slice_bias  () const;
+
+        const Statistics & get_statistics () const
+        {
+            return statistics;
+        }
+
+        const std::vector< glm::uvec2 > & get_grid () const
+        {
+            return grid;
+        }
+
+        const std::vector< uint32_t > & get_light_indices () const
+        {
+            return light_indices;
+        }
+
+    private:
+
+        void assign_slice (unsigned slice_index);
+
+    };
+
+}
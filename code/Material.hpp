@@ -0,0 +1,44 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <glad/glad.h>
+#include <glm.hpp>
+#include "Shader_Variants.hpp"
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Propiedades de superficie de un objeto. A partir de ellas se elige la variante mínima del
+    ///     shader de la escena, de modo que un objeto sin textura no la muestrea y uno opaco no
+    ///     paga el coste de la mezcla.
+    /// </summary>
+    struct Material
+    {
+        glm::vec3 color              = glm::vec3(1.f);
+        float     alpha              = 1.f;
+        float     roughness          = 0.5f;        // 0 = brillo puntual, 1 = brillo muy difuso
+        GLuint    texture_id         = 0;           // 0 si no tiene textura
+        bool      vertex_color       = false;       // Multiplica el color por el color de cada vértice
+        bool      per_pixel_lighting = false;       // Iluminación por fragmento en lugar de por vértice
+        bool      transparent        = false;       // Se dibuja en la etapa de objetos transparentes
+        bool      terrain_lod        = false;       // Las posiciones y normales salen del mapa de alturas (Terrain_Lod)
+
+        unsigned variant_key (unsigned light_count) const
+        {
+            unsigned features = 0;
+
+            if (texture_id        ) features |= Shader_Variants::TEXTURED;
+            if (vertex_color      ) features |= Shader_Variants::VERTEX_COLOR;
+            if (per_pixel_lighting) features |= Shader_Variants::PER_PIXEL_LIGHTING;
+            if (transparent       ) features |= Shader_Variants::ALPHA_BLENDED;
+            if (terrain_lod       ) features |= Shader_Variants::TERRAIN_LOD;
+
+            return Shader_Variants::make_key (features, light_count);
+        }
+    };
+
+}
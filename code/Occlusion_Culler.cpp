@@ -0,0 +1,353 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Occlusion_Culler.hpp"
+#include "Job_System.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <xmmintrin.h>                      // SSE
+
+using namespace std;
+
+namespace udit
+{
+
+    namespace
+    {
+
+        typedef chrono::high_resolution_clock Clock;
+
+        float milliseconds_since (Clock::time_point start)
+        {
+            return chrono::duration< float, milli >(Clock::now () - start).count ();
+        }
+
+        // Los vértices con w menor que este valor están detrás del plano cercano:
+
+        const float minimum_w = 1e-4f;
+
+    }
+
+    Occlusion_Culler::Occlusion_Culler()
+    :
+        view_projection_matrix(1.f),
+        depth      (WIDTH    * HEIGHT,   1.f),
+        block_depth(BLOCKS_X * BLOCKS_Y, 1.f),
+        statistics {}
+    {
+    }
+
+    void Occlusion_Culler::begin_frame (const glm::mat4 & view_projection_matrix)
+    {
+        this->view_projection_matrix = view_projection_matrix;
+
+        triangles.clear ();
+
+        for (auto & list : tile_triangles) list.clear ();
+
+        statistics.occluder_triangles  = 0;
+        statistics.raster_milliseconds = 0.f;
+    }
+
+    void Occlusion_Culler::add_occluder
+    (
+        const float    * positions,
+        size_t           vertex_count,
+        const uint32_t * indices,
+        size_t           index_count,
+        const glm::mat4 & model_matrix
+    )
+    {
+        auto start = Clock::now ();
+
+        // Se transforman todos los vértices una sola vez (los comparten varios triángulos):
+
+        glm::mat4 matrix = view_projection_matrix * model_matrix;
+
+        clip_positions.resize (vertex_count);
+
+        for (size_t i = 0; i < vertex_count; ++i)
+        {
+            clip_positions[i] = matrix * glm::vec4(positions[i * 3 + 0], positions[i * 3 + 1], positions[i * 3 + 2], 1.f);
+        }
+
+        // Se preparan los triángulos y se reparten entre las teselas que toca su rectángulo:
+
+        for (size_t i = 0; i + 2 < index_count; i += 3)
+        {
+            const glm::vec4 & c0 = clip_positions[indices[i + 0]];
+            const glm::vec4 & c1 = clip_positions[indices[i + 1]];
+            const glm::vec4 & c2 = clip_positions[indices[i + 2]];
+
+            // Los triángulos que cruzan el plano cercano se descartan. Así solo se pierde oclusión,
+            // nunca se oculta un objeto visible:
+
+            if (c0.w < minimum_w || c1.w < minimum_w || c2.w < minimum_w) continue;
+
+            float x[3], y[3], z[3];
+
+            const glm::vec4 * clip[3] = { &c0, &c1, &c2 };
+
+            for (int v = 0; v < 3; ++v)
+            {
+                float inverse_w = 1.f / clip[v]->w;
+
+                x[v] = (clip[v]->x * inverse_w * 0.5f + 0.5f) * WIDTH;
+                y[v] = (clip[v]->y * inverse_w * 0.5f + 0.5f) * HEIGHT;
+                z[v] =  clip[v]->z * inverse_w;
+            }
+
+            // Se orientan todos los triángulos en sentido antihorario (los oclusores no descartan caras traseras):
+
+            float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+
+            if (fabs (area) < 1e-6f) continue;
+
+            if (area < 0.f)
+            {
+                swap (x[1], x[2]);
+                swap (y[1], y[2]);
+                swap (z[1], z[2]);
+                area = -area;
+            }
+
+            Triangle triangle;
+
+            triangle.min_x = max (int(floor (min ({ x[0], x[1], x[2] }))), 0);
+            triangle.min_y = max (int(floor (min ({ y[0], y[1], y[2] }))), 0);
+            triangle.max_x = min (int(floor (max ({ x[0], x[1], x[2] }))), WIDTH  - 1);
+            triangle.max_y = min (int(floor (max ({ y[0], y[1], y[2] }))), HEIGHT - 1);
+
+            if (triangle.min_x > triangle.max_x || triangle.min_y > triangle.max_y) continue;
+
+            for (int edge = 0; edge < 3; ++edge)
+            {
+                int from = edge, to = (edge + 1) % 3;
+
+                triangle.edge_a[edge] = y[from] - y[to];
+                triangle.edge_b[edge] = x[to] - x[from];
+                triangle.edge_c[edge] = -(triangle.edge_a[edge] * x[from] + triangle.edge_b[edge] * y[from]);
+            }
+
+            triangle.depth_x = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+            triangle.depth_y = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) / area;
+            triangle.depth_c = z[0] - triangle.depth_x * x[0] - triangle.depth_y * y[0];
+
+            uint32_t triangle_index = uint32_t(triangles.size ());
+
+            triangles.push_back (triangle);
+
+            for (int tile_y = triangle.min_y / TILE_HEIGHT; tile_y <= triangle.max_y / TILE_HEIGHT; ++tile_y)
+            {
+                for (int tile_x = triangle.min_x / TILE_WIDTH; tile_x <= triangle.max_x / TILE_WIDTH; ++tile_x)
+                {
+                    tile_triangles[tile_y * TILES_X + tile_x].push_back (triangle_index);
+                }
+            }
+        }
+
+        statistics.occluder_triangles   = triangles.size ();
+        statistics.raster_milliseconds += milliseconds_since (start);
+    }
+
+    void Occlusion_Culler::rasterize ()
+    {
+        auto start = Clock::now ();
+
+        // Las teselas se reparten entre los hilos del sistema de trabajos. No comparten píxeles, por
+        // lo que no hace falta sincronizar las escrituras:
+
+        Job_System::get_instance ().parallel_for
+        (
+            TILES_X * TILES_Y,
+            [this] (size_t first, size_t last)
+            {
+                for (size_t tile = first; tile < last; ++tile) rasterize_tile (int(tile));
+            }
+        );
+
+        statistics.raster_milliseconds += milliseconds_since (start);
+    }
+
+    void Occlusion_Culler::rasterize_tile (int tile_index)
+    {
+        const int tile_x0 = (tile_index % TILES_X) * TILE_WIDTH;
+        const int tile_y0 = (tile_index / TILES_X) * TILE_HEIGHT;
+        const int tile_x1 = tile_x0 + TILE_WIDTH  - 1;
+        const int tile_y1 = tile_y0 + TILE_HEIGHT - 1;
+
+        // Se limpia la tesela al plano lejano:
+
+        for (int y = tile_y0; y <= tile_y1; ++y)
+        {
+            fill_n (&depth[y * WIDTH + tile_x0], TILE_WIDTH, 1.f);
+        }
+
+        const __m128 lane_offsets = _mm_setr_ps (0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 zero         = _mm_setzero_ps ();
+
+        for (uint32_t triangle_index : tile_triangles[tile_index])
+        {
+            const Triangle & triangle = triangles[triangle_index];
+
+            // Rectángulo del triángulo dentro de la tesela. Se recorre de 4 en 4 píxeles empezando
+            // en un múltiplo de 4 (las teselas también lo son, así que nunca se sale de ella):
+
+            int x0 = max (triangle.min_x, tile_x0) & ~3;
+            int x1 = min (triangle.max_x, tile_x1);
+            int y0 = max (triangle.min_y, tile_y0);
+            int y1 = min (triangle.max_y, tile_y1);
+
+            __m128 a[3], step[3];
+
+            for (int edge = 0; edge < 3; ++edge)
+            {
+                a   [edge] = _mm_set1_ps (triangle.edge_a[edge]);
+                step[edge] = _mm_set1_ps (triangle.edge_a[edge] * 4.f);
+            }
+
+            __m128 depth_step = _mm_set1_ps (triangle.depth_x * 4.f);
+            __m128 x_start    = _mm_add_ps  (_mm_set1_ps (float(x0)), lane_offsets);
+
+            for (int y = y0; y <= y1; ++y)
+            {
+                float  pixel_y = float(y) + 0.5f;
+                __m128 e[3];
+
+                for (int edge = 0; edge < 3; ++edge)
+                {
+                    e[edge] = _mm_add_ps (_mm_mul_ps (a[edge], x_start), _mm_set1_ps (triangle.edge_b[edge] * pixel_y + triangle.edge_c[edge]));
+                }
+
+                __m128 z = _mm_add_ps (_mm_mul_ps (_mm_set1_ps (triangle.depth_x), x_start), _mm_set1_ps (triangle.depth_y * pixel_y + triangle.depth_c));
+
+                float * row = &depth[y * WIDTH];
+
+                for (int x = x0; x <= x1; x += 4)
+                {
+                    __m128 inside = _mm_and_ps (_mm_and_ps (_mm_cmpge_ps (e[0], zero), _mm_cmpge_ps (e[1], zero)), _mm_cmpge_ps (e[2], zero));
+
+                    if (_mm_movemask_ps (inside))
+                    {
+                        __m128 old_depth = _mm_loadu_ps (row + x);
+                        __m128 new_depth = _mm_min_ps (old_depth, z);
+
+                        _mm_storeu_ps (row + x, _mm_or_ps (_mm_and_ps (inside, new_depth), _mm_andnot_ps (inside, old_depth)));
+                    }
+
+                    e[0] = _mm_add_ps (e[0], step[0]);
+                    e[1] = _mm_add_ps (e[1], step[1]);
+                    e[2] = _mm_add_ps (e[2], step[2]);
+                    z    = _mm_add_ps (z,    depth_step);
+                }
+            }
+        }
+
+        // Nivel jerárquico: profundidad más lejana de cada bloque de la tesela:
+
+        for (int block_y = tile_y0 / BLOCK_SIZE; block_y <= tile_y1 / BLOCK_SIZE; ++block_y)
+        {
+            for (int block_x = tile_x0 / BLOCK_SIZE; block_x <= tile_x1 / BLOCK_SIZE; ++block_x)
+            {
+                __m128 farthest = _mm_set1_ps (-1.f);
+
+                for (int y = block_y * BLOCK_SIZE; y < (block_y + 1) * BLOCK_SIZE; ++y)
+                {
+                    const float * row = &depth[y * WIDTH + block_x * BLOCK_SIZE];
+
+                    for (int x = 0; x < BLOCK_SIZE; x += 4)
+                    {
+                        farthest = _mm_max_ps (farthest, _mm_loadu_ps (row + x));
+                    }
+                }
+
+                float lanes[4];
+
+                _mm_storeu_ps (lanes, farthest);
+
+                block_depth[block_y * BLOCKS_X + block_x] = max (max (lanes[0], lanes[1]), max (lanes[2], lanes[3]));
+            }
+        }
+    }
+
+    bool Occlusion_Culler::is_occluded (const glm::vec3 & center, const glm::vec3 & extent)
+    {
+        auto start = Clock::now ();
+
+        statistics.tested_count++;
+
+        // Se proyectan las 8 esquinas de la caja para obtener su rectángulo en pantalla y su
+        // profundidad más cercana:
+
+        float min_x = +1e30f, min_y = +1e30f, max_x = -1e30f, max_y = -1e30f, nearest = +1e30f;
+
+        bool occluded = true;
+
+        for (int corner = 0; corner < 8 && occluded; ++corner)
+        {
+            glm::vec3 position = center + extent * glm::vec3(corner & 1 ? 1.f : -1.f, corner & 2 ? 1.f : -1.f, corner & 4 ? 1.f : -1.f);
+            glm::vec4 clip     = view_projection_matrix * glm::vec4(position, 1.f);
+
+            // Si la caja cruza el plano cercano se considera visible:
+
+            if (clip.w < minimum_w)
+            {
+                occluded = false;
+                break;
+            }
+
+            float inverse_w = 1.f / clip.w;
+            float x = (clip.x * inverse_w * 0.5f + 0.5f) * WIDTH;
+            float y = (clip.y * inverse_w * 0.5f + 0.5f) * HEIGHT;
+
+            min_x   = min (min_x, x);
+            min_y   = min (min_y, y);
+            max_x   = max (max_x, x);
+            max_y   = max (max_y, y);
+            nearest = min (nearest, clip.z * inverse_w);
+        }
+
+        int x0 = max (int(floor (min_x)), 0), x1 = min (int(floor (max_x)), WIDTH  - 1);
+        int y0 = max (int(floor (min_y)), 0), y1 = min (int(floor (max_y)), HEIGHT - 1);
+
+        // Las cajas fuera de la pantalla son cosa del frustum culling:
+
+        if (occluded && (x0 > x1 || y0 > y1)) occluded = false;
+
+        // Primero se consultan los bloques. Solo se baja a nivel de píxel en los bloques cuya
+        // profundidad más lejana no basta para ocultar la caja:
+
+        for (int block_y = y0 / BLOCK_SIZE; occluded && block_y <= y1 / BLOCK_SIZE; ++block_y)
+        {
+            for (int block_x = x0 / BLOCK_SIZE; occluded && block_x <= x1 / BLOCK_SIZE; ++block_x)
+            {
+                if (block_depth[block_y * BLOCKS_X + block_x] < nearest) continue;
+
+                int pixel_x0 = max (x0, block_x * BLOCK_SIZE), pixel_x1 = min (x1, block_x * BLOCK_SIZE + BLOCK_SIZE - 1);
+                int pixel_y0 = max (y0, block_y * BLOCK_SIZE), pixel_y1 = min (y1, block_y * BLOCK_SIZE + BLOCK_SIZE - 1);
+
+                for (int y = pixel_y0; occluded && y <= pixel_y1; ++y)
+                {
+                    for (int x = pixel_x0; x <= pixel_x1; ++x)
+                    {
+                        if (depth[y * WIDTH + x] >= nearest)
+                        {
+                            occluded = false;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (occluded) statistics.occluded_count++;
+
+        statistics.test_milliseconds += milliseconds_since (start);
+
+        return occluded;
+    }
+
+}
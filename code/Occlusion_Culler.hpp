@@ -0,0 +1,114 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstdint>
+#include <glm.hpp>
+#include <vector>
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Occlusion culling por software: los oclusores (mallas grandes y sencillas, como el terreno)
+    ///     se rasterizan en la CPU en un Z-buffer de baja resolución y después se prueba la caja de
+    ///     cada objeto contra él. El Z-buffer se divide en teselas que se rasterizan en paralelo
+    ///     (4 píxeles a la vez con SSE) y de cada bloque de 8x8 píxeles se guarda la profundidad más
+    ///     lejana, de modo que la mayoría de las cajas se resuelven consultando pocos valores.
+    ///     No usa OpenGL, por lo que se puede probar sin ventana.
+    /// </summary>
+    class Occlusion_Culler
+    {
+    public:
+
+        static const int WIDTH       = 256;
+        static const int HEIGHT      = 128;
+        static const int TILE_WIDTH  =  32;
+        static const int TILE_HEIGHT =  16;
+        static const int TILES_X     = WIDTH  / TILE_WIDTH;
+        static const int TILES_Y     = HEIGHT / TILE_HEIGHT;
+        static const int BLOCK_SIZE  =   8;         // Lado de los bloques del nivel jerárquico
+        static const int BLOCKS_X    = WIDTH  / BLOCK_SIZE;
+        static const int BLOCKS_Y    = HEIGHT / BLOCK_SIZE;
+
+        struct Statistics
+        {
+            size_t occluder_triangles;              // Triángulos que han llegado a rasterizarse
+            size_t tested_count;
+            size_t occluded_count;
+            float  raster_milliseconds;
+            float  test_milliseconds;
+        };
+
+    private:
+
+        /// Triángulo en coordenadas de pantalla preparado para rasterizar:
+        struct Triangle
+        {
+            float edge_a[3], edge_b[3], edge_c[3];  // Funciones de arista: a·x + b·y + c >= 0 dentro
+            float depth_x, depth_y, depth_c;        // Plano de profundidad: z = depth_x·x + depth_y·y + depth_c
+            int   min_x, min_y, max_x, max_y;       // Rectángulo en píxeles (inclusivo)
+        };
+
+        glm::mat4               view_projection_matrix;
+
+        std::vector< float    > depth;              // WIDTH x HEIGHT, profundidad NDC (-1 cerca, +1 lejos)
+        std::vector< float    > block_depth;        // Profundidad más lejana de cada bloque
+        std::vector< Triangle > triangles;
+        std::vector< uint32_t > tile_triangles[TILES_X * TILES_Y];
+        std::vector< glm::vec4 > clip_positions;    // Memoria temporal de add_occluder()
+
+        Statistics statistics;
+
+    public:
+
+        Occlusion_Culler();
+
+    public:
+
+        /// Empieza un frame nuevo: se descartan los oclusores anteriores:
+        void begin_frame (const glm::mat4 & view_projection_matrix);
+
+        /// Añade una malla oclusora (posiciones xyz consecutivas e índices de triángulos):
+        void add_occluder
+        (
+            const float    * positions,
+            size_t           vertex_count,
+            const uint32_t * indices,
+            size_t           index_count,
+            const glm::mat4 & model_matrix
+        );
+
+        /// Rasteriza todos los oclusores del frame en paralelo por teselas:
+        void rasterize ();
+
+        /// Retorna true si la caja (en espacio de mundo) queda por completo detrás de los oclusores:
+        bool is_occluded (const glm::vec3 & center, const glm::vec3 & extent);
+
+        /// Pone a cero los contadores de objetos probados (se llama una vez por frame):
+        void reset_test_statistics ()
+        {
+            statistics.tested_count      = 0;
+            statistics.occluded_count    = 0;
+            statistics.test_milliseconds = 0.f;
+        }
+
+        const Statistics & get_statistics () const
+        {
+            return statistics;
+        }
+
+        const std::vector< float > & get_depth () const
+        {
+            return depth;
+        }
+
+    private:
+
+        void rasterize_tile (int tile_index);
+
+    };
+
+}
@@ -0,0 +1,266 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Occlusion_Queries.hpp"
+
+#include <gtc/matrix_transform.hpp>
+#include <gtc/type_ptr.hpp>
+
+using namespace std;
+
+namespace udit
+{
+
+    const string Occlusion_Queries::vertex_shader_code =
+        "#version 330\n"
+        ""
+        "uniform mat4 model_view_projection_matrix;"
+        ""
+        "layout (location = 0) in vec3 vertex_coordinates;"
+        ""
+        "void main()"
+        "{"
+        "   gl_Position = model_view_projection_matrix * vec4(vertex_coordinates, 1.0);"
+        "}";
+
+    const string Occlusion_Queries::fragment_shader_code =
+        "#version 330\n"
+        ""
+        "out vec4 fragment_color;"
+        ""
+        "void main()"
+        "{"
+        "   fragment_color = vec4(1.0);"        // No se llega a escribir (glColorMask desactivado)
+        "}";
+
+    Occlusion_Queries::Occlusion_Queries(Shader_Compiler & compiler, unsigned retest_interval)
+    :
+        compiler                (compiler),
+        program_id              (0),
+        model_view_projection_id(-1),
+        vao_id                  (0),
+        vbo_ids                 {},
+        frame_index             (0),
+        retest_interval         (retest_interval),
+        statistics              {}
+    {
+    }
+
+    Occlusion_Queries::~Occlusion_Queries()
+    {
+        for (auto & object : objects)
+        {
+            glDeleteQueries (1, &object.query_id);
+        }
+
+        if (vao_id)
+        {
+            glDeleteVertexArrays (1, &vao_id);
+            glDeleteBuffers      (VBO_COUNT, vbo_ids);
+            glDeleteProgram      (program_id);
+        }
+    }
+
+    void Occlusion_Queries::build ()
+    {
+        // Caja unitaria (de -1 a +1) que se escala y se traslada a la caja de cada objeto:
+
+        static const GLfloat coordinates[] =
+        {
+            -1.f, -1.f, -1.f,   +1.f, -1.f, -1.f,   -1.f, +1.f, -1.f,   +1.f, +1.f, -1.f,
+            -1.f, -1.f, +1.f,   +1.f, -1.f, +1.f,   -1.f, +1.f, +1.f,   +1.f, +1.f, +1.f,
+        };
+
+        static const GLubyte indices[] =
+        {
+            0, 2, 3,  0, 3, 1,  4, 5, 7,  4, 7, 6,  0, 1, 5,  0, 5, 4,
+            2, 6, 7,  2, 7, 3,  0, 4, 6,  0, 6, 2,  1, 3, 7,  1, 7, 5,
+        };
+
+        glGenVertexArrays (1, &vao_id);
+        glGenBuffers      (VBO_COUNT, vbo_ids);
+
+        glBindVertexArray (vao_id);
+
+        glBindBuffer (GL_ARRAY_BUFFER, vbo_ids[COORDINATES_VBO]);
+        glBufferData (GL_ARRAY_BUFFER, sizeof(coordinates), coordinates, GL_STATIC_DRAW);
+
+        glEnableVertexAttribArray (0);
+        glVertexAttribPointer     (0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+        glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, vbo_ids[INDICES_EBO]);
+        glBufferData (GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+
+        glBindVertexArray (0);
+
+        program_id = compiler.submit (vertex_shader_code, fragment_shader_code);
+    }
+
+    uint32_t Occlusion_Queries::add (bool expensive)
+    {
+        Object object{};
+
+        glGenQueries (1, &object.query_id);
+
+        object.visible   = true;                    // Hasta que se pruebe por primera vez
+        object.expensive = expensive;
+
+        objects.push_back (object);
+
+        return uint32_t(objects.size () - 1);
+    }
+
+    void Occlusion_Queries::begin_frame ()
+    {
+        ++frame_index;
+
+        statistics = Statistics{};
+
+        // Solo se leen los resultados que ya están disponibles. El resto se consultará en el
+        // siguiente frame y mientras tanto el objeto conserva su último resultado:
+
+        for (auto & object : objects)
+        {
+            if (!object.pending) continue;
+
+            GLint available = 0;
+
+            glGetQueryObjectiv (object.query_id, GL_QUERY_RESULT_AVAILABLE, &available);
+
+            if (available)
+            {
+                GLuint any_samples_passed = 0;
+
+                glGetQueryObjectuiv (object.query_id, GL_QUERY_RESULT, &any_samples_passed);
+
+                object.visible = any_samples_passed != 0;
+                object.pending = false;
+
+                statistics.results_read++;
+            }
+        }
+    }
+
+    bool Occlusion_Queries::begin_proxies ()
+    {
+        if (compiler.poll (program_id) != Shader_Compiler::Status::READY) return false;
+
+        glUseProgram (program_id);
+
+        if (model_view_projection_id == -1)
+        {
+            model_view_projection_id = glGetUniformLocation (program_id, "model_view_projection_matrix");
+        }
+
+        // Las cajas solo se prueban contra el Z-buffer, sin modificarlo ni escribir color. Se
+        // desactiva el descarte de caras para que cuenten también las caras traseras:
+
+        glColorMask (GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask (GL_FALSE);
+        glEnable    (GL_DEPTH_TEST);
+        glDisable   (GL_CULL_FACE);
+
+        glBindVertexArray (vao_id);
+
+        return true;
+    }
+
+    void Occlusion_Queries::end_proxies ()
+    {
+        glColorMask (GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthMask (GL_TRUE);
+        glEnable    (GL_CULL_FACE);
+    }
+
+    void Occlusion_Queries::test
+    (
+        uint32_t          index,
+        const glm::vec3 & center,
+        const glm::vec3 & extent,
+        const glm::mat4 & view_projection_matrix,
+        const glm::vec3 & camera_position
+    )
+    {
+        Object & object = objects[index];
+
+        // No se lanza otra consulta hasta haber leído la anterior:
+
+        if (object.pending) return;
+
+        // Los objetos visibles se vuelven a probar de forma escalonada; los ocultos, en cada frame:
+
+        if (object.visible && (frame_index + index) % retest_interval != 0) return;
+
+        // Si la cámara está dentro de la caja (con margen para el plano cercano) sus caras quedarían
+        // recortadas y la consulta podría fallar aunque el objeto se vea:
+
+        glm::vec3 distance = glm::abs (camera_position - center) - extent;
+
+        if (distance.x < 1.f && distance.y < 1.f && distance.z < 1.f)
+        {
+            object.visible = true;
+            return;
+        }
+
+        glm::mat4 model_view_projection_matrix = glm::scale (glm::translate (view_projection_matrix, center), extent);
+
+        glUniformMatrix4fv (model_view_projection_id, 1, GL_FALSE, glm::value_ptr (model_view_projection_matrix));
+
+        glBeginQuery   (GL_ANY_SAMPLES_PASSED, object.query_id);
+        glDrawElements (GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0);
+        glEndQuery     (GL_ANY_SAMPLES_PASSED);
+
+        object.pending      = true;
+        object.issued_frame = frame_index;
+
+        statistics.queries_issued++;
+    }
+
+    bool Occlusion_Queries::should_render (uint32_t index)
+    {
+        const Object & object = objects[index];
+
+        // Un objeto caro con una consulta de este frame se envía siempre: la GPU decide si lo dibuja:
+
+        bool render = object.visible || (object.expensive && object.pending && object.issued_frame == frame_index);
+
+        if (!render) statistics.objects_skipped++;
+
+        return render;
+    }
+
+    GLuint Occlusion_Queries::get_conditional_query (uint32_t index)
+    {
+        const Object & object = objects[index];
+
+        if (object.expensive && object.pending && object.issued_frame == frame_index)
+        {
+            statistics.conditional_draws++;
+
+            return object.query_id;
+        }
+
+        return 0;
+    }
+
+    void Occlusion_Queries::begin_conditional_render (uint32_t index)
+    {
+        GLuint query_id = get_conditional_query (index);
+
+        // GL_QUERY_NO_WAIT: si el resultado todavía no está listo la GPU dibuja el objeto sin esperar:
+
+        if (query_id) glBeginConditionalRender (query_id, GL_QUERY_NO_WAIT);
+    }
+
+    void Occlusion_Queries::end_conditional_render (uint32_t index)
+    {
+        const Object & object = objects[index];
+
+        if (object.expensive && object.pending && object.issued_frame == frame_index)
+        {
+            glEndConditionalRender ();
+        }
+    }
+
+}
@@ -0,0 +1,126 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstdint>
+#include <glad/glad.h>
+#include <glm.hpp>
+#include <string>
+#include <vector>
+#include "Shader_Compiler.hpp"
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Occlusion culling en la GPU con consultas GL_ANY_SAMPLES_PASSED: se dibuja la caja envolvente
+    ///     de cada objeto (sin escribir color ni profundidad) y se cuenta si algún fragmento pasa la
+    ///     prueba de profundidad. Para no detener la CPU el resultado se lee en el frame siguiente, y
+    ///     mientras tanto se usa el último resultado conocido. Los objetos visibles solo se vuelven a
+    ///     probar cada cierto número de frames (escalonados para repartir las consultas), mientras que
+    ///     los ocultos se prueban en todos. Los objetos caros se dibujan además con render condicional,
+    ///     de modo que es la propia GPU la que los descarta si la consulta de este frame no pasa.
+    /// </summary>
+    class Occlusion_Queries
+    {
+    public:
+
+        struct Statistics
+        {
+            size_t queries_issued;
+            size_t results_read;
+            size_t objects_skipped;                 // No se han enviado porque su última consulta no pasó
+            size_t conditional_draws;               // Se han enviado con render condicional
+        };
+
+    private:
+
+        struct Object
+        {
+            GLuint   query_id;
+            bool     pending;                       // Hay una consulta cuyo resultado no se ha leído
+            bool     visible;                       // Último resultado conocido
+            bool     expensive;                     // Se dibuja con render condicional
+            unsigned issued_frame;
+        };
+
+        enum
+        {
+            COORDINATES_VBO,
+            INDICES_EBO,
+            VBO_COUNT
+        };
+
+        static const std::string   vertex_shader_code;
+        static const std::string fragment_shader_code;
+
+        Shader_Compiler & compiler;
+
+        GLuint   program_id;
+        GLint    model_view_projection_id;
+        GLuint   vao_id;
+        GLuint   vbo_ids[VBO_COUNT];
+
+        std::vector< Object > objects;
+
+        unsigned frame_index;
+        unsigned retest_interval;                   // Frames entre consultas de un objeto visible
+
+        Statistics statistics;
+
+    public:
+
+        Occlusion_Queries(Shader_Compiler & compiler, unsigned retest_interval = 4);
+       ~Occlusion_Queries();
+
+        Occlusion_Queries(const Occlusion_Queries & ) = delete;
+
+        Occlusion_Queries & operator = (const Occlusion_Queries & ) = delete;
+
+    public:
+
+        /// Crea la caja unitaria y envía a compilar el programa de las cajas:
+        void build ();
+
+        /// Registra un objeto y retorna su índice:
+        uint32_t add (bool expensive);
+
+        /// Recoge (sin esperar) los resultados de las consultas de frames anteriores:
+        void begin_frame ();
+
+        /// Activa el estado con el que se dibujan las cajas (sin color, sin escribir profundidad).
+        /// Retorna false si el programa todavía no está listo, en cuyo caso no se debe llamar a test():
+        bool begin_proxies ();
+        void   end_proxies ();
+
+        /// Lanza una consulta para el objeto si le toca (la caja está en espacio de mundo):
+        void test
+        (
+            uint32_t          object,
+            const glm::vec3 & center,
+            const glm::vec3 & extent,
+            const glm::mat4 & view_projection_matrix,
+            const glm::vec3 & camera_position
+        );
+
+        /// Indica si el objeto se debe enviar a la GPU en este frame:
+        bool should_render (uint32_t object);
+
+        /// Consulta con la que se tiene que dibujar el objeto con render condicional en este frame (para
+        /// grabarlo en una lista de comandos), o 0 si se dibuja sin condiciones:
+        GLuint get_conditional_query (uint32_t object);
+
+        /// Rodean el dibujado de un objeto. Solo tienen efecto en los objetos caros con una consulta de este frame:
+        void begin_conditional_render (uint32_t object);
+        void   end_conditional_render (uint32_t object);
+
+        const Statistics & get_statistics () const
+        {
+            return statistics;
+        }
+
+    };
+
+}
@@ -30,9 +30,8 @@ using namespace glm;
 
 namespace udit
 {
-    const string Scene::vertex_shader_code =
-        "#version 330\n"
-        ""
+    /// Código común a las dos etapas de todas las variantes (se inserta tras los #define)
+    const string Scene::common_shader_code =
         /// Definición del struct que describe una luz puntual
         "struct Light\n"
         "{\n"
@@ -40,96 +39,282 @@ namespace udit
         "    vec3 color;\n"     // Color/intensidad de la luz (RGB)
         "};\n"
         ""
-        /// Matrices uniformes enviadas desde la CPU/C++
-        "uniform mat4 model_view_matrix;\n" // Combina modelo y vista: lleva coordenadas de modelo a eye‐space
-        "uniform mat4 projection_matrix;\n" // Proyección de cámara (perspectiva u ortográfica)
-        "uniform mat4 normal_matrix;\n"     // Matriz para transformar normales correctamente
-        ""
         /// Parámetros de iluminación especular
-        "uniform float specular_intensity;" // Intensidad global del componente especular
-        "uniform float shininess;"          // Exponente de “dureza” del brillo (mayor = más punto pequeño y concentrado)
-        "uniform vec3  specular_color;"     // Color del brillo especular
+        "uniform float specular_intensity;\n"   // Intensidad global del componente especular
+        "uniform float material_roughness;\n"   // Rugosidad del material (0 = brillo pequeño y concentrado)
+        "uniform vec3  specular_color;\n"       // Color del brillo especular
         ""
         /// Parámetros de la luz y los componentes
-        "uniform Light light;\n"                // Datos de la luz (posición + color)
+        "#if LIGHT_COUNT > 0\n"
+        "uniform Light lights[LIGHT_COUNT];\n"  // Datos de las luces (posición + color)
+        "#endif\n"
         "uniform float ambient_intensity;\n"    // Intensidad de luz ambiental 
         "uniform float diffuse_intensity;\n"    // Intensidad de luz difusa
         ""
+        /// Exponente de “dureza” del brillo equivalente a una rugosidad (el camino deferred guarda
+        /// la rugosidad de cada píxel en el G-buffer en lugar del exponente)
+        "float roughness_to_shininess (float roughness)\n"
+        "{\n"
+        "    float r2 = roughness * roughness;\n"
+        "    return 2.0 / max(r2 * r2, 0.0001) - 2.0;\n"
+        "}\n"
+        ""
+        /// Mezcla de los tres componentes (Ambient + Diffuse + Specular) en eye-space, donde la
+        /// cámara está en el origen. La usa el vertex shader (Gouraud) o el fragment shader (por píxel).
+        "vec3 compute_lighting (vec3 pos_view, vec3 N, vec3 base_color, float shininess)\n"
+        "{\n"
+        "    vec3 V = normalize(-pos_view);\n"
+        "    vec3 color = ambient_intensity * base_color;\n"
+        "#if LIGHT_COUNT > 0\n"
+        "    for (int i = 0; i < LIGHT_COUNT; ++i)\n"
+        "    {\n"
+        "        vec3 L = normalize(lights[i].position.xyz - pos_view);\n"
+        // Término difuso (Lambert): dot(N, L) = cos(θ) entre normal y luz
+        "        float diff = diffuse_intensity * max(dot(N, L), 0.0);\n"
+        // Término especular (Blinn-Phong) con el vector half-way H entre luz y vista
+        "        vec3 H = normalize(L + V);\n"
+        "        float spec = specular_intensity * pow(max(dot(N, H), 0.0), shininess);\n"
+        "        color += diff * lights[i].color * base_color + spec * specular_color;\n"
+        "    }\n"
+        "#endif\n"
+        "    return color;\n"
+        "}\n";
+
+    const string Scene::vertex_shader_code =
+        "#version 330\n"
+        ""
+        /// Matrices uniformes enviadas desde la CPU/C++
+        "uniform mat4 model_view_matrix;\n" // Combina modelo y vista: lleva coordenadas de modelo a eye‐space
+        "uniform mat4 projection_matrix;\n" // Proyección de cámara (perspectiva u ortográfica)
+        "uniform mat4 normal_matrix;\n"     // Matriz para transformar normales correctamente
+        ""
         /// Propiedades del material
         "uniform vec3 material_color;\n"        // Color base del material (difuso)
         ""
         /// Atributos de vértice (entradas del VAO)
+        "#ifdef TERRAIN_LOD\n"
+        /// Rejilla compartida del terreno con LOD continuo (ver Terrain_Lod). La posición y la normal
+        /// se calculan con el mapa de alturas antes de usarlas como las de cualquier otro vértice
+        "layout (location = 0) in vec2 patch_coordinates;\n"    // Columna y fila del vértice en la rejilla
+        "layout (location = 4) in vec4 terrain_node;\n"         // Por instancia: esquina y lado del nodo en [0,1]² y su nivel
+        "uniform sampler2D height_texture;\n"
+        "uniform vec2  terrain_size;\n"                         // Ancho y fondo
+        "uniform float max_height;\n"                           // Altura del terreno donde el mapa vale 1
+        "uniform vec3  terrain_camera;\n"                       // Cámara en el espacio local del terreno
+        "uniform float patch_resolution;\n"                     // Cuadrados por lado de la rejilla
+        "uniform vec2  morph_ranges[16];\n"                     // Inicio y fin de la transición de cada nivel
+        "uniform sampler2DArray horizon_texture;\n"             // Horizontes en 8 direcciones (ver Horizon_Map)
+        "uniform vec3  sun_direction;\n"                        // Hacia el sol, en el espacio del terreno
+        "vec3  vertex_coordinates;\n"
+        "vec3  vertex_normal;\n"
+        "float terrain_shading;\n"                              // Multiplica el color del material
+        ""
+        /// Altura en un punto del terreno (de 0 a 1 en cada eje), muestreando en los centros de los texels
+        "float terrain_height (vec2 uv)\n"
+        "{\n"
+        "    vec2 size = vec2(textureSize(height_texture, 0));\n"
+        "    return textureLod(height_texture, (uv * (size - 1.0) + 0.5) / size, 0.0).r * max_height;\n"
+        "}\n"
+        ""
+        /// Sombra del sol y oclusión ambiental precalculadas. El sol se ve si queda por encima del
+        /// horizonte en su dirección (entre las dos guardadas más cercanas) y la parte del cielo que
+        /// tapa el terreno es la media del seno al cuadrado del horizonte en todas las direcciones
+        "float horizon_shading (vec2 uv)\n"
+        "{\n"
+        "    vec2  size    = vec2(textureSize(horizon_texture, 0).xy);\n"
+        "    vec2  st      = (uv * (size - 1.0) + 0.5) / size;\n"
+        "    vec4  first   = textureLod(horizon_texture, vec3(st, 0.0), 0.0);\n"
+        "    vec4  second  = textureLod(horizon_texture, vec3(st, 1.0), 0.0);\n"
+        "    float horizon[8] = float[8](first.x, first.y, first.z, first.w, second.x, second.y, second.z, second.w);\n"
+        "    float azimuth = mod(atan(sun_direction.z, sun_direction.x) / 0.7853982 + 8.0, 8.0);\n"  // En octavos de vuelta
+        "    int   index   = int(azimuth) % 8;\n"
+        "    float sun     = mix(horizon[index], horizon[(index + 1) % 8], fract(azimuth));\n"
+        "    float visible = smoothstep(sun - 0.05, sun + 0.05, sun_direction.y);\n"
+        "    float ambient = 1.0 - (dot(first, first) + dot(second, second)) / 8.0;\n"
+        "    return ambient * mix(0.4, 1.0, visible);\n"
+        "}\n"
+        ""
+        /// Coloca el vértice en su nodo y, cerca del final del rango del nivel, desplaza los vértices
+        /// impares hacia los pares para que la rejilla acabe siendo la del nivel siguiente
+        "void place_terrain_vertex ()\n"
+        "{\n"
+        "    float cell  = terrain_node.z / patch_resolution;\n"
+        "    vec2  uv    = terrain_node.xy + patch_coordinates * cell;\n"
+        "    vec3  local = vec3((uv.x - 0.5) * terrain_size.x, terrain_height(uv), (uv.y - 0.5) * terrain_size.y);\n"
+        "    vec2  range = morph_ranges[int(terrain_node.w)];\n"
+        "    float morph = clamp((distance(local, terrain_camera) - range.x) / (range.y - range.x), 0.0, 1.0);\n"
+        "    uv -= mod(patch_coordinates, 2.0) * morph * cell;\n"
+        // Normal por diferencias centrales entre los texels vecinos
+        "    vec2  texel = 1.0 / (vec2(textureSize(height_texture, 0)) - 1.0);\n"
+        "    float dx    = terrain_height(uv + vec2(texel.x, 0.0)) - terrain_height(uv - vec2(texel.x, 0.0));\n"
+        "    float dz    = terrain_height(uv + vec2(0.0, texel.y)) - terrain_height(uv - vec2(0.0, texel.y));\n"
+        "    vertex_coordinates = vec3((uv.x - 0.5) * terrain_size.x, terrain_height(uv), (uv.y - 0.5) * terrain_size.y);\n"
+        "    vertex_normal      = normalize(vec3(-dx / (2.0 * texel.x * terrain_size.x), 1.0, -dz / (2.0 * texel.y * terrain_size.y)));\n"
+        "    terrain_shading    = horizon_shading(uv);\n"
+        "}\n"
+        "#else\n"
         "layout (location = 0) in vec3 vertex_coordinates;\n"   // Coordenadas XYZ del vértice
         "layout (location = 1) in vec3 vertex_normal;\n"        // Normal del vértice (para iluminación)
+        "#endif\n"
+        "#ifdef TEXTURED\n"
         "layout (location = 2) in vec2 vertex_uv;\n"            // Coordenadas UV para texturizado
+        "out vec2 texture_uv;\n"                                // Coordenadas UV para muestrear la textura en el fragment
+        "#endif\n"
+        "#ifdef VERTEX_COLOR\n"
+        "layout (location = 3) in vec3 vertex_color;\n"         // Color del vértice (modula el del material)
+        "#endif\n"
         ""
         /// Salidas (para pasar al fragment shader)
+        "#ifdef PER_PIXEL_LIGHTING\n"
+        "out vec3 view_position;\n" // La iluminación se calcula por fragmento con estos datos interpolados
+        "out vec3 view_normal;\n"
+        "out vec3 base_color;\n"
+        "#else\n"
         "out vec3 front_color;\n"   // Color resultante tras mezcla de ambient, diffuse y specular
-        "out vec2 texture_uv;\n"    // Coordenadas UV para muestrear la textura en el fragment
+        "#endif\n"
         ""
         /// Función principal del shader de vértices
         "void main()\n"
         "{\n"
+        "#ifdef TERRAIN_LOD\n"
+        "place_terrain_vertex();\n"
+        "#endif\n"
         // 1) Transformar posición del vértice a espacio ojo (eye‐space)
-        "vec4 pos_view = model_view_matrix * vec4(vertex_coordinates, 1.0);"
+        "vec4 pos_view = model_view_matrix * vec4(vertex_coordinates, 1.0);\n"
         // 2) Transformar y normalizar la normal normal_matrix corrige escalados/no‐uniformes de model_view
-        "vec3 N = normalize((normal_matrix * vec4(vertex_normal, 0.0)).xyz);"
-        // 3) Vector desde vértice hacia la luz
-        "vec3 L = normalize((light.position - pos_view).xyz);"
-        // 4) Vector desde vértice hacia la cámara (en eye‐space la cámara está en el origen)
-        "vec3 V = normalize(-pos_view.xyz);"     // cámara en origen de eye‐space
-
-        /// Cálculo del término difuso (Lambert)
-        // dot(N, L) = cos(θ) entre normal y luz
-        // max(..., 0) para no iluminar caras opuestas
-        "float diff = diffuse_intensity * max(dot(N, L), 0.0);" // Componente difusa de iluminación
-
-        /// Cálculo del término especular (Blinn-Phong)
-        // vector half‐way H entre luz y vista
-        // dot(N, H) = cos(φ) entre normal y half‐way
-        // pow(..., shininess) ajusta la concentración del brillo
-        "vec3 H = normalize(L + V);"
-        "float spec = specular_intensity * pow(max(dot(N, H), 0.0), shininess);"
-        // Alternativa (Phong)
-        //"vec3 R = reflect(-L, N);"
-        //"float spec = specular_intensity * pow(max(dot(R, V), 0.0), shininess);"
-
-        /// Mezcla final de los tres componentes: (Ambient + Diffuse + Specular)
-        "front_color =" 
-        "ambient_intensity * material_color"        // luz ambiental
-        "+ diff * light.color * material_color "    // componente difuso coloreado
-        "+ spec * specular_color;"                  // componente especular
-
+        "vec3 N = normalize((normal_matrix * vec4(vertex_normal, 0.0)).xyz);\n"
+        // 3) Color base del material (opcionalmente modulado por el color del vértice)
+        "#ifdef VERTEX_COLOR\n"
+        "vec3 color = material_color * vertex_color;\n"
+        "#else\n"
+        "vec3 color = material_color;\n"
+        "#endif\n"
+        "#ifdef TERRAIN_LOD\n"
+        "color *= terrain_shading;\n"
+        "#endif\n"
+        // 4) Iluminación por vértice (Gouraud) o datos para calcularla por fragmento
+        "#ifdef PER_PIXEL_LIGHTING\n"
+        "view_position = pos_view.xyz;\n"
+        "view_normal   = N;\n"
+        "base_color    = color;\n"
+        "#else\n"
+        "front_color = compute_lighting(pos_view.xyz, N, color, roughness_to_shininess(material_roughness));\n"
+        "#endif\n"
         // 5) Pasamos la UV al fragment shader
-        "texture_uv = vertex_uv;"
+        "#ifdef TEXTURED\n"
+        "texture_uv = vertex_uv;\n"
+        "#endif\n"
         // 6) Calculamos la posición final en screen‐space
-        "gl_Position = projection_matrix * pos_view;"
+        "gl_Position = projection_matrix * pos_view;\n"
         "}";
 
     const string Scene::fragment_shader_code =
         "#version 330\n"
         ""
+        "#ifdef TEXTURED\n"
         /// Uniform que representa la textura activa (unit 0) a muestrear
         "uniform sampler2D sampler;\n"
+        "in  vec2 texture_uv;\n"        // Coordenadas UV interpoladas para texturizado
+        "#endif\n"
+        "#ifdef ALPHA_BLENDED\n"
+        "uniform float material_alpha;\n"   // Opacidad del material
+        "#endif\n"
         ""
         /// Entradas desde el vertex shader
-        "in  vec2 texture_uv;\n"        // Coordenadas UV interpoladas para texturizado
+        "#ifdef PER_PIXEL_LIGHTING\n"
+        "in  vec3 view_position;\n"
+        "in  vec3 view_normal;\n"
+        "in  vec3 base_color;\n"
+        "#else\n"
         "in  vec3 front_color;\n"       // Color calculado (ambient + difuso + especular)
+        "#endif\n"
+        ""
+        /// Salidas del fragment shader
+        "#ifdef DEFERRED_GEOMETRY\n"
+        "layout (location = 0) out vec2 gbuffer_normal;\n"     // Normal con codificación octaédrica
+        "layout (location = 1) out vec4 gbuffer_albedo;\n"     // Albedo y rugosidad
         ""
-        /// Salida del fragment shader
+        /// Proyecta la normal sobre un octaedro y lo despliega en un cuadrado [0,1]²
+        "vec2 octahedral_encode (vec3 n)\n"
+        "{\n"
+        "    n /= abs(n.x) + abs(n.y) + abs(n.z);\n"
+        "    vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);\n"
+        "    return e * 0.5 + 0.5;\n"
+        "}\n"
+        "#else\n"
         "out vec4 fragment_color;\n"    // Color final del píxel
+        "#endif\n"
         ""
-        "void main()\n"
+        /// Luces puntuales repartidas en clusters (ver Light_Clusters)
+        "#ifdef CLUSTERED_LIGHTING\n"
+        "uniform samplerBuffer  light_data;\n"         // 2 texels por luz: (posición en eye-space, radio) y (color, 0)
+        "uniform usamplerBuffer cluster_grid;\n"       // (desplazamiento, número de luces) de cada cluster
+        "uniform usamplerBuffer light_indices;\n"      // Índices de luz de todos los clusters
+        "uniform ivec3 cluster_grid_size;\n"
+        "uniform vec2  cluster_scale;\n"               // Clusters por píxel en X e Y
+        "uniform float slice_scale;\n"                 // Corte = log(profundidad) * slice_scale + slice_bias
+        "uniform float slice_bias;\n"
+        ""
+        "vec3 compute_clustered_lighting (vec3 pos_view, vec3 N, vec3 base_color, float shininess)\n"
         "{\n"
-        // 1) Muestreamos la textura en las coordenadas UV proporcionadas
-        "    vec4 texture_color = texture(sampler, texture_uv);\n"
+        // 1) Cluster al que pertenece el fragmento
+        "    ivec3 cluster = ivec3(ivec2(gl_FragCoord.xy * cluster_scale), int(log(-pos_view.z) * slice_scale + slice_bias));\n"
+        "    cluster = clamp(cluster, ivec3(0), cluster_grid_size - 1);\n"
+        "    uvec2 range = texelFetch(cluster_grid, (cluster.z * cluster_grid_size.y + cluster.y) * cluster_grid_size.x + cluster.x).xy;\n"
+        // 2) Solo se recorren las luces que alcanzan el cluster
+        "    vec3 V = normalize(-pos_view);\n"
+        "    vec3 color = vec3(0.0);\n"
+        "    for (uint i = 0u; i < range.y; ++i)\n"
+        "    {\n"
+        "        int   light    = int(texelFetch(light_indices, int(range.x + i)).x);\n"
+        "        vec4  position = texelFetch(light_data, light * 2);\n"
+        "        vec3  L        = position.xyz - pos_view;\n"
+        "        float distance = length(L);\n"
+        // Atenuación suave que llega a 0 en el radio de la luz
+        "        float attenuation = clamp(1.0 - distance / position.w, 0.0, 1.0);\n"
+        "        L /= max(distance, 0.0001);\n"
+        "        float diff = diffuse_intensity * max(dot(N, L), 0.0);\n"
+        "        vec3  H    = normalize(L + V);\n"
+        "        float spec = specular_intensity * pow(max(dot(N, H), 0.0), shininess);\n"
+        "        color += attenuation * attenuation * (diff * texelFetch(light_data, light * 2 + 1).rgb * base_color + spec * specular_color);\n"
+        "    }\n"
+        "    return color;\n"
+        "}\n"
+        "#endif\n"
         ""
-        // 2) Mezclamos el color de iluminación con el color de la textura.
-        //    Se usa un alpha de 0.5 para semi-transparencia (puedes ajustarlo).
-        //    front_color contiene el RGB; le damos alpha 0.5 y luego multiplicamos
-        //    por el RGBA de la textura para obtener el color final.
-        "    fragment_color = vec4(front_color, 0.5) * texture_color;\n" // Resultado final visual
-        // Ahora fragment_color es lo que se escribirá en el frame-buffer.
+        "void main()\n"
+        "{\n"
+        // 0) En la etapa de geometría del camino deferred solo se guardan las propiedades de la superficie
+        "#ifdef DEFERRED_GEOMETRY\n"
+        "    vec3 albedo = base_color;\n"
+        "#ifdef TEXTURED\n"
+        "    albedo *= texture(sampler, texture_uv).rgb;\n"
+        "#endif\n"
+        "    gbuffer_normal = octahedral_encode(normalize(view_normal));\n"
+        "    gbuffer_albedo = vec4(albedo, material_roughness);\n"
+        "#else\n"
+        // 1) Color de iluminación calculado por vértice o por fragmento
+        "#ifdef PER_PIXEL_LIGHTING\n"
+        "    vec3  N = normalize(view_normal);\n"
+        "    float shininess = roughness_to_shininess(material_roughness);\n"
+        "    vec3  color = compute_lighting(view_position, N, base_color, shininess);\n"
+        "#ifdef CLUSTERED_LIGHTING\n"
+        "    color += compute_clustered_lighting(view_position, N, base_color, shininess);\n"
+        "#endif\n"
+        "#else\n"
+        "    vec3 color = front_color;\n"
+        "#endif\n"
+        // 2) Solo los materiales transparentes tienen en cuenta la opacidad
+        "#ifdef ALPHA_BLENDED\n"
+        "    fragment_color = vec4(color, material_alpha);\n"
+        "#else\n"
+        "    fragment_color = vec4(color, 1.0);\n"
+        "#endif\n"
+        // 3) Mezclamos el color de iluminación con el color de la textura
+        "#ifdef TEXTURED\n"
+        "    fragment_color *= texture(sampler, texture_uv);\n"
+        "#endif\n"
+        "#endif\n"
         "}";
 
     /// Vertex Shader para renderizar el quad de post-procesado
@@ -180,57 +365,273 @@ namespace udit
         "   fragment_color = texture(sampler2d, texture_uv);"
         "}";
 
-    const string Scene::texture_path = "../assets/Stone_Base_Color.png";
+    /// Shaders mínimos que se usan mientras el programa principal se sigue compilando
+    const string Scene::fallback_vertex_shader_code =
+        "#version 330\n"
+        ""
+        "uniform mat4 model_view_matrix;"
+        "uniform mat4 projection_matrix;"
+        ""
+        "layout (location = 0) in vec3 vertex_coordinates;"
+        ""
+        "void main()"
+        "{"
+        "   gl_Position = projection_matrix * model_view_matrix * vec4(vertex_coordinates, 1.0);"
+        "}";
+
+    const string Scene::fallback_fragment_shader_code =
+        "#version 330\n"
+        ""
+        "out vec4 fragment_color;"
+        ""
+        "void main()"
+        "{"
+        "   fragment_color = vec4(0.5, 0.5, 0.5, 1.0);" // Gris neutro sin iluminación ni textura
+        "}";
+
+    const string Scene::texture_path        = "../assets/Stone_Base_Color.png";
+    const string Scene::height_map_path     = "../assets/height-map.png";
+    const string Scene::height_archive_path = "../assets/height-map.heights";
+    const string Scene::horizon_cache_path  = "../assets/height-map.horizons";
+
+    const glm::vec3 Scene::background_color(.8f, .8f, .8f);
+
+    namespace
+    {
+
+        /// Transformación entre a (t = 0) y b (t = 1). La traslación, la rotación y la escala se
+        /// interpolan por separado para que la matriz no se deforme al girar:
+        glm::mat4 interpolate_transform(const glm::mat4 & a, const glm::mat4 & b, float t)
+        {
+            if (t >= 1.f) return b;
+
+            glm::vec3 scale_a(glm::length(glm::vec3(a[0])), glm::length(glm::vec3(a[1])), glm::length(glm::vec3(a[2])));
+            glm::vec3 scale_b(glm::length(glm::vec3(b[0])), glm::length(glm::vec3(b[1])), glm::length(glm::vec3(b[2])));
+
+            glm::quat rotation_a = glm::quat_cast(glm::mat3(glm::vec3(a[0]) / scale_a.x, glm::vec3(a[1]) / scale_a.y, glm::vec3(a[2]) / scale_a.z));
+            glm::quat rotation_b = glm::quat_cast(glm::mat3(glm::vec3(b[0]) / scale_b.x, glm::vec3(b[1]) / scale_b.y, glm::vec3(b[2]) / scale_b.z));
+
+            glm::vec3 scale  = glm::mix(scale_a, scale_b, t);
+            glm::mat4 result = glm::mat4_cast(glm::slerp(rotation_a, rotation_b, t));
+
+            result[0] *= scale.x;
+            result[1] *= scale.y;
+            result[2] *= scale.z;
+            result[3]  = glm::mix(a[3], b[3], t);
+
+            return result;
+        }
+
+    }
 
     Scene::Scene(unsigned width, unsigned height)
         : 
-        camera(glm::vec3(0, 0, 5)), 
-        angle(0)
-        //terrain(10.f, 10.f, 50, 50)
+        horizon_built(false),
+        horizon_culling(true),
+        sun_direction(glm::normalize(glm::vec3(-.6f, .45f, -.35f))),
+        use_terrain_lod(true),
+        use_streamed_terrain(false),
+        flythrough(false),
+        flythrough_step(0),
+        cube(geometry_pool),
+        angle(0),
+        occlusion_culling(true),
+        occlusion_queries(shader_compiler),
+        hardware_occlusion(false),
+        scene_shaders(shader_compiler, common_shader_code, vertex_shader_code, fragment_shader_code),
+        clustered_lighting(true),
+        light_clusters_current(false),
+        deferred_renderer(shader_compiler, common_shader_code, framebuffer_width, framebuffer_height),
+        deferred_shading(false),
+        geometry_pass(false),
+        stream_buffer(streaming_region_size),
+        frame_index(0),
+        gpu_milliseconds(0.f),
+        simulation_step(0),
+        aspect_ratio(float(width) / float(height)),
+        frame_latency(0.f),
+        rendered_sequence(0),
+        skipped_snapshots(0),
+        render_alpha(1.f),
+        camera(glm::vec3(0, 0, 5))
     {
         /// Postprocesado
         // Se crea la textura y se dibuja algo en ella:
         build_framebuffer();
 
-        // Se compilan y se activan los shaders:
-        program_id = compile_shaders(vertex_shader_code, fragment_shader_code);
-        effect_program_id = compile_shaders(effect_vertex_shader_code, effect_fragment_shader_code);
+        // Se carga la textura y se envía a la GPU (create_texture_2d() retorna -1 si falla):
+              texture_id = create_texture_2d(texture_path);
+        there_is_texture = texture_id > 0 && texture_id != GLuint(-1);
+
+        // Se configuran los materiales. Cada uno usará la variante mínima del shader de la escena:
+        mesh_material.texture_id         = there_is_texture ? texture_id : 0;
+        mesh_material.per_pixel_lighting = true;
 
-        glUseProgram(program_id);
+        cube_material.transparent        = true;
+        cube_material.alpha              = 0.5f;
 
-        model_view_matrix_id = glGetUniformLocation(program_id, "model_view_matrix");
-        projection_matrix_id = glGetUniformLocation(program_id, "projection_matrix");
-            normal_matrix_id = glGetUniformLocation(program_id,     "normal_matrix");
+        terrain_material.color              = glm::vec3(0.45f, 0.55f, 0.3f);
+        terrain_material.per_pixel_lighting = true;
+        terrain_material.terrain_lod        = true;
 
-        // Se carga la textura y se envía a la GPU:
-              texture_id = create_texture_2d(texture_path);
-        there_is_texture = texture_id > 0;
+        chunk_material             = terrain_material;
+        chunk_material.terrain_lod = false;
+
+        lights.push_back({ glm::vec4(10.f, 10.f, 10.f, 1.f), glm::vec3(1.f, 1.f, 1.f) });
+
+        create_point_lights();
+
+        // El camino deferred acumula la luz en la misma textura que lee el postprocesado:
+        deferred_renderer.build(out_texture_id, unsigned(lights.size()));
+
+        glGenQueries(2, gpu_timer_ids);
+
+        load_mesh("../assets/Terreno.obj");
+
+        // La malla está fija en su sitio y el cubo cuelga, alejado 2 unidades, de un pivote que gira:
+        mesh_node       = scene_graph.add_node(Scene_Graph::NO_PARENT, glm::vec3(0.f, -1.f, -3.f));
+        cube_pivot_node = scene_graph.add_node(Scene_Graph::NO_PARENT, glm::vec3(0.f,  0.f, -5.f));
+        cube_node       = scene_graph.add_node(cube_pivot_node,        glm::vec3(0.f,  0.f, +2.f));
+
+        // Se registran las cajas de los objetos (el cubo tiene lado 2 y está centrado en el origen):
+        mesh_object = frustum_culler.add(mesh_min, mesh_max);
+        cube_object = frustum_culler.add(glm::vec3(-1.f), glm::vec3(+1.f));
+
+        // Cada hoja del árbol guarda el índice del objeto en el frustum culler:
+        mesh_proxy = object_tree.create_proxy(mesh_min, mesh_max, mesh_object);
+        cube_proxy = object_tree.create_proxy(glm::vec3(-1.f), glm::vec3(+1.f), cube_object);
+
+        // El terreno queda por debajo del resto de la escena. La GPU solo guarda sus alturas (en R16)
+        // y la rejilla compartida; la copia en memoria se conserva para poder editarlo. El mapa se
+        // lee del archivo comprimido por tiles, que se descomprime en todos los hilos. La primera vez
+        // se crea a partir de la imagen (de 8 bits, por lo que no se pierde nada). Si se cambia la
+        // imagen hay que borrar el archivo:
+        if (auto archive = Height_Archive::open(height_archive_path))
+        {
+            height_map = archive->decode();
+        }
+        else
+        {
+            height_map = Height_Map::load(height_map_path);
+
+            if (height_map && !Height_Archive::write(height_archive_path, *height_map, 8))
+            {
+                std::cerr << "No se ha podido guardar " << height_archive_path << std::endl;
+            }
+        }
+
+        // Si falta el mapa se genera uno procedural del mismo tamaño en lugar de quedarse sin terreno:
+        if (!height_map)
+        {
+            Height_Noise::Settings hills;
+
+            hills.frequency = 1.f / 384.f;
+
+            height_map = Height_Noise(hills).generate(1025, 1025);
+        }
+
+        if (height_map)
+        {
+            terrain_lod.reset(new Terrain_Lod(*height_map, glm::vec3(200.f, 20.f, 200.f), 40.f));
+            terrain_lod->build(*height_map, GL_R16);
+
+            height_field.reset(new Height_Field(*height_map, terrain_lod->get_pyramid(), terrain_lod->get_size()));
+
+            // El horizonte se construye cada paso a partir de las mismas cotas, por lo que sigue valiendo
+            // al editar el terreno:
+            horizon_culler.reset(new Horizon_Culler(terrain_lod->get_pyramid(), terrain_lod->get_size()));
+
+            // Los horizontes se calculan en todos los hilos la primera vez y después se leen de disco
+            // (la caché deja de servir en cuanto cambia el mapa):
+            horizon_map.reset(new Horizon_Map(*height_map, terrain_lod->get_size()));
+
+            if (!horizon_map->load(horizon_cache_path, *height_map))
+            {
+                horizon_map->bake(*height_map);
+
+                if (!horizon_map->save(horizon_cache_path, *height_map))
+                {
+                    std::cerr << "No se ha podido guardar " << horizon_cache_path << std::endl;
+                }
+            }
+
+            horizon_map->build();
+
+            terrain_model_matrix = glm::translate(glm::mat4(1.f), glm::vec3(0.f, -25.f, -100.f));
+
+            // Chunks de 64 x 64 unidades con una celda por unidad. Las alturas salen de ruido ridged con
+            // el dominio deformado, por lo que el mundo no se repite. Cada chunk se genera entero en el
+            // hilo de trabajo que lo pide (ya se generan varios a la vez). Se guardan como mucho 48 MB:
+            Height_Noise::Settings ridges;
+
+            ridges.seed          = 7;
+            ridges.type          = Height_Noise::RIDGED;
+            ridges.frequency     = 1.f / 400.f;
+            ridges.octaves       = 7;
+            ridges.warp_strength = 60.f;
+
+            auto noise = std::make_shared< Height_Noise >(ridges);
+
+            terrain_streamer.reset
+            (
+                new Terrain_Streamer
+                (
+                    geometry_pool,
+                    [noise] (float x0, float z0, float step, Height_Map & heights)
+                    {
+                        noise->fill(x0, z0, step, heights, false);
+                    },
+                    64.f, 64, 40.f, 600.f, 48 * 1024 * 1024, 512 * 1024
+                )
+            );
+        }
+
+        occlusion_queries.build();
+
+        // La malla es cara de dibujar, por lo que se dibuja con render condicional y es la GPU la que la
+        // descarta en el mismo frame. El cubo tiene muy pocos triángulos, por lo que no compensa y basta
+        // con leer su resultado en la CPU en el frame siguiente:
+        mesh_query = occlusion_queries.add(true);
+        cube_query = occlusion_queries.add(false);
+
+        // Se envían todos los programas al driver antes de consultar el estado de ninguno para que
+        // puedan compilarse en paralelo. Los uniforms de cada variante se configuran cuando esté
+        // lista (ver use_material()):
+         effect_program_id = shader_compiler.submit(effect_vertex_shader_code, effect_fragment_shader_code);
+        fallback_variant.program_id = shader_compiler.submit(fallback_vertex_shader_code, fallback_fragment_shader_code);
+
+        scene_shaders.acquire(variant_key(mesh_material, false));
+        scene_shaders.acquire(variant_key(mesh_material, true ));
+        scene_shaders.acquire(variant_key(cube_material, false));
+        scene_shaders.acquire(variant_key(terrain_material, false));
+        scene_shaders.acquire(variant_key(terrain_material, true ));
+        scene_shaders.acquire(variant_key(chunk_material, false));
+        scene_shaders.acquire(variant_key(chunk_material, true ));
 
-        // Se establece la altura máxima del height map en el vertex shader:
-        //glUniform1f(glGetUniformLocation(program_id, "max_height"), 5.f);
+        // Solo se espera por el programa de respaldo, que es trivial:
+        shader_compiler.wait(fallback_variant.program_id);
 
-        configure_material(program_id);
-        configure_light(program_id);
+        Shader_Variants::locate_uniforms(fallback_variant);
 
         // Se establece la configuración básica:
         glEnable(GL_CULL_FACE);
         glEnable(GL_DEPTH_TEST);     // PANTALLAZO NEGRO CON ESTO ACTIVADO!!!
+        glEnable(GL_PRIMITIVE_RESTART);
+        glPrimitiveRestartIndex(Terrain::RESTART_INDEX);    // Separa las tiras de triángulos del terreno
         glClearColor(0.f, 0.f, 0.f, 1.f);
 
         resize(width, height);
-
-        load_mesh("../assets/Terreno.obj");
     }
 
     Scene::~Scene()
     {
-        glDeleteVertexArrays(1, &vao_id);
-        glDeleteBuffers(VBO_COUNT, vbo_ids);
-
         glDeleteVertexArrays(1, &framebuffer_quad_vao);
         glDeleteBuffers(2, framebuffer_quad_vbos);
 
-        glDeleteProgram(program_id);
+        glDeleteQueries(2, gpu_timer_ids);
+
+        glDeleteProgram(effect_program_id);
+        glDeleteProgram(fallback_variant.program_id);
 
         if (there_is_texture)
         {
@@ -238,81 +639,700 @@ namespace udit
         }
     }
 
-    void Scene::update ()
+    void Scene::post_input (int mouse_dx, int mouse_dy, const Uint8 * keystate, bool pick, bool place)
     {
-        angle += 0.01f; // Rotación de la escena en tiempo real
+        std::lock_guard< std::mutex > lock(input_mutex);
+
+        // El ratón se acumula hasta que la simulación lo consume; del teclado basta el último estado:
+        pending_input.mouse_dx += mouse_dx;
+        pending_input.mouse_dy += mouse_dy;
+        pending_input.pick      = pending_input.pick  || pick;
+        pending_input.place     = pending_input.place || place;
+
+        std::copy(keystate, keystate + SDL_NUM_SCANCODES, pending_input.keys.begin());
+    }
+
+    void Scene::update (const Frame_Clock & clock)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        // Todo lo que se mueve avanza con la duración del paso, que es fija, por lo que la simulación
+        // no depende de la frecuencia de los frames:
+        float delta_time = clock.get_step_seconds();
+
+        Input input;
+
+        {
+            std::lock_guard< std::mutex > lock(input_mutex);
+
+            input = pending_input;
+
+            pending_input.mouse_dx = 0;
+            pending_input.mouse_dy = 0;
+            pending_input.pick     = false;
+            pending_input.place    = false;
+        }
+
+        if (input.mouse_dx != 0 || input.mouse_dy != 0)
+        {
+            camera.process_mouse(input.mouse_dx, input.mouse_dy);
+        }
+
+        camera.process_keyboard(input.keys.data(), delta_time);
+
+        clamp_camera_to_terrain();
+
+        if (input.place)
+        {
+            place_mesh_on_terrain();
+        }
+
+        angle += 0.6f * delta_time; // Rotación de la escena en tiempo real (radianes por segundo)
+
+        // Transformaciones de los objetos. Sus cajas en espacio de mundo se actualizan solo aquí:
+        scene_graph.set_rotation(mesh_node,       glm::angleAxis(angle, glm::normalize(glm::vec3(1.f, 1.f, 0.f))));
+        scene_graph.set_rotation(cube_pivot_node, glm::angleAxis(angle, glm::vec3(0.f, 1.f, 0.f)));
+        scene_graph.update();
+
+        mesh_model_matrix = scene_graph.get_world_matrix(mesh_node);
+        cube_model_matrix = scene_graph.get_world_matrix(cube_node);
+
+        frustum_culler.set_transform(mesh_object, mesh_model_matrix);
+        frustum_culler.set_transform(cube_object, cube_model_matrix);
+
+        // El árbol solo cambia cuando un objeto sale de su caja engordada:
+        for (auto proxy : { mesh_proxy, cube_proxy })
+        {
+            uint32_t  object = object_tree.get_user_data(proxy);
+            glm::vec3 center = frustum_culler.get_center(object);
+            glm::vec3 extent = frustum_culler.get_extent(object);
+
+            object_tree.move_proxy(proxy, center - extent, center + extent);
+        }
+
+        // Las luces puntuales orbitan alrededor del centro de la escena, cada una a su velocidad:
+        for (auto & light : point_lights)
+        {
+            float c = cos(angle * light.orbit_speed);
+            float s = sin(angle * light.orbit_speed);
+
+            light.position = glm::vec3
+            (
+                light.base_position.x * c - light.base_position.z * s,
+                light.base_position.y,
+                light.base_position.x * s + light.base_position.z * c - 5.f
+            );
+        }
+
+        // Se pide la selección después de mover el árbol para que coincida con lo que se va a ver. El
+        // resultado pasa al snapshot y el hilo principal lo muestra en el título de la ventana:
+        if (input.pick)
+        {
+            picked_object = pick_object();
+        }
+
+        /// RECORRIDO FIJO
+        // Durante el recorrido la cámara sigue una curva sobre el terreno por chunks, a unas 100
+        // unidades por segundo y cambiando de dirección, en lugar de responder a la entrada:
+        glm::vec3 camera_position = camera.get_position();
+        glm::mat4 view            = camera.get_view_matrix();
+
+        if (flythrough)
+        {
+            auto path = [] (float t)
+            {
+                return glm::vec3(1500.f * sin(t * 0.06f), 60.f, 1000.f * sin(t * 0.09f));
+            };
+
+            float t = float(flythrough_step) * delta_time;
+
+            camera_position = glm::vec3(terrain_model_matrix * glm::vec4(path(t), 1.f));
+            view            = glm::lookAt(camera_position, glm::vec3(terrain_model_matrix * glm::vec4(path(t + 0.5f), 1.f)), glm::vec3(0.f, 1.f, 0.f));
+
+            if (++flythrough_step == flythrough_steps)
+            {
+                flythrough_step = 0;
+                flythrough      = false;
+            }
+        }
+
+        /// FRUSTUM CULLING + OCCLUSION CULLING
+        // Se usa la misma proyección que el render, pero construida aquí a partir de la forma de la ventana:
+        glm::mat4 culling_projection = glm::perspective(20.f, aspect_ratio.load(), 1.f, 5000.f);
+
+        cull_objects(culling_projection * view, camera_position);
+
+        /// SNAPSHOT
+        Frame_Snapshot & frame = snapshots.get_write_slot();
+
+        // En el primer paso no hay uno anterior con el que interpolar:
+        if (simulation_step == 0)
+        {
+            last_view_matrix       = view;
+            last_camera_position   = camera_position;
+            last_mesh_model_matrix = mesh_model_matrix;
+            last_cube_model_matrix = cube_model_matrix;
+        }
+
+        frame.sequence                   = ++simulation_step;
+        frame.step_counter               = clock.get_simulated_counter();
+        frame.step_seconds               = delta_time;
+        frame.view_matrix                = view;
+        frame.previous_view_matrix       = last_view_matrix;
+        frame.camera_position            = camera_position;
+        frame.previous_camera_position   = last_camera_position;
+        frame.cube_model_matrix          = cube_model_matrix;
+        frame.previous_cube_model_matrix = last_cube_model_matrix;
+        frame.cube_center       = frustum_culler.get_center(cube_object);
+        frame.cube_extent       = frustum_culler.get_extent(cube_object);
+        frame.cube_visible      = is_object_visible(cube_object);
+
+        size_t picked_length = std::min(picked_object.size(), frame.picked_object.size() - 1);
+
+        std::copy_n(picked_object.data(), picked_length, frame.picked_object.data());
+
+        frame.picked_object[picked_length] = '\0';
+
+        // Se devuelve a la arena lo que ocupaba el paso que se simuló en este slot hace tres pasos y se
+        // vacía. Con la capacidad ya ajustada en los primeros pasos, esto no reserva memoria del sistema:
+        frame.opaque_objects = Frame_Vector< Opaque_Object     >(frame.arena);
+        frame.terrain_nodes  = Frame_Vector< Terrain_Lod::Node >(frame.arena);
+        frame.arena.reset();
+
+        if (mesh_geometry != Geometry_Pool::NO_MESH && is_object_visible(mesh_object))
+        {
+            frame.opaque_objects.push_back
+            ({
+                mesh_model_matrix, last_mesh_model_matrix,
+                frustum_culler.get_center(mesh_object), frustum_culler.get_extent(mesh_object), mesh_query,
+                mesh_geometry, 0, GL_TRIANGLES
+            });
+        }
+
+        // El terreno elige sus nodos en su espacio local. Con R o E se sube o se baja alrededor de la
+        // cámara: se editan la copia en memoria y las cotas, y el render sube las alturas a la textura.
+        // El terreno por chunks lo carga y lo dibuja el render a partir de la misma posición:
+        frame.terrain_statistics = Terrain_Lod::Statistics{};
+        frame.streamed_terrain   = is_streamed_terrain();
+        frame.terrain_camera     = glm::vec3(glm::inverse(terrain_model_matrix) * glm::vec4(frame.camera_position, 1.f));
+
+        if (terrain_lod && !frame.streamed_terrain)
+        {
+            if (input.keys[SDL_SCANCODE_R] || input.keys[SDL_SCANCODE_E])
+            {
+                edit_terrain(frame.terrain_camera, input.keys[SDL_SCANCODE_R] ? delta_time : -delta_time);
+            }
+
+            frame.terrain_statistics = terrain_lod->select(frame.terrain_camera, culling_projection * view * terrain_model_matrix, frame.terrain_nodes, use_terrain_lod);
+        }
+
+        // Los objetos transparentes se iluminan con los clusters también en el camino deferred:
+        if (clustered_lighting)
+        {
+            update_view_lights(view, frame.view_lights);
+        }
+        else
+        {
+            frame.view_lights.clear();
+        }
+
+        frame.culling_statistics   = frustum_culler  .get_statistics();
+        frame.occlusion_statistics = occlusion_culler.get_statistics();
+        frame.horizon_statistics   = horizon_culler ? horizon_culler->get_statistics() : Horizon_Culler::Statistics{};
+
+        frame.simulated_at            = std::chrono::steady_clock::now();
+        frame.simulation_milliseconds = std::chrono::duration< float, std::milli >(frame.simulated_at - start).count();
+
+        snapshots.publish();
+
+        last_view_matrix       = view;
+        last_camera_position   = camera_position;
+        last_mesh_model_matrix = mesh_model_matrix;
+        last_cube_model_matrix = cube_model_matrix;
     }
 
     void Scene::render()
     {
-        glViewport(0, 0, framebuffer_width, framebuffer_height);
-        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_id);         // Se activa el framebuffer de la textura
-        glUseProgram(program_id);
+        /// SNAPSHOT
+        // Se toma el último paso publicado por la simulación. Si no hay ninguno nuevo se vuelve a
+        // dibujar el anterior (la cámara y los objetos no se han movido):
+        if (snapshots.acquire())
+        {
+            const Frame_Snapshot & frame = snapshots.get_read_slot();
 
-        glClearColor(.8f, .8f, .8f, 1.f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            if (rendered_sequence != 0 && frame.sequence > rendered_sequence + 1)
+            {
+                skipped_snapshots += frame.sequence - rendered_sequence - 1;
+            }
 
-        // Se selecciona la textura si está disponible:
-        if (there_is_texture)
+            rendered_sequence = frame.sequence;
+        }
+
+        const Frame_Snapshot & frame = snapshots.get_read_slot();
+
+        if (frame.sequence == 0)
         {
-            glBindTexture(GL_TEXTURE_2D, texture_id);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            return;
         }
 
-        /// CÁMARA
-        // MATRIZ DE VISTA (transformaciones de la cámara)
-        glm::mat4 view = camera.get_view_matrix();
+        /// INTERPOLACIÓN
+        // Se dibuja entre el paso anterior y el último según el tiempo que ha pasado desde el instante
+        // que representa el último (un paso por detrás del tiempo real), de modo que el movimiento es
+        // continuo aunque los frames no coincidan con los pasos:
+        uint64_t now = Frame_Clock::now();
 
-        /// MATRIZ DEL MODELO (transformaciones del cubo)
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.f, -1.f, -3.f));  // Posición fija del cubo
-        model = glm::rotate(model, angle, glm::vec3(1.f, 1.f, 0.f)); // Rotación sobre eje Y
+        render_alpha = now > frame.step_counter ? float(Frame_Clock::to_seconds(now - frame.step_counter)) / frame.step_seconds : 0.f;
+        render_alpha = std::min(render_alpha, 1.f);
 
-        // COMBINACIÓN FINAL: Cámara + modelos
-        glm::mat4 model_view_matrix = view * model;
+        render_view_matrix       = interpolate_transform(frame.previous_view_matrix, frame.view_matrix, render_alpha);
+        render_camera_position   = glm::mix(frame.previous_camera_position, frame.camera_position, render_alpha);
+        render_cube_model_matrix = interpolate_transform(frame.previous_cube_model_matrix, frame.cube_model_matrix, render_alpha);
 
-        /// PRIMERA ETAPA (RENDER DE LOS OBJETOS OPACOS):
-        glEnable(GL_DEPTH_TEST);
-        glDepthMask(GL_TRUE);
-        glDisable(GL_BLEND);
+        // Las luces están en el espacio de la vista simulada:
+        glm::mat4 view_correction = render_view_matrix * glm::inverse(frame.view_matrix);
 
-        glUniformMatrix4fv(model_view_matrix_id, 1, GL_FALSE, glm::value_ptr(model_view_matrix));
+        render_lights.clear();
 
-        glm::mat4 normal_matrix = glm::transpose(glm::inverse(model_view_matrix));
-        glUniformMatrix4fv(normal_matrix_id, 1, GL_FALSE, glm::value_ptr(normal_matrix));
+        for (size_t i = 0; i < frame.view_lights.size(); ++i)
+        {
+            glm::vec3 position(view_correction * glm::vec4(frame.view_lights.x[i], frame.view_lights.y[i], frame.view_lights.z[i], 1.f));
 
-        // Texturizado
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture_id);
-        glUniform1i(glGetUniformLocation(program_id, "sampler"), 0);
+            render_lights.add(position, frame.view_lights.radius[i], glm::vec3(frame.view_lights.red[i], frame.view_lights.green[i], frame.view_lights.blue[i]));
+        }
+
+        // Se pasa a la región del búfer de streaming que la GPU ya ha terminado de leer:
+        stream_buffer.begin_frame();
+
+        upload_height_edits();
+
+        // Se piden los chunks que faltan alrededor de la cámara y se suben los que ya se han generado:
+        if (frame.streamed_terrain)
+        {
+            terrain_streamer->stream(frame.terrain_camera);
+        }
+
+        if (hardware_occlusion)
+        {
+            occlusion_queries.begin_frame();
+        }
+
+        /// LUCES PUNTUALES
+        // Los clusters solo los leen los objetos que se dibujan con el shader forward. En el camino
+        // deferred las luces se aplican con volúmenes, por lo que solo se reparten si se llega a dibujar
+        // algún objeto transparente (ver render_transparent()):
+        bool deferred = deferred_shading && deferred_renderer.is_ready();
+
+        light_clusters_current = false;
+
+        glBeginQuery(GL_TIME_ELAPSED, gpu_timer_ids[frame_index % 2]);
+
+        if (deferred)
+        {
+            /// PRIMERA ETAPA (OBJETOS OPACOS EN EL G-BUFFER + ILUMINACIÓN):
+            deferred_renderer.begin_geometry_pass();
+
+            geometry_pass = true;
+            render_opaque(frame);
+            geometry_pass = false;
 
-        // Se dibuja la malla:
-        glBindVertexArray(vao_id);
-        glDrawElements(GL_TRIANGLES, number_of_indices, GL_UNSIGNED_SHORT, 0);
+            // Las etapas de iluminación comparten las intensidades y luces globales con el camino forward:
+            for (auto * variant : { &deferred_renderer.resolve_variant(), &deferred_renderer.volume_variant() })
+            {
+                if (!variant->is_configured)
+                {
+                    glUseProgram(variant->program_id);
+                    configure_light(*variant);
+                    variant->is_configured = true;
+                }
+            }
+
+            deferred_renderer.render_lighting(projection_matrix, 1.f, render_lights, background_color, stream_buffer);
+        }
+        else
+        {
+            glViewport(0, 0, framebuffer_width, framebuffer_height);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_id);         // Se activa el framebuffer de la textura
+
+            glClearColor(background_color.r, background_color.g, background_color.b, 1.f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            if (clustered_lighting)
+            {
+                update_light_clusters(render_lights);
+            }
+
+            /// PRIMERA ETAPA (RENDER DE LOS OBJETOS OPACOS):
+            glEnable(GL_DEPTH_TEST);
+            glDepthMask(GL_TRUE);
+            glDisable(GL_BLEND);
+
+            render_opaque(frame);
+        }
 
         /// SEGUNDA ETAPA (RENDER DE LOS OBJETOS TRANSPARENTES):
+        render_transparent(frame);
+
+        glEndQuery(GL_TIME_ELAPSED);
+
+        read_gpu_timer();
+
+        // Se desactiva la prueba de profundidad antes de renderizar el framebuffer
+        glDisable(GL_DEPTH_TEST);
+        render_framebuffer();   // Dibuja el framebuffer en pantalla
+
+        stream_buffer.end_frame();
+
+        // Latencia desde que la simulación terminó el paso hasta que su imagen se ha enviado a la GPU:
+        frame_latency = std::chrono::duration< float, std::milli >(std::chrono::steady_clock::now() - frame.simulated_at).count();
+    }
+
+    void Scene::render_opaque(const Frame_Snapshot & frame)
+    {
+        // Materiales de los objetos opacos (de momento solo la malla). Los objetos visibles los deja la
+        // simulación en el snapshot:
+        const Material * materials[] = { &mesh_material };
+
+        auto & objects = frame.opaque_objects;
+
+        // El terreno se dibuja primero porque es el oclusor de los demás objetos opacos:
+        render_terrain_lod(frame);
+        render_terrain_chunks(frame);
+
+        // Con las occlusion queries la caja de cada objeto se prueba contra la profundidad del terreno.
+        // Los objetos cuya consulta anterior no pasó no se envían, y los caros se graban con render
+        // condicional para que la GPU los descarte con la consulta de este mismo frame:
+        opaque_conditions.assign(objects.size(), 0);
+
+        if (hardware_occlusion)
+        {
+            if (occlusion_queries.begin_proxies())
+            {
+                for (auto & object : objects)
+                {
+                    occlusion_queries.test(object.query, object.center, object.extent, projection_matrix * render_view_matrix, render_camera_position);
+                }
+
+                occlusion_queries.end_proxies();
+            }
+
+            for (size_t i = 0; i < objects.size(); ++i)
+            {
+                opaque_conditions[i] = occlusion_queries.should_render(objects[i].query) ? occlusion_queries.get_conditional_query(objects[i].query) : skipped_draw;
+            }
+        }
+
+        // Los hilos del sistema de trabajos preparan los objetos (COMBINACIÓN FINAL: Cámara + modelos)
+        // y graban sus comandos en listas independientes:
+        Command_List::record_parallel
+        (
+            opaque_commands, objects.size(), objects_per_command_list,
+            [&] (Command_List & list, size_t first, size_t last)
+            {
+                for (size_t i = first; i < last; ++i)
+                {
+                    GLuint condition = opaque_conditions[i];
+
+                    if (condition == skipped_draw) continue;
+
+                    if (condition) list.begin_conditional_render(condition, GL_QUERY_NO_WAIT);
+
+                    list.bind_material       (objects[i].material);
+                    list.set_object_uniforms (render_view_matrix * interpolate_transform(objects[i].previous_model_matrix, objects[i].model_matrix, render_alpha));
+                    // Las mallas con el mismo formato de vértice comparten VAO, por lo que entre ellas
+                    // solo cambian el primer índice y el vértice base:
+                    const Geometry_Pool::Mesh_Range & range = geometry_pool.get_range(objects[i].mesh);
+
+                    list.bind_vertex_array   (range.vertex_array_id);
+                    list.draw_elements       (objects[i].primitive, range.index_count, GL_UNSIGNED_SHORT, range.first_index, range.base_vertex);
+
+                    if (condition) list.end_conditional_render();
+                }
+            }
+        );
+
+        // Este hilo las reproduce en orden. Mientras la variante de un material no haya terminado de
+        // compilarse se usa la de respaldo:
+        Command_List::replay
+        (
+            opaque_commands,
+            [&] (uint32_t material) -> const Shader_Variants::Variant &
+            {
+                return use_material(*materials[material]);
+            }
+        );
+    }
+
+    void Scene::render_terrain_lod(const Frame_Snapshot & frame)
+    {
+        if (frame.terrain_nodes.empty()) return;
+
+        // El programa de respaldo no sabe colocar la rejilla, por lo que se espera a la variante:
+        const Shader_Variants::Variant & variant = use_material(terrain_material);
+
+        if (&variant == &fallback_variant) return;
+
+        glm::mat4 model_view_matrix = render_view_matrix * terrain_model_matrix;
+
+        glUniformMatrix4fv(variant.model_view_matrix_id, 1, GL_FALSE, glm::value_ptr(model_view_matrix));
+        glUniformMatrix4fv(variant.normal_matrix_id,     1, GL_FALSE, glm::value_ptr(glm::transpose(glm::inverse(model_view_matrix))));
+
+        horizon_map->bind(variant.program_id, sun_direction);
+
+        terrain_lod->render(variant.program_id, frame.terrain_camera, frame.terrain_nodes.data(), frame.terrain_nodes.size(), stream_buffer);
+    }
+
+    void Scene::render_terrain_chunks(const Frame_Snapshot & frame)
+    {
+        if (!frame.streamed_terrain) return;
+
+        // Los chunks tienen vértices normales, por lo que sirve también el programa de respaldo:
+        const Shader_Variants::Variant & variant = use_material(chunk_material);
+
+        glm::mat4 model_view_matrix = render_view_matrix * terrain_model_matrix;
+
+        glUniformMatrix4fv(variant.model_view_matrix_id, 1, GL_FALSE, glm::value_ptr(model_view_matrix));
+        glUniformMatrix4fv(variant.normal_matrix_id,     1, GL_FALSE, glm::value_ptr(glm::transpose(glm::inverse(model_view_matrix))));
+
+        terrain_streamer->render(projection_matrix * model_view_matrix);
+    }
+
+    void Scene::edit_terrain(const glm::vec3 & terrain_camera, float amount)
+    {
+        const glm::vec3 & size = terrain_lod->get_size();
+
+        // Posición de la cámara en muestras del mapa (el terreno está centrado en el origen):
+        float x = (terrain_camera.x / size.x + 0.5f) * float(height_map->get_width() - 1);
+        float z = (terrain_camera.z / size.z + 0.5f) * float(height_map->get_depth() - 1);
+
+        Height_Map::Region region = height_map->raise(x, z, 8.f, amount * 0.25f);
+
+        if (region.width == 0) return;
+
+        terrain_lod->update_pyramid(*height_map, region);
+
+        Height_Edit edit{ region, std::vector< float >(size_t(region.width) * region.depth), horizon_map->update(*height_map, region), {} };
+
+        horizon_map->copy(edit.horizon_region, edit.horizons);
+
+        for (unsigned row = 0; row < region.depth; ++row)
+        {
+            const float * source = height_map->get_row(region.z + row) + region.x;
+
+            std::copy(source, source + region.width, edit.heights.begin() + size_t(row) * region.width);
+        }
+
+        std::lock_guard< std::mutex > lock(height_edit_mutex);
+
+        height_edits.push_back(std::move(edit));
+    }
+
+    void Scene::upload_height_edits()
+    {
+        {
+            std::lock_guard< std::mutex > lock(height_edit_mutex);
+
+            uploading_edits.swap(height_edits);
+        }
+
+        // Cada edición cuesta una subida parcial de las texturas de alturas y de horizontes (no se toca
+        // ningún búfer de vértices):
+        for (auto & edit : uploading_edits)
+        {
+            terrain_lod->upload_heights(edit.region, edit.heights.data());
+            horizon_map->upload(edit.horizon_region, edit.horizons.data());
+        }
+
+        uploading_edits.clear();
+    }
+
+    void Scene::render_transparent(const Frame_Snapshot & frame)
+    {
+        if (!frame.cube_visible) return;
+
+        // El Z-buffer ya contiene los objetos opacos, por lo que se puede consultar si la caja del
+        // cubo queda detrás de ellos. El resultado se usa en el frame siguiente:
+        if (hardware_occlusion)
+        {
+            if (occlusion_queries.begin_proxies())
+            {
+                occlusion_queries.test(cube_query, frame.cube_center, frame.cube_extent, projection_matrix * render_view_matrix, render_camera_position);
+                occlusion_queries.end_proxies();
+            }
+
+            if (!occlusion_queries.should_render(cube_query)) return;
+        }
+
+        if (clustered_lighting && !light_clusters_current)
+        {
+            update_light_clusters(render_lights);
+        }
+
         // Se habilita la mezcla con el color de fondo usando el canal alpha y se deshabilita la escritura en el Z-Buffer:
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
         glDepthMask(GL_FALSE);
 
-        // Se rota otro cubo y se empuja hacia el fondo:
-        model = glm::mat4(1);
-        model = glm::translate(model, glm::vec3(0.f, 0.f, -5.f));
-        model = glm::rotate(model, angle, glm::vec3(0.f, 1.f, 0.f));
-        model = glm::translate(model, glm::vec3(0.f, 0.f, +2.f));
+        glm::mat4 model_view_matrix = render_view_matrix * render_cube_model_matrix;
+        glm::mat4 normal_matrix     = glm::transpose(glm::inverse(model_view_matrix));
+
+        const Shader_Variants::Variant * variant = &use_material(cube_material);
 
-        glUniformMatrix4fv(model_view_matrix_id, 1, GL_FALSE, glm::value_ptr(model_view_matrix));
+        glUniformMatrix4fv(variant->model_view_matrix_id, 1, GL_FALSE, glm::value_ptr(model_view_matrix));
+        glUniformMatrix4fv(variant->normal_matrix_id,     1, GL_FALSE, glm::value_ptr(normal_matrix));
 
         // Se renderiza el cubo en el framebuffer:
+        if (hardware_occlusion) occlusion_queries.begin_conditional_render(cube_query);
+
         cube.render();
 
+        if (hardware_occlusion) occlusion_queries.end_conditional_render(cube_query);
+
         // Se deshabilita la mezcla con el fondo y se restaura escritura en el Z-Buffer:
         glDepthMask(GL_TRUE);
         glDisable(GL_BLEND);
+    }
 
-        // Se desactiva la prueba de profundidad antes de renderizar el framebuffer
-        glDisable(GL_DEPTH_TEST);
-        render_framebuffer();   // Dibuja el framebuffer en pantalla
+    void Scene::cull_objects(const glm::mat4 & view_projection_matrix, const glm::vec3 & camera_position)
+    {
+        frustum_culler.cull(view_projection_matrix);
+
+        // El horizonte del terreno visto desde la cámara no depende de la dirección de la vista, por lo
+        // que también se construye en el espacio local del terreno:
+        horizon_built = is_horizon_culling();
+
+        if (horizon_built)
+        {
+            horizon_culler->reset_test_statistics();
+            horizon_culler->build(glm::vec3(glm::inverse(terrain_model_matrix) * glm::vec4(camera_position, 1.f)));
+        }
+
+        // Los oclusores se rasterizan en la CPU una vez por frame antes de enviar ningún objeto:
+        occlusion_culler.reset_test_statistics();
+
+        if (occlusion_culling)
+        {
+            occlusion_culler.begin_frame(view_projection_matrix);
+
+            if (!occluder_indices.empty() && frustum_culler.is_visible(mesh_object))
+            {
+                occlusion_culler.add_occluder
+                (
+                    occluder_positions.data(), occluder_positions.size() / 3,
+                    occluder_indices  .data(), occluder_indices  .size(),
+                    mesh_model_matrix
+                );
+            }
+
+            occlusion_culler.rasterize();
+        }
+    }
+
+    bool Scene::is_object_visible(uint32_t object)
+    {
+        if (!frustum_culler.is_visible(object)) return false;
+
+        // El terreno puede tapar cualquier objeto, también la malla que hace de oclusor por software. La
+        // matriz del terreno solo traslada, por lo que la caja solo se desplaza:
+        if (horizon_built)
+        {
+            glm::vec3 local_center = frustum_culler.get_center(object) - glm::vec3(terrain_model_matrix[3]);
+
+            if (horizon_culler->is_occluded(local_center, frustum_culler.get_extent(object))) return false;
+        }
+
+        // Los oclusores no se prueban contra sí mismos:
+        if (!occlusion_culling || object == mesh_object) return true;
+
+        return !occlusion_culler.is_occluded(frustum_culler.get_center(object), frustum_culler.get_extent(object));
+    }
+
+    void Scene::read_gpu_timer()
+    {
+        // La consulta del frame anterior ya debería haber terminado. Si no es así se deja el
+        // valor anterior en lugar de bloquear:
+        if (++frame_index < 2) return;
+
+        GLuint query_id  = gpu_timer_ids[frame_index % 2];
+        GLint  available = 0;
+
+        glGetQueryObjectiv(query_id, GL_QUERY_RESULT_AVAILABLE, &available);
+
+        if (available)
+        {
+            GLuint64 nanoseconds = 0;
+
+            glGetQueryObjectui64v(query_id, GL_QUERY_RESULT, &nanoseconds);
+
+            gpu_milliseconds = float(nanoseconds) / 1000000.f;
+        }
+    }
+
+    std::string Scene::pick_object() const
+    {
+        // Se lanza un rayo desde la cámara hacia el centro de la vista y se toma la primera caja que corta,
+        // salvo que antes corte el terreno:
+        float   distance;
+        int32_t proxy = object_tree.ray_cast(camera.get_position(), camera.get_front(), 5000.f, distance);
+
+        float terrain_distance;
+
+        if (intersect_terrain(camera.get_position(), camera.get_front(), proxy == Dynamic_AABB_Tree::NULL_NODE ? 5000.f : distance, terrain_distance))
+        {
+            glm::vec3 point = camera.get_position() + camera.get_front() * terrain_distance;
+
+            return "terreno en (" + std::to_string(point.x) + ", " + std::to_string(point.y) + ", " + std::to_string(point.z) + ")";
+        }
+
+        if (proxy == Dynamic_AABB_Tree::NULL_NODE) return std::string();
+
+        return object_tree.get_user_data(proxy) == mesh_object ? "malla" : "cubo";
+    }
+
+    bool Scene::intersect_terrain(const glm::vec3 & origin, const glm::vec3 & direction, float max_distance, float & distance) const
+    {
+        if (!height_field || use_streamed_terrain) return false;
+
+        // El terreno solo está desplazado, por lo que las distancias son las mismas en su espacio local:
+        glm::vec3 local_origin = glm::vec3(glm::inverse(terrain_model_matrix) * glm::vec4(origin, 1.f));
+
+        return height_field->intersect_ray(local_origin, direction, max_distance, distance);
+    }
+
+    void Scene::clamp_camera_to_terrain()
+    {
+        if (!height_field || use_streamed_terrain) return;
+
+        // La cámara no baja de 2 unidades sobre el suelo mientras está encima del terreno:
+        const float clearance = 2.f;
+
+        glm::vec3 local = glm::vec3(glm::inverse(terrain_model_matrix) * glm::vec4(camera.get_position(), 1.f));
+
+        if (!height_field->contains(local.x, local.z)) return;
+
+        float ground = height_field->height_at(local.x, local.z) + clearance;
+
+        if (local.y < ground)
+        {
+            local.y = ground;
+
+            camera.set_position(glm::vec3(terrain_model_matrix * glm::vec4(local, 1.f)));
+        }
+    }
+
+    void Scene::place_mesh_on_terrain()
+    {
+        float distance;
+
+        if (!intersect_terrain(camera.get_position(), camera.get_front(), 5000.f, distance)) return;
+
+        // La malla gira alrededor de su origen, así que se levanta la distancia desde él hasta la esquina
+        // más lejana de su caja para que no se hunda en el suelo en ninguna orientación:
+        glm::vec3 point  = camera.get_position() + camera.get_front() * distance;
+        float     radius = std::max(glm::length(mesh_min), glm::length(mesh_max));
+
+        scene_graph.set_translation(mesh_node, point + glm::vec3(0.f, radius, 0.f));
     }
 
 
@@ -326,13 +1346,81 @@ namespace udit
         window_width  = width;
         window_height = height;
 
-        glm::mat4 projection_matrix = glm::perspective (20.f, GLfloat(width) / height, 1.f, 5000.f);
+        aspect_ratio = GLfloat(width) / height;
 
-        glUniformMatrix4fv (projection_matrix_id, 1, GL_FALSE, glm::value_ptr(projection_matrix));
+        // La matriz se envía al programa activo en cada render() porque puede cambiar de programa:
+        projection_matrix = glm::perspective (20.f, GLfloat(width) / height, 1.f, 5000.f);
+
+        // Los clusters dependen de la proyección y los shaders que los usan deben reconfigurarse:
+        light_clusters.set_projection (projection_matrix, 1.f, 5000.f);
+        scene_shaders.reset_configuration ();
+        deferred_renderer.reset_configuration ();
 
         glViewport (0, 0, width, height);
     }
 
+    /// <summary>
+    ///     Activa la variante del shader que corresponde al material y le envía sus parámetros. Si la
+    ///     variante todavía no ha terminado de compilarse se activa el programa de respaldo. La primera
+    ///     vez que se usa una variante se configuran sus luces.
+    /// </summary>
+    unsigned Scene::variant_key (const Material & material, bool deferred_geometry) const
+    {
+        // Los objetos opacos del camino deferred solo escriben su superficie en el G-buffer:
+        if (deferred_geometry && !material.transparent)
+        {
+            unsigned features = material.variant_key(0) & (Shader_Variants::TEXTURED | Shader_Variants::VERTEX_COLOR | Shader_Variants::TERRAIN_LOD);
+
+            return Shader_Variants::make_key(features | Shader_Variants::PER_PIXEL_LIGHTING | Shader_Variants::DEFERRED_GEOMETRY, 0);
+        }
+
+        unsigned key = material.variant_key(unsigned(lights.size()));
+
+        // Las luces puntuales solo se pueden buscar en su cluster desde el fragment shader:
+        if (clustered_lighting)
+        {
+            key |= Shader_Variants::CLUSTERED_LIGHTING | Shader_Variants::PER_PIXEL_LIGHTING;
+        }
+
+        return key;
+    }
+
+    const Shader_Variants::Variant & Scene::use_material (const Material & material)
+    {
+        Shader_Variants::Variant * variant = scene_shaders.get_ready(variant_key(material, geometry_pass));
+
+        if (!variant)
+        {
+            glUseProgram(fallback_variant.program_id);
+            glUniformMatrix4fv(fallback_variant.projection_matrix_id, 1, GL_FALSE, glm::value_ptr(projection_matrix));
+
+            return fallback_variant;
+        }
+
+        glUseProgram(variant->program_id);
+
+        if (!variant->is_configured)
+        {
+            glUniform1i(glGetUniformLocation(variant->program_id, "sampler"), 0);
+
+            // Se establece la altura máxima del height map en el vertex shader:
+            if (terrain_lod)
+            {
+                glUniform1f(glGetUniformLocation(variant->program_id, "max_height"), terrain_lod->get_size().y);
+            }
+
+            configure_light(*variant);
+
+            variant->is_configured = true;
+        }
+
+        glUniformMatrix4fv(variant->projection_matrix_id, 1, GL_FALSE, glm::value_ptr(projection_matrix));
+
+        configure_material(*variant, material);
+
+        return *variant;
+    }
+
     /// ------------------ POSTPROCESADO ------------------
 
     void Scene::build_framebuffer()
@@ -440,6 +1528,22 @@ namespace udit
 
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+        // Mientras el shader del efecto no esté listo se copia el framebuffer sin procesar:
+
+        if (shader_compiler.poll(effect_program_id) != Shader_Compiler::Status::READY)
+        {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer_id);
+            glBlitFramebuffer
+            (
+                0, 0, framebuffer_width, framebuffer_height,
+                0, 0, window_width,      window_height,
+                GL_COLOR_BUFFER_BIT,
+                GL_LINEAR
+            );
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+            return;
+        }
+
         glUseProgram(effect_program_id);
 
         // Se activa la textura del framebuffer y se renderiza en la ventana:
@@ -464,7 +1568,7 @@ namespace udit
         auto scene = importer.ReadFile
         (
             mesh_file_path,
-            aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_SortByPType
+            aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_SortByPType | aiProcess_GenBoundingBoxes
         );
 
         // Si scene es un puntero nulo significa que el archivo no se pudo cargar con éxito:
@@ -474,96 +1578,209 @@ namespace udit
             auto mesh = scene->mMeshes[0];
             size_t number_of_vertices = mesh->mNumVertices;
 
-            // Se generan índices para los VBOs del cubo:
-            glGenBuffers(VBO_COUNT, vbo_ids);
-            glGenVertexArrays(1, &vao_id);
-            // Se activa el VAO del cubo para configurarlo:
-            glBindVertexArray(vao_id);
+            // Caja envolvente para el frustum culling. Si el importador no la ha generado se calcula
+            // recorriendo los vértices:
+            mesh_min = glm::vec3(mesh->mAABB.mMin.x, mesh->mAABB.mMin.y, mesh->mAABB.mMin.z);
+            mesh_max = glm::vec3(mesh->mAABB.mMax.x, mesh->mAABB.mMax.y, mesh->mAABB.mMax.z);
+
+            if (mesh_min == mesh_max && number_of_vertices > 0)
+            {
+                mesh_min = mesh_max = glm::vec3(mesh->mVertices[0].x, mesh->mVertices[0].y, mesh->mVertices[0].z);
 
-            // Coordenadas
-            glBindBuffer(GL_ARRAY_BUFFER, vbo_ids[COORDINATES_VBO]);
-            glBufferData(GL_ARRAY_BUFFER, number_of_vertices * sizeof(aiVector3D), mesh->mVertices, GL_STATIC_DRAW);
-            glEnableVertexAttribArray(0);
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+                for (size_t i = 1; i < number_of_vertices; ++i)
+                {
+                    glm::vec3 vertex(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
 
+                    mesh_min = glm::min(mesh_min, vertex);
+                    mesh_max = glm::max(mesh_max, vertex);
+                }
+            }
 
-            // El archivo del modelo 3D de ejemplo no guarda un color por cada vértice, por lo que se va
-            // a crear un array de colores aleatorios (tantos como vértices):
-            // vector< vec3 > vertex_colors(number_of_vertices);
-            // for (auto& color : vertex_colors)
-            // {
-            //     color = random_color();
-            // }
+            // Los atributos que tenga la malla se intercalan en cada vértice. Las posiciones de los
+            // atributos en el vertex shader son: 0 coordenadas, 1 normales, 2 UVs y 3 colores:
+            Geometry_Pool::Vertex_Format format{ { { 0, 3, GL_FLOAT, GL_FALSE, 0 } }, 3 * sizeof(float) };
 
-            // Normales (para iluminación)
             if (mesh->HasNormals())
             {
-                // Se suben a un VBO los datos de color y se vinculan al VAO:
-                glBindBuffer(GL_ARRAY_BUFFER, vbo_ids[COLORS_VBO]);
-                glBufferData(GL_ARRAY_BUFFER, number_of_vertices * sizeof(aiVector3D), mesh->mNormals, GL_STATIC_DRAW);
-                glEnableVertexAttribArray(1);
-                glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+                format.attributes.push_back({ 1, 3, GL_FLOAT, GL_FALSE, GLuint(format.stride) });
+                format.stride += 3 * sizeof(float);
             }
 
-            // Coordenadas de textura (UVs)
             if (mesh->HasTextureCoords(0))
             {
-                vector<vec2> uvs(number_of_vertices);
-                for (unsigned i = 0; i < number_of_vertices; ++i)
+                format.attributes.push_back({ 2, 2, GL_FLOAT, GL_FALSE, GLuint(format.stride) });
+                format.stride += 2 * sizeof(float);
+            }
+
+            // Colores por vértice (solo se usan si el material activa la característica VERTEX_COLOR)
+            if (mesh->HasVertexColors(0))
+            {
+                format.attributes.push_back({ 3, 3, GL_FLOAT, GL_FALSE, GLuint(format.stride) });
+                format.stride += 3 * sizeof(float);
+
+                mesh_material.vertex_color = true;
+            }
+
+            vector<float> vertices;
+            vertices.reserve(number_of_vertices * format.stride / sizeof(float));
+
+            for (unsigned i = 0; i < number_of_vertices; ++i)
+            {
+                auto & position = mesh->mVertices[i];
+
+                vertices.insert(vertices.end(), { position.x, position.y, position.z });
+
+                if (mesh->HasNormals())
+                {
+                    auto & normal = mesh->mNormals[i];
+                    vertices.insert(vertices.end(), { normal.x, normal.y, normal.z });
+                }
+
+                if (mesh->HasTextureCoords(0))
+                {
+                    auto & uv = mesh->mTextureCoords[0][i];
+                    vertices.insert(vertices.end(), { uv.x, uv.y });
+                }
+
+                if (mesh->HasVertexColors(0))
                 {
-                    uvs[i] = vec2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y);
+                    auto & color = mesh->mColors[0][i];
+                    vertices.insert(vertices.end(), { color.r, color.g, color.b });
                 }
-                glBindBuffer(GL_ARRAY_BUFFER, vbo_ids[UVS_VBO]);
-                glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(vec2), uvs.data(), GL_STATIC_DRAW);
-                glEnableVertexAttribArray(2);
-                glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
             }
 
             // Índices
             // Los índices en ASSIMP están repartidos en "faces", pero OpenGL necesita un array de enteros
             // por lo que vamos a mover los índices de las "faces" a un array de enteros:
             // Se asume que todas las "faces" son triángulos (revisar el flag aiProcess_Triangulate arriba).
-            number_of_indices = mesh->mNumFaces * 3;
-            vector<GLshort> indices(number_of_indices);
+            // Los índices son de 16 bits y relativos al primer vértice de la malla. El último valor se
+            // reserva para reiniciar las tiras de triángulos:
+            assert(number_of_vertices <= Terrain::RESTART_INDEX);
+
+            vector<uint16_t> indices(mesh->mNumFaces * 3);
             auto vertex_index = indices.begin();
             for (unsigned i = 0; i < mesh->mNumFaces; ++i)
             {
                 auto& face = mesh->mFaces[i];
-                *vertex_index++ = face.mIndices[0];
-                *vertex_index++ = face.mIndices[1];
-                *vertex_index++ = face.mIndices[2];
+                *vertex_index++ = uint16_t(face.mIndices[0]);
+                *vertex_index++ = uint16_t(face.mIndices[1]);
+                *vertex_index++ = uint16_t(face.mIndices[2]);
             }
 
-            // Se suben a un EBO los datos de índices:
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo_ids[INDICES_EBO]);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLshort), indices.data(), GL_STATIC_DRAW);
+            // Copia de la malla para rasterizarla como oclusor en la CPU:
+            occluder_positions.assign(&mesh->mVertices[0].x, &mesh->mVertices[0].x + number_of_vertices * 3);
+            occluder_indices  .resize(indices.size());
+
+            for (size_t i = 0; i < indices.size(); ++i)
+            {
+                occluder_indices[i] = indices[i];
+            }
+
+            // Se copian los vértices y los índices al almacén de geometría compartido:
+            mesh_geometry = geometry_pool.create_mesh
+            (
+                format,
+                vertices.data(), GLsizei(number_of_vertices),
+                indices .data(), GLsizei(indices.size())
+            );
         }
     }
 
-    void Scene::configure_material(GLuint program_id)
+    void Scene::configure_material(const Shader_Variants::Variant & variant, const Material & material)
     {
-        GLint material_color = glGetUniformLocation(program_id, "material_color");
+        glUniform3fv(variant.material_color_id, 1, glm::value_ptr(material.color));
+        glUniform1f (variant.material_alpha_id, material.alpha);
+        glUniform1f (variant.material_roughness_id, material.roughness);
 
-        glUniform3f(material_color, 1.f, 1.f, 1.f);
+        // Texturizado
+        if (material.texture_id)
+        {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, material.texture_id);
+        }
     }
 
-    void Scene::configure_light(GLuint program_id)
+    void Scene::configure_light(const Shader_Variants::Variant & variant)
     {
-        GLint    light_position = glGetUniformLocation(program_id, "light.position"   );
-        GLint       light_color = glGetUniformLocation(program_id, "light.color"      );
+        GLuint program_id = variant.program_id;
+
+        // La variante solo declara tantas luces como indica su clave:
+        unsigned light_count = variant.key >> Shader_Variants::LIGHT_COUNT_SHIFT;
+
+        for (unsigned i = 0; i < light_count; ++i)
+        {
+            string light = "lights[" + to_string(i) + "]";
+
+            GLint light_position = glGetUniformLocation(program_id, (light + ".position").c_str());
+            GLint    light_color = glGetUniformLocation(program_id, (light + ".color"   ).c_str());
+
+            glUniform4fv(light_position, 1, glm::value_ptr(lights[i].position));
+            glUniform3fv(light_color,    1, glm::value_ptr(lights[i].color   ));
+        }
+
         GLint ambient_intensity = glGetUniformLocation(program_id, "ambient_intensity");
         GLint diffuse_intensity = glGetUniformLocation(program_id, "diffuse_intensity");
         GLint      spec_int_loc = glGetUniformLocation(program_id, "specular_intensity");
-        GLint     shininess_loc = glGetUniformLocation(program_id, "shininess");
         GLint    spec_color_loc = glGetUniformLocation(program_id, "specular_color");
 
-        glUniform4f(light_position   , 10.0f, 10.f, 10.f, 1.f);
-        glUniform3f(light_color      , 1.0f, 1.f, 1.f        );
         glUniform1f(ambient_intensity, 0.2f                  );
         glUniform1f(diffuse_intensity, 0.8f                  );
         glUniform1f(spec_int_loc, 1.0f);   // fuerza del brillo
-        glUniform1f(shininess_loc, 32.0f);   // “dureza” del material
         glUniform3f(spec_color_loc, 1.0f, 1.0f, 1.0f); // color del reflejo (blanco)
+
+        // Parámetros para localizar el cluster de cada fragmento:
+        if (variant.key & Shader_Variants::CLUSTERED_LIGHTING)
+        {
+            glUniform1i(glGetUniformLocation(program_id, "light_data"   ), cluster_texture_unit + 0);
+            glUniform1i(glGetUniformLocation(program_id, "cluster_grid" ), cluster_texture_unit + 1);
+            glUniform1i(glGetUniformLocation(program_id, "light_indices"), cluster_texture_unit + 2);
+
+            glUniform3i(glGetUniformLocation(program_id, "cluster_grid_size"), Light_Clusters::GRID_X, Light_Clusters::GRID_Y, Light_Clusters::GRID_Z);
+            glUniform2f(glGetUniformLocation(program_id, "cluster_scale"), float(Light_Clusters::GRID_X) / framebuffer_width, float(Light_Clusters::GRID_Y) / framebuffer_height);
+            glUniform1f(glGetUniformLocation(program_id, "slice_scale"), light_clusters.slice_scale());
+            glUniform1f(glGetUniformLocation(program_id, "slice_bias" ), light_clusters.slice_bias ());
+        }
+    }
+
+    /// ------------------ LUCES PUNTUALES (CLUSTERED FORWARD) ------------------
+
+    void Scene::create_point_lights()
+    {
+        point_lights.resize(point_light_count);
+
+        for (auto & light : point_lights)
+        {
+            float distance  = 30.f * sqrt(float(rand()) / float(RAND_MAX));
+            float direction = 6.2831853f * float(rand()) / float(RAND_MAX);
+
+            // Se reparten en un disco alrededor del centro de la escena (0, 0, -5) a distintas alturas:
+            light.base_position = glm::vec3(distance * cos(direction), -2.f + 4.f * float(rand()) / float(RAND_MAX), distance * sin(direction));
+            light.position      = light.base_position + glm::vec3(0.f, 0.f, -5.f);
+            light.color         = random_color() * 0.5f;
+            light.radius        = 1.5f + 2.5f * float(rand()) / float(RAND_MAX);
+            light.orbit_speed   = 0.2f + float(rand()) / float(RAND_MAX);
+        }
+    }
+
+    void Scene::update_view_lights(const glm::mat4 & view_matrix, Light_Clusters::Light_Set & view_lights) const
+    {
+        // Las luces se pasan a eye-space, que es el espacio en el que están definidos los clusters
+        // y en el que se reconstruye la posición de cada píxel del G-buffer:
+        view_lights.clear();
+
+        for (auto & light : point_lights)
+        {
+            view_lights.add(glm::vec3(view_matrix * glm::vec4(light.position, 1.f)), light.radius, light.color);
+        }
+    }
+
+    void Scene::update_light_clusters(const Light_Clusters::Light_Set & view_lights)
+    {
+        light_clusters.assign(view_lights);
+        light_clusters.upload(view_lights);
+        light_clusters.bind  (cluster_texture_unit);
+
+        light_clusters_current = true;
     }
 
     /// ------------------ TEXTURIZADO ------------------ 
@@ -4,53 +4,214 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 #include <glad/glad.h>
 #include <glm.hpp>
 #include "Color.hpp"
 #include "Color_Buffer.hpp"
 #include "Camera.hpp"
+#include "Command_List.hpp"
 #include "Cube.hpp"
-//#include "Terrain.hpp"
+#include "Deferred_Renderer.hpp"
+#include "Frame_Arena.hpp"
+#include "Frame_Clock.hpp"
+#include "Dynamic_AABB_Tree.hpp"
+#include "Frustum_Culler.hpp"
+#include "Geometry_Pool.hpp"
+#include "Height_Archive.hpp"
+#include "Height_Field.hpp"
+#include "Height_Map.hpp"
+#include "Height_Noise.hpp"
+#include "Horizon_Culler.hpp"
+#include "Horizon_Map.hpp"
+#include "Occlusion_Culler.hpp"
+#include "Occlusion_Queries.hpp"
+#include "Scene_Graph.hpp"
+#include "Light_Clusters.hpp"
+#include "Material.hpp"
+#include "Shader_Compiler.hpp"
+#include "Shader_Variants.hpp"
+#include "Streaming_Buffer.hpp"
+#include "Terrain.hpp"
+#include "Terrain_Lod.hpp"
+#include "Terrain_Streamer.hpp"
+#include "Triple_Buffer.hpp"
 
 namespace udit
 {
 
     class Scene
     {
-    private:
+    public:
 
-        typedef Color_Buffer< Rgba8888 > Color_Buffer;
+        struct Light
+        {
+            glm::vec4 position;                     // Posicin de la luz en espacio ojo (eye-space)
+            glm::vec3 color;                        // Color/intensidad de la luz (RGB)
+        };
+
+        struct Point_Light
+        {
+            glm::vec3 base_position;                // Posicin relativa al centro de su rbita
+            glm::vec3 position;
+            glm::vec3 color;
+            float     radius;                       // Distancia a partir de la cual no ilumina
+            float     orbit_speed;
+        };
+
+        /// Entrada que acumula el hilo principal entre dos pasos de la simulacin:
+        struct Input
+        {
+            int  mouse_dx = 0;
+            int  mouse_dy = 0;
+            bool pick     = false;                  // Se ha pedido seleccionar el objeto del centro de la vista
+            bool place    = false;                  // Se ha pedido colocar la malla en el terreno del centro de la vista
+            std::array< Uint8, SDL_NUM_SCANCODES > keys{};
+        };
 
-        enum
+        /// Objeto opaco visible que tiene que dibujar el render:
+        struct Opaque_Object
         {
-            COORDINATES_VBO,
-            COLORS_VBO,
-            INDICES_EBO,
-            UVS_VBO,
-            VBO_COUNT
+            glm::mat4           model_matrix;
+            glm::mat4           previous_model_matrix;  // La del paso anterior, para interpolar
+            glm::vec3           center;                 // Caja en espacio de mundo (occlusion queries)
+            glm::vec3           extent;
+            uint32_t            query;                  // Objeto de Occlusion_Queries
+            Geometry_Pool::Mesh mesh;
+            uint32_t            material;           // ndice en la tabla de materiales de render_opaque()
+            GLenum              primitive;
         };
 
+        /// Todo lo que necesita el render para dibujar un frame. Lo rellena el hilo de simulacin y no
+        /// cambia mientras lo usa el hilo de render:
+        struct Frame_Snapshot
+        {
+            // Cada slot del triple buffer tiene su propia arena para los datos temporales del paso, de
+            // modo que la simulacin puede vaciarla mientras el render sigue leyendo otro slot:
+            Frame_Arena arena;
+
+            uint64_t                              sequence = 0;     // 0 mientras no se ha simulado ningn paso
+            std::chrono::steady_clock::time_point simulated_at;
+            uint64_t                              step_counter;     // Instante del paso en el contador de Frame_Clock
+            float                                 step_seconds;
+
+            // Las transformaciones que se mueven se guardan tambin como estaban en el paso anterior
+            // para que el render interpole entre las dos segn el tiempo que ha pasado desde el paso:
+
+            glm::mat4 view_matrix;
+            glm::mat4 previous_view_matrix;
+            glm::vec3 camera_position;
+            glm::vec3 previous_camera_position;
+
+            glm::mat4 cube_model_matrix;
+            glm::mat4 previous_cube_model_matrix;
+            glm::vec3 cube_center;                  // Caja del cubo en espacio de mundo (occlusion queries)
+            glm::vec3 cube_extent;
+            bool      cube_visible;
+
+            std::array< char, 64 > picked_object;   // ltimo objeto seleccionado (vaco si no hay ninguno)
+
+            Frame_Vector< Opaque_Object > opaque_objects;       // Reservado en la arena del slot
+
+            Frame_Vector< Terrain_Lod::Node > terrain_nodes;    // Vaco si no se usa el terreno con LOD
+            glm::vec3                         terrain_camera;   // Cmara en el espacio local del terreno
+            bool                              streamed_terrain; // Se dibuja el terreno por chunks en lugar del de LOD
+
+            Light_Clusters::Light_Set view_lights;  // Luces puntuales en eye-space
+
+            Frustum_Culler  ::Statistics culling_statistics;
+            Occlusion_Culler::Statistics occlusion_statistics;
+            Horizon_Culler  ::Statistics horizon_statistics;
+            Terrain_Lod     ::Statistics terrain_statistics;
+            float                        simulation_milliseconds;
+
+            Frame_Snapshot() : opaque_objects(arena), terrain_nodes(arena)
+            {
+            }
+        };
+
+    private:
+
+        typedef Color_Buffer< Rgba8888 > Color_Buffer;
+
         // Postprocesado: Reescalado de la pantalla con framebuffer
         static const GLsizei  framebuffer_width = 1024; // 256;
         static const GLsizei framebuffer_height = 1024; // 256;
 
+        // Objetos por lista de comandos al grabarlas en paralelo
+        static const size_t   objects_per_command_list = 64;
+        static const GLuint   skipped_draw = ~0u;    // Objeto que las occlusion queries dejan sin enviar
+
+        // Bytes que puede escribir cada frame en el bfer de streaming
+        static const GLsizeiptr streaming_region_size = 1024 * 1024;
+
+        // Clustered forward shading
+        static const unsigned point_light_count    = 1024;
+        static const GLuint   cluster_texture_unit = 1;   // Usa 3 unidades consecutivas
+
+        static const glm::vec3 background_color;
+
+        static const std::string          common_shader_code;
         static const std::string          vertex_shader_code;
         static const std::string        fragment_shader_code;
         static const std::string                texture_path;
+        static const std::string             height_map_path;
+        static const std::string             height_archive_path;
+        static const std::string             horizon_cache_path;
         static const std::string   effect_vertex_shader_code;
         static const std::string effect_fragment_shader_code;
+        static const std::string   fallback_vertex_shader_code;
+        static const std::string fallback_fragment_shader_code;
 
-        GLint   model_view_matrix_id;
-        GLint   projection_matrix_id;
-        GLint       normal_matrix_id;
         GLuint        framebuffer_id;
         GLuint        depthbuffer_id;
         GLuint        out_texture_id;
 
-        /// Terreno (Mallas de elevacin)
-        //Terrain terrain;
+        /// Vrtices e ndices de todas las mallas (un bfer por formato de vrtice y uno de ndices)
+        Geometry_Pool       geometry_pool;
+        Geometry_Pool::Mesh mesh_geometry = Geometry_Pool::NO_MESH;
+
+        /// Terreno con LOD continuo (CDLOD). Las alturas estn en una textura que lee el vertex shader y
+        /// todos los nodos comparten una sola rejilla. Es nulo si no se ha podido cargar el mapa:
+        std::unique_ptr< Height_Map     > height_map;       // Copia en memoria que edita la simulacin
+        std::unique_ptr< Terrain_Lod    > terrain_lod;
+        std::unique_ptr< Height_Field   > height_field;     // Alturas y cortes con rayos en la CPU
+        std::unique_ptr< Horizon_Map    > horizon_map;      // Sombras y oclusin ambiental precalculadas
+        std::unique_ptr< Horizon_Culler > horizon_culler;   // Objetos tapados por el terreno (CPU)
+        bool                              horizon_built;    // El horizonte es el del paso actual
+        std::atomic< bool >               horizon_culling;
+        glm::vec3                         sun_direction;    // Hacia el sol, en el espacio del terreno
+        glm::mat4                         terrain_model_matrix;
+        std::atomic< bool >               use_terrain_lod;  // Si es false se dibuja todo con el nivel 0
+
+        /// Alturas editadas por la simulacin que el render tiene que subir a la textura:
+        struct Height_Edit
+        {
+            Height_Map::Region     region;
+            std::vector< float   > heights;         // Por filas de region.width
+            Height_Map::Region     horizon_region;  // Horizontes que han cambiado (ms grande que region)
+            std::vector< uint8_t > horizons;        // Ordenados como espera Horizon_Map::upload()
+        };
+
+        std::mutex                  height_edit_mutex;
+        std::vector< Height_Edit >  height_edits;
+        std::vector< Height_Edit >  uploading_edits;    // Se intercambia con height_edits para que ninguno pierda su capacidad
+
+        /// Terreno sin lmites por chunks que se generan en segundo plano a partir del mismo mapa
+        /// (repetido en espejo). Se puede alternar con el de LOD:
+        std::unique_ptr< Terrain_Streamer > terrain_streamer;
+        std::atomic< bool >                 use_streamed_terrain;
+
+        /// Recorrido fijo de la cmara sobre el terreno por chunks para medir los tiempos de frame:
+        static const uint64_t               flythrough_steps = 60 * 60;
+        std::atomic< bool >                 flythrough;
+        uint64_t                            flythrough_step;
 
         Cube  cube;
 
@@ -59,19 +220,117 @@ namespace udit
         /// Cargar modelos 3D
         GLuint  vao_model, vbo_model, ebo_model;
         GLsizei index_count = 0;
+        glm::vec3 mesh_min = glm::vec3(0.f);        // Caja envolvente de la malla en espacio local
+        glm::vec3 mesh_max = glm::vec3(0.f);
+
+        /// Jerarqua de transformaciones (el cubo gira alrededor de un pivote)
+        Scene_Graph    scene_graph;
+        uint32_t       mesh_node;
+        uint32_t       cube_pivot_node;
+        uint32_t       cube_node;
 
-        /// Color aleatorio
-        GLuint  vbo_ids[VBO_COUNT];
-        GLuint              vao_id;
-        GLsizei  number_of_indices;
+        /// Frustum culling (cajas en espacio de mundo de los objetos de la escena)
+        Frustum_Culler frustum_culler;
+        uint32_t       mesh_object;
+        uint32_t       cube_object;
+        glm::mat4      mesh_model_matrix;
+        glm::mat4      cube_model_matrix;
+
+        /// Jerarqua de cajas de los objetos para las consultas espaciales (seleccin con el ratn)
+        Dynamic_AABB_Tree object_tree;
+        int32_t           mesh_proxy;
+        int32_t           cube_proxy;
+        std::string       picked_object;            // ltimo objeto seleccionado (hilo de simulacin)
+
+        /// Occlusion culling por software (la malla cargada hace de oclusor)
+        Occlusion_Culler        occlusion_culler;
+        std::vector< float    > occluder_positions;
+        std::vector< uint32_t > occluder_indices;
+        std::atomic< bool >     occlusion_culling;
+
+        /// Occlusion queries en la GPU. Los objetos opacos se prueban contra el terreno y se dibujan con
+        /// render condicional; el cubo se prueba contra todos los opacos y se descarta en la CPU
+        Occlusion_Queries       occlusion_queries;
+        uint32_t                mesh_query;
+        uint32_t                cube_query;
+        bool                    hardware_occlusion;
+        std::vector< GLuint >   opaque_conditions;  // Por objeto opaco: consulta, 0 o skipped_draw (render)
 
         /// Cargar texturas
-        GLuint          program_id;
         GLuint      texture_id = 0;
-        GLuint use_vertex_color_id;
         //GLuint     cube_program_id;
         GLuint   effect_program_id;
 
+        /// Compilacin de shaders en paralelo y variantes del shader de la escena
+        Shader_Compiler          shader_compiler;
+        Shader_Variants          scene_shaders;
+        Shader_Variants::Variant fallback_variant{};  // Se usa mientras la variante pedida no est lista
+
+        /// Materiales
+        Material mesh_material;
+        Material cube_material;
+        Material terrain_material;
+        Material chunk_material;
+
+        /// Listas de comandos de los objetos opacos (se graban en paralelo y se reproducen en el hilo del contexto)
+        std::vector< Command_List > opaque_commands;
+
+        /// Luces
+        std::vector< Light > lights;
+
+        /// Luces puntuales (clustered forward shading)
+        std::vector< Point_Light > point_lights;
+        Light_Clusters             light_clusters;
+        std::atomic< bool >        clustered_lighting;
+        bool                       light_clusters_current;  // Ya se han repartido las luces de este frame
+
+        /// Deferred shading (alternativa al camino forward que se puede activar en tiempo de ejecucin)
+        Deferred_Renderer          deferred_renderer;
+        bool                       deferred_shading;
+        bool                       geometry_pass;   // Se estn dibujando los objetos opacos en el G-buffer
+
+        /// Datos que cambian en cada frame (de momento las luces puntuales del camino deferred)
+        Streaming_Buffer           stream_buffer;
+
+        /// Tiempo de GPU del render de la escena (sin el postprocesado). Se leen los resultados
+        /// del frame anterior para no esperar a la GPU:
+        GLuint                     gpu_timer_ids[2];
+        unsigned                   frame_index;
+        float                      gpu_milliseconds;
+
+        glm::mat4   projection_matrix;
+
+        /// Simulacin y render en hilos separados. La simulacin (update()) es duea de la cmara, de
+        /// las transformaciones, de las luces puntuales y del culling, y publica cada paso en un
+        /// snapshot. El render (render(), en el hilo del contexto de OpenGL) dibuja el ltimo snapshot
+        /// publicado, de modo que ninguno de los dos espera al otro:
+        Triple_Buffer< Frame_Snapshot > snapshots;
+        uint64_t                        simulation_step;
+        std::atomic< float >            aspect_ratio;         // Lo fija resize() y lo lee la simulacin
+        std::mutex                      input_mutex;
+        Input                           pending_input;
+        float                           frame_latency;        // Milisegundos desde la simulacin hasta el fin del render
+        uint64_t                        rendered_sequence;
+        uint64_t                        skipped_snapshots;    // Snapshots que el render no ha llegado a dibujar
+
+        /// Transformaciones del ltimo paso simulado, que pasan a ser las anteriores en el siguiente
+        /// (hilo de simulacin):
+        glm::mat4                       last_view_matrix;
+        glm::vec3                       last_camera_position;
+        glm::mat4                       last_mesh_model_matrix;
+        glm::mat4                       last_cube_model_matrix;
+
+        /// Interpolacin entre los dos ltimos pasos en el momento de dibujar (hilo de render). Las
+        /// luces se pasan de la vista simulada a la interpolada:
+        float                           render_alpha;
+        glm::mat4                       render_view_matrix;
+        glm::vec3                       render_camera_position;
+        glm::mat4                       render_cube_model_matrix;
+        Light_Clusters::Light_Set       render_lights;
+
+        /// Cmara (la mueve el hilo de simulacin a partir de la entrada que recibe)
+        Camera camera;
+
         bool      there_is_texture;
 
         /// Postprocesado
@@ -83,15 +342,204 @@ namespace udit
 
     public:
 
-        /// Cmara
-        Camera camera;
-
         Scene (unsigned width, unsigned height);
        ~Scene ();
 
-        void   update       ();
+        /// Avanza la simulacin un paso del reloj (que acaba de consumirlo con step()) y publica su
+        /// snapshot (hilo de simulacin):
+        void   update       (const Frame_Clock & clock);
+
+        /// Dibuja el ltimo snapshot publicado (hilo del contexto de OpenGL):
         void   render       ();
         void   resize       (unsigned width, unsigned height);
+
+        /// Entrega a la simulacin el movimiento del ratn y el estado del teclado (hilo principal):
+        void   post_input   (int mouse_dx, int mouse_dy, const Uint8 * keystate, bool pick, bool place = false);
+
+        void   toggle_clustered_lighting ()
+        {
+            clustered_lighting = !clustered_lighting;
+        }
+
+        void   toggle_occlusion_culling ()
+        {
+            occlusion_culling = !occlusion_culling;
+        }
+
+        void   toggle_horizon_culling ()
+        {
+            horizon_culling = !horizon_culling;
+        }
+
+        void   toggle_hardware_occlusion ()
+        {
+            hardware_occlusion = !hardware_occlusion;
+        }
+
+        void   toggle_deferred_shading ()
+        {
+            deferred_shading = !deferred_shading;
+        }
+
+        void   toggle_terrain_lod ()
+        {
+            use_terrain_lod = !use_terrain_lod;
+        }
+
+        bool   is_terrain_lod () const
+        {
+            return use_terrain_lod;
+        }
+
+        bool   has_terrain () const
+        {
+            return terrain_lod != nullptr;
+        }
+
+        void   toggle_streamed_terrain ()
+        {
+            use_streamed_terrain = !use_streamed_terrain;
+        }
+
+        bool   is_streamed_terrain () const
+        {
+            return use_streamed_terrain && terrain_streamer;
+        }
+
+        /// Recorre el terreno por chunks con la cmara durante un minuto (la simulacin ignora la
+        /// entrada mientras tanto):
+        void   start_flythrough ()
+        {
+            if (terrain_streamer)
+            {
+                use_streamed_terrain = true;
+                flythrough           = true;
+            }
+        }
+
+        bool   is_flythrough_active () const
+        {
+            return flythrough;
+        }
+
+        /// Estadsticas del terreno por chunks (hilo del contexto de OpenGL):
+        const Terrain_Streamer::Statistics * get_terrain_streaming_statistics () const
+        {
+            return terrain_streamer ? &terrain_streamer->get_statistics () : nullptr;
+        }
+
+        /// Memoria de vdeo del terreno (la textura de alturas y la rejilla compartida):
+        size_t get_terrain_video_memory () const
+        {
+            return (terrain_lod ? terrain_lod->get_video_memory () : 0) + (horizon_map ? horizon_map->get_video_memory () : 0);
+        }
+
+        /// Junta la geometra de las mallas al principio de sus bferes (hilo del contexto de OpenGL):
+        void   defragment_geometry ()
+        {
+            geometry_pool.defragment ();
+        }
+
+        Geometry_Pool::Statistics get_geometry_statistics () const
+        {
+            return geometry_pool.get_statistics ();
+        }
+
+        const Light_Clusters::Statistics & get_light_cluster_statistics () const
+        {
+            return light_clusters.get_statistics ();
+        }
+
+        bool   is_deferred_shading () const
+        {
+            return deferred_shading;
+        }
+
+        /// Luces puntuales que se han dibujado en el ltimo frame:
+        size_t get_point_light_count () const
+        {
+            return clustered_lighting ? point_lights.size () : 0;
+        }
+
+        const Streaming_Buffer::Statistics & get_streaming_statistics () const
+        {
+            return stream_buffer.get_statistics ();
+        }
+
+        // Las estadsticas de la simulacin son las del ltimo snapshot dibujado:
+
+        const Frustum_Culler::Statistics & get_culling_statistics () const
+        {
+            return snapshots.get_read_slot ().culling_statistics;
+        }
+
+        const Occlusion_Culler::Statistics & get_occlusion_statistics () const
+        {
+            return snapshots.get_read_slot ().occlusion_statistics;
+        }
+
+        const Horizon_Culler::Statistics & get_horizon_statistics () const
+        {
+            return snapshots.get_read_slot ().horizon_statistics;
+        }
+
+        const Terrain_Lod::Statistics & get_terrain_lod_statistics () const
+        {
+            return snapshots.get_read_slot ().terrain_statistics;
+        }
+
+        float  get_simulation_milliseconds () const
+        {
+            return snapshots.get_read_slot ().simulation_milliseconds;
+        }
+
+        float  get_frame_latency () const
+        {
+            return frame_latency;
+        }
+
+        /// Uso de la arena del ltimo snapshot (el mximo indica cunto necesita un paso):
+        const Frame_Arena::Statistics & get_frame_arena_statistics () const
+        {
+            return snapshots.get_read_slot ().arena.get_statistics ();
+        }
+
+        /// Nombre del ltimo objeto seleccionado con el ratn (vaco si no hay ninguno):
+        const char * get_picked_object () const
+        {
+            return snapshots.get_read_slot ().picked_object.data ();
+        }
+
+        uint64_t get_skipped_snapshots () const
+        {
+            return skipped_snapshots;
+        }
+
+        const Occlusion_Queries::Statistics & get_occlusion_query_statistics () const
+        {
+            return occlusion_queries.get_statistics ();
+        }
+
+        bool   is_hardware_occlusion () const
+        {
+            return hardware_occlusion;
+        }
+
+        bool   is_occlusion_culling () const
+        {
+            return occlusion_culling;
+        }
+
+        /// Solo hay horizonte con el terreno con LOD (el terreno por chunks no tiene cotas):
+        bool   is_horizon_culling () const
+        {
+            return horizon_culling && horizon_culler && !is_streamed_terrain ();
+        }
+
+        float  get_gpu_milliseconds () const
+        {
+            return gpu_milliseconds;
+        }
         //void   load_model   (const std::string& path);
 
     private:
@@ -100,13 +548,45 @@ namespace udit
         void   build_framebuffer();
         void   render_framebuffer();
 
+        void   render_opaque      (const Frame_Snapshot & frame);
+        void   render_transparent (const Frame_Snapshot & frame);
+        void   render_terrain_lod (const Frame_Snapshot & frame);
+        void   render_terrain_chunks (const Frame_Snapshot & frame);
+
+        /// Sube o baja el terreno alrededor de la cmara (hilo de simulacin) y deja las alturas que
+        /// han cambiado para que el render las suba a la textura:
+        void   edit_terrain        (const glm::vec3 & terrain_camera, float amount);
+        void   upload_height_edits ();
+        void   read_gpu_timer     ();
+        void   cull_objects       (const glm::mat4 & view_projection_matrix, const glm::vec3 & camera_position);
+        bool   is_object_visible  (uint32_t object);
+
+        /// Nombre del objeto que queda en el centro de la vista (vaco si no hay ninguno):
+        std::string pick_object () const;
+
+        /// Primer corte de un rayo en espacio de mundo con el terreno (si no se dibuja el de chunks):
+        bool   intersect_terrain (const glm::vec3 & origin, const glm::vec3 & direction, float max_distance, float & distance) const;
+
+        /// Mantiene la cmara por encima del suelo del terreno:
+        void   clamp_camera_to_terrain ();
+
+        /// Coloca la malla sobre el terreno en el punto del centro de la vista:
+        void   place_mesh_on_terrain ();
+
+        unsigned                         variant_key  (const Material & material, bool deferred_geometry) const;
+        const Shader_Variants::Variant & use_material (const Material & material);
+
+        void   create_point_lights ();
+        void   update_view_lights    (const glm::mat4 & view_matrix, Light_Clusters::Light_Set & view_lights) const;
+        void   update_light_clusters (const Light_Clusters::Light_Set & view_lights);
+
         void        show_compilation_error (GLuint  shader_id);
         void        show_linkage_error     (GLuint program_id);
         void        load_mesh              (const std::string& mesh_file_path);
         glm::vec3   random_color           ();
 
-        void   configure_material (GLuint program_id);
-        void   configure_light    (GLuint program_id);
+        void   configure_material (const Shader_Variants::Variant & variant, const Material & material);
+        void   configure_light    (const Shader_Variants::Variant & variant);
 
         GLuint create_texture_2d(const std::string& texture_path);
         std::unique_ptr< Color_Buffer > load_image(const std::string& image_path);
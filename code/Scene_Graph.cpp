@@ -0,0 +1,104 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Scene_Graph.hpp"
+#include "simd-recipes.hpp"
+
+#include <cassert>
+#include <gtc/type_ptr.hpp>
+
+using namespace std;
+
+namespace udit
+{
+
+    Scene_Graph::Scene_Graph()
+    :
+        first_dirty(0)
+    {
+    }
+
+    uint32_t Scene_Graph::add_node (uint32_t parent, const glm::vec3 & translation, const glm::quat & rotation, const glm::vec3 & scale)
+    {
+        uint32_t node = uint32_t(parents.size ());
+
+        // El orden topológico es lo que permite actualizar la jerarquía en una sola pasada:
+
+        assert(parent == NO_PARENT || parent < node);
+
+        translations  .push_back (translation);
+        rotations     .push_back (rotation);
+        scales        .push_back (scale);
+        parents       .push_back (parent);
+        flags         .push_back (0);
+        local_matrices.push_back (glm::mat4(1));
+        world_matrices.push_back (glm::mat4(1));
+
+        mark_dirty (node);
+
+        return node;
+    }
+
+    void Scene_Graph::compose (const glm::vec3 & translation, const glm::quat & rotation, const glm::vec3 & scale, glm::mat4 & matrix)
+    {
+        // T * R * S: las columnas de la rotación escaladas y la traslación en la cuarta columna:
+
+        glm::mat3 rotation_matrix = glm::mat3_cast (rotation);
+
+        matrix[0] = glm::vec4(rotation_matrix[0] * scale.x, 0.f);
+        matrix[1] = glm::vec4(rotation_matrix[1] * scale.y, 0.f);
+        matrix[2] = glm::vec4(rotation_matrix[2] * scale.z, 0.f);
+        matrix[3] = glm::vec4(translation, 1.f);
+    }
+
+    void Scene_Graph::update ()
+    {
+        // Se olvidan los cambios del update() anterior:
+
+        for (auto node : changed_nodes) flags[node] &= ~WORLD_CHANGED;
+
+        changed_nodes.clear ();
+
+        // Como los padres van antes que los hijos, cuando se llega a un nodo su padre ya tiene la
+        // matriz de mundo de este frame y su marca indica si ha cambiado:
+
+        const uint32_t count = uint32_t(parents.size ());
+
+        for (uint32_t node = first_dirty; node < count; ++node)
+        {
+            uint8_t  node_flags = flags  [node];
+            uint32_t parent     = parents[node];
+
+            bool parent_changed = parent != NO_PARENT && (flags[parent] & WORLD_CHANGED);
+
+            if (!(node_flags & LOCAL_DIRTY) && !parent_changed) continue;
+
+            if (node_flags & LOCAL_DIRTY)
+            {
+                compose (translations[node], rotations[node], scales[node], local_matrices[node]);
+            }
+
+            if (parent == NO_PARENT)
+            {
+                world_matrices[node] = local_matrices[node];
+            }
+            else
+            {
+                multiply_matrices
+                (
+                    glm::value_ptr (world_matrices[parent]),
+                    glm::value_ptr (local_matrices[node  ]),
+                    glm::value_ptr (world_matrices[node  ])
+                );
+            }
+
+            flags[node] = WORLD_CHANGED;
+
+            changed_nodes.push_back (node);
+        }
+
+        first_dirty = count;
+    }
+
+}
@@ -0,0 +1,128 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstdint>
+#include <glm.hpp>
+#include <gtc/quaternion.hpp>
+#include <vector>
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Jerarquía de transformaciones plana. En lugar de un árbol de nodos enlazados con punteros
+    ///     que se recorre recursivamente multiplicando matrices en cada visita, los nodos se guardan en
+    ///     arrays paralelos (structure-of-arrays) en orden topológico: el padre de un nodo siempre tiene
+    ///     un índice menor que él. Así basta con una pasada lineal por los arrays para propagar las
+    ///     transformaciones, y solo se recalculan las matrices de los nodos modificados y de sus
+    ///     descendientes.
+    /// </summary>
+    class Scene_Graph
+    {
+    public:
+
+        static const uint32_t NO_PARENT = ~0u;
+
+    private:
+
+        enum : uint8_t
+        {
+            LOCAL_DIRTY   = 1,                      // Ha cambiado la traslación, la rotación o la escala
+            WORLD_CHANGED = 2,                      // Se ha recalculado la matriz de mundo en el último update()
+        };
+
+        // Transformación local de cada nodo:
+
+        std::vector< glm::vec3 > translations;
+        std::vector< glm::quat > rotations;
+        std::vector< glm::vec3 > scales;
+
+        std::vector< uint32_t  > parents;
+        std::vector< uint8_t   > flags;
+
+        std::vector< glm::mat4 > local_matrices;
+        std::vector< glm::mat4 > world_matrices;
+
+        std::vector< uint32_t  > changed_nodes;     // Nodos cuya matriz de mundo cambió en el último update()
+
+        uint32_t first_dirty;                       // Ningún nodo anterior a este tiene que recalcularse
+
+    public:
+
+        Scene_Graph();
+
+    public:
+
+        /// Añade un nodo y retorna su índice. El padre tiene que haberse añadido antes:
+        uint32_t add_node
+        (
+            uint32_t          parent      = NO_PARENT,
+            const glm::vec3 & translation = glm::vec3(0.f),
+            const glm::quat & rotation    = glm::quat(1.f, 0.f, 0.f, 0.f),
+            const glm::vec3 & scale       = glm::vec3(1.f)
+        );
+
+        void set_translation (uint32_t node, const glm::vec3 & translation)
+        {
+            translations[node] = translation;
+            mark_dirty (node);
+        }
+
+        void set_rotation (uint32_t node, const glm::quat & rotation)
+        {
+            rotations[node] = rotation;
+            mark_dirty (node);
+        }
+
+        void set_scale (uint32_t node, const glm::vec3 & scale)
+        {
+            scales[node] = scale;
+            mark_dirty (node);
+        }
+
+        const glm::vec3 & get_translation (uint32_t node) const { return translations[node]; }
+        const glm::quat & get_rotation    (uint32_t node) const { return rotations   [node]; }
+        const glm::vec3 & get_scale       (uint32_t node) const { return scales      [node]; }
+
+        uint32_t get_parent (uint32_t node) const
+        {
+            return parents[node];
+        }
+
+        /// Matriz de mundo calculada en el último update():
+        const glm::mat4 & get_world_matrix (uint32_t node) const
+        {
+            return world_matrices[node];
+        }
+
+        /// Nodos cuya matriz de mundo ha cambiado en el último update() (en orden topológico):
+        const std::vector< uint32_t > & get_changed_nodes () const
+        {
+            return changed_nodes;
+        }
+
+        size_t size () const
+        {
+            return parents.size ();
+        }
+
+        /// Recalcula las matrices de los nodos modificados y de todos sus descendientes:
+        void update ();
+
+    private:
+
+        void mark_dirty (uint32_t node)
+        {
+            flags[node] |= LOCAL_DIRTY;
+
+            if (node < first_dirty) first_dirty = node;
+        }
+
+        static void compose (const glm::vec3 & translation, const glm::quat & rotation, const glm::vec3 & scale, glm::mat4 & matrix);
+
+    };
+
+}
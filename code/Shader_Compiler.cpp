@@ -0,0 +1,251 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Shader_Compiler.hpp"
+
+#include <iostream>
+#include <SDL.h>
+
+using namespace std;
+
+namespace udit
+{
+
+    namespace
+    {
+
+        string shader_info_log (GLuint shader_id)
+        {
+            string info_log;
+            GLint  info_log_length = 0;
+
+            glGetShaderiv (shader_id, GL_INFO_LOG_LENGTH, &info_log_length);
+
+            if (info_log_length > 0)
+            {
+                info_log.resize (info_log_length);
+
+                glGetShaderInfoLog (shader_id, info_log_length, NULL, &info_log.front ());
+            }
+
+            return info_log;
+        }
+
+        string program_info_log (GLuint program_id)
+        {
+            string info_log;
+            GLint  info_log_length = 0;
+
+            glGetProgramiv (program_id, GL_INFO_LOG_LENGTH, &info_log_length);
+
+            if (info_log_length > 0)
+            {
+                info_log.resize (info_log_length);
+
+                glGetProgramInfoLog (program_id, info_log_length, NULL, &info_log.front ());
+            }
+
+            return info_log;
+        }
+
+    }
+
+    Shader_Compiler::Shader_Compiler()
+    {
+        parallel_compile_supported =
+            SDL_GL_ExtensionSupported ("GL_KHR_parallel_shader_compile") ||
+            SDL_GL_ExtensionSupported ("GL_ARB_parallel_shader_compile");
+
+        if (parallel_compile_supported)
+        {
+            auto max_shader_compiler_threads = reinterpret_cast< Max_Shader_Compiler_Threads >
+            (
+                SDL_GL_GetProcAddress ("glMaxShaderCompilerThreadsKHR")
+            );
+
+            if (!max_shader_compiler_threads)
+            {
+                max_shader_compiler_threads = reinterpret_cast< Max_Shader_Compiler_Threads >
+                (
+                    SDL_GL_GetProcAddress ("glMaxShaderCompilerThreadsARB")
+                );
+            }
+
+            // 0xFFFFFFFF deja que el driver use tantos hilos como considere oportuno:
+
+            if (max_shader_compiler_threads)
+            {
+                max_shader_compiler_threads (0xFFFFFFFF);
+            }
+        }
+    }
+
+    Shader_Compiler::~Shader_Compiler()
+    {
+        // Los programas pertenecen a quien los solicitó, pero los shaders de los que siguen
+        // pendientes no se han llegado a liberar:
+
+        for (auto & program : programs)
+        {
+            if (program.status == Status::PENDING)
+            {
+                glDeleteShader (program.vertex_shader_id);
+                glDeleteShader (program.fragment_shader_id);
+            }
+        }
+    }
+
+    GLuint Shader_Compiler::submit (const string & vertex_shader_code, const string & fragment_shader_code)
+    {
+        // Se crean objetos para los shaders y se carga su código:
+
+        GLuint   vertex_shader_id = glCreateShader (GL_VERTEX_SHADER  );
+        GLuint fragment_shader_id = glCreateShader (GL_FRAGMENT_SHADER);
+
+        const char *   vertex_shaders_code[] = {          vertex_shader_code.c_str ()   };
+        const char * fragment_shaders_code[] = {        fragment_shader_code.c_str ()   };
+        const GLint    vertex_shaders_size[] = { GLint(  vertex_shader_code.size  ()) };
+        const GLint  fragment_shaders_size[] = { GLint(fragment_shader_code.size  ()) };
+
+        glShaderSource (  vertex_shader_id, 1,   vertex_shaders_code,   vertex_shaders_size);
+        glShaderSource (fragment_shader_id, 1, fragment_shaders_code, fragment_shaders_size);
+
+        // Se compilan y se linkan sin consultar el resultado para no forzar una sincronización
+        // con el driver. El estado se comprueba más tarde en poll() o en wait():
+
+        glCompileShader (  vertex_shader_id);
+        glCompileShader (fragment_shader_id);
+
+        GLuint program_id = glCreateProgram ();
+
+        glAttachShader (program_id,   vertex_shader_id);
+        glAttachShader (program_id, fragment_shader_id);
+        glLinkProgram  (program_id);
+
+        programs.push_back ({ program_id, vertex_shader_id, fragment_shader_id, Status::PENDING });
+
+        return program_id;
+    }
+
+    Shader_Compiler::Status Shader_Compiler::poll (GLuint program_id)
+    {
+        Program * program = find (program_id);
+
+        if (!program) return Status::FAILED;
+
+        if (program->status == Status::PENDING && is_done (*program))
+        {
+            finish (*program);
+        }
+
+        return program->status;
+    }
+
+    size_t Shader_Compiler::poll_all ()
+    {
+        size_t pending_count = 0;
+
+        for (auto & program : programs)
+        {
+            if (program.status == Status::PENDING)
+            {
+                if (is_done (program))
+                {
+                    finish (program);
+                }
+                else
+                {
+                    ++pending_count;
+                }
+            }
+        }
+
+        return pending_count;
+    }
+
+    Shader_Compiler::Status Shader_Compiler::wait (GLuint program_id)
+    {
+        Program * program = find (program_id);
+
+        if (!program) return Status::FAILED;
+
+        if (program->status == Status::PENDING)
+        {
+            finish (*program);
+        }
+
+        return program->status;
+    }
+
+    Shader_Compiler::Program * Shader_Compiler::find (GLuint program_id)
+    {
+        for (auto & program : programs)
+        {
+            if (program.program_id == program_id) return &program;
+        }
+
+        return nullptr;
+    }
+
+    const Shader_Compiler::Program * Shader_Compiler::find (GLuint program_id) const
+    {
+        for (auto & program : programs)
+        {
+            if (program.program_id == program_id) return &program;
+        }
+
+        return nullptr;
+    }
+
+    bool Shader_Compiler::is_done (const Program & program) const
+    {
+        // Sin soporte de compilación paralela no hay forma de preguntar sin bloquear, por lo que
+        // se da por terminado y la consulta posterior esperará al driver:
+
+        if (!parallel_compile_supported) return true;
+
+        GLint completed = GL_FALSE;
+
+        glGetProgramiv (program.program_id, COMPLETION_STATUS, &completed);
+
+        return completed == GL_TRUE;
+    }
+
+    void Shader_Compiler::finish (Program & program)
+    {
+        // Los errores se escriben en el log en lugar de lanzar una excepción, ya que quien usa el
+        // programa puede seguir con otro (las variantes usan la de respaldo):
+
+        GLint vertex_compiled   = GL_FALSE;
+        GLint fragment_compiled = GL_FALSE;
+        GLint linked            = GL_FALSE;
+
+        glGetShaderiv  (program.vertex_shader_id,   GL_COMPILE_STATUS, &vertex_compiled  );
+        glGetShaderiv  (program.fragment_shader_id, GL_COMPILE_STATUS, &fragment_compiled);
+        glGetProgramiv (program.program_id,         GL_LINK_STATUS,    &linked           );
+
+        if (!vertex_compiled)
+        {
+            cerr << "Error compilando un vertex shader:\n" << shader_info_log (program.vertex_shader_id) << endl;
+        }
+
+        if (!fragment_compiled)
+        {
+            cerr << "Error compilando un fragment shader:\n" << shader_info_log (program.fragment_shader_id) << endl;
+        }
+
+        if (vertex_compiled && fragment_compiled && !linked)
+        {
+            cerr << "Error linkando los shaders:\n" << program_info_log (program.program_id) << endl;
+        }
+
+        // Los shaders ya no hacen falta tanto si se han linkado como si no:
+
+        glDeleteShader (program.vertex_shader_id);
+        glDeleteShader (program.fragment_shader_id);
+
+        program.status = linked ? Status::READY : Status::FAILED;
+    }
+
+}
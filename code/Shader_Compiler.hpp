@@ -0,0 +1,98 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Compila programas de shaders por lotes sin bloquear el hilo que los solicita. Primero se
+    ///     envían al driver todas las compilaciones y linkados y solo después se consulta su estado,
+    ///     de modo que el driver puede repartir el trabajo entre sus hilos. Si el driver soporta
+    ///     GL_KHR_parallel_shader_compile la consulta no bloquea (GL_COMPLETION_STATUS_KHR).
+    /// </summary>
+    class Shader_Compiler
+    {
+    public:
+
+        enum class Status
+        {
+            PENDING,
+            READY,
+            FAILED                                  // El error se ha escrito en el log
+        };
+
+    private:
+
+        struct Program
+        {
+            GLuint program_id;
+            GLuint vertex_shader_id;
+            GLuint fragment_shader_id;
+            Status status;
+        };
+
+        typedef void (APIENTRYP Max_Shader_Compiler_Threads) (GLuint count);
+
+        // Constantes de GL_KHR_parallel_shader_compile (no incluidas en la versión de GLAD usada):
+
+        static const GLenum MAX_SHADER_COMPILER_THREADS = 0x91B0;
+        static const GLenum COMPLETION_STATUS           = 0x91B1;
+
+    private:
+
+        std::vector< Program > programs;
+
+        bool parallel_compile_supported;
+
+    public:
+
+        Shader_Compiler();
+       ~Shader_Compiler();
+
+        Shader_Compiler(const Shader_Compiler & ) = delete;
+
+        Shader_Compiler & operator = (const Shader_Compiler & ) = delete;
+
+    public:
+
+        /// Envía al driver la compilación y el linkado de un programa y retorna su id sin esperar:
+        GLuint submit   (const std::string & vertex_shader_code, const std::string & fragment_shader_code);
+
+        /// Consulta el estado de un programa. No bloquea si hay soporte de compilación paralela:
+        Status poll     (GLuint program_id);
+
+        /// Consulta el estado de todos los programas pendientes y retorna cuántos siguen pendientes:
+        size_t poll_all ();
+
+        /// Espera hasta que el programa indicado haya terminado de compilarse y linkarse:
+        Status wait     (GLuint program_id);
+
+        bool is_ready (GLuint program_id) const
+        {
+            const Program * program = find (program_id);
+
+            return program && program->status == Status::READY;
+        }
+
+        bool supports_parallel_compile () const
+        {
+            return parallel_compile_supported;
+        }
+
+    private:
+
+        Program       * find   (GLuint program_id);
+        const Program * find   (GLuint program_id) const;
+        bool            is_done (const Program & program) const;
+        void            finish  (Program & program);
+
+    };
+
+}
@@ -0,0 +1,127 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Shader_Variants.hpp"
+
+using namespace std;
+
+namespace udit
+{
+
+    Shader_Variants::Shader_Variants
+    (
+        Shader_Compiler & compiler,
+        const string    & common_code,
+        const string    & vertex_shader_code,
+        const string    & fragment_shader_code
+    )
+    :
+        compiler            (compiler            ),
+        common_code         (common_code         ),
+        vertex_shader_code  (vertex_shader_code  ),
+        fragment_shader_code(fragment_shader_code)
+    {
+    }
+
+    Shader_Variants::~Shader_Variants()
+    {
+        for (auto & entry : variants)
+        {
+            glDeleteProgram (entry.second.program_id);
+        }
+    }
+
+    Shader_Variants::Variant & Shader_Variants::acquire (unsigned key)
+    {
+        auto found = variants.find (key);
+
+        if (found != variants.end ()) return found->second;
+
+        // La variante no existe todavía: se envía a compilar y se retorna de inmediato. Hasta que
+        // esté lista sus uniforms no se pueden localizar:
+
+        Variant variant{};
+
+        variant.key        = key;
+        variant.program_id = compiler.submit
+        (
+            build_source (common_code,   vertex_shader_code, key),
+            build_source (common_code, fragment_shader_code, key)
+        );
+
+        variant.model_view_matrix_id  = -1;
+        variant.projection_matrix_id  = -1;
+        variant.normal_matrix_id      = -1;
+        variant.material_color_id     = -1;
+        variant.material_alpha_id     = -1;
+        variant.material_roughness_id = -1;
+
+        return variants.emplace (key, variant).first->second;
+    }
+
+    Shader_Variants::Variant * Shader_Variants::get_ready (unsigned key)
+    {
+        Variant & variant = acquire (key);
+
+        if (!variant.is_ready)
+        {
+            if (compiler.poll (variant.program_id) != Shader_Compiler::Status::READY) return nullptr;
+
+            // Acaba de terminar de compilarse, por lo que se localizan sus uniforms:
+
+            locate_uniforms (variant);
+
+            variant.is_ready = true;
+        }
+
+        return &variant;
+    }
+
+    void Shader_Variants::locate_uniforms (Variant & variant)
+    {
+        variant.model_view_matrix_id  = glGetUniformLocation (variant.program_id, "model_view_matrix");
+        variant.projection_matrix_id  = glGetUniformLocation (variant.program_id, "projection_matrix");
+        variant.normal_matrix_id      = glGetUniformLocation (variant.program_id, "normal_matrix");
+        variant.material_color_id     = glGetUniformLocation (variant.program_id, "material_color");
+        variant.material_alpha_id     = glGetUniformLocation (variant.program_id, "material_alpha");
+        variant.material_roughness_id = glGetUniformLocation (variant.program_id, "material_roughness");
+    }
+
+    string Shader_Variants::build_source (const string & common_code, const string & code, unsigned key)
+    {
+        static const char * feature_names[FEATURE_COUNT] =
+        {
+            "TEXTURED",
+            "VERTEX_COLOR",
+            "PER_PIXEL_LIGHTING",
+            "ALPHA_BLENDED",
+            "CLUSTERED_LIGHTING",
+            "DEFERRED_GEOMETRY",
+            "TERRAIN_LOD",
+        };
+
+        // Los #define deben ir después de la directiva #version, que tiene que ser la primera línea:
+
+        size_t version_end = code.find ('\n', code.find ("#version"));
+
+        if (version_end == string::npos) version_end = 0; else ++version_end;
+
+        string defines;
+
+        for (unsigned feature = 0; feature < FEATURE_COUNT; ++feature)
+        {
+            if (key & (1u << feature))
+            {
+                defines += "#define ";
+                defines += feature_names[feature];
+                defines += '\n';
+            }
+        }
+
+        defines += "#define LIGHT_COUNT " + to_string (key >> LIGHT_COUNT_SHIFT) + '\n';
+
+        return code.substr (0, version_end) + defines + common_code + '\n' + code.substr (version_end);
+    }
+
+}
@@ -0,0 +1,112 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <algorithm>
+#include <glad/glad.h>
+#include <string>
+#include <unordered_map>
+#include "Shader_Compiler.hpp"
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Genera variantes de un mismo programa activando características con #define al compilarlo.
+    ///     Cada variante se identifica por una máscara de bits, se compila la primera vez que se pide
+    ///     (a través de Shader_Compiler, sin bloquear) y se guarda para reutilizarla.
+    /// </summary>
+    class Shader_Variants
+    {
+    public:
+
+        enum Feature : unsigned
+        {
+            TEXTURED           = 1 << 0,
+            VERTEX_COLOR       = 1 << 1,
+            PER_PIXEL_LIGHTING = 1 << 2,
+            ALPHA_BLENDED      = 1 << 3,
+            CLUSTERED_LIGHTING = 1 << 4,            // Luces puntuales repartidas en clusters (Light_Clusters)
+            DEFERRED_GEOMETRY  = 1 << 5,            // Escribe en el G-buffer en lugar de iluminar (Deferred_Renderer)
+            TERRAIN_LOD        = 1 << 6,            // Vértices de una rejilla colocada y desplazada con un mapa de alturas (Terrain_Lod)
+            FEATURE_COUNT      = 7
+        };
+
+        // El número de luces se guarda en los bits que siguen a las características:
+
+        static const unsigned LIGHT_COUNT_SHIFT = FEATURE_COUNT;
+        static const unsigned MAX_LIGHTS        = 15;
+
+        struct Variant
+        {
+            unsigned key;
+            GLuint   program_id;
+            bool     is_ready;
+            bool     is_configured;                 // Lo activa quien configura los uniforms propios
+
+            GLint    model_view_matrix_id;
+            GLint    projection_matrix_id;
+            GLint    normal_matrix_id;
+            GLint    material_color_id;
+            GLint    material_alpha_id;
+            GLint    material_roughness_id;
+        };
+
+    private:
+
+        Shader_Compiler & compiler;
+
+        std::string        common_code;             // Se inserta en ambas etapas tras los #define
+        std::string        vertex_shader_code;
+        std::string      fragment_shader_code;
+
+        std::unordered_map< unsigned, Variant > variants;
+
+    public:
+
+        Shader_Variants
+        (
+            Shader_Compiler   & compiler,
+            const std::string & common_code,
+            const std::string & vertex_shader_code,
+            const std::string & fragment_shader_code
+        );
+
+       ~Shader_Variants();
+
+        Shader_Variants(const Shader_Variants & ) = delete;
+
+        Shader_Variants & operator = (const Shader_Variants & ) = delete;
+
+    public:
+
+        static unsigned make_key (unsigned features, unsigned light_count)
+        {
+            return features | (std::min (light_count, MAX_LIGHTS) << LIGHT_COUNT_SHIFT);
+        }
+
+        /// Retorna la variante indicada, enviándola a compilar si todavía no existe:
+        Variant & acquire  (unsigned key);
+
+        /// Retorna la variante solo si ya está compilada y linkada, o nullptr en caso contrario:
+        Variant * get_ready (unsigned key);
+
+        size_t size () const
+        {
+            return variants.size ();
+        }
+
+        /// Obliga a volver a configurar los uniforms propios de todas las variantes (p. ej. al cambiar la proyección):
+        void reset_configuration ()
+        {
+            for (auto & entry : variants) entry.second.is_configured = false;
+        }
+
+        static void        locate_uniforms (Variant & variant);
+        static std::string build_source    (const std::string & common_code, const std::string & code, unsigned key);
+
+    };
+
+}
@@ -0,0 +1,188 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Streaming_Buffer.hpp"
+
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <SDL.h>
+
+using namespace std;
+
+namespace udit
+{
+
+    Streaming_Buffer::Streaming_Buffer(GLsizeiptr region_size)
+    :
+        region_size  (region_size),
+        mapped_memory(nullptr),
+        fences       {},
+        region       (REGION_COUNT - 1),
+        offset       (0),
+        statistics   {},
+        current      {}
+    {
+        GLsizeiptr buffer_size = region_size * REGION_COUNT;
+
+        glGenBuffers (1, &buffer_id);
+
+        // Se usa GL_COPY_WRITE_BUFFER para no alterar los búferes vinculados a los demás targets:
+
+        glBindBuffer (GL_COPY_WRITE_BUFFER, buffer_id);
+
+        Buffer_Storage buffer_storage = nullptr;
+
+        if (SDL_GL_ExtensionSupported ("GL_ARB_buffer_storage"))
+        {
+            buffer_storage = reinterpret_cast< Buffer_Storage >(SDL_GL_GetProcAddress ("glBufferStorage"));
+        }
+
+        if (buffer_storage)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | MAP_PERSISTENT_BIT | MAP_COHERENT_BIT;
+
+            buffer_storage (GL_COPY_WRITE_BUFFER, buffer_size, nullptr, flags);
+
+            mapped_memory = static_cast< uint8_t * >(glMapBufferRange (GL_COPY_WRITE_BUFFER, 0, buffer_size, flags));
+        }
+
+        if (!mapped_memory)
+        {
+            glBufferData (GL_COPY_WRITE_BUFFER, buffer_size, nullptr, GL_STREAM_DRAW);
+        }
+
+        glBindBuffer (GL_COPY_WRITE_BUFFER, 0);
+
+        statistics.persistent = current.persistent = mapped_memory != nullptr;
+    }
+
+    Streaming_Buffer::~Streaming_Buffer()
+    {
+        for (auto fence : fences)
+        {
+            if (fence) glDeleteSync (fence);
+        }
+
+        if (mapped_memory)
+        {
+            glBindBuffer   (GL_COPY_WRITE_BUFFER, buffer_id);
+            glUnmapBuffer  (GL_COPY_WRITE_BUFFER);
+            glBindBuffer   (GL_COPY_WRITE_BUFFER, 0);
+        }
+
+        glDeleteBuffers (1, &buffer_id);
+    }
+
+    void Streaming_Buffer::begin_frame ()
+    {
+        region = (region + 1) % REGION_COUNT;
+        offset = 0;
+
+        current.bytes_streamed          = 0;
+        current.failed_allocations      = 0;
+        current.fence_wait_milliseconds = 0.f;
+
+        // Normalmente la GPU ya ha pasado la región hace tiempo y la espera no bloquea. Se pide vaciar
+        // la cola de comandos la primera vez para que la fence llegue a la GPU:
+
+        GLsync & fence = fences[region];
+
+        if (fence)
+        {
+            auto start = chrono::high_resolution_clock::now ();
+
+            GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+
+            for (;;)
+            {
+                GLenum result = glClientWaitSync (fence, flags, 1000000);       // 1 ms
+
+                if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED) break;
+
+                flags = 0;
+            }
+
+            current.fence_wait_milliseconds = chrono::duration< float, milli >(chrono::high_resolution_clock::now () - start).count ();
+
+            glDeleteSync (fence);
+
+            fence = nullptr;
+        }
+    }
+
+    void Streaming_Buffer::end_frame ()
+    {
+        assert(!fences[region]);
+
+        fences[region] = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        statistics = current;
+    }
+
+    Streaming_Buffer::Allocation Streaming_Buffer::allocate (GLsizeiptr size, GLsizeiptr alignment)
+    {
+        assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+        GLsizeiptr aligned = (offset + alignment - 1) & ~(alignment - 1);
+
+        if (aligned + size > region_size)
+        {
+            current.failed_allocations++;
+
+            return { nullptr, 0, 0 };
+        }
+
+        offset = aligned + size;
+
+        current.bytes_streamed += size_t(size);
+
+        GLintptr buffer_offset = GLintptr(region) * region_size + aligned;
+
+        if (mapped_memory)
+        {
+            return { mapped_memory + buffer_offset, buffer_offset, size };
+        }
+
+        // Sin mapeo persistente se mapea solo el rango reservado. La región está protegida por su
+        // fence, por lo que no hace falta que el driver se sincronice con la GPU:
+
+        glBindBuffer (GL_COPY_WRITE_BUFFER, buffer_id);
+
+        void * memory = glMapBufferRange
+        (
+            GL_COPY_WRITE_BUFFER,
+            buffer_offset,
+            size,
+            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT
+        );
+
+        glBindBuffer (GL_COPY_WRITE_BUFFER, 0);
+
+        return { memory, buffer_offset, size };
+    }
+
+    void Streaming_Buffer::commit (const Allocation & allocation)
+    {
+        if (mapped_memory || !allocation.memory) return;
+
+        glBindBuffer  (GL_COPY_WRITE_BUFFER, buffer_id);
+        glUnmapBuffer (GL_COPY_WRITE_BUFFER);
+        glBindBuffer  (GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    GLintptr Streaming_Buffer::upload (const void * data, GLsizeiptr size, GLsizeiptr alignment)
+    {
+        Allocation allocation = allocate (size, alignment);
+
+        if (!allocation.memory) return -1;
+
+        memcpy (allocation.memory, data, size_t(size));
+
+        commit (allocation);
+
+        return allocation.offset;
+    }
+
+}
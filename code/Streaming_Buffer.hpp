@@ -0,0 +1,112 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glad/glad.h>
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Búfer para los datos que cambian en cada frame (datos por instancia, uniforms, partículas).
+    ///     En lugar de pedir con glBufferData un búfer nuevo cada vez (lo que obliga al driver a
+    ///     renombrarlo o a esperar a la GPU), se crea uno grande dividido en REGION_COUNT regiones y cada
+    ///     frame escribe en la siguiente. Al terminar el frame se pone una fence tras sus comandos y la
+    ///     región solo se vuelve a escribir cuando la GPU la ha pasado.
+    ///
+    ///     Si el driver soporta GL_ARB_buffer_storage, el búfer se mapea una sola vez de forma
+    ///     persistente y coherente y escribir en él es solo copiar memoria. Si no, cada reserva se mapea
+    ///     con GL_MAP_UNSYNCHRONIZED_BIT (las fences ya garantizan que la GPU no está leyendo ese rango).
+    ///
+    ///     Solo se puede usar desde el hilo del contexto de OpenGL.
+    /// </summary>
+    class Streaming_Buffer
+    {
+    public:
+
+        static const unsigned REGION_COUNT = 3;
+
+        /// Espacio reservado dentro del búfer. memory es nullptr si no cabe en la región del frame:
+        struct Allocation
+        {
+            void     * memory;
+            GLintptr   offset;                      // Desde el principio del búfer (para glVertexAttribPointer, etc.)
+            GLsizeiptr size;
+        };
+
+        struct Statistics
+        {
+            size_t   bytes_streamed;                // En el último frame terminado
+            size_t   failed_allocations;            // Reservas del último frame que no cupieron en su región
+            float    fence_wait_milliseconds;       // Esperando a la GPU al empezar el último frame
+            bool     persistent;                    // Se está usando GL_ARB_buffer_storage
+        };
+
+    private:
+
+        typedef void (APIENTRYP Buffer_Storage) (GLenum target, GLsizeiptr size, const void * data, GLbitfield flags);
+
+        // Constantes de GL_ARB_buffer_storage (no incluidas en la versión de GLAD usada):
+
+        static const GLbitfield MAP_PERSISTENT_BIT = 0x0040;
+        static const GLbitfield MAP_COHERENT_BIT   = 0x0080;
+
+        GLuint     buffer_id;
+        GLsizeiptr region_size;
+        uint8_t  * mapped_memory;                   // Todo el búfer si el mapeo es persistente, si no nullptr
+
+        GLsync     fences[REGION_COUNT];
+        unsigned   region;                          // Región del frame actual
+        GLsizeiptr offset;                          // Siguiente byte libre dentro de la región
+
+        Statistics statistics;
+        Statistics current;                         // Se copian a statistics al terminar el frame
+
+    public:
+
+        explicit Streaming_Buffer(GLsizeiptr region_size);
+       ~Streaming_Buffer();
+
+        Streaming_Buffer(const Streaming_Buffer & ) = delete;
+
+        Streaming_Buffer & operator = (const Streaming_Buffer & ) = delete;
+
+    public:
+
+        /// Pasa a la siguiente región y espera, si hace falta, a que la GPU haya terminado con ella:
+        void begin_frame ();
+
+        /// Pone la fence que protege la región del frame (después del último comando que la lee):
+        void end_frame ();
+
+        /// Reserva espacio en la región del frame. Sin mapeo persistente el rango queda mapeado hasta
+        /// que se llama a commit(), que se debe llamar antes de dibujar con él:
+        Allocation allocate (GLsizeiptr size, GLsizeiptr alignment = 16);
+
+        void commit (const Allocation & allocation);
+
+        /// Copia los datos a la región del frame y retorna su posición en el búfer (o -1 si no caben):
+        GLintptr upload (const void * data, GLsizeiptr size, GLsizeiptr alignment = 16);
+
+        GLuint get_id () const
+        {
+            return buffer_id;
+        }
+
+        GLsizeiptr get_region_size () const
+        {
+            return region_size;
+        }
+
+        const Statistics & get_statistics () const
+        {
+            return statistics;
+        }
+
+    };
+
+}
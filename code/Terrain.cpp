@@ -3,89 +3,347 @@
 // angel.rodriguez@udit.es
 
 #include "Terrain.hpp"
-#include <glm.hpp>
+#include "Job_System.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <emmintrin.h>
 #include <half.hpp>
-#include <vector>
 
 using glm::vec3;
+using std::min;
 using std::vector;
 using half_float::half;
 
 namespace udit
 {
 
-    Terrain::Terrain(float width, float depth, unsigned x_slices, unsigned z_slices)
+    const Geometry_Pool::Vertex_Format Terrain::vertex_format
     {
-        number_of_vertices = x_slices * z_slices;
+        {
+            { 0, 3, GL_FLOAT,      GL_FALSE, offsetof(Vertex, position) },
+            { 1, 4, GL_BYTE,       GL_TRUE,  offsetof(Vertex, normal  ) },
+            { 2, 2, GL_HALF_FLOAT, GL_FALSE, offsetof(Vertex, uv      ) },
+        },
+        sizeof(Vertex)
+    };
 
-        vector< half > coordinates(number_of_vertices * 2);     // Sólo es necesario guardar las coordenadas X y Z
-        vector< half > texture_uvs(number_of_vertices * 2);
+    namespace
+    {
 
-        float x = -width * .5f;
-        float z = -depth * .5f;
-        float u =  0.f;
-        float v =  0.f;
+        uint16_t half_bits (float value)
+        {
+            half     converted(value);
+            uint16_t bits;
 
-        float x_step = width / float(x_slices);
-        float z_step = depth / float(z_slices);
-        float u_step =   1.f / float(x_slices);
-        float v_step =   1.f / float(z_slices);
+            std::memcpy (&bits, &converted, sizeof(bits));
 
-        int   coordinate_index = 0;
+            return bits;
+        }
 
-        for (unsigned j = 0; j < z_slices; ++j, z += z_step, v += v_step)
+        /// Normal de la superficie y = h(x, z) a partir de sus pendientes: (-dh/dx, 1, -dh/dz) normalizada:
+        void pack_normal (float slope_x, float slope_z, int8_t * normal)
         {
-            for (unsigned i = 0; i < x_slices; ++i, coordinate_index += 2, x += x_step, u += u_step)
+            float inverse_length = 1.f / std::sqrt (slope_x * slope_x + slope_z * slope_z + 1.f);
+
+            normal[0] = int8_t(std::lround (-slope_x * inverse_length * 127.f));
+            normal[1] = int8_t(std::lround (          inverse_length * 127.f));
+            normal[2] = int8_t(std::lround (-slope_z * inverse_length * 127.f));
+            normal[3] = 0;
+        }
+
+        /// Normales de una fila de la rejilla por diferencias centrales con las alturas de las filas
+        /// vecinas (above y below pueden ser la misma fila en los bordes). Se calculan de 4 en 4 con
+        /// SSE2 salvo en las columnas de los bordes, donde la diferencia es hacia un solo lado:
+        void compute_row_normals
+        (
+            const float       * above,
+            const float       * row,
+            const float       * below,
+            unsigned            columns,
+            float               step_x,
+            float               distance_z,                 // Distancia entre above y below
+            Terrain::Vertex   * vertices
+        )
+        {
+            float inverse_dz = 1.f / distance_z;
+
+            auto scalar_normal = [&] (unsigned x)
             {
-                coordinates[coordinate_index + 0] = half(x);
-                coordinates[coordinate_index + 1] = half(z);
-                texture_uvs[coordinate_index + 0] = half(u);
-                texture_uvs[coordinate_index + 1] = half(v);
+                unsigned left  = x > 0           ? x - 1 : x;
+                unsigned right = x + 1 < columns ? x + 1 : x;
+
+                float slope_x = (row  [right] - row  [left]) / (float(right - left) * step_x);
+                float slope_z = (below[x    ] - above[x   ]) * inverse_dz;
+
+                pack_normal (slope_x, slope_z, vertices[x].normal);
+            };
+
+            const __m128 scale_x      = _mm_set1_ps (-1.f / (2.f * step_x));
+            const __m128 scale_z      = _mm_set1_ps (-inverse_dz);
+            const __m128 one          = _mm_set1_ps (1.f);
+            const __m128 one_half     = _mm_set1_ps (.5f);
+            const __m128 three_halves = _mm_set1_ps (1.5f);
+            const __m128 byte_scale   = _mm_set1_ps (127.f);
+
+            scalar_normal (0);
+
+            unsigned x = 1;
+
+            for ( ; x + 4 < columns; x += 4)
+            {
+                __m128 nx = _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (row   + x + 1), _mm_loadu_ps (row   + x - 1)), scale_x);
+                __m128 nz = _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (below + x    ), _mm_loadu_ps (above + x    )), scale_z);
+
+                __m128 length2 = _mm_add_ps (_mm_add_ps (_mm_mul_ps (nx, nx), _mm_mul_ps (nz, nz)), one);
+
+                // Raíz inversa aproximada con un paso de Newton-Raphson (error relativo ~1e-7, de sobra
+                // para pasarla a 8 bits):
+
+                __m128 r = _mm_rsqrt_ps (length2);
+                       r = _mm_mul_ps (r, _mm_sub_ps (three_halves, _mm_mul_ps (_mm_mul_ps (one_half, length2), _mm_mul_ps (r, r))));
+
+                __m128 scale = _mm_mul_ps (r, byte_scale);
+
+                __m128i bx = _mm_cvtps_epi32 (_mm_mul_ps (nx, scale));
+                __m128i by = _mm_cvtps_epi32 (scale);
+                __m128i bz = _mm_cvtps_epi32 (_mm_mul_ps (nz, scale));
+
+                // [x0..x3 y0..y3 z0..z3 0000] -> [x0 y0 z0 0 x1 y1 z1 0 ...]:
+
+                __m128i bytes = _mm_packs_epi16 (_mm_packs_epi32 (bx, by), _mm_packs_epi32 (bz, _mm_setzero_si128 ()));
+                __m128i xzyw  = _mm_unpacklo_epi8 (bytes, _mm_srli_si128 (bytes, 8));
+                __m128i xyzw  = _mm_unpacklo_epi8 (xzyw,  _mm_srli_si128 (xzyw,  8));
+
+                alignas(16) int8_t normals[16];
+
+                _mm_store_si128 (reinterpret_cast< __m128i * >(normals), xyzw);
+
+                for (unsigned i = 0; i < 4; ++i)
+                {
+                    std::memcpy (vertices[x + i].normal, normals + i * 4, 4);
+                }
             }
 
-            x += x_step = -x_step;                              // Se invierte el sentido para hacer un zigzag
-            u += u_step = -u_step;
+            for ( ; x < columns; ++x) scalar_normal (x);
         }
 
-        // Se crean el VAO y los VBOs:
+    }
 
-        glGenVertexArrays (1, &vao_id);
-        glGenBuffers (VBO_COUNT, vbo_ids);
+    Terrain::Terrain(Geometry_Pool & geometry_pool, const Height_Map & height_map, const vec3 & size, unsigned x_slices, unsigned z_slices)
+    :
+        geometry_pool(geometry_pool)
+    {
+        Grid grid;
+
+        generate (height_map, size, x_slices, z_slices, grid);
 
-        // Se activa el VAO para configurarlo:
+        // Los tiles comparten los vértices de sus bordes. Todos tienen TILE_QUADS cuadrados por lado
+        // salvo los de la última fila y columna, por lo que solo hay unas pocas formas de índices:
 
-        glBindVertexArray (vao_id);
+        struct Shape
+        {
+            unsigned           x_quads;
+            unsigned           z_quads;
+            vector< uint16_t > indices;
+        };
 
-        // Se suben a un VBO los datos de coordenadas y se vinculan al VAO:
+        vector< Shape  > shapes;
+        vector< Vertex > tile_vertices;
 
-        glBindBuffer (GL_ARRAY_BUFFER, vbo_ids[COORDINATES_VBO]);
-        glBufferData (GL_ARRAY_BUFFER, coordinates.size () * sizeof(half), coordinates.data (), GL_STATIC_DRAW);
+        for (unsigned z0 = 0; z0 < z_slices; z0 += TILE_QUADS)
+        {
+            for (unsigned x0 = 0; x0 < x_slices; x0 += TILE_QUADS)
+            {
+                unsigned x_quads = min (unsigned(TILE_QUADS), x_slices - x0);
+                unsigned z_quads = min (unsigned(TILE_QUADS), z_slices - z0);
 
-        glEnableVertexAttribArray (0);
-        glVertexAttribPointer (0, 2, GL_HALF_FLOAT, GL_FALSE, 0, 0);
+                // Se copian los vértices del tile y se calcula su caja:
 
-        // Se suben a un VBO los datos de coordenadas de textura y se vinculan al VAO:
+                tile_vertices.clear ();
 
-        glBindBuffer (GL_ARRAY_BUFFER, vbo_ids[TEXTURE_UVS_VBO]);
-        glBufferData (GL_ARRAY_BUFFER, texture_uvs.size () * sizeof(half), texture_uvs.data (), GL_STATIC_DRAW);
+                Tile tile;
 
-        glEnableVertexAttribArray (1);
-        glVertexAttribPointer (1, 2, GL_HALF_FLOAT, GL_FALSE, 0, 0);
+                tile.min = vec3( std::numeric_limits< float >::max ());
+                tile.max = vec3(-std::numeric_limits< float >::max ());
+
+                for (unsigned z = z0; z <= z0 + z_quads; ++z)
+                {
+                    const Vertex * row = grid.vertices.data () + size_t(z) * grid.columns + x0;
+
+                    tile_vertices.insert (tile_vertices.end (), row, row + x_quads + 1);
+
+                    for (unsigned x = 0; x <= x_quads; ++x)
+                    {
+                        vec3 position(row[x].position[0], row[x].position[1], row[x].position[2]);
+
+                        tile.min = glm::min (tile.min, position);
+                        tile.max = glm::max (tile.max, position);
+                    }
+                }
+
+                auto shape = std::find_if
+                (
+                    shapes.begin (), shapes.end (),
+                    [&] (const Shape & shape) { return shape.x_quads == x_quads && shape.z_quads == z_quads; }
+                );
+
+                if (shape == shapes.end ())
+                {
+                    shapes.push_back ({ x_quads, z_quads, build_strip_indices (x_quads, z_quads) });
+                    shape = shapes.end () - 1;
+                }
+
+                tile.mesh = geometry_pool.create_mesh
+                (
+                    vertex_format,
+                    tile_vertices.data (),
+                    GLsizei(tile_vertices.size ()),
+                    shape->indices.data (),
+                    GLsizei(shape->indices.size ())
+                );
+
+                tiles.push_back (tile);
+            }
+        }
     }
 
     Terrain::~Terrain()
     {
-        glDeleteVertexArrays (1, &vao_id);
-        glDeleteBuffers      (VBO_COUNT, vbo_ids);
+        for (auto & tile : tiles)
+        {
+            geometry_pool.destroy_mesh (tile.mesh);
+        }
+    }
+
+    void Terrain::generate (const Height_Map & height_map, const vec3 & size, unsigned x_slices, unsigned z_slices, Grid & grid)
+    {
+        assert(x_slices > 0 && z_slices > 0);
+
+        unsigned columns = grid.columns = x_slices + 1;
+        unsigned rows    = grid.rows    = z_slices + 1;
+
+        grid.vertices.resize (size_t(columns) * rows);
+
+        vector< float    > heights(size_t(columns) * rows);
+        vector< uint16_t > u_bits (columns);
+
+        for (unsigned x = 0; x < columns; ++x)
+        {
+            u_bits[x] = half_bits (float(x) / float(x_slices));
+        }
+
+        float step_x = size.x / float(x_slices);
+        float step_z = size.z / float(z_slices);
+
+        Job_System & jobs = Job_System::get_instance ();
+
+        // Primero las alturas de todas las filas, ya que la normal de cada vértice necesita las de las
+        // filas vecinas:
+
+        jobs.parallel_for
+        (
+            rows,
+            [&] (size_t first, size_t last)
+            {
+                for (size_t z = first; z < last; ++z)
+                {
+                    float   v   = float(z) / float(z_slices);
+                    float * row = heights.data () + z * columns;
+
+                    for (unsigned x = 0; x < columns; ++x)
+                    {
+                        row[x] = height_map.sample (float(x) / float(x_slices), v) * size.y;
+                    }
+                }
+            },
+            16
+        );
+
+        // Después los vértices con sus normales:
+
+        jobs.parallel_for
+        (
+            rows,
+            [&] (size_t first, size_t last)
+            {
+                for (size_t z = first; z < last; ++z)
+                {
+                    size_t above = z > 0        ? z - 1 : z;
+                    size_t below = z + 1 < rows ? z + 1 : z;
+
+                    const float * row      = heights.data () + z * columns;
+                    Vertex      * vertices = grid.vertices.data () + z * columns;
+
+                    float    position_z = -size.z * .5f + float(z) * step_z;
+                    uint16_t v          = half_bits (float(z) / float(z_slices));
+
+                    for (unsigned x = 0; x < columns; ++x)
+                    {
+                        Vertex & vertex = vertices[x];
+
+                        vertex.position[0] = -size.x * .5f + float(x) * step_x;
+                        vertex.position[1] = row[x];
+                        vertex.position[2] = position_z;
+                        vertex.uv[0]       = u_bits[x];
+                        vertex.uv[1]       = v;
+                    }
+
+                    compute_row_normals
+                    (
+                        heights.data () + above * columns,
+                        row,
+                        heights.data () + below * columns,
+                        columns,
+                        step_x,
+                        float(below - above) * step_z,
+                        vertices
+                    );
+                }
+            },
+            16
+        );
+    }
+
+    vector< uint16_t > Terrain::build_strip_indices (unsigned x_quads, unsigned z_quads)
+    {
+        assert((x_quads + 1) * (z_quads + 1) <= RESTART_INDEX);
+
+        vector< uint16_t > indices;
+
+        indices.reserve (size_t(z_quads) * (2 * (x_quads + 1) + 1));
+
+        // Cada tira recorre una fila de cuadrados alternando entre la fila de vértices de arriba y la
+        // de abajo, de modo que el primer triángulo ((x, z), (x, z + 1), (x + 1, z)) queda en sentido
+        // antihorario visto desde +Y:
+
+        unsigned columns = x_quads + 1;
+
+        for (unsigned z = 0; z < z_quads; ++z)
+        {
+            if (z > 0) indices.push_back (uint16_t(RESTART_INDEX));
+
+            for (unsigned x = 0; x < columns; ++x)
+            {
+                indices.push_back (uint16_t( z      * columns + x));
+                indices.push_back (uint16_t((z + 1) * columns + x));
+            }
+        }
+
+        return indices;
     }
 
     void Terrain::render ()
     {
-        // Se selecciona el VAO que contiene los datos del objeto y se dibujan sus vértices
-        // conectándolos con líneas:
+        // Cada tile es una sola llamada con todas sus tiras separadas por el índice de reinicio:
 
-        glBindVertexArray (vao_id);
-        glDrawArrays (GL_LINE_STRIP, 0, number_of_vertices);
+        for (auto & tile : tiles)
+        {
+            geometry_pool.draw (tile.mesh, GL_TRIANGLE_STRIP);
+        }
     }
 
 }
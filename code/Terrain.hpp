@@ -5,38 +5,95 @@
 #ifndef GROUND_HEADER
 #define GROUND_HEADER
 
+    #include <cstdint>
+    #include <vector>
     #include <glad/glad.h>
+    #include <glm.hpp>
+    #include "Geometry_Pool.hpp"
+    #include "Height_Map.hpp"
 
     namespace udit
     {
 
+        /// <summary>
+        ///     Malla de elevación generada a partir de un mapa de alturas. La rejilla de vértices se
+        ///     reparte en tiles de TILE_QUADS x TILE_QUADS cuadrados para que cada tile quepa en índices
+        ///     de 16 bits y se pueda descartar por separado con el frustum culling. Cada tile se dibuja
+        ///     con una sola llamada: una tira de triángulos por fila separadas por RESTART_INDEX (hay que
+        ///     activar GL_PRIMITIVE_RESTART con ese índice).
+        ///
+        ///     La generación (alturas, normales y vértices) no usa OpenGL, se reparte por filas entre los
+        ///     hilos del sistema de trabajos y calcula las normales por diferencias centrales con SIMD.
+        /// </summary>
         class Terrain
         {
-        private:
+        public:
 
-            // Índices para indexar el array vbo_ids:
+            static const unsigned TILE_QUADS    = 128;      // 129 x 129 vértices por tile
+            static const uint16_t RESTART_INDEX = 0xFFFF;
 
-            enum
+            struct Vertex
             {
-                COORDINATES_VBO,
-                TEXTURE_UVS_VBO,
-                VBO_COUNT
+                float    position[3];                       // location 0
+                int8_t   normal  [4];                       // location 1, normalizada a [-127, 127] (la cuarta es relleno)
+                uint16_t uv      [2];                       // location 2, half float
             };
 
-        private:
+            /// Vértices de toda la rejilla, por filas de columns vértices:
+            struct Grid
+            {
+                unsigned              columns;
+                unsigned              rows;
+                std::vector< Vertex > vertices;
+            };
+
+            struct Tile
+            {
+                Geometry_Pool::Mesh mesh;
+                glm::vec3           min;                    // Caja en espacio local del terreno
+                glm::vec3           max;
+            };
+
+            static const Geometry_Pool::Vertex_Format vertex_format;
 
-            GLuint  vao_id;
-            GLuint  vbo_ids[VBO_COUNT];
+        private:
 
-            GLsizei number_of_vertices;
+            Geometry_Pool       & geometry_pool;
+            std::vector< Tile >   tiles;
 
         public:
 
-            Terrain(float width, float depth, unsigned x_slices, unsigned z_slices);
+            /// El terreno ocupa size.x x size.z centrado en el origen, con las alturas del mapa escaladas
+            /// a [0, size.y]. x_slices y z_slices son los cuadrados de la rejilla en cada eje:
+            Terrain(Geometry_Pool & geometry_pool, const Height_Map & height_map, const glm::vec3 & size, unsigned x_slices, unsigned z_slices);
            ~Terrain();
 
+            Terrain(const Terrain & ) = delete;
+
+            Terrain & operator = (const Terrain & ) = delete;
+
         public:
 
+            /// Genera los vértices de la rejilla completa (hilos del sistema de trabajos, sin OpenGL):
+            static void generate
+            (
+                const Height_Map & height_map,
+                const glm::vec3  & size,
+                unsigned           x_slices,
+                unsigned           z_slices,
+                Grid             & grid
+            );
+
+            /// Índices de una rejilla de x_quads x z_quads cuadrados: una tira por fila con RESTART_INDEX
+            /// entre ellas. Los índices son relativos al primer vértice de la rejilla:
+            static std::vector< uint16_t > build_strip_indices (unsigned x_quads, unsigned z_quads);
+
+            const std::vector< Tile > & get_tiles () const
+            {
+                return tiles;
+            }
+
+            /// Dibuja todos los tiles (con GL_PRIMITIVE_RESTART activado):
             void render ();
 
         };
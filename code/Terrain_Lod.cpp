@@ -0,0 +1,356 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Terrain_Lod.hpp"
+#include "Frustum_Culler.hpp"
+#include "Terrain.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include <gtc/type_ptr.hpp>
+#include <half.hpp>
+
+using namespace std;
+using half_float::half;
+
+namespace udit
+{
+
+    Terrain_Lod::Terrain_Lod(const Height_Map & height_map, const glm::vec3 & size, float lod_distance, unsigned patch_resolution)
+    :
+        pyramid          (height_map),
+        size             (size),
+        patch_resolution (patch_resolution),
+        height_texture_id(0),
+        height_format    (GL_R16),
+        texture_width    (0),
+        texture_depth    (0),
+        vao_id           (0),
+        vbo_id           (0),
+        ebo_id           (0),
+        index_count      (0)
+    {
+        assert(patch_resolution >= 2 && patch_resolution % 2 == 0);
+
+        // Niveles necesarios para que los nodos del nivel 0 tengan una celda del mapa por cuadrado de
+        // la rejilla (o menos):
+
+        unsigned cells = max (height_map.get_width (), height_map.get_depth ()) - 1;
+
+        level_count = 1;
+
+        while ((patch_resolution << (level_count - 1)) < cells && level_count < MAX_LEVELS) ++level_count;
+
+        // Un nodo del nivel L se elige cuando su padre toca el rango de L, por lo que sus vértices
+        // pueden estar hasta una diagonal del padre más lejos. Para que no empiecen a transformarse
+        // al nivel L + 2 (y abran grietas con sus vecinos), esa diagonal tiene que caber en la parte
+        // del rango de L + 1 anterior a su transición:
+
+        const float morph_start = .7f;
+
+        float leaf_x    = size.x / float(1u << (level_count - 1));
+        float leaf_z    = size.z / float(1u << (level_count - 1));
+        float diagonal  = sqrt (4.f * leaf_x * leaf_x + 4.f * leaf_z * leaf_z + size.y * size.y);
+
+        lod_distance = max (lod_distance, diagonal / morph_start);
+
+        for (unsigned level = 0; level < MAX_LEVELS; ++level)
+        {
+            float previous = level > 0 ? ranges[level - 1] : 0.f;
+
+            ranges      [level] = lod_distance * float(1u << level);
+            morph_ranges[level] = glm::vec2(previous + (ranges[level] - previous) * morph_start, ranges[level]);
+        }
+    }
+
+    Terrain_Lod::~Terrain_Lod()
+    {
+        if (vao_id)
+        {
+            glDeleteVertexArrays (1, &vao_id);
+            glDeleteBuffers      (1, &vbo_id);
+            glDeleteBuffers      (1, &ebo_id);
+            glDeleteTextures     (1, &height_texture_id);
+        }
+    }
+
+    namespace
+    {
+
+        // Alturas de [0, 1] convertidas al formato normalizado de la textura:
+
+        template< typename TYPE >
+        void quantize (const float * heights, size_t count, TYPE * output)
+        {
+            const float scale = float(numeric_limits< TYPE >::max ());
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                output[i] = TYPE(min (max (heights[i], 0.f), 1.f) * scale + .5f);
+            }
+        }
+
+        void upload_texels (GLenum format, GLint x, GLint z, GLsizei width, GLsizei depth, const float * heights, bool allocate)
+        {
+            size_t count = size_t(width) * depth;
+
+            if (format == GL_R8)
+            {
+                vector< uint8_t > texels(count);
+
+                quantize (heights, count, texels.data ());
+
+                glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+
+                if (allocate) glTexImage2D    (GL_TEXTURE_2D, 0, GL_R8, width, depth, 0, GL_RED, GL_UNSIGNED_BYTE, texels.data ());
+                else          glTexSubImage2D (GL_TEXTURE_2D, 0, x, z,  width, depth,    GL_RED, GL_UNSIGNED_BYTE, texels.data ());
+            }
+            else
+            {
+                vector< uint16_t > texels(count);
+
+                quantize (heights, count, texels.data ());
+
+                glPixelStorei (GL_UNPACK_ALIGNMENT, 2);
+
+                if (allocate) glTexImage2D    (GL_TEXTURE_2D, 0, GL_R16, width, depth, 0, GL_RED, GL_UNSIGNED_SHORT, texels.data ());
+                else          glTexSubImage2D (GL_TEXTURE_2D, 0, x, z,   width, depth,    GL_RED, GL_UNSIGNED_SHORT, texels.data ());
+            }
+
+            glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+        }
+
+    }
+
+    void Terrain_Lod::build (const Height_Map & height_map, GLenum internal_format)
+    {
+        assert(internal_format == GL_R16 || internal_format == GL_R8);
+
+        height_format = internal_format;
+        texture_width = height_map.get_width ();
+        texture_depth = height_map.get_depth ();
+
+        // Alturas normalizadas con filtrado bilineal. El shader muestrea en los centros de los texels
+        // para que los bordes del terreno coincidan con los del mapa:
+
+        glGenTextures   (1, &height_texture_id);
+        glBindTexture   (GL_TEXTURE_2D, height_texture_id);
+
+        upload_texels (height_format, 0, 0, GLsizei(texture_width), GLsizei(texture_depth), height_map.get_row (0), true);
+
+        glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,     GL_CLAMP_TO_EDGE);
+        glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,     GL_CLAMP_TO_EDGE);
+        glBindTexture   (GL_TEXTURE_2D, 0);
+
+        // Rejilla compartida: cada vértice guarda su columna y su fila en half float (los enteros
+        // hasta 2048 son exactos, así que el shader distingue los pares de los impares sin errores
+        // de redondeo). Se dibuja con las mismas tiras que los tiles del terreno:
+
+        assert(patch_resolution <= 2048);
+
+        unsigned columns = patch_resolution + 1;
+
+        vector< half > coordinates;
+
+        coordinates.reserve (size_t(columns) * columns * 2);
+
+        for (unsigned z = 0; z < columns; ++z)
+        {
+            for (unsigned x = 0; x < columns; ++x)
+            {
+                coordinates.push_back (half(float(x)));
+                coordinates.push_back (half(float(z)));
+            }
+        }
+
+        vector< uint16_t > indices = Terrain::build_strip_indices (patch_resolution, patch_resolution);
+
+        index_count = GLsizei(indices.size ());
+
+        glGenVertexArrays (1, &vao_id);
+        glGenBuffers      (1, &vbo_id);
+        glGenBuffers      (1, &ebo_id);
+
+        glBindVertexArray (vao_id);
+
+        glBindBuffer (GL_ARRAY_BUFFER, vbo_id);
+        glBufferData (GL_ARRAY_BUFFER, coordinates.size () * sizeof(half), coordinates.data (), GL_STATIC_DRAW);
+
+        glEnableVertexAttribArray (0);
+        glVertexAttribPointer     (0, 2, GL_HALF_FLOAT, GL_FALSE, 0, 0);
+
+        // Los nodos se leen del búfer de streaming en render(), uno por instancia:
+
+        glEnableVertexAttribArray (4);
+        glVertexAttribDivisor     (4, 1);
+
+        glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, ebo_id);
+        glBufferData (GL_ELEMENT_ARRAY_BUFFER, indices.size () * sizeof(uint16_t), indices.data (), GL_STATIC_DRAW);
+
+        glBindVertexArray (0);
+    }
+
+    void Terrain_Lod::upload_heights (const Height_Map::Region & region, const float * heights)
+    {
+        if (!height_texture_id || region.width == 0 || region.depth == 0) return;
+
+        assert(region.x + region.width <= texture_width && region.z + region.depth <= texture_depth);
+
+        glBindTexture (GL_TEXTURE_2D, height_texture_id);
+
+        upload_texels (height_format, GLint(region.x), GLint(region.z), GLsizei(region.width), GLsizei(region.depth), heights, false);
+
+        glBindTexture (GL_TEXTURE_2D, 0);
+    }
+
+    size_t Terrain_Lod::get_video_memory () const
+    {
+        size_t texel_size = height_format == GL_R8 ? 1 : 2;
+        size_t columns    = patch_resolution + 1;
+
+        return size_t(texture_width) * texture_depth * texel_size
+             + columns * columns * 2 * sizeof(half)
+             + size_t(index_count) * sizeof(uint16_t);
+    }
+
+    Terrain_Lod::Statistics Terrain_Lod::select
+    (
+        const glm::vec3      & camera_position,
+        const glm::mat4      & view_projection_matrix,
+        Frame_Vector< Node > & nodes,
+        bool                   continuous_lod
+    ) const
+    {
+        auto start = chrono::high_resolution_clock::now ();
+
+        Statistics statistics{};
+
+        glm::vec4 planes[6];
+
+        Frustum_Culler::extract_planes (view_projection_matrix, planes);
+
+        nodes.clear ();
+
+        select_node (0, 0, 0, camera_position, planes, continuous_lod, nodes, statistics);
+
+        statistics.node_count          = nodes.size ();
+        statistics.triangle_count      = nodes.size () * patch_resolution * patch_resolution * 2;
+        statistics.select_milliseconds = chrono::duration< float, milli >(chrono::high_resolution_clock::now () - start).count ();
+
+        return statistics;
+    }
+
+    void Terrain_Lod::select_node
+    (
+        unsigned                x,
+        unsigned                z,
+        unsigned                depth,
+        const glm::vec3       & camera_position,
+        const glm::vec4         planes[6],
+        bool                    continuous_lod,
+        Frame_Vector< Node >  & nodes,
+        Statistics            & statistics
+    ) const
+    {
+        unsigned level = level_count - 1 - depth;
+
+        // Celdas del mapa que cubre el nodo (redondeando hacia fuera) y su caja en espacio local:
+
+        unsigned cells_x = pyramid.get_width (0);
+        unsigned cells_z = pyramid.get_depth (0);
+
+        unsigned x0 = unsigned((uint64_t(x    ) * cells_x                    ) >> depth);
+        unsigned z0 = unsigned((uint64_t(z    ) * cells_z                    ) >> depth);
+        unsigned x1 = unsigned((uint64_t(x + 1) * cells_x + (1u << depth) - 1) >> depth);
+        unsigned z1 = unsigned((uint64_t(z + 1) * cells_z + (1u << depth) - 1) >> depth);
+
+        Height_Pyramid::Range heights = pyramid.get_range (min (x0, cells_x - 1), min (z0, cells_z - 1), max (x1, x0 + 1), max (z1, z0 + 1));
+
+        float node_size = 1.f / float(1u << depth);
+
+        glm::vec3 box_min((float(x) * node_size - .5f) * size.x, heights.min * size.y, (float(z) * node_size - .5f) * size.z);
+        glm::vec3 box_max(box_min.x + node_size * size.x,        heights.max * size.y, box_min.z + node_size * size.z);
+
+        // Fuera del frustum si queda entera detrás de alguno de los planos:
+
+        for (int p = 0; p < 6; ++p)
+        {
+            glm::vec3 farthest
+            (
+                planes[p].x >= 0.f ? box_max.x : box_min.x,
+                planes[p].y >= 0.f ? box_max.y : box_min.y,
+                planes[p].z >= 0.f ? box_max.z : box_min.z
+            );
+
+            if (glm::dot (glm::vec3(planes[p]), farthest) + planes[p].w < 0.f)
+            {
+                statistics.culled_count++;
+                return;
+            }
+        }
+
+        // Se dibuja entero con su nivel si ya es el más detallado o si ninguna parte llega al rango
+        // del nivel siguiente (sin LOD continuo se baja siempre hasta el nivel 0):
+
+        glm::vec3 nearest = glm::clamp (camera_position, box_min, box_max);
+
+        if (level == 0 || (continuous_lod && glm::distance (nearest, camera_position) > ranges[level - 1]))
+        {
+            nodes.push_back ({ float(x) * node_size, float(z) * node_size, node_size, float(level) });
+            return;
+        }
+
+        // Si no, cada hijo elige su propio nivel. Los que quedan fuera del rango se dibujan con la
+        // rejilla de su tamaño pero totalmente transformada a la del nivel del padre:
+
+        for (unsigned child = 0; child < 4; ++child)
+        {
+            select_node (x * 2 + (child & 1), z * 2 + (child >> 1), depth + 1, camera_position, planes, continuous_lod, nodes, statistics);
+        }
+    }
+
+    void Terrain_Lod::render
+    (
+        GLuint              program_id,
+        const glm::vec3   & camera_position,
+        const Node        * nodes,
+        size_t              node_count,
+        Streaming_Buffer  & stream
+    ) const
+    {
+        if (node_count == 0 || !vao_id) return;
+
+        GLintptr offset = stream.upload (nodes, GLsizeiptr(node_count * sizeof(Node)), 16);
+
+        if (offset < 0) return;
+
+        glUniform1i  (glGetUniformLocation (program_id, "height_texture"  ), GLint(height_texture_unit));
+        glUniform2f  (glGetUniformLocation (program_id, "terrain_size"    ), size.x, size.z);
+        glUniform3fv (glGetUniformLocation (program_id, "terrain_camera"  ), 1, glm::value_ptr (camera_position));
+        glUniform1f  (glGetUniformLocation (program_id, "patch_resolution"), float(patch_resolution));
+        glUniform2fv (glGetUniformLocation (program_id, "morph_ranges"    ), MAX_LEVELS, glm::value_ptr (morph_ranges[0]));
+
+        glActiveTexture (GL_TEXTURE0 + height_texture_unit);
+        glBindTexture   (GL_TEXTURE_2D, height_texture_id);
+        glActiveTexture (GL_TEXTURE0);
+
+        glBindVertexArray     (vao_id);
+        glBindBuffer          (GL_ARRAY_BUFFER, stream.get_id ());
+        glVertexAttribPointer (4, 4, GL_FLOAT, GL_FALSE, sizeof(Node), reinterpret_cast< const void * >(offset));
+
+        // Todos los nodos con una sola llamada (las tiras se separan con el índice de reinicio):
+
+        glDrawElementsInstanced (GL_TRIANGLE_STRIP, index_count, GL_UNSIGNED_SHORT, 0, GLsizei(node_count));
+
+        glBindVertexArray (0);
+    }
+
+}
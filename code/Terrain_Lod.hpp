@@ -0,0 +1,168 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstdint>
+#include <glad/glad.h>
+#include <glm.hpp>
+#include "Frame_Arena.hpp"
+#include "Height_Map.hpp"
+#include "Height_Pyramid.hpp"
+#include "Streaming_Buffer.hpp"
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Nivel de detalle continuo del terreno (CDLOD). El terreno se divide en un quadtree cuyos
+    ///     nodos se acotan en altura con un Height_Pyramid. Cada frame se eligen los nodos que se ven
+    ///     y, de cada uno, el nivel que le corresponde según su distancia a la cámara: un nodo se
+    ///     subdivide mientras alguna parte de él queda dentro del rango del nivel más fino, que es la
+    ///     mitad del suyo. Todos los nodos elegidos se dibujan con la misma rejilla de cuadrados
+    ///     escalada a su tamaño, en una sola llamada con un nodo por instancia, por lo que el número
+    ///     de triángulos depende de los rangos y no del tamaño del terreno.
+    ///
+    ///     Las alturas se leen de una textura en el vertex shader (variante TERRAIN_LOD del shader de
+    ///     la escena). Cerca del final de su rango, los vértices impares de la rejilla se desplazan
+    ///     poco a poco hasta los pares, de modo que al llegar al límite la rejilla coincide con la del
+    ///     nivel siguiente: no hay grietas entre nodos de niveles distintos ni saltos al cambiar.
+    ///
+    ///     La textura (R16 o R8) es lo único que ocupa memoria de vídeo en proporción al terreno: la
+    ///     rejilla guarda solo columnas y filas en half float. Por eso editar el terreno cuesta una
+    ///     subida parcial de la textura y no reconstruir ningún VBO.
+    /// </summary>
+    class Terrain_Lod
+    {
+    public:
+
+        static const unsigned MAX_LEVELS          = 16;     // Tamaño del array morph_ranges del shader
+        static const GLuint   height_texture_unit = 4;      // La 0 es la de los materiales y las 1-3 las de los clusters
+
+        /// Datos de instancia de un nodo elegido (location 4 del vertex shader):
+        struct Node
+        {
+            float x;                                // Esquina del nodo en [0, 1] x [0, 1] sobre el terreno
+            float z;
+            float size;                             // Lado en la misma escala
+            float level;                            // 0 = el más detallado
+        };
+
+        struct Statistics
+        {
+            size_t node_count;                      // Nodos elegidos
+            size_t culled_count;                    // Nodos descartados por el frustum
+            size_t triangle_count;
+            float  select_milliseconds;
+        };
+
+    private:
+
+        Height_Pyramid  pyramid;
+        glm::vec3       size;                       // Ancho, altura máxima y fondo
+        unsigned        patch_resolution;
+        unsigned        level_count;
+        float           ranges      [MAX_LEVELS];   // Distancia hasta la que se usa cada nivel
+        glm::vec2       morph_ranges[MAX_LEVELS];   // Inicio y fin de la transición al nivel siguiente
+
+        GLuint          height_texture_id;
+        GLenum          height_format;              // GL_R16 o GL_R8
+        unsigned        texture_width;
+        unsigned        texture_depth;
+        GLuint          vao_id;
+        GLuint          vbo_id;
+        GLuint          ebo_id;
+        GLsizei         index_count;
+
+    public:
+
+        /// El terreno ocupa size.x x size.z centrado en el origen, con las alturas escaladas a
+        /// [0, size.y]. El nivel 0 llega hasta lod_distance y cada nivel dobla el rango del anterior:
+        Terrain_Lod
+        (
+            const Height_Map & height_map,
+            const glm::vec3  & size,
+            float              lod_distance,
+            unsigned           patch_resolution = 32
+        );
+
+       ~Terrain_Lod();
+
+        Terrain_Lod(const Terrain_Lod & ) = delete;
+
+        Terrain_Lod & operator = (const Terrain_Lod & ) = delete;
+
+    public:
+
+        /// Crea la textura de alturas (a partir del mismo mapa que el constructor) y la rejilla
+        /// compartida (hilo del contexto de OpenGL). El formato puede ser GL_R16 o GL_R8:
+        void build (const Height_Map & height_map, GLenum internal_format = GL_R16);
+
+        /// Ajusta las cotas de altura después de editar region en el mapa (no usa OpenGL):
+        void update_pyramid (const Height_Map & height_map, const Height_Map::Region & region)
+        {
+            pyramid.update (height_map, region);
+        }
+
+        /// Sube a la textura las alturas de region, guardadas por filas de region.width (hilo del
+        /// contexto de OpenGL):
+        void upload_heights (const Height_Map::Region & region, const float * heights);
+
+        /// Elige los nodos que hay que dibujar. La cámara y la matriz están en el espacio local del
+        /// terreno (no usa OpenGL, se llama desde la simulación). Si continuous_lod es false todos
+        /// los nodos visibles usan el nivel 0:
+        Statistics select
+        (
+            const glm::vec3      & camera_position,
+            const glm::mat4      & view_projection_matrix,
+            Frame_Vector< Node > & nodes,
+            bool                   continuous_lod = true
+        ) const;
+
+        /// Dibuja los nodos con el programa activo, que tiene que ser una variante TERRAIN_LOD con sus
+        /// matrices y max_height ya establecidos. Los datos de instancia se escriben en el búfer de streaming:
+        void render
+        (
+            GLuint              program_id,
+            const glm::vec3   & camera_position,
+            const Node        * nodes,
+            size_t              node_count,
+            Streaming_Buffer  & stream
+        ) const;
+
+        const Height_Pyramid & get_pyramid () const
+        {
+            return pyramid;
+        }
+
+        const glm::vec3 & get_size () const
+        {
+            return size;
+        }
+
+        unsigned get_level_count () const
+        {
+            return level_count;
+        }
+
+        /// Bytes de la textura de alturas y de la rejilla compartida:
+        size_t get_video_memory () const;
+
+    private:
+
+        void select_node
+        (
+            unsigned                x,              // Posición del nodo entre los de su profundidad
+            unsigned                z,
+            unsigned                depth,          // 0 = raíz
+            const glm::vec3       & camera_position,
+            const glm::vec4         planes[6],
+            bool                    continuous_lod,
+            Frame_Vector< Node >  & nodes,
+            Statistics            & statistics
+        ) const;
+
+    };
+
+}
@@ -0,0 +1,467 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#include "Terrain_Streamer.hpp"
+#include "Frustum_Culler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <half.hpp>
+
+using namespace std;
+using half_float::half;
+
+namespace udit
+{
+
+    Terrain_Streamer::Terrain_Streamer
+    (
+        Geometry_Pool & geometry_pool,
+        Height_Source   source,
+        float           chunk_size,
+        unsigned        chunk_quads,
+        float           height_scale,
+        float           load_radius,
+        size_t          memory_cap,
+        size_t          upload_budget
+    )
+    :
+        geometry_pool   (geometry_pool),
+        source          (move (source)),
+        chunk_size      (chunk_size),
+        chunk_quads     (chunk_quads),
+        height_scale    (height_scale),
+        load_radius     (load_radius),
+        memory_cap      (memory_cap),
+        upload_budget   (upload_budget),
+        indices         (Terrain::build_strip_indices (chunk_quads, chunk_quads)),
+        frame           (0),
+        generating_count(0),
+        statistics      {}
+    {
+        assert(chunk_size > 0.f && chunk_quads > 0);
+
+        // Como mucho un chunk por hilo entre los que se generan y los que esperan a subir, para que
+        // la cola no crezca sin límite cuando la cámara va más rápido que la generación:
+
+        max_jobs = max (Job_System::get_instance ().get_thread_count (), 2u);
+
+        if (Job_System::get_instance ().get_thread_count () == 1) max_jobs = 1;
+    }
+
+    Terrain_Streamer::~Terrain_Streamer()
+    {
+        wait ();
+
+        for (auto & entry : chunks)
+        {
+            if (entry.second.state == RESIDENT) geometry_pool.destroy_mesh (entry.second.mesh);
+        }
+    }
+
+    Terrain_Streamer::Height_Source Terrain_Streamer::mirrored (shared_ptr< const Height_Map > height_map, float samples_per_unit)
+    {
+        return [height_map, samples_per_unit] (float x0, float z0, float step, Height_Map & heights)
+        {
+            // Coordenada del mapa (de 0 a size - 1) de una posición del mundo, reflejando el mapa en
+            // cada repetición para que no haya saltos entre ellas:
+
+            auto mirror = [samples_per_unit] (float position, unsigned size)
+            {
+                float last   = float(size - 1);
+                float sample = fmod (position * samples_per_unit, 2.f * last);
+
+                if (sample <  0.f ) sample += 2.f * last;
+                if (sample > last ) sample  = 2.f * last - sample;
+
+                return sample / last;
+            };
+
+            for (unsigned z = 0; z < heights.get_depth (); ++z)
+            {
+                float   v   = mirror (z0 + float(z) * step, height_map->get_depth ());
+                float * row = heights.get_row (z);
+
+                for (unsigned x = 0; x < heights.get_width (); ++x)
+                {
+                    row[x] = height_map->sample (mirror (x0 + float(x) * step, height_map->get_width ()), v);
+                }
+            }
+        };
+    }
+
+    Terrain_Streamer::Height_Source Terrain_Streamer::archived (shared_ptr< const Height_Archive > archive, float samples_per_unit)
+    {
+        return [archive, samples_per_unit] (float x0, float z0, float step, Height_Map & heights)
+        {
+            float last_x = float(archive->get_width () - 1);
+            float last_z = float(archive->get_depth () - 1);
+
+            auto to_sample = [samples_per_unit] (float position, float last)
+            {
+                return min (max (position * samples_per_unit, 0.f), last);
+            };
+
+            // Rectángulo de muestras que cubre el chunk, que es lo único que se descomprime:
+
+            float first_u = to_sample (x0, last_x), last_u = to_sample (x0 + float(heights.get_width () - 1) * step, last_x);
+            float first_v = to_sample (z0, last_z), last_v = to_sample (z0 + float(heights.get_depth () - 1) * step, last_z);
+
+            Height_Map::Region region;
+
+            region.x     = unsigned(first_u);
+            region.z     = unsigned(first_v);
+            region.width = min (unsigned(last_u) + 2, archive->get_width ()) - region.x;
+            region.depth = min (unsigned(last_v) + 2, archive->get_depth ()) - region.z;
+
+            vector< float > window(size_t(region.width) * region.depth);
+
+            archive->decode (region, window.data ());
+
+            // Interpolación bilineal dentro del rectángulo:
+
+            for (unsigned z = 0; z < heights.get_depth (); ++z)
+            {
+                float    v     = to_sample (z0 + float(z) * step, last_z) - float(region.z);
+                unsigned row0  = min (unsigned(v), region.depth - 1);
+                unsigned row1  = min (row0 + 1,    region.depth - 1);
+                float    fz    = v - float(row0);
+                float  * row   = heights.get_row (z);
+
+                const float * top    = window.data () + size_t(row0) * region.width;
+                const float * bottom = window.data () + size_t(row1) * region.width;
+
+                for (unsigned x = 0; x < heights.get_width (); ++x)
+                {
+                    float    u       = to_sample (x0 + float(x) * step, last_x) - float(region.x);
+                    unsigned column0 = min (unsigned(u), region.width - 1);
+                    unsigned column1 = min (column0 + 1, region.width - 1);
+                    float    fx      = u - float(column0);
+
+                    float upper = top   [column0] + (top   [column1] - top   [column0]) * fx;
+                    float lower = bottom[column0] + (bottom[column1] - bottom[column0]) * fx;
+
+                    row[x] = upper + (lower - upper) * fz;
+                }
+            }
+        };
+    }
+
+    float Terrain_Streamer::distance_to_chunk (int x, int z, const glm::vec3 & position) const
+    {
+        float min_x = float(x) * chunk_size;
+        float min_z = float(z) * chunk_size;
+
+        float dx = max (max (min_x - position.x, position.x - (min_x + chunk_size)), 0.f);
+        float dz = max (max (min_z - position.z, position.z - (min_z + chunk_size)), 0.f);
+
+        return sqrt (dx * dx + dz * dz);
+    }
+
+    void Terrain_Streamer::stream (const glm::vec3 & camera_position)
+    {
+        auto start = chrono::high_resolution_clock::now ();
+
+        ++frame;
+
+        statistics.uploaded_bytes = 0;
+
+        // Se marcan los chunks que están dentro del radio y se apuntan los que faltan:
+
+        struct Missing
+        {
+            int   x;
+            int   z;
+            float distance;
+        };
+
+        vector< Missing > missing;
+
+        int first_x = int(floor ((camera_position.x - load_radius) / chunk_size));
+        int first_z = int(floor ((camera_position.z - load_radius) / chunk_size));
+        int last_x  = int(floor ((camera_position.x + load_radius) / chunk_size));
+        int last_z  = int(floor ((camera_position.z + load_radius) / chunk_size));
+
+        for (int z = first_z; z <= last_z; ++z)
+        {
+            for (int x = first_x; x <= last_x; ++x)
+            {
+                float distance = distance_to_chunk (x, z, camera_position);
+
+                if (distance > load_radius) continue;
+
+                auto chunk = chunks.find (make_key (x, z));
+
+                if (chunk == chunks.end ())
+                {
+                    missing.push_back ({ x, z, distance });
+                }
+                else
+                {
+                    chunk->second.last_seen = frame;
+
+                    if (chunk->second.state == RESIDENT) lru.splice (lru.begin (), lru, chunk->second.lru);
+                }
+            }
+        }
+
+        // Se generan primero los más cercanos, sin ocupar más hilos de la cuenta:
+
+        sort (missing.begin (), missing.end (), [] (const Missing & a, const Missing & b) { return a.distance < b.distance; });
+
+        for (size_t i = 0; i < missing.size () && generating_count < max_jobs; ++i)
+        {
+            request (missing[i].x, missing[i].z);
+        }
+
+        // Se recogen los chunks generados que caben en el presupuesto (al menos uno, para que un
+        // presupuesto menor que un chunk no pare la carga). Los demás esperan al siguiente frame:
+
+        const size_t index_bytes = indices.size () * sizeof(uint16_t);
+
+        vector< Generated > ready;
+
+        {
+            lock_guard< mutex > lock(generated_mutex);
+
+            size_t bytes = 0, count = 0;
+
+            for ( ; count < generated.size (); ++count)
+            {
+                size_t chunk_bytes = generated[count].vertices.size () * sizeof(Terrain::Vertex) + index_bytes;
+
+                if (count > 0 && bytes + chunk_bytes > upload_budget) break;
+
+                bytes += chunk_bytes;
+            }
+
+            ready.assign (make_move_iterator (generated.begin ()), make_move_iterator (generated.begin () + count));
+
+            generated.erase (generated.begin (), generated.begin () + count);
+
+            statistics.pending_count = generating_count - count;
+        }
+
+        for (auto & chunk : ready)
+        {
+            upload (chunk);
+        }
+
+        evict ();
+
+        statistics.stream_milliseconds = chrono::duration< float, milli >(chrono::high_resolution_clock::now () - start).count ();
+    }
+
+    void Terrain_Streamer::request (int x, int z)
+    {
+        int64_t key   = make_key (x, z);
+        Chunk & chunk = chunks[key];
+
+        chunk.x         = x;
+        chunk.z         = z;
+        chunk.state     = GENERATING;
+        chunk.mesh      = Geometry_Pool::NO_MESH;
+        chunk.bytes     = 0;
+        chunk.last_seen = frame;
+
+        ++generating_count;
+
+        auto job = [this, x, z, key] ()
+        {
+            Generated result;
+
+            result.key = key;
+
+            generate (x, z, result);
+
+            lock_guard< mutex > lock(generated_mutex);
+
+            generated.push_back (move (result));
+        };
+
+        // Generar un chunk cuesta varios milisegundos, así que va a la cola de fondo: si fuese a la
+        // normal, cualquier wait() del hilo de la simulación (un parallel_for) podría quedarse con él y
+        // retrasar el paso. Sin hilos de trabajo (una sola CPU) se genera aquí mismo (con max_jobs = 1,
+        // un chunk por frame):
+
+        Job_System::get_instance ().submit_background (job, &jobs);
+    }
+
+    void Terrain_Streamer::upload (Generated & result)
+    {
+        Chunk & chunk = chunks[result.key];
+
+        --generating_count;
+        ++statistics.generated_total;
+
+        // Aunque la cámara se haya alejado mientras se generaba se sube, pero en la lista se coloca
+        // según el último frame en que estuvo dentro del radio y no al principio: si no cabe, evict()
+        // lo descartará antes que cualquier chunk visto después:
+
+        chunk.mesh = geometry_pool.create_mesh
+        (
+            Terrain::vertex_format,
+            result.vertices.data (),
+            GLsizei(result.vertices.size ()),
+            indices.data (),
+            GLsizei(indices.size ())
+        );
+
+        chunk.state = RESIDENT;
+        chunk.min   = result.min;
+        chunk.max   = result.max;
+        chunk.bytes = result.vertices.size () * sizeof(Terrain::Vertex) + indices.size () * sizeof(uint16_t);
+        chunk.lru   = lru.insert (lru_position (chunk.last_seen), result.key);
+
+        statistics.resident_count++;
+        statistics.resident_bytes += chunk.bytes;
+        statistics.uploaded_bytes += chunk.bytes;
+    }
+
+    list< int64_t >::iterator Terrain_Streamer::lru_position (uint64_t last_seen)
+    {
+        // La lista está ordenada de más a menos reciente, así que se busca desde el final (lo
+        // habitual es que un chunk que ya no se ve vaya cerca de allí):
+
+        if (last_seen == frame) return lru.begin ();
+
+        auto position = lru.end ();
+
+        while (position != lru.begin () && chunks.find (*prev (position))->second.last_seen < last_seen)
+        {
+            --position;
+        }
+
+        return position;
+    }
+
+    void Terrain_Streamer::evict ()
+    {
+        // Se descartan desde el final de la lista (los que hace más tiempo que no se ven) hasta bajar
+        // del límite. Los que están dentro del radio no se descartan aunque no quepan todos:
+
+        while (statistics.resident_bytes > memory_cap && !lru.empty ())
+        {
+            auto chunk = chunks.find (lru.back ());
+
+            if (chunk->second.last_seen == frame) break;
+
+            geometry_pool.destroy_mesh (chunk->second.mesh);
+
+            statistics.resident_count--;
+            statistics.resident_bytes -= chunk->second.bytes;
+            statistics.evicted_total++;
+
+            lru.pop_back ();
+            chunks.erase (chunk);
+        }
+    }
+
+    void Terrain_Streamer::generate (int x, int z, Generated & result) const
+    {
+        // Se generan las alturas con una fila y una columna más por cada lado para que las normales
+        // de los bordes usen diferencias centrales y coincidan con las de los chunks vecinos:
+
+        unsigned samples  = chunk_quads + 3;
+        float    step     = chunk_size / float(chunk_quads);
+        float    extended = chunk_size + 2.f * step;
+
+        Height_Map heights(samples, samples);
+
+        source (float(x) * chunk_size - step, float(z) * chunk_size - step, step, heights);
+
+        Terrain::Grid grid;
+
+        Terrain::generate (heights, glm::vec3(extended, height_scale, extended), chunk_quads + 2, chunk_quads + 2, grid);
+
+        // Se quita el borde y se lleva cada vértice a su sitio en el mundo (el centro del chunk):
+
+        unsigned  columns = chunk_quads + 1;
+        glm::vec2 center((float(x) + .5f) * chunk_size, (float(z) + .5f) * chunk_size);
+
+        vector< uint16_t > uv_bits(columns);
+
+        for (unsigned i = 0; i < columns; ++i)
+        {
+            half uv(float(i) / float(chunk_quads));
+
+            memcpy (&uv_bits[i], &uv, sizeof(uint16_t));
+        }
+
+        result.vertices.resize (size_t(columns) * columns);
+        result.min = glm::vec3( numeric_limits< float >::max ());
+        result.max = glm::vec3(-numeric_limits< float >::max ());
+
+        for (unsigned row = 0; row < columns; ++row)
+        {
+            const Terrain::Vertex * source_row = grid.vertices.data () + size_t(row + 1) * grid.columns + 1;
+                  Terrain::Vertex * target_row = result.vertices.data () + size_t(row) * columns;
+
+            for (unsigned column = 0; column < columns; ++column)
+            {
+                Terrain::Vertex & vertex = target_row[column] = source_row[column];
+
+                vertex.position[0] += center.x;
+                vertex.position[2] += center.y;
+                vertex.uv[0]        = uv_bits[column];
+                vertex.uv[1]        = uv_bits[row];
+
+                glm::vec3 position(vertex.position[0], vertex.position[1], vertex.position[2]);
+
+                result.min = glm::min (result.min, position);
+                result.max = glm::max (result.max, position);
+            }
+        }
+    }
+
+    size_t Terrain_Streamer::render (const glm::mat4 & view_projection_matrix) const
+    {
+        glm::vec4 planes[6];
+
+        Frustum_Culler::extract_planes (view_projection_matrix, planes);
+
+        size_t drawn = 0;
+
+        for (auto & entry : chunks)
+        {
+            const Chunk & chunk = entry.second;
+
+            if (chunk.state != RESIDENT) continue;
+
+            // Fuera del frustum si el vértice de la caja más adelantado queda detrás de algún plano:
+
+            bool visible = true;
+
+            for (int p = 0; p < 6 && visible; ++p)
+            {
+                glm::vec3 farthest
+                (
+                    planes[p].x >= 0.f ? chunk.max.x : chunk.min.x,
+                    planes[p].y >= 0.f ? chunk.max.y : chunk.min.y,
+                    planes[p].z >= 0.f ? chunk.max.z : chunk.min.z
+                );
+
+                visible = glm::dot (glm::vec3(planes[p]), farthest) + planes[p].w >= 0.f;
+            }
+
+            if (visible)
+            {
+                geometry_pool.draw (chunk.mesh, GL_TRIANGLE_STRIP);
+                drawn++;
+            }
+        }
+
+        return drawn;
+    }
+
+    void Terrain_Streamer::wait ()
+    {
+        Job_System::get_instance ().wait (jobs);
+    }
+
+}
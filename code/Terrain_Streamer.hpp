@@ -0,0 +1,180 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <glad/glad.h>
+#include <glm.hpp>
+#include "Geometry_Pool.hpp"
+#include "Height_Archive.hpp"
+#include "Height_Map.hpp"
+#include "Job_System.hpp"
+#include "Terrain.hpp"
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Terreno sin límites dividido en chunks cuadrados del mismo tamaño que se generan cuando la
+    ///     cámara se acerca. Cada chunk se genera en un trabajo del sistema de trabajos (alturas de la
+    ///     fuente y vértices con Terrain::generate) y el hilo de OpenGL solo copia a la GPU los que
+    ///     han terminado, sin pasar de un presupuesto de bytes por frame, por lo que cruzar el borde de
+    ///     un chunk no para el frame esperando a que se genere.
+    ///
+    ///     Los chunks que quedan fuera del radio de carga se conservan mientras la memoria de todos
+    ///     no pase del límite. Al pasarlo se descartan primero los que hace más tiempo que no están
+    ///     dentro del radio (LRU), que son también los que han quedado más lejos del camino recorrido.
+    /// </summary>
+    class Terrain_Streamer
+    {
+    public:
+
+        /// Rellena heights con las alturas normalizadas a [0, 1] de los puntos (x0 + x * step, z0 + z * step)
+        /// del mundo. Se llama desde los hilos del sistema de trabajos, varias veces a la vez:
+        typedef std::function< void (float x0, float z0, float step, Height_Map & heights) > Height_Source;
+
+        struct Statistics
+        {
+            size_t resident_count;                  // Chunks en la GPU
+            size_t pending_count;                   // Chunks generándose o esperando a subir
+            size_t resident_bytes;                  // Vértices e índices de los chunks en la GPU
+            size_t uploaded_bytes;                  // Subidos en el último frame
+            size_t generated_total;
+            size_t evicted_total;
+            float  stream_milliseconds;             // Tiempo de stream() en el último frame
+        };
+
+    private:
+
+        enum State
+        {
+            GENERATING,
+            RESIDENT
+        };
+
+        struct Chunk
+        {
+            int                              x;
+            int                              z;
+            State                            state;
+            Geometry_Pool::Mesh              mesh;
+            glm::vec3                        min;       // Caja en espacio de mundo
+            glm::vec3                        max;
+            size_t                           bytes;
+            uint64_t                         last_seen; // Último frame en el que estaba dentro del radio
+            std::list< int64_t >::iterator   lru;       // Posición en lru (solo los que están en la GPU)
+        };
+
+        /// Resultado de un trabajo de generación, a la espera de que lo suba el hilo de OpenGL:
+        struct Generated
+        {
+            int64_t                         key;
+            std::vector< Terrain::Vertex >  vertices;
+            glm::vec3                       min;
+            glm::vec3                       max;
+        };
+
+        Geometry_Pool                     & geometry_pool;
+        Height_Source                       source;
+
+        float                               chunk_size;         // Lado de un chunk en unidades del mundo
+        unsigned                            chunk_quads;        // Cuadrados por lado de un chunk
+        float                               height_scale;
+        float                               load_radius;
+        size_t                              memory_cap;
+        size_t                              upload_budget;      // Bytes por frame
+
+        std::vector< uint16_t >             indices;            // Los mismos para todos los chunks
+
+        std::unordered_map< int64_t, Chunk > chunks;
+        std::list< int64_t >                lru;                // El más reciente al principio
+        uint64_t                            frame;
+
+        std::mutex                          generated_mutex;
+        std::vector< Generated >            generated;
+        Job_System::Counter                 jobs;
+        unsigned                            max_jobs;           // Chunks generándose a la vez como mucho
+        unsigned                            generating_count;
+
+        Statistics                          statistics;
+
+    public:
+
+        /// Los chunks miden chunk_size x chunk_size con chunk_quads x chunk_quads cuadrados y alturas de
+        /// [0, height_scale]. Se piden los que quedan a menos de load_radius de la cámara:
+        Terrain_Streamer
+        (
+            Geometry_Pool & geometry_pool,
+            Height_Source   source,
+            float           chunk_size,
+            unsigned        chunk_quads,
+            float           height_scale,
+            float           load_radius,
+            size_t          memory_cap    = 64 * 1024 * 1024,
+            size_t          upload_budget = 512 * 1024
+        );
+
+       ~Terrain_Streamer();
+
+        Terrain_Streamer(const Terrain_Streamer & ) = delete;
+
+        Terrain_Streamer & operator = (const Terrain_Streamer & ) = delete;
+
+    public:
+
+        /// Fuente que repite un mapa de alturas como un espejo en ambos ejes, con samples_per_unit
+        /// muestras del mapa por unidad del mundo:
+        static Height_Source mirrored (std::shared_ptr< const Height_Map > height_map, float samples_per_unit);
+
+        /// Fuente que lee un mapa comprimido descomprimiendo solo los tiles que toca cada chunk, con
+        /// samples_per_unit muestras por unidad del mundo y el origen del mundo en la muestra (0, 0).
+        /// Fuera del mapa se repite el borde:
+        static Height_Source archived (std::shared_ptr< const Height_Archive > archive, float samples_per_unit);
+
+        /// Pide los chunks que faltan alrededor de la cámara, sube los que se han generado y descarta
+        /// los que sobran (hilo del contexto de OpenGL, una vez por frame):
+        void stream (const glm::vec3 & camera_position);
+
+        /// Dibuja los chunks que están en la GPU y dentro del frustum (con el programa y las matrices
+        /// ya establecidos y GL_PRIMITIVE_RESTART activado). Retorna cuántos ha dibujado:
+        size_t render (const glm::mat4 & view_projection_matrix) const;
+
+        /// Espera a que terminen los trabajos en curso (sin subir sus resultados):
+        void wait ();
+
+        const Statistics & get_statistics () const
+        {
+            return statistics;
+        }
+
+    private:
+
+        static int64_t make_key (int x, int z)
+        {
+            return int64_t(uint64_t(uint32_t(x)) << 32 | uint32_t(z));
+        }
+
+        /// Distancia en el plano XZ desde el punto hasta el chunk (0 si está dentro):
+        float distance_to_chunk (int x, int z, const glm::vec3 & position) const;
+
+        void  request (int x, int z);
+        void  upload  (Generated & chunk);
+        void  evict   ();
+
+        /// Posición de lru en la que va un chunk visto por última vez en el frame last_seen:
+        std::list< int64_t >::iterator lru_position (uint64_t last_seen);
+
+        /// Genera los vértices de un chunk en espacio de mundo (hilos del sistema de trabajos):
+        void  generate (int x, int z, Generated & chunk) const;
+
+    };
+
+}
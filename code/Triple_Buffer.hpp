@@ -0,0 +1,82 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <atomic>
+
+namespace udit
+{
+
+    /// <summary>
+    ///     Triple buffer entre un hilo productor y un hilo consumidor sin cerrojos. El productor escribe
+    ///     siempre en su propio slot y al publicarlo lo intercambia con el slot compartido; el consumidor
+    ///     intercambia el suyo con el compartido solo si hay uno nuevo. Ninguno espera nunca al otro: si
+    ///     el productor va más rápido, el consumidor se salta los slots intermedios y toma el último, y
+    ///     si va más lento, el consumidor vuelve a usar el que ya tenía.
+    ///
+    ///     Al publicar, el productor recibe un slot que contiene datos antiguos, por lo que tiene que
+    ///     escribirlo entero cada vez.
+    /// </summary>
+    template< class T >
+    class Triple_Buffer
+    {
+
+        static const unsigned INDEX_MASK = 3;
+        static const unsigned FRESH      = 4;       // El slot compartido no lo ha tomado todavía el consumidor
+
+        T slots[3];
+
+        std::atomic< unsigned > shared_index;       // Índice del slot compartido | FRESH
+        unsigned                 write_index;       // Solo lo usa el productor
+        unsigned                  read_index;       // Solo lo usa el consumidor
+
+    public:
+
+        Triple_Buffer()
+        :
+            shared_index(1),
+            write_index (0),
+            read_index  (2)
+        {
+        }
+
+        Triple_Buffer(const Triple_Buffer & ) = delete;
+
+        Triple_Buffer & operator = (const Triple_Buffer & ) = delete;
+
+    public:
+
+        /// Slot que está rellenando el productor:
+        T & get_write_slot ()
+        {
+            return slots[write_index];
+        }
+
+        /// Hace visible al consumidor el slot de escritura y toma otro para el siguiente frame:
+        void publish ()
+        {
+            write_index = shared_index.exchange (write_index | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+        }
+
+        /// Toma el último slot publicado si hay uno nuevo. Retorna false si no lo hay, en cuyo caso
+        /// el slot de lectura sigue siendo el anterior:
+        bool acquire ()
+        {
+            if (!(shared_index.load (std::memory_order_relaxed) & FRESH)) return false;
+
+            read_index = shared_index.exchange (read_index, std::memory_order_acq_rel) & INDEX_MASK;
+
+            return true;
+        }
+
+        /// Slot que está usando el consumidor:
+        const T & get_read_slot () const
+        {
+            return slots[read_index];
+        }
+
+    };
+
+}
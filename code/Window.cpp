@@ -85,4 +85,9 @@ namespace udit
         SDL_GL_SwapWindow (window_handle);
     }
 
+    void Window::set_title (const std::string & title)
+    {
+        SDL_SetWindowTitle (window_handle, title.c_str ());
+    }
+
 }
@@ -86,6 +86,8 @@ namespace udit
 
         void swap_buffers ();
 
+        void set_title (const std::string & title);
+
     };
 
 }
@@ -2,14 +2,36 @@
 // Este código es de dominio público
 // angel.rodriguez@udit.es
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Allocation_Counter.hpp"
+#include "Benchmark.hpp"
+#include "Frame_Clock.hpp"
+#include "Job_System.hpp"
 #include "Scene.hpp"
 #include "Window.hpp"
 
+using udit::Allocation_Counter;
+using udit::Frame_Clock;
+using udit::Job_System;
 using udit::Scene;
 using udit::Window;
 
-int main(int, char* [])
+int main(int argc, char* argv[])
 {
+    // Las pruebas de rendimiento de la CPU se ejecutan sin abrir la ventana:
+    if (argc > 1 && std::string(argv[1]) == "--benchmark")
+    {
+        return udit::run_benchmarks(argc > 2 ? argv[2] : "");
+    }
+
     constexpr unsigned viewport_width = 1024;
     constexpr unsigned viewport_height = 576;
 
@@ -23,21 +45,63 @@ int main(int, char* [])
         { 3, 3 }
     );
 
+    // Los hilos del sistema de trabajos se crean desde el hilo principal, que es el que tiene el contexto:
+    Job_System & jobs = Job_System::get_instance();
+
     Scene scene(viewport_width, viewport_height);
 
-    bool exit = false;
+    std::atomic< bool > exit(false);
     int  mouse_x = 0;
     int  mouse_y = 0;
     bool button_down = false;
+    unsigned frame_count = 0;
+
+    // Tiempos de los frames dibujados (el reloj guarda los últimos) y de los del recorrido fijo de la cámara:
+    Frame_Clock          frame_clock;
+    std::vector< float > flythrough_frames;
+    std::vector< float > flythrough_steps;     // Duración del paso de la simulación que se dibuja en cada frame
+
+    frame_clock.tick();
+
+    // Reservas de memoria dinámica de todos los hilos durante los frames (sin contar las del título):
+    size_t allocation_mark   = Allocation_Counter::get_allocation_count();
+    size_t frame_allocations = 0;
 
     bool camera_active = true;  // Modo FPS activado al inicio
     SDL_SetRelativeMouseMode(SDL_TRUE);
 
+    // La simulación avanza en su propio hilo a pasos fijos y publica cada paso en un snapshot que el
+    // render (este hilo, que tiene el contexto de OpenGL) dibuja cuando puede, interpolando entre los
+    // dos últimos pasos:
+    std::thread simulation_thread([&scene, &exit] ()
+    {
+        // Se simulan los pasos de 1/60 s que caben en el tiempo real que ha pasado (si se ha quedado
+        // atrás, varios seguidos) y se duerme hasta que se acumula el siguiente:
+        Frame_Clock clock(1.0 / 60.0);
+
+        while (!exit)
+        {
+            clock.tick();
+
+            while (clock.step())
+            {
+                scene.update(clock);
+            }
+
+            std::this_thread::sleep_for(std::chrono::duration< double >(clock.get_seconds_to_next_step()));
+        }
+    });
+
     do
     {
         // Se procesan los eventos acumulados:
 
         SDL_Event event;
+        bool      pick  = false;
+        bool      place = false;
+
+        mouse_x = 0;
+        mouse_y = 0;
 
         while (SDL_PollEvent(&event) > 0)
         {
@@ -49,9 +113,25 @@ int main(int, char* [])
 
                 if (camera_active) 
                 {
-                    mouse_x = event.motion.xrel;
-                    mouse_y = event.motion.yrel;
-                    scene.camera.process_mouse(mouse_x, mouse_y);
+                    mouse_x += event.motion.xrel;
+                    mouse_y += event.motion.yrel;
+                }
+
+                break;
+            }
+
+            case SDL_MOUSEBUTTONDOWN:
+            {
+                // Con el botón izquierdo se selecciona el objeto que queda en el centro de la vista:
+                if (event.button.button == SDL_BUTTON_LEFT)
+                {
+                    pick = true;
+                }
+
+                // Con el derecho se coloca la malla sobre el terreno en ese mismo punto:
+                if (event.button.button == SDL_BUTTON_RIGHT)
+                {
+                    place = true;
                 }
 
                 break;
@@ -65,6 +145,42 @@ int main(int, char* [])
                     SDL_SetRelativeMouseMode(camera_active ? SDL_TRUE : SDL_FALSE);
                     break;
 
+                case SDLK_l:
+                    scene.toggle_clustered_lighting(); // Activar/desactivar las luces puntuales
+                    break;
+
+                case SDLK_o:
+                    scene.toggle_occlusion_culling();  // Activar/desactivar el occlusion culling por software
+                    break;
+
+                case SDLK_h:
+                    scene.toggle_horizon_culling();    // Activar/desactivar el culling con el horizonte del terreno
+                    break;
+
+                case SDLK_q:
+                    scene.toggle_hardware_occlusion(); // Activar/desactivar las occlusion queries de la GPU
+                    break;
+
+                case SDLK_g:
+                    scene.toggle_deferred_shading();   // Alternar entre forward y deferred (G-buffer)
+                    break;
+
+                case SDLK_f:
+                    scene.defragment_geometry();       // Juntar la geometría al principio de sus búferes
+                    break;
+
+                case SDLK_t:
+                    scene.toggle_terrain_lod();        // Alternar entre el LOD continuo y el terreno entero con el máximo detalle
+                    break;
+
+                case SDLK_c:
+                    scene.toggle_streamed_terrain();   // Alternar entre el terreno con LOD y el terreno sin límites por chunks
+                    break;
+
+                case SDLK_p:
+                    scene.start_flythrough();          // Recorrer el terreno por chunks y medir los tiempos de frame
+                    break;
+
                 //case SDLK_w || SDLK_a || SDLK_s || SDLK_d:
                 //    scene.camera.process_keyboard(keystate, delta_time);
                 //    // puedes añadir más cases para otras teclas
@@ -80,23 +196,179 @@ int main(int, char* [])
             }
         }
 
-        // Leer el estado actual del teclado
+        // Leer el estado actual del teclado y se entrega a la simulación junto con el ratón:
         const Uint8* keystate = SDL_GetKeyboardState(NULL);
-        // Tiempo fijo entre frames (ajusta según tu temporizador real si tienes)
-        float delta_time = 1.0f / 60.0f;
 
-        scene.camera.process_keyboard(keystate, delta_time);
+        scene.post_input(mouse_x, mouse_y, keystate, pick, place);
 
-        // Se actualiza la escena:
-        scene.update();
+        // Se ejecutan los trabajos que otros hilos han dejado para el contexto de OpenGL:
+        jobs.run_main_thread_jobs();
 
-        // Se redibuja la escena:
+        // Se redibuja la escena con el último paso de la simulación:
         scene.render();
 
         // Se actualiza el contenido de la ventana:
         window.swap_buffers();
+
+        // Al terminar el recorrido se muestran los percentiles de los tiempos de frame y de los pasos de
+        // la simulación, que tienen que mantenerse aunque la cámara cruce los bordes de los chunks:
+        float frame_milliseconds = frame_clock.tick() * 1000.f;
+
+        frame_allocations += Allocation_Counter::get_allocation_count() - allocation_mark;
+
+        if (scene.is_flythrough_active())
+        {
+            flythrough_frames.push_back(frame_milliseconds);
+            flythrough_steps .push_back(scene.get_simulation_milliseconds());
+        }
+        else if (!flythrough_frames.empty())
+        {
+            std::sort(flythrough_frames.begin(), flythrough_frames.end());
+            std::sort(flythrough_steps .begin(), flythrough_steps .end());
+
+            auto percentile = [] (const std::vector< float > & times, float p)
+            {
+                return times[std::min(size_t(p * times.size()), times.size() - 1)];
+            };
+
+            auto streaming = scene.get_terrain_streaming_statistics();
+
+            std::cout << "Flythrough: " << flythrough_frames.size() << " frames, p50 " << std::fixed << std::setprecision(2)
+                      << percentile(flythrough_frames, .5f) << " ms, p95 " << percentile(flythrough_frames, .95f) << " ms, p99 "
+                      << percentile(flythrough_frames, .99f) << " ms, max " << flythrough_frames.back() << " ms - simulation p50 "
+                      << percentile(flythrough_steps, .5f) << " ms, p99 " << percentile(flythrough_steps, .99f) << " ms, max "
+                      << flythrough_steps.back() << " ms - " << streaming->generated_total << " chunks generated, "
+                      << streaming->evicted_total << " evicted" << std::endl;
+
+            flythrough_frames.clear();
+            flythrough_steps .clear();
+        }
+
+        // Se muestra en el título el coste en GPU del camino activo para poder compararlos:
+        if (++frame_count % 30 == 0)
+        {
+            size_t light_count = scene.get_point_light_count();
+            float  gpu_time    = scene.get_gpu_milliseconds();
+
+            std::ostringstream title;
+
+            title << "OpenGL example - " << (scene.is_deferred_shading() ? "deferred" : "forward")
+                  << " - " << light_count << " point lights - GPU " << std::fixed << std::setprecision(2) << gpu_time << " ms";
+
+            if (light_count > 0)
+            {
+                title << " (" << std::setprecision(3) << gpu_time * 1000.f / light_count << " us/light)";
+            }
+
+            // Ocupación de los búferes de geometría compartidos:
+            auto geometry = scene.get_geometry_statistics();
+
+            title << " - " << geometry.mesh_count << " meshes in " << geometry.buffer_count << " buffers ("
+                  << std::setprecision(1) << geometry.utilisation * 100.f << "% used, "
+                  << geometry.fragmentation * 100.f << "% fragmented)";
+
+            // Datos escritos en el búfer de streaming y tiempo esperando a que la GPU liberase su región:
+            if (scene.is_deferred_shading())
+            {
+                auto & stream = scene.get_streaming_statistics();
+
+                title << " - streamed " << std::setprecision(1) << stream.bytes_streamed / 1024.f << " KB"
+                      << (stream.persistent ? " (persistent)" : "") << ", fence wait " << std::setprecision(3)
+                      << stream.fence_wait_milliseconds << " ms";
+            }
+
+            // Nodos y triángulos del terreno (con LOD continuo no dependen de su tamaño) y su memoria de
+            // vídeo, que es casi toda la de la textura de alturas:
+            if (scene.is_streamed_terrain())
+            {
+                auto streaming = scene.get_terrain_streaming_statistics();
+
+                title << " - terrain " << streaming->resident_count << " chunks (" << std::setprecision(1)
+                      << streaming->resident_bytes / (1024.f * 1024.f) << " MB), " << streaming->pending_count << " pending, stream "
+                      << std::setprecision(3) << streaming->stream_milliseconds << " ms";
+            }
+            else if (scene.has_terrain())
+            {
+                auto & terrain = scene.get_terrain_lod_statistics();
+
+                title << " - terrain " << (scene.is_terrain_lod() ? "" : "full detail, ") << terrain.node_count << " nodes, "
+                      << terrain.triangle_count / 1000 << "K triangles (" << std::setprecision(3) << terrain.select_milliseconds
+                      << " ms), " << std::setprecision(1) << scene.get_terrain_video_memory() / 1024.f << " KB VRAM";
+            }
+
+            auto & culling = scene.get_culling_statistics();
+
+            title << " - " << culling.visible_count << "/" << culling.object_count << " visible ("
+                  << culling.culled_count << " culled, " << std::setprecision(3) << culling.cull_milliseconds << " ms)";
+
+            // Objeto seleccionado con el botón izquierdo:
+            if (*scene.get_picked_object())
+            {
+                title << " - selected " << scene.get_picked_object();
+            }
+
+            // Tiempos de los últimos frames:
+            title << " - frame p50 " << std::setprecision(2) << frame_clock.get_frame_percentile(.5f) << " ms, p99 "
+                  << frame_clock.get_frame_percentile(.99f) << " ms";
+
+            // Coste de un paso de la simulación y tiempo que tarda en llegar a la pantalla:
+            title << " - simulation " << std::setprecision(2) << scene.get_simulation_milliseconds() << " ms, latency "
+                  << scene.get_frame_latency() << " ms, " << scene.get_skipped_snapshots() << " skipped";
+
+            // Con la escena estable los frames no deberían reservar memoria (ver Frame_Arena):
+            title << " - " << std::setprecision(1) << frame_allocations / 30.f << " allocations/frame";
+
+            frame_allocations = 0;
+
+            if (scene.is_occlusion_culling())
+            {
+                auto & occlusion = scene.get_occlusion_statistics();
+
+                title << " - " << occlusion.occluded_count << "/" << occlusion.tested_count << " occluded ("
+                      << std::setprecision(3) << occlusion.raster_milliseconds + occlusion.test_milliseconds << " ms)";
+            }
+
+            if (scene.is_horizon_culling())
+            {
+                auto & horizon = scene.get_horizon_statistics();
+
+                title << " - " << horizon.occluded_count << "/" << horizon.tested_count << " below horizon ("
+                      << std::setprecision(3) << horizon.build_milliseconds + horizon.test_milliseconds << " ms)";
+            }
+
+            if (scene.is_hardware_occlusion())
+            {
+                auto & queries = scene.get_occlusion_query_statistics();
+
+                title << " - " << queries.queries_issued << " queries, " << queries.objects_skipped << " skipped, "
+                      << queries.conditional_draws << " conditional";
+            }
+
+            // Tiempo que han pasado dormidos los hilos del sistema de trabajos desde la última vez:
+            if (jobs.get_thread_count() > 1)
+            {
+                float busy = 0.f, idle = 0.f;
+
+                for (auto & worker : jobs.get_worker_statistics())
+                {
+                    busy += worker.busy_milliseconds;
+                    idle += worker.idle_milliseconds;
+                }
+
+                title << " - " << jobs.get_thread_count() << " job threads, " << std::setprecision(0)
+                      << 100.f * idle / std::max(busy + idle, 1e-3f) << "% idle";
+
+                jobs.reset_statistics();
+            }
+
+            window.set_title(title.str());
+        }
+
+        allocation_mark = Allocation_Counter::get_allocation_count();
     } while (not exit);
 
+    simulation_thread.join();
+
     SDL_Quit();
 
     return 0;
@@ -0,0 +1,63 @@
+
+// Este código es de dominio público
+// angel.rodriguez@udit.es
+
+#pragma once
+
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+namespace udit
+{
+
+    /// Retorna la posición del bit activo de menor peso (mask no puede ser 0). Sirve para recorrer
+    /// las máscaras que retornan _mm_movemask_ps() y similares:
+    inline unsigned lowest_set_bit (unsigned mask)
+    {
+        #ifdef _MSC_VER
+            unsigned long index;
+            _BitScanForward (&index, mask);
+            return unsigned(index);
+        #else
+            return unsigned(__builtin_ctz (mask));
+        #endif
+    }
+
+    /// Multiplica dos matrices 4x4 guardadas por columnas (como las de glm): result = a * b. Cada
+    /// columna del resultado es la combinación de las columnas de a con los elementos de la columna
+    /// de b, de modo que se calcula con 4 productos de vectores. result puede coincidir con a o b:
+    inline void multiply_matrices (const float * a, const float * b, float * result)
+    {
+        const __m128 a0 = _mm_loadu_ps (a +  0);
+        const __m128 a1 = _mm_loadu_ps (a +  4);
+        const __m128 a2 = _mm_loadu_ps (a +  8);
+        const __m128 a3 = _mm_loadu_ps (a + 12);
+
+        __m128 columns[4];
+
+        for (int j = 0; j < 4; ++j)
+        {
+            const float * b_column = b + j * 4;
+
+            #ifdef __AVX2__
+                __m128 column = _mm_mul_ps    (a0, _mm_set1_ps (b_column[0]));
+                       column = _mm_fmadd_ps  (a1, _mm_set1_ps (b_column[1]), column);
+                       column = _mm_fmadd_ps  (a2, _mm_set1_ps (b_column[2]), column);
+                columns[j]    = _mm_fmadd_ps  (a3, _mm_set1_ps (b_column[3]), column);
+            #else
+                __m128 column01 = _mm_add_ps (_mm_mul_ps (a0, _mm_set1_ps (b_column[0])), _mm_mul_ps (a1, _mm_set1_ps (b_column[1])));
+                __m128 column23 = _mm_add_ps (_mm_mul_ps (a2, _mm_set1_ps (b_column[2])), _mm_mul_ps (a3, _mm_set1_ps (b_column[3])));
+                columns[j]      = _mm_add_ps (column01, column23);
+            #endif
+        }
+
+        _mm_storeu_ps (result +  0, columns[0]);
+        _mm_storeu_ps (result +  4, columns[1]);
+        _mm_storeu_ps (result +  8, columns[2]);
+        _mm_storeu_ps (result + 12, columns[3]);
+    }
+
+}